@@ -0,0 +1,1385 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   hvsc_bench.c
+ * \brief   Benchmark driver for hvsclib
+ *
+ * Runs repeatable workloads against a HVSC tree and reports throughput and
+ * latency percentiles for each workload, backend and page cache state.
+ *
+ * With -r a workload file written by hvsc_record_start() is replayed instead
+ * of the synthetic workloads, optionally spread over multiple threads.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * \defgroup    hvsc_bench  Benchmark code for hvsclib
+ * \ingroup     hvsc_bench
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+#include "hvsc_defs.h"
+
+
+/** \brief  Default number of timed operations per run
+ *
+ * \ingroup hvsc_bench
+ */
+#define BENCH_OPS_DEFAULT   1000
+
+
+/** \brief  Number of untimed operations to warm the page cache
+ *
+ * \ingroup hvsc_bench
+ */
+#define BENCH_WARMUP_OPS    16
+
+
+/** \brief  Maximum number of replay threads
+ *
+ * \ingroup hvsc_bench
+ */
+#define BENCH_THREADS_MAX   256
+
+
+/** \brief  Backends, ways the library can answer queries
+ *
+ * \ingroup hvsc_bench
+ */
+enum {
+    BENCH_SCAN,     /**< scan the text files */
+    BENCH_INDEX,    /**< in-memory index (hvsc_index_load()) */
+    BENCH_MMAP,     /**< mapped catalog file (hvsc_catalog_load()) */
+
+    BENCH_BACKEND_COUNT /**< number of backends */
+};
+
+
+/** \brief  Sets of PSID files a workload picks its files from
+ *
+ * \ingroup hvsc_bench
+ */
+enum {
+    BENCH_SET_ALL,          /**< all PSID files */
+    BENCH_SET_STIL_HIT,     /**< files with a STIL entry */
+    BENCH_SET_STIL_MISS,    /**< files without a STIL entry */
+    BENCH_SET_BUGS_HIT,     /**< files with a BUGlist entry */
+
+    BENCH_SET_COUNT         /**< number of sets */
+};
+
+
+/** \brief  Page cache states
+ *
+ * \ingroup hvsc_bench
+ */
+enum {
+    BENCH_WARM = 1, /**< files read before the run */
+    BENCH_COLD = 2  /**< files dropped from the page cache before each op */
+};
+
+
+/** \brief  Names of the backends
+ *
+ * \ingroup hvsc_bench
+ */
+static const char *backend_names[BENCH_BACKEND_COUNT] = {
+    "scan", "index", "mmap"
+};
+
+
+/** \brief  Benchmark state
+ *
+ * \ingroup hvsc_bench
+ */
+typedef struct bench_s {
+    hvsc_catalog_t  catalog;    /**< PSID files found in the HVSC */
+    char **         paths;      /**< absolute path per catalog row */
+    size_t *        sets[BENCH_SET_COUNT];      /**< catalog rows per set */
+    size_t          set_sizes[BENCH_SET_COUNT]; /**< number of rows per set */
+    bool            have_index; /**< index could be loaded */
+    hvsc_catalog_t  mapped;     /**< catalog loaded from \a catalog_file */
+    char *          catalog_file;   /**< path of the saved catalog */
+    char *          docs[3];    /**< SLDB, STIL and BUGlist paths */
+    int             backend;    /**< backend of the current run */
+} bench_t;
+
+
+/** \brief  Benchmark workload
+ *
+ * \ingroup hvsc_bench
+ */
+typedef struct bench_workload_s {
+    const char *name;       /**< workload name */
+    const char *desc;       /**< workload description */
+    unsigned int backends;  /**< bitmask of supported backends */
+    int set;                /**< BENCH_SET_* to pick files from */
+    bool random;            /**< pick files in random order */
+    bool (*func)(bench_t *, size_t);    /**< operation on a catalog row */
+} bench_workload_t;
+
+
+/** \brief  Replay state
+ *
+ * \ingroup hvsc_bench
+ */
+typedef struct bench_replay_s {
+    bench_t *               bench;      /**< benchmark state */
+    const hvsc_workload_t * workload;   /**< recorded calls */
+    char **                 paths;      /**< path per subject, `NULL` for
+                                             digests */
+    uint8_t *               digests;    /**< digest per subject */
+    int                     cache;      /**< BENCH_WARM or BENCH_COLD */
+    int                     threads;    /**< number of replay threads */
+    uint64_t *              latencies;  /**< latency per call */
+    bool *                  failed;     /**< result per call */
+} bench_replay_t;
+
+
+/** \brief  Replay thread
+ *
+ * \ingroup hvsc_bench
+ */
+typedef struct bench_replay_thread_s {
+    bench_replay_t *    replay; /**< replay state */
+    int                 num;    /**< thread number */
+    pthread_t           thread; /**< thread ID */
+} bench_replay_thread_t;
+
+
+/** \brief  State of the pseudo random number generator
+ *
+ * A private xorshift64* generator is used instead of rand(3), so the file
+ * order for a given seed is the same on every platform.
+ *
+ * \ingroup hvsc_bench
+ */
+static uint64_t rng_state;
+
+
+/** \brief  Seed the random number generator
+ *
+ * \param[in]   seed    seed
+ *
+ * \ingroup hvsc_bench
+ */
+static void rng_seed(uint64_t seed)
+{
+    rng_state = seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+
+/** \brief  Get next pseudo random number
+ *
+ * \return  64-bit number
+ *
+ * \ingroup hvsc_bench
+ */
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time
+ *
+ * \ingroup hvsc_bench
+ */
+static uint64_t bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/** \brief  Concatenate \a dir and \a path
+ *
+ * \param[in]   dir     directory
+ * \param[in]   path    path starting with '/'
+ *
+ * \return  heap-allocated string or `NULL` when out of memory
+ *
+ * \ingroup hvsc_bench
+ */
+static char *bench_join(const char *dir, const char *path)
+{
+    size_t len = strlen(dir) + strlen(path) + 1;
+    char *result = malloc(len);
+
+    if (result != NULL) {
+        snprintf(result, len, "%s%s", dir, path);
+    }
+    return result;
+}
+
+
+/** \brief  Ask the kernel to drop file \a path from the page cache
+ *
+ * Only clean pages are dropped, which is fine for read-only workloads.
+ *
+ * \param[in]   path    path to file (can be `NULL`)
+ *
+ * \ingroup hvsc_bench
+ */
+static void bench_drop_file(const char *path)
+{
+    int fd;
+
+    if (path == NULL) {
+        return;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+
+/** \brief  Drop the files an operation on \a row can touch from the cache
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \ingroup hvsc_bench
+ */
+static void bench_drop_caches(const bench_t *bench, size_t row)
+{
+    size_t i;
+
+    for (i = 0; i < 3; i++) {
+        bench_drop_file(bench->docs[i]);
+    }
+    bench_drop_file(bench->catalog_file);
+    bench_drop_file(bench->paths[row]);
+}
+
+
+/*
+ * Operations, each returns false when the result isn't what was expected
+ */
+
+
+/** \brief  Look up the SLDB entry of \a row by path
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_sldb(bench_t *bench, size_t row)
+{
+    char *entry = hvsc_sldb_get_entry_txt(bench->paths[row]);
+
+    free(entry);
+    return entry != NULL;
+}
+
+
+/** \brief  Look up the SLDB entry of \a row by MD5 digest
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_sldb_md5(bench_t *bench, size_t row)
+{
+    char *entry = hvsc_sldb_get_entry_md5(bench->paths[row]);
+
+    free(entry);
+    return entry != NULL;
+}
+
+
+/** \brief  Read the STIL entry of \a row
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_stil_hit(bench_t *bench, size_t row)
+{
+    hvsc_stil_t stil;
+    bool result;
+
+    if (!hvsc_stil_open(bench->paths[row], &stil)) {
+        return false;
+    }
+    result = hvsc_stil_read_entry(&stil);
+    hvsc_stil_close(&stil);
+    return result;
+}
+
+
+/** \brief  Look up \a row in the STIL, expecting no entry
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_stil_miss(bench_t *bench, size_t row)
+{
+    hvsc_stil_t stil;
+
+    if (hvsc_stil_open(bench->paths[row], &stil)) {
+        hvsc_stil_close(&stil);
+        return false;
+    }
+    return hvsc_errno == HVSC_ERR_NOT_FOUND;
+}
+
+
+/** \brief  Read the BUGlist entry of \a row
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_bugs(bench_t *bench, size_t row)
+{
+    hvsc_bugs_t bugs;
+
+    if (!hvsc_bugs_open(bench->paths[row], &bugs)) {
+        return false;
+    }
+    hvsc_bugs_close(&bugs);
+    return true;
+}
+
+
+/** \brief  Get the PSID header of \a row
+ *
+ * The scan backend opens the file, the mmap backend looks it up in the mapped
+ * catalog.
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_psid(bench_t *bench, size_t row)
+{
+    hvsc_psid_t psid;
+
+    if (bench->backend == BENCH_MMAP) {
+        const char *path = hvsc_catalog_string(&(bench->catalog),
+                                               bench->catalog.path[row]);
+        long found = hvsc_catalog_find(&(bench->mapped), path);
+
+        return found >= 0 && bench->mapped.songs[found] > 0;
+    }
+    if (!hvsc_psid_open_header(bench->paths[row], &psid)) {
+        return false;
+    }
+    hvsc_psid_close(&psid);
+    return true;
+}
+
+
+/** \brief  Calculate the MD5 digest of \a row
+ *
+ * \param[in]   bench   benchmark state
+ * \param[in]   row     catalog row
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool op_md5(bench_t *bench, size_t row)
+{
+    uint8_t digest[HVSC_DIGEST_SIZE];
+
+    return hvsc_dcache_digest(bench->paths[row], digest);
+}
+
+
+/** \brief  List of workloads
+ *
+ * \ingroup hvsc_bench
+ */
+static const bench_workload_t workloads[] = {
+    { "sldb-seq", "SLDB lookups by path, sequential",
+      (1 << BENCH_SCAN) | (1 << BENCH_INDEX), BENCH_SET_ALL, false, op_sldb },
+    { "sldb-rand", "SLDB lookups by path, random",
+      (1 << BENCH_SCAN) | (1 << BENCH_INDEX), BENCH_SET_ALL, true, op_sldb },
+    { "sldb-md5", "SLDB lookups by MD5 digest, random",
+      (1 << BENCH_SCAN) | (1 << BENCH_INDEX), BENCH_SET_ALL, true,
+      op_sldb_md5 },
+    { "stil-hit", "STIL lookups of files with an entry, random",
+      (1 << BENCH_SCAN) | (1 << BENCH_INDEX), BENCH_SET_STIL_HIT, true,
+      op_stil_hit },
+    { "stil-miss", "STIL lookups of files without an entry, random",
+      (1 << BENCH_SCAN) | (1 << BENCH_INDEX), BENCH_SET_STIL_MISS, true,
+      op_stil_miss },
+    { "bugs", "BUGlist lookups of files with an entry, random",
+      (1 << BENCH_SCAN) | (1 << BENCH_INDEX), BENCH_SET_BUGS_HIT, true,
+      op_bugs },
+    { "psid", "PSID header reads, random",
+      (1 << BENCH_SCAN) | (1 << BENCH_MMAP), BENCH_SET_ALL, true, op_psid },
+    { "md5", "MD5 digests of PSID files, random",
+      (1 << BENCH_SCAN), BENCH_SET_ALL, true, op_md5 },
+    { NULL, NULL, 0, 0, false, NULL }
+};
+
+
+/** \brief  Compare two latencies for qsort()
+ *
+ * \param[in]   p1  first latency
+ * \param[in]   p2  second latency
+ *
+ * \return  <0, 0 or >0
+ *
+ * \ingroup hvsc_bench
+ */
+static int latency_cmp(const void *p1, const void *p2)
+{
+    uint64_t a = *(const uint64_t *)p1;
+    uint64_t b = *(const uint64_t *)p2;
+
+    return a < b ? -1 : a > b;
+}
+
+
+/** \brief  Get percentile \a p of sorted \a latencies in microseconds
+ *
+ * Uses the nearest-rank method.
+ *
+ * \param[in]   latencies   sorted latencies in nanoseconds
+ * \param[in]   count       number of latencies
+ * \param[in]   p           percentile (0.0-1.0)
+ *
+ * \return  latency in microseconds
+ *
+ * \ingroup hvsc_bench
+ */
+static double percentile(const uint64_t *latencies, size_t count, double p)
+{
+    size_t rank = (size_t)(p * (double)count + 0.999999);
+
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > count) {
+        rank = count;
+    }
+    return (double)latencies[rank - 1] / 1000.0;
+}
+
+
+/** \brief  Run \a workload on \a bench and print a result line
+ *
+ * \param[in,out]   bench       benchmark state, with the backend set up
+ * \param[in]       workload    workload
+ * \param[in]       cache       BENCH_WARM or BENCH_COLD
+ * \param[in]       ops         number of timed operations
+ * \param[in]       seed        seed for the random file order
+ * \param[in]       latencies   buffer for \a ops latencies
+ *
+ * \ingroup hvsc_bench
+ */
+static void bench_run(bench_t *bench, const bench_workload_t *workload,
+                      int cache, size_t ops, uint64_t seed,
+                      uint64_t *latencies)
+{
+    const size_t *set = bench->sets[workload->set];
+    size_t set_size = bench->set_sizes[workload->set];
+    uint64_t total = 0;
+    size_t failures = 0;
+    size_t i;
+
+    if (set_size == 0) {
+        printf("%-10s %-6s %-5s  (no files in set)\n",
+               workload->name, backend_names[bench->backend],
+               cache == BENCH_COLD ? "cold" : "warm");
+        return;
+    }
+
+    rng_seed(seed);
+    if (cache == BENCH_WARM) {
+        for (i = 0; i < BENCH_WARMUP_OPS; i++) {
+            workload->func(bench, set[i % set_size]);
+        }
+    }
+
+    for (i = 0; i < ops; i++) {
+        size_t row;
+        uint64_t start;
+        bool ok;
+
+        if (workload->random) {
+            row = set[rng_next() % set_size];
+        } else {
+            row = set[i % set_size];
+        }
+        if (cache == BENCH_COLD) {
+            bench_drop_caches(bench, row);
+        }
+
+        start = bench_now();
+        ok = workload->func(bench, row);
+        latencies[i] = bench_now() - start;
+        total += latencies[i];
+        if (!ok) {
+            failures++;
+        }
+    }
+
+    qsort(latencies, ops, sizeof *latencies, latency_cmp);
+    printf("%-10s %-6s %-5s %8zu %12.1f %10.1f %10.1f %10.1f %6zu\n",
+           workload->name, backend_names[bench->backend],
+           cache == BENCH_COLD ? "cold" : "warm", ops,
+           total > 0 ? (double)ops * 1e9 / (double)total : 0.0,
+           percentile(latencies, ops, 0.50),
+           percentile(latencies, ops, 0.99),
+           percentile(latencies, ops, 0.999),
+           failures);
+    fflush(stdout);
+}
+
+
+/** \brief  Add catalog \a row to file set \a set
+ *
+ * \param[in,out]   bench   benchmark state
+ * \param[in]       set     BENCH_SET_* value
+ * \param[in]       row     catalog row
+ *
+ * \ingroup hvsc_bench
+ */
+static void bench_set_add(bench_t *bench, int set, size_t row)
+{
+    bench->sets[set][bench->set_sizes[set]++] = row;
+}
+
+
+/** \brief  Crawl the HVSC and sort the PSID files into sets
+ *
+ * The STIL and BUGlist sets are determined with the index loaded, when the
+ * index can't be loaded those sets stay empty.
+ *
+ * \param[in,out]   bench   benchmark state
+ * \param[in]       root    HVSC root directory
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool bench_setup(bench_t *bench, const char *root)
+{
+    size_t row;
+    int set;
+
+    if (!hvsc_catalog_build(&(bench->catalog), root, 0)) {
+        return false;
+    }
+    if (bench->catalog.count == 0) {
+        fprintf(stderr, "no PSID files found in '%s'\n", root);
+        return false;
+    }
+
+    bench->paths = calloc(bench->catalog.count, sizeof *(bench->paths));
+    if (bench->paths == NULL) {
+        return false;
+    }
+    for (set = 0; set < BENCH_SET_COUNT; set++) {
+        bench->sets[set] = malloc(bench->catalog.count
+                                  * sizeof *(bench->sets[set]));
+        if (bench->sets[set] == NULL) {
+            return false;
+        }
+    }
+
+    for (row = 0; row < bench->catalog.count; row++) {
+        const char *rel = hvsc_catalog_string(&(bench->catalog),
+                                              bench->catalog.path[row]);
+
+        bench->paths[row] = bench_join(root, rel);
+        if (bench->paths[row] == NULL) {
+            return false;
+        }
+        bench_set_add(bench, BENCH_SET_ALL, row);
+    }
+
+    bench->have_index = hvsc_index_load();
+    if (!bench->have_index) {
+        hvsc_perror("warning: can't load index, skipping STIL/BUGlist");
+        return true;
+    }
+    for (row = 0; row < bench->catalog.count; row++) {
+        hvsc_stil_t stil;
+        hvsc_bugs_t bugs;
+
+        if (hvsc_stil_open(bench->paths[row], &stil)) {
+            hvsc_stil_close(&stil);
+            bench_set_add(bench, BENCH_SET_STIL_HIT, row);
+        } else {
+            bench_set_add(bench, BENCH_SET_STIL_MISS, row);
+        }
+        if (hvsc_bugs_open(bench->paths[row], &bugs)) {
+            hvsc_bugs_close(&bugs);
+            bench_set_add(bench, BENCH_SET_BUGS_HIT, row);
+        }
+    }
+    hvsc_index_free();
+    return true;
+}
+
+
+/** \brief  Free memory used by \a bench and remove the catalog file
+ *
+ * \param[in,out]   bench   benchmark state
+ *
+ * \ingroup hvsc_bench
+ */
+static void bench_free(bench_t *bench)
+{
+    size_t i;
+
+    if (bench->paths != NULL) {
+        for (i = 0; i < bench->catalog.count; i++) {
+            free(bench->paths[i]);
+        }
+        free(bench->paths);
+    }
+    for (i = 0; i < BENCH_SET_COUNT; i++) {
+        free(bench->sets[i]);
+    }
+    for (i = 0; i < 3; i++) {
+        free(bench->docs[i]);
+    }
+    hvsc_catalog_free(&(bench->mapped));
+    hvsc_catalog_free(&(bench->catalog));
+    if (bench->catalog_file != NULL) {
+        unlink(bench->catalog_file);
+        free(bench->catalog_file);
+    }
+}
+
+
+/** \brief  Set up \a backend for the next runs
+ *
+ * \param[in,out]   bench   benchmark state
+ * \param[in]       backend BENCH_* backend
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool bench_backend_begin(bench_t *bench, int backend)
+{
+    bench->backend = backend;
+    switch (backend) {
+        case BENCH_INDEX:
+            return bench->have_index && hvsc_index_load();
+        case BENCH_MMAP:
+            if (bench->catalog_file == NULL) {
+                const char *tmpdir = getenv("TMPDIR");
+                size_t len;
+
+                if (tmpdir == NULL || *tmpdir == '\0') {
+                    tmpdir = "/tmp";
+                }
+                len = strlen(tmpdir) + 64;
+                bench->catalog_file = malloc(len);
+                if (bench->catalog_file == NULL) {
+                    return false;
+                }
+                snprintf(bench->catalog_file, len, "%s/hvsc_bench.%ld.cat",
+                         tmpdir, (long)getpid());
+                if (!hvsc_catalog_save(&(bench->catalog),
+                                       bench->catalog_file)) {
+                    free(bench->catalog_file);
+                    bench->catalog_file = NULL;
+                    return false;
+                }
+            }
+            return hvsc_catalog_load(&(bench->mapped), bench->catalog_file);
+        default:
+            return true;
+    }
+}
+
+
+/** \brief  Tear down \a backend after its runs
+ *
+ * \param[in,out]   bench   benchmark state
+ * \param[in]       backend BENCH_* backend
+ *
+ * \ingroup hvsc_bench
+ */
+static void bench_backend_end(bench_t *bench, int backend)
+{
+    if (backend == BENCH_INDEX) {
+        hvsc_index_free();
+    } else if (backend == BENCH_MMAP) {
+        hvsc_catalog_free(&(bench->mapped));
+    }
+}
+
+
+/*
+ * Replay of recorded workloads
+ */
+
+
+/** \brief  Free memory used by \a replay
+ *
+ * \param[in,out]   replay  replay state
+ *
+ * \ingroup hvsc_bench
+ */
+static void replay_free(bench_replay_t *replay)
+{
+    size_t i;
+
+    if (replay->paths != NULL) {
+        for (i = 0; i < replay->workload->subjects; i++) {
+            free(replay->paths[i]);
+        }
+        free(replay->paths);
+    }
+    free(replay->digests);
+    free(replay->latencies);
+    free(replay->failed);
+}
+
+
+/** \brief  Prepare replay of \a workload
+ *
+ * Recorded paths relative to the HVSC root are made absolute using \a root,
+ * so a workload recorded on one machine can be replayed on another.
+ *
+ * \param[out]  replay      replay state
+ * \param[in]   bench       benchmark state
+ * \param[in]   workload    recorded calls
+ * \param[in]   root        HVSC root directory
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool replay_init(bench_replay_t *replay, bench_t *bench,
+                        const hvsc_workload_t *workload, const char *root)
+{
+    size_t i;
+
+    memset(replay, 0, sizeof *replay);
+    replay->bench = bench;
+    replay->workload = workload;
+    replay->paths = calloc(workload->subjects + 1, sizeof *(replay->paths));
+    replay->digests = calloc(workload->subjects + 1, HVSC_DIGEST_SIZE);
+    replay->latencies = malloc((workload->count + 1)
+                               * sizeof *(replay->latencies));
+    replay->failed = malloc((workload->count + 1) * sizeof *(replay->failed));
+    if (replay->paths == NULL || replay->digests == NULL
+            || replay->latencies == NULL || replay->failed == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < workload->subjects; i++) {
+        const char *text = workload->strings + workload->subject_text[i];
+        int flags = workload->subject_flags[i];
+
+        if (flags & HVSC_WORKLOAD_DIGEST) {
+            uint8_t *digest = replay->digests + i * HVSC_DIGEST_SIZE;
+            int d;
+
+            for (d = 0; d < HVSC_DIGEST_SIZE; d++) {
+                unsigned int byte = 0;
+
+                sscanf(text + d * 2, "%2x", &byte);
+                digest[d] = (uint8_t)byte;
+            }
+            continue;
+        }
+        if (flags & HVSC_WORKLOAD_RELATIVE) {
+            replay->paths[i] = bench_join(root, text);
+        } else {
+            replay->paths[i] = bench_join("", text);
+        }
+        if (replay->paths[i] == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Drop the files recorded \a call can touch from the cache
+ *
+ * \param[in]   replay  replay state
+ * \param[in]   call    call number
+ *
+ * \ingroup hvsc_bench
+ */
+static void replay_drop_caches(const bench_replay_t *replay, size_t call)
+{
+    size_t i;
+
+    for (i = 0; i < 3; i++) {
+        bench_drop_file(replay->bench->docs[i]);
+    }
+    bench_drop_file(replay->bench->catalog_file);
+    bench_drop_file(replay->paths[replay->workload->subject[call]]);
+}
+
+
+/** \brief  Execute recorded \a call
+ *
+ * The mmap backend answers PSID calls on files inside the HVSC from the
+ * mapped catalog, all other calls go through the library as recorded.
+ *
+ * \param[in]   replay  replay state
+ * \param[in]   call    call number
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool replay_call(const bench_replay_t *replay, size_t call)
+{
+    const hvsc_workload_t *workload = replay->workload;
+    uint32_t subject = workload->subject[call];
+    const char *path = replay->paths[subject];
+    const uint8_t *digest = replay->digests + subject * HVSC_DIGEST_SIZE;
+    hvsc_psid_t psid;
+    hvsc_stil_t stil;
+    hvsc_bugs_t bugs;
+    const hvsc_stil_t *cached;
+    long *lengths;
+    char *result;
+    bool ok;
+    int songs;
+
+    /* calls on a digest don't have a path and vice versa */
+    if ((path == NULL) != (workload->op[call] == HVSC_OP_SLDB_ENTRY_DIGEST
+                || workload->op[call] == HVSC_OP_INDEX_RESOLVE_DIGEST)) {
+        return false;
+    }
+
+    switch (workload->op[call]) {
+        case HVSC_OP_SLDB_LENGTHS:
+            songs = hvsc_sldb_get_lengths(path, &lengths);
+            free(lengths);
+            return songs >= 0;
+        case HVSC_OP_SLDB_LENGTHS_PSID:
+            if (!hvsc_psid_open(path, &psid)) {
+                return false;
+            }
+            songs = hvsc_sldb_get_lengths_psid(&psid, &lengths);
+            free(lengths);
+            hvsc_psid_close(&psid);
+            return songs >= 0;
+        case HVSC_OP_SLDB_ENTRY_MD5:
+            result = hvsc_sldb_get_entry_md5(path);
+            break;
+        case HVSC_OP_SLDB_ENTRY_TXT:
+            result = hvsc_sldb_get_entry_txt(path);
+            break;
+        case HVSC_OP_SLDB_ENTRY_DIGEST:
+            result = hvsc_sldb_get_entry_digest(digest);
+            break;
+        case HVSC_OP_STIL_OPEN:
+        case HVSC_OP_STIL_GET:
+            if (workload->op[call] == HVSC_OP_STIL_OPEN) {
+                ok = hvsc_stil_open(path, &stil);
+            } else {
+                ok = hvsc_stil_get(&stil, path);
+            }
+            if (ok) {
+                hvsc_stil_close(&stil);
+            }
+            return ok;
+        case HVSC_OP_STIL_CACHE_GET:
+            cached = hvsc_stil_cache_get(path);
+            hvsc_stil_cache_release(cached);
+            return cached != NULL;
+        case HVSC_OP_BUGS_OPEN:
+            if (!hvsc_bugs_open(path, &bugs)) {
+                return false;
+            }
+            hvsc_bugs_close(&bugs);
+            return true;
+        case HVSC_OP_PSID_OPEN:
+        case HVSC_OP_PSID_OPEN_HEADER:
+            if (replay->bench->backend == BENCH_MMAP
+                    && (workload->subject_flags[subject]
+                        & HVSC_WORKLOAD_RELATIVE)) {
+                long found = hvsc_catalog_find(&(replay->bench->mapped),
+                        hvsc_workload_subject(workload, call));
+
+                return found >= 0 && replay->bench->mapped.songs[found] > 0;
+            }
+            if (workload->op[call] == HVSC_OP_PSID_OPEN) {
+                ok = hvsc_psid_open(path, &psid);
+            } else {
+                ok = hvsc_psid_open_header(path, &psid);
+            }
+            if (ok) {
+                hvsc_psid_close(&psid);
+            }
+            return ok;
+        case HVSC_OP_INDEX_RESOLVE:
+            result = hvsc_index_resolve(path);
+            break;
+        case HVSC_OP_INDEX_RESOLVE_DIGEST:
+            result = hvsc_index_resolve_digest(digest);
+            break;
+        default:
+            return false;
+    }
+    free(result);
+    return result != NULL;
+}
+
+
+/** \brief  Check if \a call is replayed by thread \a num
+ *
+ * Calls keep their recorded thread when the workload was recorded with more
+ * than one thread, otherwise they're dealt out round-robin.
+ *
+ * \param[in]   replay  replay state
+ * \param[in]   call    call number
+ * \param[in]   num     thread number
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool replay_owns(const bench_replay_t *replay, size_t call, int num)
+{
+    if (replay->workload->threads > 1) {
+        return replay->workload->thread[call] % (uint32_t)replay->threads
+            == (uint32_t)num;
+    }
+    return call % (size_t)replay->threads == (size_t)num;
+}
+
+
+/** \brief  Replay thread: execute this thread's share of the calls
+ *
+ * \param[in,out]   arg replay thread
+ *
+ * \return  `NULL`
+ *
+ * \ingroup hvsc_bench
+ */
+static void *replay_thread(void *arg)
+{
+    bench_replay_thread_t *self = arg;
+    bench_replay_t *replay = self->replay;
+    size_t call;
+
+    for (call = 0; call < replay->workload->count; call++) {
+        uint64_t start;
+
+        if (!replay_owns(replay, call, self->num)) {
+            continue;
+        }
+        if (replay->cache == BENCH_COLD) {
+            replay_drop_caches(replay, call);
+        }
+        start = bench_now();
+        replay->failed[call] = !replay_call(replay, call);
+        replay->latencies[call] = bench_now() - start;
+    }
+    return NULL;
+}
+
+
+/** \brief  Print a result line for the calls of \a op in \a replay
+ *
+ * \param[in]   replay      replay state
+ * \param[in]   op          operation or -1 for all calls
+ * \param[in]   wall        wall-clock time of the replay in nanoseconds
+ * \param[in]   sorted      buffer for the latencies
+ *
+ * \ingroup hvsc_bench
+ */
+static void replay_report(const bench_replay_t *replay, int op, uint64_t wall,
+                          uint64_t *sorted)
+{
+    const hvsc_workload_t *workload = replay->workload;
+    uint64_t total = 0;
+    size_t failures = 0;
+    size_t count = 0;
+    size_t call;
+    double rate;
+
+    for (call = 0; call < workload->count; call++) {
+        if (op >= 0 && workload->op[call] != op) {
+            continue;
+        }
+        sorted[count++] = replay->latencies[call];
+        total += replay->latencies[call];
+        if (replay->failed[call]) {
+            failures++;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+
+    /* all calls: throughput of the replay, per op: of a single thread */
+    if (op < 0) {
+        rate = wall > 0 ? (double)count * 1e9 / (double)wall : 0.0;
+    } else {
+        rate = total > 0 ? (double)count * 1e9 / (double)total : 0.0;
+    }
+    qsort(sorted, count, sizeof *sorted, latency_cmp);
+    printf("%-17s %-6s %-5s %8zu %12.1f %10.1f %10.1f %10.1f %6zu\n",
+           op < 0 ? "all" : hvsc_record_op_name(op),
+           backend_names[replay->bench->backend],
+           replay->cache == BENCH_COLD ? "cold" : "warm", count, rate,
+           percentile(sorted, count, 0.50),
+           percentile(sorted, count, 0.99),
+           percentile(sorted, count, 0.999),
+           failures);
+}
+
+
+/** \brief  Replay the recorded calls in \a replay and print the results
+ *
+ * Calls are issued as fast as possible, the recorded timing is not
+ * reproduced.
+ *
+ * \param[in,out]   replay  replay state, with the backend set up
+ * \param[in]       cache   BENCH_WARM or BENCH_COLD
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_bench
+ */
+static bool replay_run(bench_replay_t *replay, int cache)
+{
+    bench_replay_thread_t threads[BENCH_THREADS_MAX];
+    size_t count = replay->workload->count;
+    uint64_t *sorted;
+    uint64_t start;
+    uint64_t wall;
+    size_t call;
+    int started;
+    int op;
+    int i;
+
+    replay->cache = cache;
+    if (cache == BENCH_WARM) {
+        for (call = 0; call < count && call < BENCH_WARMUP_OPS; call++) {
+            replay_call(replay, call);
+        }
+    }
+
+    start = bench_now();
+    for (started = 0; started < replay->threads; started++) {
+        threads[started].replay = replay;
+        threads[started].num = started;
+        if (pthread_create(&(threads[started].thread), NULL, replay_thread,
+                           &(threads[started])) != 0) {
+            break;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    wall = bench_now() - start;
+    if (started < replay->threads) {
+        fprintf(stderr, "can't start replay threads\n");
+        return false;
+    }
+
+    sorted = malloc((count + 1) * sizeof *sorted);
+    if (sorted == NULL) {
+        return false;
+    }
+    for (op = 0; op < HVSC_OP_COUNT; op++) {
+        replay_report(replay, op, wall, sorted);
+    }
+    replay_report(replay, -1, wall, sorted);
+    free(sorted);
+    fflush(stdout);
+    return true;
+}
+
+
+/** \brief  Print usage message on stdout
+ *
+ * \param[in]   prg program name
+ *
+ * \ingroup hvsc_bench
+ */
+static void usage(const char *prg)
+{
+    int i;
+
+    printf("Usage: %s [options] <hvsc-root-path>\n\n", prg);
+    printf("Options:\n"
+           "  -n <ops>       timed operations per run (default %d)\n"
+           "  -w <workload>  run only <workload>\n"
+           "  -b <backend>   run only <backend>: scan, index or mmap\n"
+           "  -c <cache>     page cache state: warm, cold or both (default)\n"
+           "  -s <seed>      seed for the random file order (default 1)\n"
+           "  -r <file>      replay workload <file> instead of the workloads\n"
+           "  -t <threads>   threads for the replay (default 1)\n"
+           "  -S <KiB>       open the STIL cache with a cap of <KiB>\n"
+           "\nWorkloads:\n", BENCH_OPS_DEFAULT);
+    for (i = 0; workloads[i].name != NULL; i++) {
+        printf("  %-10s %s\n", workloads[i].name, workloads[i].desc);
+    }
+    printf("\nLatencies are in microseconds. Cold runs ask the kernel to drop "
+           "the files an\noperation touches from the page cache before each "
+           "operation.\n"
+           "\nA replay reports a line per recorded operation, with ops/s "
+           "per thread, and a\nline for all calls with the ops/s of the "
+           "whole replay.\n");
+}
+
+
+/** \brief  Benchmark driver
+ *
+ * \return  EXIT_SUCCESS or EXIT_FAILURE
+ *
+ * \ingroup hvsc_bench
+ */
+int main(int argc, char *argv[])
+{
+    bench_t bench;
+    const char *only_workload = NULL;
+    int only_backend = -1;
+    int caches = BENCH_WARM | BENCH_COLD;
+    size_t ops = BENCH_OPS_DEFAULT;
+    uint64_t seed = 1;
+    uint64_t *latencies;
+    const char *replay_file = NULL;
+    int threads = 1;
+    size_t stil_cache_kib = 0;
+    hvsc_workload_t recorded;
+    bench_replay_t replay;
+    const char *root;
+    int backend;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:w:b:c:s:r:t:S:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                ops = (size_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                only_workload = optarg;
+                break;
+            case 'b':
+                for (only_backend = 0; only_backend < BENCH_BACKEND_COUNT;
+                        only_backend++) {
+                    if (strcmp(optarg, backend_names[only_backend]) == 0) {
+                        break;
+                    }
+                }
+                if (only_backend == BENCH_BACKEND_COUNT) {
+                    fprintf(stderr, "unknown backend '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c':
+                if (strcmp(optarg, "warm") == 0) {
+                    caches = BENCH_WARM;
+                } else if (strcmp(optarg, "cold") == 0) {
+                    caches = BENCH_COLD;
+                } else if (strcmp(optarg, "both") == 0) {
+                    caches = BENCH_WARM | BENCH_COLD;
+                } else {
+                    fprintf(stderr, "unknown cache state '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'r':
+                replay_file = optarg;
+                break;
+            case 'S':
+                stil_cache_kib = (size_t)strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1 || threads > BENCH_THREADS_MAX) {
+                    fprintf(stderr, "threads must be 1-%d\n",
+                            BENCH_THREADS_MAX);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || ops == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    root = argv[optind];
+
+    if (!hvsc_init(root)) {
+        hvsc_perror(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (stil_cache_kib > 0 && !hvsc_stil_cache_open(stil_cache_kib * 1024)) {
+        hvsc_perror(argv[0]);
+        hvsc_exit();
+        return EXIT_FAILURE;
+    }
+
+    hvsc_workload_init(&recorded);
+    if (replay_file != NULL && !hvsc_workload_load(&recorded, replay_file)) {
+        hvsc_perror(replay_file);
+        hvsc_exit();
+        return EXIT_FAILURE;
+    }
+
+    memset(&bench, 0, sizeof bench);
+    hvsc_catalog_init(&(bench.catalog));
+    hvsc_catalog_init(&(bench.mapped));
+    bench.docs[0] = bench_join(root, "/" HVSC_SLDB_FILE);
+    bench.docs[1] = bench_join(root, "/" HVSC_STIL_FILE);
+    bench.docs[2] = bench_join(root, "/" HVSC_BUGS_FILE);
+    latencies = malloc(ops * sizeof *latencies);
+    if (latencies == NULL || !bench_setup(&bench, root)) {
+        hvsc_perror(argv[0]);
+        free(latencies);
+        bench_free(&bench);
+        hvsc_workload_free(&recorded);
+        hvsc_exit();
+        return EXIT_FAILURE;
+    }
+
+    if (replay_file != NULL) {
+        bool ok = replay_init(&replay, &bench, &recorded, root);
+
+        if (ok) {
+            printf("hvsclib %s, replaying %zu calls on %zu subjects, "
+                   "recorded with %u threads, replayed with %d\n\n",
+                   hvsc_lib_version_str(), recorded.count,
+                   recorded.subjects, recorded.threads, threads);
+            printf("%-17s %-6s %-5s %8s %12s %10s %10s %10s %6s\n",
+                   "operation", "backend", "cache", "calls", "ops/s",
+                   "p50", "p99", "p999", "fail");
+            replay.threads = threads;
+        }
+        for (backend = 0; ok && backend < BENCH_BACKEND_COUNT; backend++) {
+            if (only_backend >= 0 && backend != only_backend) {
+                continue;
+            }
+            if (!bench_backend_begin(&bench, backend)) {
+                printf("%-17s %-6s unavailable\n", "*",
+                       backend_names[backend]);
+                continue;
+            }
+            if (ok && (caches & BENCH_WARM)) {
+                ok = replay_run(&replay, BENCH_WARM);
+            }
+            if (ok && (caches & BENCH_COLD)) {
+                ok = replay_run(&replay, BENCH_COLD);
+            }
+            bench_backend_end(&bench, backend);
+        }
+        if (!ok) {
+            hvsc_perror(argv[0]);
+        }
+        replay_free(&replay);
+        free(latencies);
+        bench_free(&bench);
+        hvsc_workload_free(&recorded);
+        hvsc_exit();
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    printf("hvsclib %s, %zu PSID files, %zu with STIL entry, "
+           "%zu with BUGlist entry\n\n",
+           hvsc_lib_version_str(), bench.catalog.count,
+           bench.set_sizes[BENCH_SET_STIL_HIT],
+           bench.set_sizes[BENCH_SET_BUGS_HIT]);
+    printf("%-10s %-6s %-5s %8s %12s %10s %10s %10s %6s\n",
+           "workload", "backend", "cache", "ops", "ops/s",
+           "p50", "p99", "p999", "fail");
+
+    for (backend = 0; backend < BENCH_BACKEND_COUNT; backend++) {
+        if (only_backend >= 0 && backend != only_backend) {
+            continue;
+        }
+        if (!bench_backend_begin(&bench, backend)) {
+            printf("%-10s %-6s unavailable\n", "*", backend_names[backend]);
+            continue;
+        }
+        for (i = 0; workloads[i].name != NULL; i++) {
+            const bench_workload_t *workload = &(workloads[i]);
+
+            if ((workload->backends & (1U << backend)) == 0
+                    || (only_workload != NULL
+                        && strcmp(only_workload, workload->name) != 0)) {
+                continue;
+            }
+            if (caches & BENCH_WARM) {
+                bench_run(&bench, workload, BENCH_WARM, ops, seed, latencies);
+            }
+            if (caches & BENCH_COLD) {
+                bench_run(&bench, workload, BENCH_COLD, ops, seed, latencies);
+            }
+        }
+        bench_backend_end(&bench, backend);
+    }
+
+    free(latencies);
+    bench_free(&bench);
+    hvsc_exit();
+    return EXIT_SUCCESS;
+}
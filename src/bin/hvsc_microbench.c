@@ -0,0 +1,910 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   hvsc_microbench.c
+ * \brief   Micro benchmarks of the hot parsers in hvsclib
+ *
+ * Times the parsing kernels on fixed in-memory inputs, writes the results as
+ * JSON and compares them with a baseline written by an earlier run. Used by
+ * `make bench-check` to catch performance regressions.
+ *
+ * Absolute timings vary too much between machines and between runs on a
+ * shared machine to compare with a baseline. Each sample of a kernel is
+ * paired with a sample of a reference loop that doesn't use the library, and
+ * the median ratio of the two is what gets compared.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * \defgroup    hvsc_microbench Micro benchmarks for hvsclib
+ * \ingroup     hvsc_microbench
+ */
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hvsc.h"
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "sldb.h"
+#include "stil.h"
+#include "psid.h"
+
+
+/** \brief  Default number of samples per kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+#define MICRO_SAMPLES_DEFAULT   1001
+
+/** \brief  Maximum number of samples per kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+#define MICRO_SAMPLES_MAX       10001
+
+/** \brief  Default tolerance in percent
+ *
+ * \ingroup hvsc_microbench
+ */
+#define MICRO_TOLERANCE_DEFAULT 30.0
+
+/** \brief  Number of times a kernel that looks regressed is timed again
+ *
+ * A single slow run is usually caused by other load on the machine, a real
+ * regression stays slow.
+ *
+ * \ingroup hvsc_microbench
+ */
+#define MICRO_RETRIES           2
+
+/** \brief  Number of lines in the text for the text file kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+#define MICRO_TEXT_LINES        2048
+
+
+/** \brief  Micro benchmark kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+typedef struct micro_kernel_s {
+    const char *name;   /**< kernel name, as used in the JSON */
+    const char *desc;   /**< description */
+    /** \brief  run kernel \a iterations times, return number of operations */
+    uint64_t (*func)(uint64_t iterations);
+    uint64_t iterations;    /**< iterations per sample, about a millisecond */
+} micro_kernel_t;
+
+
+/** \brief  Result of a kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+typedef struct micro_result_s {
+    double      ns_per_op;  /**< fastest sample */
+    double      median_ns;  /**< median of the samples */
+    double      relative;   /**< median ratio against the reference loop */
+    uint64_t    ops;        /**< operations per sample */
+} micro_result_t;
+
+
+/** \brief  Sink for kernel results, keeps the compiler from removing calls
+ *
+ * \ingroup hvsc_microbench
+ */
+static volatile long micro_sink;
+
+
+/*
+ * Inputs of the kernels
+ */
+
+/** \brief  Timestamps
+ *
+ * \ingroup hvsc_microbench
+ */
+static char timestamps[][8] = {
+    "3:25", "0:45", "12:07", "1:02", "5:59", "0:03", "27:41", "2:30"
+};
+
+/** \brief  SLDB entries, the parser modifies nothing but takes `char *`
+ *
+ * \ingroup hvsc_microbench
+ */
+static char sldb_entries[][256] = {
+    "0a1b2c3d4e5f60718293a4b5c6d7e8f9=3:25",
+    "1b2c3d4e5f60718293a4b5c6d7e8f90a=2:13 0:45 1:02 0:12 3:33",
+    "2c3d4e5f60718293a4b5c6d7e8f90a1b=0:10 0:09 0:11 1:40 2:02 0:30 0:31 "
+        "0:32 0:33 0:34 0:35 0:36 0:37 0:38 0:39 0:40 4:11 12:00 0:01 0:02"
+};
+
+/** \brief  Lines to check for a field identifier, a third isn't a field
+ *
+ * \ingroup hvsc_microbench
+ */
+static const char *field_lines[] = {
+    "COMMENT: Based on the theme of the arcade game.",
+    "   NAME: Main theme",
+    " AUTHOR: Rob Hubbard",
+    "  TITLE: Zoids (intro)",
+    " ARTIST: Martin Galway",
+    "(#2)",
+    "         with some help from a friend",
+    "    BUG: Plays at the wrong speed"
+};
+
+/** \brief  Lines of a STIL comment
+ *
+ * \ingroup hvsc_microbench
+ */
+static char *comment_lines[] = {
+    "COMMENT: Also used in the game's sequel, with a different intro and a",
+    "         slightly faster tempo. The original was composed on a real",
+    "         C64 using a self-written music routine, according to an",
+    "         interview in a 1987 issue of a computer magazine.",
+    "   NAME: Ingame"
+};
+
+/** \brief  PSID v2 header
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint8_t psid_header[HVSC_PSID_HEADER_MIN_SIZE];
+
+/** \brief  STIL-like text for the text file kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static char *text = NULL;
+
+/** \brief  Size of \a text
+ *
+ * \ingroup hvsc_microbench
+ */
+static size_t text_size = 0;
+
+
+/** \brief  Set up the inputs of the kernels
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_microbench
+ */
+static bool inputs_init(void)
+{
+    size_t used = 0;
+    int i;
+
+    /* PSID v2 header with name, author and copyright */
+    memset(psid_header, 0, sizeof psid_header);
+    memcpy(psid_header + HVSC_PSID_MAGIC, "PSID", 4);
+    psid_header[HVSC_PSID_VERSION + 1] = 2;
+    psid_header[HVSC_PSID_DATA_OFFSET + 1] = 0x7c;
+    psid_header[HVSC_PSID_INIT_ADDRESS] = 0x10;
+    psid_header[HVSC_PSID_PLAY_ADDRESS] = 0x10;
+    psid_header[HVSC_PSID_PLAY_ADDRESS + 1] = 0x03;
+    psid_header[HVSC_PSID_SONGS + 1] = 12;
+    psid_header[HVSC_PSID_START_SONG + 1] = 1;
+    memcpy(psid_header + HVSC_PSID_NAME, "Commando", 8);
+    memcpy(psid_header + HVSC_PSID_AUTHOR, "Rob Hubbard", 11);
+    memcpy(psid_header + HVSC_PSID_COPYRIGHT, "1985 Elite", 10);
+    psid_header[HVSC_PSID_FLAGS + 1] = 0x14;
+    psid_header[0x7c] = 0x00;
+    psid_header[0x7d] = 0x10;
+
+    /* text with STIL-like lines of varying length */
+    text = malloc(MICRO_TEXT_LINES * 80);
+    if (text == NULL) {
+        return false;
+    }
+    for (i = 0; i < MICRO_TEXT_LINES; i++) {
+        const char *line = field_lines[i % (int)(sizeof field_lines
+                                                 / sizeof field_lines[0])];
+
+        used += (size_t)sprintf(text + used, "%s\n", line);
+    }
+    text_size = used;
+    return true;
+}
+
+
+/*
+ * State the kernels write to
+ *
+ * Kept off the stack, which is at a random address on every run: stores to
+ * it would alias the loads of the inputs (4K aliasing) in some runs and not
+ * in others, making a kernel up to 50% slower in a random run.
+ */
+
+/** \brief  End pointer of the timestamp kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static char *timestamp_end;
+
+/** \brief  Song lengths of the SLDB entry kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static long *sldb_lengths;
+
+/** \brief  STIL handle of the STIL comment kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static hvsc_stil_t stil_handle;
+
+/** \brief  Parser state of the STIL comment kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static hvsc_stil_parser_state_t stil_state;
+
+/** \brief  PSID handle of the PSID header kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static hvsc_psid_t psid_handle;
+
+/** \brief  Text file handle of the text file kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static hvsc_text_file_t text_handle;
+
+
+/*
+ * Kernels
+ */
+
+
+/** \brief  Kernel: hvsc_parse_simple_timestamp()
+ *
+ * \param[in]   iterations  number of iterations
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_timestamp(uint64_t iterations)
+{
+    size_t count = sizeof timestamps / sizeof timestamps[0];
+    uint64_t i;
+    long total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        total += hvsc_parse_simple_timestamp(timestamps[i % count],
+                                             &timestamp_end);
+    }
+    micro_sink = total;
+    return iterations;
+}
+
+
+/** \brief  Kernel: hvsc_sldb_parse_entry()
+ *
+ * \param[in]   iterations  number of iterations
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_sldb_entry(uint64_t iterations)
+{
+    size_t count = sizeof sldb_entries / sizeof sldb_entries[0];
+    uint64_t i;
+    long total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        int songs = hvsc_sldb_parse_entry(sldb_entries[i % count],
+                                          &sldb_lengths);
+
+        if (songs > 0) {
+            total += sldb_lengths[songs - 1];
+            free(sldb_lengths);
+        }
+    }
+    micro_sink = total;
+    return iterations;
+}
+
+
+/** \brief  Kernel: hvsc_get_field_type()
+ *
+ * \param[in]   iterations  number of iterations
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_field_type(uint64_t iterations)
+{
+    size_t count = sizeof field_lines / sizeof field_lines[0];
+    uint64_t i;
+    long total = 0;
+
+    for (i = 0; i < iterations; i++) {
+        total += hvsc_get_field_type(field_lines[i % count]);
+    }
+    micro_sink = total;
+    return iterations;
+}
+
+
+/** \brief  Kernel: hvsc_stil_parse_comment()
+ *
+ * \param[in]   iterations  number of iterations
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_stil_comment(uint64_t iterations)
+{
+    uint64_t i;
+    long total = 0;
+
+    memset(&stil_handle, 0, sizeof stil_handle);
+    stil_handle.entry_buffer = comment_lines;
+    stil_handle.entry_bufused = sizeof comment_lines
+        / sizeof comment_lines[0];
+    memset(&stil_state, 0, sizeof stil_state);
+    stil_state.handle = &stil_handle;
+
+    for (i = 0; i < iterations; i++) {
+        char *comment;
+
+        stil_state.lineno = 0;
+        comment = hvsc_stil_parse_comment(&stil_state);
+        if (comment != NULL) {
+            total += (long)stil_state.lineno;
+            hvsc_free(comment);
+        }
+    }
+    micro_sink = total;
+    return iterations;
+}
+
+
+/** \brief  Kernel: hvsc_psid_parse_header()
+ *
+ * \param[in]   iterations  number of iterations
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_psid_header(uint64_t iterations)
+{
+    uint64_t i;
+    long total = 0;
+
+    memset(&psid_handle, 0, sizeof psid_handle);
+    for (i = 0; i < iterations; i++) {
+        hvsc_psid_parse_header(&psid_handle, psid_header);
+        total += psid_handle.songs;
+    }
+    micro_sink = total;
+    return iterations;
+}
+
+
+/** \brief  Kernel: hvsc_text_file_read() on a text in memory
+ *
+ * An operation is reading a single line.
+ *
+ * \param[in]   iterations  number of iterations (passes over the text)
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_text_read(uint64_t iterations)
+{
+    uint64_t i;
+    uint64_t lines = 0;
+
+    for (i = 0; i < iterations; i++) {
+        if (!hvsc_text_file_open_mem(text, text_size, 0, "microbench",
+                                     &text_handle)) {
+            break;
+        }
+        while (hvsc_text_file_read(&text_handle) != NULL) {
+            lines++;
+        }
+        hvsc_text_file_close(&text_handle);
+    }
+    micro_sink = (long)lines;
+    return lines;
+}
+
+
+/** \brief  Reference loop: split lines of the text into words
+ *
+ * Byte-at-a-time work with branches, like the parsers, but without calling
+ * the library, so it only changes speed when the machine does.
+ *
+ * \param[in]   iterations  number of iterations
+ *
+ * \return  number of operations
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t kernel_reference(uint64_t iterations)
+{
+    uint64_t i;
+    size_t pos = 0;
+    long words = 0;
+    long upper = 0;
+    long other = 0;
+
+    for (i = 0; i < iterations; i++) {
+        const char *p = text + pos;
+        bool in_word = false;
+
+        while (*p != '\n') {
+            if (*p == ' ' || *p == ':' || *p == '(' || *p == ')') {
+                in_word = false;
+            } else {
+                if (!in_word) {
+                    words++;
+                    in_word = true;
+                }
+                if (*p >= 'A' && *p <= 'Z') {
+                    upper++;
+                } else if (*p < 'a' || *p > 'z') {
+                    other++;
+                }
+            }
+            p++;
+        }
+        pos = (size_t)(p + 1 - text);
+        if (pos >= text_size) {
+            pos = 0;
+        }
+    }
+    micro_sink = words + upper + other;
+    return iterations;
+}
+
+
+/** \brief  Reference kernel, timed along with each kernel
+ *
+ * \ingroup hvsc_microbench
+ */
+static const micro_kernel_t reference = {
+    "reference", "scanning lines without hvsclib", kernel_reference, 16384
+};
+
+/** \brief  List of kernels
+ *
+ * \ingroup hvsc_microbench
+ */
+static const micro_kernel_t kernels[] = {
+    { "timestamp", "hvsc_parse_simple_timestamp()", kernel_timestamp,
+      131072 },
+    { "sldb-entry", "hvsc_sldb_parse_entry()", kernel_sldb_entry, 8192 },
+    { "field-type", "hvsc_get_field_type()", kernel_field_type, 65536 },
+    { "stil-comment", "hvsc_stil_parse_comment()", kernel_stil_comment,
+      4096 },
+    { "psid-header", "hvsc_psid_parse_header()", kernel_psid_header,
+      65536 },
+    { "text-read", "hvsc_text_file_read(), per line", kernel_text_read,
+      32 },
+    { NULL, NULL, NULL, 0 }
+};
+
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time
+ *
+ * \ingroup hvsc_microbench
+ */
+static uint64_t micro_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/** \brief  Compare two doubles for qsort()
+ *
+ * \param[in]   p1  first value
+ * \param[in]   p2  second value
+ *
+ * \return  <0, 0 or >0
+ *
+ * \ingroup hvsc_microbench
+ */
+static int double_cmp(const void *p1, const void *p2)
+{
+    double a = *(const double *)p1;
+    double b = *(const double *)p2;
+
+    return a < b ? -1 : a > b;
+}
+
+
+/** \brief  Time a single sample of \a kernel
+ *
+ * \param[in]   kernel  kernel
+ * \param[out]  ops     number of operations
+ *
+ * \return  time per operation in nanoseconds
+ *
+ * \ingroup hvsc_microbench
+ */
+static double micro_sample(const micro_kernel_t *kernel, uint64_t *ops)
+{
+    uint64_t start = micro_now();
+
+    *ops = kernel->func(kernel->iterations);
+    return *ops > 0 ? (double)(micro_now() - start) / (double)*ops : 0.0;
+}
+
+
+/** \brief  Time the kernels selected in \a run
+ *
+ * Each sample of a kernel directly follows a sample of the reference loop,
+ * so both see the same clock speed and load on the machine. The samples
+ * are taken round-robin over the kernels, spreading every kernel over the
+ * whole run instead of timing it during a single burst of load on a shared
+ * machine.
+ *
+ * \param[in]   run     kernels to time
+ * \param[in]   samples number of samples per kernel
+ * \param[out]  results fastest and median time per operation and relative
+ *                      cost per kernel
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_microbench
+ */
+static bool micro_run(const bool *run, int samples, micro_result_t *results)
+{
+    size_t count = sizeof kernels / sizeof kernels[0];
+    double *times;
+    double *ratios;
+    uint64_t ops;
+    int s;
+    size_t k;
+
+    times = malloc(count * (size_t)samples * sizeof *times);
+    ratios = malloc(count * (size_t)samples * sizeof *ratios);
+    if (times == NULL || ratios == NULL) {
+        free(times);
+        free(ratios);
+        return false;
+    }
+
+    /* warm the caches */
+    micro_sample(&reference, &ops);
+    for (k = 0; kernels[k].name != NULL; k++) {
+        if (run[k]) {
+            micro_sample(&(kernels[k]), &ops);
+        }
+    }
+
+    for (s = 0; s < samples; s++) {
+        for (k = 0; kernels[k].name != NULL; k++) {
+            double ref;
+            size_t i = k * (size_t)samples + (size_t)s;
+
+            if (!run[k]) {
+                continue;
+            }
+            ref = micro_sample(&reference, &ops);
+            times[i] = micro_sample(&(kernels[k]), &(results[k].ops));
+            ratios[i] = ref > 0.0 ? times[i] / ref : 0.0;
+        }
+    }
+
+    for (k = 0; kernels[k].name != NULL; k++) {
+        double *t = times + k * (size_t)samples;
+        double *r = ratios + k * (size_t)samples;
+
+        if (!run[k]) {
+            continue;
+        }
+        qsort(t, (size_t)samples, sizeof *t, double_cmp);
+        qsort(r, (size_t)samples, sizeof *r, double_cmp);
+        results[k].ns_per_op = t[0];
+        results[k].median_ns = t[samples / 2];
+        results[k].relative = r[samples / 2];
+    }
+    free(times);
+    free(ratios);
+    return true;
+}
+
+
+/** \brief  Write \a results as JSON to \a fp
+ *
+ * \param[in]   fp      file
+ * \param[in]   results result per kernel
+ * \param[in]   ran     kernels that ran
+ *
+ * \ingroup hvsc_microbench
+ */
+static void micro_write_json(FILE *fp, const micro_result_t *results,
+                             const bool *ran)
+{
+    bool first = true;
+    int i;
+
+    fprintf(fp, "{\n  \"version\": \"%s\",\n  \"kernels\": [\n",
+            hvsc_lib_version_str());
+    for (i = 0; kernels[i].name != NULL; i++) {
+        if (!ran[i]) {
+            continue;
+        }
+        fprintf(fp, "%s    { \"name\": \"%s\", \"relative\": %.4f, "
+                "\"ns_per_op\": %.2f, \"median_ns_per_op\": %.2f, "
+                "\"ops\": %" PRIu64 " }",
+                first ? "" : ",\n", kernels[i].name, results[i].relative,
+                results[i].ns_per_op, results[i].median_ns, results[i].ops);
+        first = false;
+    }
+    fprintf(fp, "\n  ]\n}\n");
+}
+
+
+/** \brief  Look up the relative cost of kernel \a name in baseline \a json
+ *
+ * Only understands the JSON written by micro_write_json(): finds the
+ * kernel's name and takes the first "relative" after it.
+ *
+ * \param[in]   json    baseline JSON
+ * \param[in]   name    kernel name
+ *
+ * \return  relative cost or a negative value when the kernel isn't in the
+ *          baseline
+ *
+ * \ingroup hvsc_microbench
+ */
+static double micro_baseline_find(const char *json, const char *name)
+{
+    char key[128];
+    const char *p;
+    const char *end;
+
+    snprintf(key, sizeof key, "\"name\": \"%s\"", name);
+    p = strstr(json, key);
+    if (p == NULL) {
+        return -1.0;
+    }
+    end = strchr(p, '}');
+    p = strstr(p, "\"relative\":");
+    if (p == NULL || (end != NULL && p > end)) {
+        return -1.0;
+    }
+    return strtod(p + strlen("\"relative\":"), NULL);
+}
+
+
+/** \brief  Print usage message on stdout
+ *
+ * \param[in]   prg program name
+ *
+ * \ingroup hvsc_microbench
+ */
+static void usage(const char *prg)
+{
+    int i;
+
+    printf("Usage: %s [options]\n\n", prg);
+    printf("Options:\n"
+           "  -k <kernel>    run only <kernel>\n"
+           "  -n <samples>   samples per kernel (default %d)\n"
+           "  -o <file>      write results as JSON to <file> ('-' for "
+           "stdout)\n"
+           "  -b <file>      compare with baseline JSON <file>\n"
+           "  -t <percent>   allowed slowdown against the baseline "
+           "(default %.0f)\n"
+           "\nKernels:\n", MICRO_SAMPLES_DEFAULT, MICRO_TOLERANCE_DEFAULT);
+    for (i = 0; kernels[i].name != NULL; i++) {
+        printf("  %-14s %s\n", kernels[i].name, kernels[i].desc);
+    }
+    printf("\nTimes are in nanoseconds per operation. 'relative' is the "
+           "median time of a\nkernel divided by the time of a reference loop "
+           "run right before it, which\nis what gets compared with the "
+           "baseline. With -b the exit status is 1 when a\nkernel is slower "
+           "than the baseline by more than the tolerance.\n");
+}
+
+
+/** \brief  Micro benchmark driver
+ *
+ * \return  EXIT_SUCCESS, or EXIT_FAILURE on error or regression
+ *
+ * \ingroup hvsc_microbench
+ */
+int main(int argc, char *argv[])
+{
+    micro_result_t results[sizeof kernels / sizeof kernels[0]];
+    bool ran[sizeof kernels / sizeof kernels[0]];
+    double base[sizeof kernels / sizeof kernels[0]];
+    const char *only_kernel = NULL;
+    const char *output = NULL;
+    const char *baseline_file = NULL;
+    char *baseline = NULL;
+    double tolerance = MICRO_TOLERANCE_DEFAULT;
+    int samples = MICRO_SAMPLES_DEFAULT;
+    int regressions = 0;
+    int retry;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "k:n:o:b:t:h")) != -1) {
+        switch (opt) {
+            case 'k':
+                only_kernel = optarg;
+                break;
+            case 'n':
+                samples = atoi(optarg);
+                if (samples < 1 || samples > MICRO_SAMPLES_MAX) {
+                    fprintf(stderr, "samples must be 1-%d\n",
+                            MICRO_SAMPLES_MAX);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline_file = optarg;
+                break;
+            case 't':
+                tolerance = strtod(optarg, NULL);
+                if (tolerance < 0.0) {
+                    fprintf(stderr, "tolerance can't be negative\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!inputs_init()) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; kernels[i].name != NULL; i++) {
+        ran[i] = only_kernel == NULL
+            || strcmp(only_kernel, kernels[i].name) == 0;
+    }
+    if (!micro_run(ran, samples, results)) {
+        fprintf(stderr, "out of memory\n");
+        free(text);
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Only read the baseline now: the kernels that allocate memory are
+     * sensitive to the layout of the heap, and the timings with and without
+     * -b have to be comparable.
+     */
+    if (baseline_file != NULL) {
+        uint8_t *data;
+        long size = hvsc_read_file(&data, baseline_file);
+
+        if (size < 0) {
+            hvsc_perror(baseline_file);
+            free(text);
+            return EXIT_FAILURE;
+        }
+        /* turn into a string, the JSON is small */
+        baseline = calloc((size_t)size + 1, 1);
+        if (baseline == NULL) {
+            hvsc_free(data);
+            free(text);
+            return EXIT_FAILURE;
+        }
+        memcpy(baseline, data, (size_t)size);
+        hvsc_free(data);
+    }
+    for (i = 0; kernels[i].name != NULL; i++) {
+        base[i] = baseline != NULL
+            ? micro_baseline_find(baseline, kernels[i].name) : -1.0;
+    }
+    for (retry = 0; retry < MICRO_RETRIES; retry++) {
+        micro_result_t again[sizeof kernels / sizeof kernels[0]];
+        bool slow[sizeof kernels / sizeof kernels[0]];
+        bool any = false;
+
+        for (i = 0; kernels[i].name != NULL; i++) {
+            slow[i] = ran[i] && base[i] > 0.0
+                && results[i].relative > base[i] * (1.0 + tolerance / 100.0);
+            any = any || slow[i];
+        }
+        if (!any || !micro_run(slow, samples, again)) {
+            break;
+        }
+        for (i = 0; kernels[i].name != NULL; i++) {
+            if (slow[i] && again[i].relative < results[i].relative) {
+                results[i] = again[i];
+            }
+        }
+    }
+
+    printf("%-14s %10s %10s %10s %10s %8s\n",
+           "kernel", "ns/op", "median", "relative", "baseline", "change");
+    for (i = 0; kernels[i].name != NULL; i++) {
+        if (!ran[i]) {
+            continue;
+        }
+        printf("%-14s %10.2f %10.2f %10.4f", kernels[i].name,
+               results[i].ns_per_op, results[i].median_ns,
+               results[i].relative);
+
+        if (base[i] > 0.0) {
+            double change = (results[i].relative - base[i]) * 100.0
+                / base[i];
+            bool regressed = change > tolerance;
+
+            printf(" %10.4f %+7.1f%%%s\n", base[i], change,
+                   regressed ? "  REGRESSION" : "");
+            if (regressed) {
+                regressions++;
+            }
+        } else {
+            printf(" %10s %8s\n", "-", baseline != NULL ? "new" : "");
+        }
+        fflush(stdout);
+    }
+
+    if (output != NULL) {
+        FILE *fp = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+
+        if (fp == NULL) {
+            perror(output);
+            regressions = -1;
+        } else {
+            micro_write_json(fp, results, ran);
+            if (fp != stdout) {
+                fclose(fp);
+            }
+        }
+    }
+
+    if (baseline != NULL && regressions > 0) {
+        printf("\n%d kernel(s) slower than the baseline by more than "
+               "%.0f%%\n", regressions, tolerance);
+    }
+    free(baseline);
+    free(text);
+    return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
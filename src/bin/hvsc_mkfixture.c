@@ -0,0 +1,859 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   hvsc_mkfixture.c
+ * \brief   Synthetic HVSC generator
+ *
+ * Generates a fake HVSC tree: PSID files with valid headers in a MUSICIANS,
+ * GAMES and DEMOS hierarchy, with matching Songlengths.md5, STIL.txt and
+ * BUGlist.txt files. The output only depends on the file count and the seed,
+ * so benchmarks and tests can regenerate the same tree anywhere.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * \defgroup    hvsc_mkfixture  Synthetic HVSC generator
+ * \ingroup     hvsc_mkfixture
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "hvsc.h"
+#include "hvsc_defs.h"
+#include "psid.h"
+
+
+/** \brief  Default number of PSID files, roughly the size of HVSC #70
+ *
+ * \ingroup hvsc_mkfixture
+ */
+#define FIXTURE_FILES_DEFAULT   60000
+
+
+/** \brief  Size of a PSIDv2+ header, also the data offset
+ *
+ * \ingroup hvsc_mkfixture
+ */
+#define FIXTURE_HEADER_SIZE     0x7c
+
+
+/** \brief  Maximum number of songs in a generated PSID file
+ *
+ * \ingroup hvsc_mkfixture
+ */
+#define FIXTURE_SONGS_MAX       32
+
+
+/** \brief  Maximum size of a generated path
+ *
+ * \ingroup hvsc_mkfixture
+ */
+#define FIXTURE_PATH_MAX        256
+
+
+/** \brief  Generated PSID file
+ *
+ * \ingroup hvsc_mkfixture
+ */
+typedef struct fixture_tune_s {
+    char        path[FIXTURE_PATH_MAX]; /**< path relative to the root */
+    char        name[32];       /**< SID name */
+    char        author[32];     /**< SID author */
+    int         songs;          /**< number of songs */
+    uint64_t    seed;           /**< seed for the file's other properties */
+} fixture_tune_t;
+
+
+/** \brief  State of the pseudo random number generator
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static uint64_t rng_state;
+
+
+/** \brief  Syllables used to generate names
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static const char *syllables[] = {
+    "ba", "bel", "cor", "da", "den", "dro", "el", "fa", "gal", "har",
+    "in", "ka", "kel", "lan", "lo", "mar", "mi", "nor", "o", "pa",
+    "qua", "ra", "ros", "sa", "sen", "ta", "tor", "u", "van", "wen",
+    "xi", "ya", "zo", "ber", "chi", "dan", "ek", "fin", "gro", "hub"
+};
+
+
+/** \brief  Words used to generate titles, comments and bug reports
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static const char *words[] = {
+    "alien", "beat", "cosmic", "dance", "echo", "funk", "ghost", "hyper",
+    "intro", "jungle", "knight", "laser", "magic", "night", "orbit", "party",
+    "quest", "rider", "space", "tune", "ultra", "vector", "wave", "zone",
+    "blue", "crystal", "dream", "fire", "galaxy", "hero", "island", "jam",
+    "last", "metal", "ninja", "ocean", "power", "race", "storm", "tower"
+};
+
+
+/** \brief  Seed the random number generator
+ *
+ * \param[in]   seed    seed
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void rng_seed(uint64_t seed)
+{
+    rng_state = seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+
+/** \brief  Get next pseudo random number (xorshift64*)
+ *
+ * \return  64-bit number
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+
+/** \brief  Get pseudo random number in the range [0, \a n)
+ *
+ * \param[in]   n   upper bound
+ *
+ * \return  number
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static unsigned int rng_below(unsigned int n)
+{
+    return (unsigned int)(rng_next() % n);
+}
+
+
+/** \brief  Generate a capitalized name of \a count syllables in \a buf
+ *
+ * \param[out]  buf     output buffer
+ * \param[in]   size    size of \a buf
+ * \param[in]   count   number of syllables
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void gen_name(char *buf, size_t size, int count)
+{
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; i < count; i++) {
+        const char *syl = syllables[rng_below(sizeof syllables
+                                              / sizeof syllables[0])];
+        size_t slen = strlen(syl);
+
+        if (len + slen >= size) {
+            break;
+        }
+        memcpy(buf + len, syl, slen + 1);
+        len += slen;
+    }
+    buf[0] = (char)(buf[0] - 'a' + 'A');
+}
+
+
+/** \brief  Get a random word
+ *
+ * \return  word
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static const char *gen_word(void)
+{
+    return words[rng_below(sizeof words / sizeof words[0])];
+}
+
+
+/** \brief  Generate a title of one to three words in \a buf
+ *
+ * \param[out]  buf     output buffer
+ * \param[in]   size    size of \a buf
+ * \param[in]   sep     word separator
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void gen_title(char *buf, size_t size, char sep)
+{
+    int count = 1 + (int)rng_below(3);
+    size_t len = 0;
+    int i;
+
+    buf[0] = '\0';
+    for (i = 0; i < count; i++) {
+        const char *word = gen_word();
+        size_t wlen = strlen(word);
+
+        if (len + wlen + 2 >= size) {
+            break;
+        }
+        if (i > 0) {
+            buf[len++] = sep;
+        }
+        memcpy(buf + len, word, wlen + 1);
+        buf[len] = (char)(buf[len] - 'a' + 'A');
+        len += wlen;
+    }
+}
+
+
+/** \brief  Generate a song length of 0:10 to 9:59
+ *
+ * \param[out]  buf     output buffer
+ * \param[in]   size    size of \a buf
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void gen_length(char *buf, size_t size)
+{
+    unsigned int secs = 10 + rng_below(590);
+
+    snprintf(buf, size, "%u:%02u", secs / 60, secs % 60);
+}
+
+
+/** \brief  Create directory \a path and its parents
+ *
+ * \param[in]   path    directory
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static bool make_dirs(const char *path)
+{
+    char buf[FIXTURE_PATH_MAX * 2];
+    char *p;
+
+    snprintf(buf, sizeof buf, "%s", path);
+    for (p = buf + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(buf, 0755) != 0 && errno != EEXIST) {
+                perror(buf);
+                return false;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir(buf, 0755) != 0 && errno != EEXIST) {
+        perror(buf);
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Store 16-bit big endian \a value at \a p
+ *
+ * \param[out]  p       destination
+ * \param[in]   value   value
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void set_word_be(uint8_t *p, unsigned int value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)(value & 0xff);
+}
+
+
+/** \brief  Addresses of extra SIDs, as stored in the header
+ *
+ * $d420 is by far the most common address in the HVSC.
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static const uint8_t sid_addresses[] = {
+    0x42,   /* $d420 */
+    0x50,   /* $d500 */
+    0xe0,   /* $de00 */
+    0x44,   /* $d440 */
+    0xf0,   /* $df00 */
+    0x48    /* $d480 */
+};
+
+
+/** \brief  Generate the address of an extra SID
+ *
+ * Half of the extra SIDs are at $d420, the rest is spread over the others.
+ *
+ * \return  address byte for the header
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static uint8_t gen_sid_address(void)
+{
+    if (rng_below(2) == 0) {
+        return sid_addresses[0];
+    }
+    return sid_addresses[1 + rng_below((unsigned int)sizeof sid_addresses
+                                       - 1)];
+}
+
+
+/** \brief  Generate a SID model for the flags field
+ *
+ * \return  model bits: 1 = 6581, 2 = 8580, 3 = both, 0 = unknown
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static uint8_t gen_model(void)
+{
+    unsigned int r = rng_below(100);
+
+    if (r < 62) {
+        return 0x01;
+    } else if (r < 92) {
+        return 0x02;
+    } else if (r < 96) {
+        return 0x03;
+    }
+    return 0x00;
+}
+
+
+/** \brief  Generate the PSID file of \a tune in \a buf
+ *
+ * The header uses the offsets from psid.h, the data is a load address
+ * followed by random bytes. Magic, version, clock, models and the addresses
+ * of extra SIDs follow a distribution similar to the real HVSC: mostly PAL
+ * PSIDv2 files with a single SID, about 8% RSID, some NTSC, a few PSIDv3 files
+ * with two SIDs and PSIDv4 files with three SIDs.
+ *
+ * \param[in]   tune    tune
+ * \param[out]  buf     buffer, at least 0x10000 bytes
+ *
+ * \return  size of the file
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static size_t gen_psid(const fixture_tune_t *tune, uint8_t *buf)
+{
+    unsigned int load;
+    unsigned int version;
+    unsigned int clock;
+    unsigned int r;
+    unsigned int flags;
+    bool rsid;
+    size_t data_size;
+    size_t i;
+    char copyright[32];
+
+    rng_seed(tune->seed);
+    r = rng_below(100);
+    version = r < 2 ? 4 : (r < 10 ? 3 : 2);
+    rsid = rng_below(100) < 8;
+    load = 0x0800 + rng_below(0x80) * 0x100;
+    data_size = 512 + rng_below(7680);
+
+    memset(buf, 0, FIXTURE_HEADER_SIZE);
+    memcpy(buf + HVSC_PSID_MAGIC, rsid ? "RSID" : "PSID", 4);
+    set_word_be(buf + HVSC_PSID_VERSION, version);
+    set_word_be(buf + HVSC_PSID_DATA_OFFSET, FIXTURE_HEADER_SIZE);
+    set_word_be(buf + HVSC_PSID_LOAD_ADDRESS, 0);
+    set_word_be(buf + HVSC_PSID_INIT_ADDRESS, load);
+    set_word_be(buf + HVSC_PSID_SONGS, (unsigned int)tune->songs);
+    set_word_be(buf + HVSC_PSID_START_SONG, 1);
+    if (!rsid) {
+        /* RSID files have no play address and no speed flags */
+        set_word_be(buf + HVSC_PSID_PLAY_ADDRESS, load + 3);
+        buf[HVSC_PSID_SPEED + 3] = rng_below(4) == 0 ? 0x01 : 0x00;
+    }
+
+    memcpy(buf + HVSC_PSID_NAME, tune->name, strlen(tune->name));
+    memcpy(buf + HVSC_PSID_AUTHOR, tune->author, strlen(tune->author));
+    snprintf(copyright, sizeof copyright, "%u %s",
+             1982 + rng_below(36), rng_below(3) == 0 ? "<?>" : tune->author);
+    memcpy(buf + HVSC_PSID_COPYRIGHT, copyright, strlen(copyright));
+
+    /* clock: PAL, NTSC, PAL and NTSC or unknown */
+    r = rng_below(100);
+    clock = r < 80 ? 0x01 : (r < 93 ? 0x02 : (r < 96 ? 0x03 : 0x00));
+    flags = (clock << 2) | ((unsigned int)gen_model() << 4);
+    if (version >= 3) {
+        uint8_t second = gen_sid_address();
+
+        flags |= (unsigned int)gen_model() << 6;
+        buf[HVSC_PSID_SECOND_SID] = second;
+        if (version == 4) {
+            uint8_t third;
+
+            do {
+                third = gen_sid_address();
+            } while (third == second);
+            flags |= (unsigned int)gen_model() << 8;
+            buf[HVSC_PSID_THIRD_SID] = third;
+        }
+    }
+    set_word_be(buf + HVSC_PSID_FLAGS, flags);
+
+    buf[FIXTURE_HEADER_SIZE] = (uint8_t)(load & 0xff);
+    buf[FIXTURE_HEADER_SIZE + 1] = (uint8_t)(load >> 8);
+    for (i = 0; i < data_size; i++) {
+        buf[FIXTURE_HEADER_SIZE + 2 + i] = (uint8_t)rng_next();
+    }
+    return FIXTURE_HEADER_SIZE + 2 + data_size;
+}
+
+
+/** \brief  Compare tunes on path for qsort()
+ *
+ * \param[in]   p1  first tune
+ * \param[in]   p2  second tune
+ *
+ * \return  <0, 0 or >0
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static int tune_cmp(const void *p1, const void *p2)
+{
+    return strcmp(((const fixture_tune_t *)p1)->path,
+                  ((const fixture_tune_t *)p2)->path);
+}
+
+
+/** \brief  Generate the list of tunes, sorted on path
+ *
+ * About 85% of the files go to MUSICIANS, in directories of 1 to ~120
+ * files, the rest is split between GAMES and DEMOS.
+ *
+ * \param[out]  tunes   array of \a count tunes
+ * \param[in]   count   number of tunes
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void gen_tunes(fixture_tune_t *tunes, size_t count)
+{
+    char dir[FIXTURE_PATH_MAX / 2];
+    char author[32];
+    const char *group = NULL;
+    size_t left = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        fixture_tune_t *tune = &(tunes[i]);
+        char title[64];
+
+        if (left == 0) {
+            unsigned int kind = rng_below(100);
+
+            if (kind < 85) {
+                char last[12];
+                char first[12];
+
+                gen_name(last, sizeof last, 2 + (int)rng_below(2));
+                gen_name(first, sizeof first, 1 + (int)rng_below(2));
+                snprintf(dir, sizeof dir, "/MUSICIANS/%c/%s_%s",
+                         last[0], last, first);
+                snprintf(author, sizeof author, "%s %s", first, last);
+                group = NULL;
+                /* skewed: most composers have few files */
+                left = 1 + rng_below(8) * rng_below(16);
+            } else {
+                group = kind < 95 ? "GAMES" : "DEMOS";
+                left = 1;
+            }
+        }
+        left--;
+
+        gen_title(title, sizeof title, '_');
+        if (group != NULL) {
+            /* games and demos are filed under their first letter */
+            snprintf(dir, sizeof dir, "/%s/%c", group, title[0]);
+            gen_name(author, sizeof author, 2);
+        }
+        /* index suffix keeps the paths unique */
+        snprintf(tune->path, sizeof tune->path, "%s/%s_%zu.sid",
+                 dir, title, i);
+        memcpy(tune->name, title, sizeof tune->name - 1);
+        tune->name[sizeof tune->name - 1] = '\0';
+        memcpy(tune->author, author, sizeof tune->author);
+        tune->songs = rng_below(3) == 0
+            ? 2 + (int)rng_below(FIXTURE_SONGS_MAX - 1) : 1;
+        tune->seed = rng_next();
+    }
+    qsort(tunes, count, sizeof *tunes, tune_cmp);
+}
+
+
+/** \brief  Write the PSID files and the SLDB
+ *
+ * \param[in]   root    output directory
+ * \param[in]   tunes   tunes
+ * \param[in]   count   number of tunes
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static bool write_psids(const char *root, const fixture_tune_t *tunes,
+                        size_t count)
+{
+    char path[FIXTURE_PATH_MAX * 2];
+    char lastdir[FIXTURE_PATH_MAX * 2];
+    uint8_t *buf;
+    FILE *sldb;
+    size_t i;
+
+    snprintf(path, sizeof path, "%s/%s", root, HVSC_SLDB_FILE);
+    sldb = fopen(path, "wb");
+    if (sldb == NULL) {
+        perror(path);
+        return false;
+    }
+    buf = malloc(0x10000);
+    if (buf == NULL) {
+        fclose(sldb);
+        return false;
+    }
+    fprintf(sldb, "[Database]\n");
+
+    lastdir[0] = '\0';
+    for (i = 0; i < count; i++) {
+        const fixture_tune_t *tune = &(tunes[i]);
+        uint8_t digest[HVSC_DIGEST_SIZE];
+        size_t size;
+        char *slash;
+        FILE *fp;
+        int d;
+        int s;
+
+        snprintf(path, sizeof path, "%s%s", root, tune->path);
+        slash = strrchr(path, '/');
+        *slash = '\0';
+        if (strcmp(path, lastdir) != 0) {
+            if (!make_dirs(path)) {
+                free(buf);
+                fclose(sldb);
+                return false;
+            }
+            strcpy(lastdir, path);
+        }
+        *slash = '/';
+
+        size = gen_psid(tune, buf);
+        fp = fopen(path, "wb");
+        if (fp == NULL || fwrite(buf, 1, size, fp) != size) {
+            perror(path);
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            free(buf);
+            fclose(sldb);
+            return false;
+        }
+        fclose(fp);
+
+        hvsc_md5(buf, size, digest);
+        fprintf(sldb, "; %s\n", tune->path);
+        for (d = 0; d < HVSC_DIGEST_SIZE; d++) {
+            fprintf(sldb, "%02x", digest[d]);
+        }
+        fputc('=', sldb);
+        for (s = 0; s < tune->songs; s++) {
+            char len[16];
+
+            gen_length(len, sizeof len);
+            fprintf(sldb, "%s%s", s > 0 ? " " : "", len);
+        }
+        fputc('\n', sldb);
+    }
+    free(buf);
+    return fclose(sldb) == 0;
+}
+
+
+/** \brief  Write a multi-line field to \a fp
+ *
+ * Field text is continued on lines indented with nine spaces, per STIL.faq.
+ *
+ * \param[in,out]   fp      output file
+ * \param[in]       field   field identifier including the colon
+ * \param[in]       lines   number of lines
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void write_field(FILE *fp, const char *field, int lines)
+{
+    int l;
+
+    for (l = 0; l < lines; l++) {
+        int w;
+        int nwords = 6 + (int)rng_below(6);
+
+        fprintf(fp, "%s", l == 0 ? field : "        ");
+        for (w = 0; w < nwords; w++) {
+            fprintf(fp, " %s", gen_word());
+        }
+        fprintf(fp, "%s\n", l == lines - 1 ? "." : "");
+    }
+}
+
+
+/** \brief  Write the STIL fields of a single song to \a fp
+ *
+ * \param[in,out]   fp      output file
+ * \param[in]       tune    tune
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void write_stil_song(FILE *fp, const fixture_tune_t *tune)
+{
+    char title[64];
+    char artist[32];
+
+    gen_title(title, sizeof title, ' ');
+    switch (rng_below(4)) {
+        case 0:
+            /* cover with timestamp */
+            gen_name(artist, sizeof artist, 2);
+            if (rng_below(2) == 0) {
+                unsigned int from = rng_below(120);
+
+                fprintf(fp, "  TITLE: %s (%u:%02u-%u:%02u)\n", title,
+                        from / 60, from % 60, (from + 40) / 60,
+                        (from + 40) % 60);
+            } else {
+                fprintf(fp, "  TITLE: %s (%u:%02u)\n", title,
+                        rng_below(3), rng_below(60));
+            }
+            fprintf(fp, " ARTIST: %s\n", artist);
+            break;
+        case 1:
+            /* cover from an album */
+            gen_name(artist, sizeof artist, 2);
+            fprintf(fp, "  TITLE: %s [from %s]\n", title, gen_word());
+            fprintf(fp, " ARTIST: %s\n", artist);
+            break;
+        case 2:
+            fprintf(fp, "   NAME: %s\n", title);
+            fprintf(fp, " AUTHOR: %s\n", tune->author);
+            break;
+        default:
+            write_field(fp, "COMMENT:", 1 + (int)rng_below(3));
+            break;
+    }
+}
+
+
+/** \brief  Write STIL.txt and BUGlist.txt
+ *
+ * About 30% of the files get a STIL entry, half of the multi-song files with
+ * an entry get per-song fields. Some directories get a directory comment.
+ * About 1% of the files get a BUGlist entry.
+ *
+ * \param[in]   root    output directory
+ * \param[in]   tunes   tunes
+ * \param[in]   count   number of tunes
+ *
+ * \return  bool
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static bool write_stil_bugs(const char *root, const fixture_tune_t *tunes,
+                            size_t count)
+{
+    char path[FIXTURE_PATH_MAX * 2];
+    char lastdir[FIXTURE_PATH_MAX];
+    FILE *stil;
+    FILE *bugs;
+    size_t i;
+    bool result;
+
+    snprintf(path, sizeof path, "%s/%s", root, HVSC_STIL_FILE);
+    stil = fopen(path, "wb");
+    if (stil == NULL) {
+        perror(path);
+        return false;
+    }
+    snprintf(path, sizeof path, "%s/%s", root, HVSC_BUGS_FILE);
+    bugs = fopen(path, "wb");
+    if (bugs == NULL) {
+        perror(path);
+        fclose(stil);
+        return false;
+    }
+
+    fprintf(stil, "######################################################\n"
+                  "#  SID Tune Information List (STIL), generated\n"
+                  "######################################################\n"
+                  "\n");
+    fprintf(bugs, "######################################################\n"
+                  "#  BUGlist, generated\n"
+                  "######################################################\n"
+                  "\n");
+
+    lastdir[0] = '\0';
+    for (i = 0; i < count; i++) {
+        const fixture_tune_t *tune = &(tunes[i]);
+        const char *slash = strrchr(tune->path, '/');
+        size_t dirlen = (size_t)(slash - tune->path) + 1;
+
+        rng_seed(tune->seed ^ 0x5354494cULL);
+
+        if (dirlen != strlen(lastdir)
+                || strncmp(lastdir, tune->path, dirlen) != 0) {
+            memcpy(lastdir, tune->path, dirlen);
+            lastdir[dirlen] = '\0';
+            if (strncmp(lastdir, "/MUSICIANS/", 11) == 0) {
+                fprintf(stil, "### %s ###\n", tune->author);
+                if (rng_below(10) == 0) {
+                    fprintf(stil, "%s\n", lastdir);
+                    write_field(stil, "COMMENT:", 1 + (int)rng_below(4));
+                    fprintf(stil, "\n");
+                }
+            }
+        }
+
+        if (rng_below(10) < 3) {
+            fprintf(stil, "%s\n", tune->path);
+            if (tune->songs > 1 && rng_below(2) == 0) {
+                int song;
+
+                if (rng_below(3) == 0) {
+                    write_field(stil, "COMMENT:", 1 + (int)rng_below(2));
+                }
+                for (song = 1; song <= tune->songs; song++) {
+                    if (song == 1 || rng_below(2) == 0) {
+                        fprintf(stil, "(#%d)\n", song);
+                        write_stil_song(stil, tune);
+                    }
+                }
+            } else {
+                write_stil_song(stil, tune);
+            }
+            fprintf(stil, "\n");
+        }
+
+        if (rng_below(100) == 0) {
+            char user[32];
+
+            gen_name(user, sizeof user, 2);
+            fprintf(bugs, "%s\n", tune->path);
+            write_field(bugs, "    BUG:", 1 + (int)rng_below(3));
+            fprintf(bugs, "(%s)\n\n", user);
+        }
+    }
+
+    result = true;
+    if (fclose(stil) != 0) {
+        result = false;
+    }
+    if (fclose(bugs) != 0) {
+        result = false;
+    }
+    return result;
+}
+
+
+/** \brief  Print usage message on stdout
+ *
+ * \param[in]   prg program name
+ *
+ * \ingroup hvsc_mkfixture
+ */
+static void usage(const char *prg)
+{
+    printf("Usage: %s [-n <files>] [-s <seed>] <output-dir>\n\n", prg);
+    printf("Generates a synthetic HVSC in <output-dir>.\n\n"
+           "  -n <files>  number of PSID files (default %d)\n"
+           "  -s <seed>   seed (default 1), the same seed and file count "
+           "give the same tree\n", FIXTURE_FILES_DEFAULT);
+}
+
+
+/** \brief  Fixture generator driver
+ *
+ * \return  EXIT_SUCCESS or EXIT_FAILURE
+ *
+ * \ingroup hvsc_mkfixture
+ */
+int main(int argc, char *argv[])
+{
+    fixture_tune_t *tunes;
+    size_t count = FIXTURE_FILES_DEFAULT;
+    uint64_t seed = 1;
+    char docs[FIXTURE_PATH_MAX * 2];
+    const char *root;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                count = (size_t)strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || count == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    root = argv[optind];
+
+    snprintf(docs, sizeof docs, "%s/DOCUMENTS", root);
+    if (!make_dirs(docs)) {
+        return EXIT_FAILURE;
+    }
+
+    tunes = calloc(count, sizeof *tunes);
+    if (tunes == NULL) {
+        perror(argv[0]);
+        return EXIT_FAILURE;
+    }
+    rng_seed(seed);
+    gen_tunes(tunes, count);
+
+    if (!write_psids(root, tunes, count)
+            || !write_stil_bugs(root, tunes, count)) {
+        free(tunes);
+        return EXIT_FAILURE;
+    }
+    printf("Generated %zu PSID files in '%s'\n", count, root);
+    free(tunes);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,502 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   hvscd.c
+ * \brief   HVSC metadata daemon
+ *
+ * Loads the index of the SLDB, STIL and BUGlist once and answers lookups of
+ * processes in client mode (see hvsc_client_connect()) over a Unix domain
+ * socket. A single epoll loop serves all connections: every complete request
+ * in the input of a connection is answered before the responses are written
+ * in one go, so clients can pipeline requests.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ * \defgroup    hvscd   HVSC metadata daemon
+ * \ingroup     hvscd
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "hvsc.h"
+#include "hvsc_defs.h"
+#include "proto.h"
+#include "server.h"
+
+
+/** \brief  Number of events handled per epoll_wait() call
+ *
+ * \ingroup hvscd
+ */
+#define HVSCD_EVENTS        64
+
+/** \brief  Minimum number of bytes read from a connection at once
+ *
+ * \ingroup hvscd
+ */
+#define HVSCD_READ_SIZE     16384
+
+
+/** \brief  Client connection
+ *
+ * \ingroup hvscd
+ */
+typedef struct hvscd_conn_s {
+    int                 fd;     /**< socket */
+    hvsc_proto_buffer_t in;     /**< received, unanswered requests */
+    hvsc_proto_buffer_t out;    /**< responses to send */
+    size_t              sent;   /**< number of bytes of \a out sent */
+} hvscd_conn_t;
+
+
+/** \brief  epoll instance
+ *
+ * \ingroup hvscd
+ */
+static int epoll_fd = -1;
+
+/** \brief  Listening socket
+ *
+ * \ingroup hvscd
+ */
+static int listen_fd = -1;
+
+/** \brief  signalfd for SIGINT and SIGTERM
+ *
+ * \ingroup hvscd
+ */
+static int signal_fd = -1;
+
+/** \brief  Number of open connections
+ *
+ * \ingroup hvscd
+ */
+static size_t conn_count = 0;
+
+/** \brief  Number of requests answered
+ *
+ * \ingroup hvscd
+ */
+static uint64_t request_count = 0;
+
+
+/** \brief  Close connection \a conn and free it
+ *
+ * \param[in,out]   conn    connection
+ *
+ * \ingroup hvscd
+ */
+static void conn_close(hvscd_conn_t *conn)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    hvsc_proto_buffer_free(&(conn->in));
+    hvsc_proto_buffer_free(&(conn->out));
+    free(conn);
+    conn_count--;
+}
+
+
+/** \brief  Wait for input or for room to send output on \a conn
+ *
+ * While responses are waiting to be sent, no new requests are read, which
+ * keeps a client that doesn't read its responses from using up memory.
+ *
+ * \param[in]   conn    connection
+ *
+ * \return  bool
+ *
+ * \ingroup hvscd
+ */
+static bool conn_update(hvscd_conn_t *conn)
+{
+    struct epoll_event event;
+
+    event.events = conn->sent < conn->out.size ? EPOLLOUT : EPOLLIN;
+    event.data.ptr = conn;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) == 0;
+}
+
+
+/** \brief  Send pending responses of \a conn
+ *
+ * \param[in,out]   conn    connection
+ *
+ * \return  `false` when the connection failed
+ *
+ * \ingroup hvscd
+ */
+static bool conn_send(hvscd_conn_t *conn)
+{
+    bool blocked = false;
+
+    while (conn->sent < conn->out.size) {
+        ssize_t n = send(conn->fd, conn->out.data + conn->sent,
+                         conn->out.size - conn->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                blocked = true;
+                break;
+            }
+            return false;
+        }
+        conn->sent += (size_t)n;
+    }
+    if (!blocked) {
+        conn->out.size = 0;
+        conn->sent = 0;
+    }
+    return conn_update(conn);
+}
+
+
+/** \brief  Answer all complete requests received on \a conn
+ *
+ * \param[in,out]   conn    connection
+ *
+ * \return  `false` on a malformed request or when out of memory
+ *
+ * \ingroup hvscd
+ */
+static bool conn_process(hvscd_conn_t *conn)
+{
+    size_t pos = 0;
+
+    while (conn->in.size - pos >= HVSC_PROTO_HEADER_SIZE) {
+        const uint8_t *header = conn->in.data + pos;
+        uint32_t size = hvsc_proto_get_u32(header);
+
+        if (size > HVSC_PROTO_BODY_MAX) {
+            return false;
+        }
+        if (conn->in.size - pos < HVSC_PROTO_HEADER_SIZE + size) {
+            break;
+        }
+        if (!hvsc_server_request(&(conn->out), hvsc_proto_get_u32(header + 4),
+                                 header[8], header + HVSC_PROTO_HEADER_SIZE,
+                                 size)) {
+            return false;
+        }
+        request_count++;
+        pos += HVSC_PROTO_HEADER_SIZE + size;
+    }
+    hvsc_proto_buffer_consume(&(conn->in), pos);
+    return true;
+}
+
+
+/** \brief  Read requests from \a conn, answer them and send the responses
+ *
+ * Reads once per event, so a client sending a flood of requests doesn't
+ * starve the others or make the input buffer grow without limit.
+ *
+ * \param[in,out]   conn    connection
+ *
+ * \return  `false` when the connection is done
+ *
+ * \ingroup hvscd
+ */
+static bool conn_receive(hvscd_conn_t *conn)
+{
+    ssize_t n;
+
+    if (!hvsc_proto_buffer_reserve(&(conn->in), HVSCD_READ_SIZE)) {
+        return false;
+    }
+    do {
+        n = recv(conn->fd, conn->in.data + conn->in.size,
+                 conn->in.max - conn->in.size, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    if (n == 0) {
+        return false;
+    }
+    conn->in.size += (size_t)n;
+    return conn_process(conn) && conn_send(conn);
+}
+
+
+/** \brief  Accept pending connections
+ *
+ * \ingroup hvscd
+ */
+static void accept_connections(void)
+{
+    while (true) {
+        struct epoll_event event;
+        hvscd_conn_t *conn;
+        int fd;
+
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("hvscd: accept");
+            }
+            return;
+        }
+        if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0
+                || fcntl(fd, F_SETFL, O_NONBLOCK) != 0) {
+            close(fd);
+            continue;
+        }
+        conn = malloc(sizeof *conn);
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        hvsc_proto_buffer_init(&(conn->in));
+        hvsc_proto_buffer_init(&(conn->out));
+        conn->sent = 0;
+
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn_count++;
+    }
+}
+
+
+/** \brief  Create the listening socket at \a path
+ *
+ * A socket left behind by a previous run is removed, any other file at
+ * \a path is left alone.
+ *
+ * \param[in]   path    path of the socket
+ *
+ * \return  bool
+ *
+ * \ingroup hvscd
+ */
+static bool listen_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "hvscd: socket path '%s' too long\n", path);
+        return false;
+    }
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("hvscd: socket");
+        return false;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+    if (bind(listen_fd, (const struct sockaddr *)&addr, sizeof addr) != 0
+            || listen(listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "hvscd: can't listen on '%s': %s\n",
+                path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Run the event loop until SIGINT or SIGTERM
+ *
+ * \return  bool
+ *
+ * \ingroup hvscd
+ */
+static bool event_loop(void)
+{
+    struct epoll_event events[HVSCD_EVENTS];
+    struct epoll_event event;
+
+    /* the listening socket and the signalfd are told apart by data.ptr */
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+        perror("hvscd: epoll_ctl");
+        return false;
+    }
+    event.data.ptr = &signal_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) != 0) {
+        perror("hvscd: epoll_ctl");
+        return false;
+    }
+
+    while (true) {
+        int n = epoll_wait(epoll_fd, events, HVSCD_EVENTS, -1);
+        int i;
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("hvscd: epoll_wait");
+            return false;
+        }
+        for (i = 0; i < n; i++) {
+            hvscd_conn_t *conn = events[i].data.ptr;
+            bool ok;
+
+            if (events[i].data.ptr == &signal_fd) {
+                return true;
+            }
+            if (events[i].data.ptr == &listen_fd) {
+                accept_connections();
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                ok = false;
+            } else if (events[i].events & EPOLLOUT) {
+                ok = conn_send(conn);
+            } else {
+                ok = conn_receive(conn);
+            }
+            if (!ok) {
+                conn_close(conn);
+            }
+        }
+    }
+}
+
+
+/** \brief  Print usage message on stdout
+ *
+ * \param[in]   prg program name
+ *
+ * \ingroup hvscd
+ */
+static void usage(const char *prg)
+{
+    printf("Usage: %s [-s <socket>] [-w] <hvsc-root>\n\n", prg);
+    printf("Answers SLDB, STIL and BUGlist lookups of processes in client "
+           "mode.\n\n"
+           "  -s <socket>  path of the socket (default %s)\n"
+           "  -w           reload the index when the DOCUMENTS files change\n",
+           HVSC_CLIENT_SOCKET_DEFAULT);
+}
+
+
+/** \brief  Daemon driver
+ *
+ * \return  EXIT_SUCCESS or EXIT_FAILURE
+ *
+ * \ingroup hvscd
+ */
+int main(int argc, char *argv[])
+{
+    const char *socket_path = HVSC_CLIENT_SOCKET_DEFAULT;
+    bool watch = false;
+    bool result;
+    sigset_t mask;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:wh")) != -1) {
+        switch (opt) {
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'w':
+                watch = true;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /*
+     * Handle SIGINT and SIGTERM in the event loop. Block them before any
+     * thread is started: threads inherit the mask, and delivered to a
+     * thread that doesn't block them they'd kill the daemon without
+     * removing the socket.
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0
+            || (signal_fd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0
+            || (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("hvscd");
+        return EXIT_FAILURE;
+    }
+
+    if (!hvsc_init(argv[optind])) {
+        hvsc_perror(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!hvsc_index_load()) {
+        hvsc_perror("hvscd: can't load index");
+        hvsc_exit();
+        return EXIT_FAILURE;
+    }
+    if (watch && !hvsc_watch_start()) {
+        hvsc_perror("hvscd: can't watch DOCUMENTS");
+        hvsc_exit();
+        return EXIT_FAILURE;
+    }
+
+    if (!listen_socket(socket_path)) {
+        hvsc_exit();
+        return EXIT_FAILURE;
+    }
+
+    printf("hvscd: serving '%s' on '%s'\n", argv[optind], socket_path);
+    fflush(stdout);
+    result = event_loop();
+    printf("hvscd: answered %" PRIu64 " requests, %zu clients connected\n",
+           request_count, conn_count);
+
+    close(listen_fd);
+    unlink(socket_path);
+    close(signal_fd);
+    close(epoll_fd);
+    hvsc_exit();
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,381 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/alloc.c
+ * \brief   Allocator hooks and memory accounting
+ *
+ * All memory owned by the library is allocated through hvsc_malloc() and
+ * friends, which call the allocator set with hvsc_set_allocator() and keep
+ * track of the current and peak number of bytes per subsystem. To know the
+ * size of a block when it's freed, each block is prefixed with a small
+ * header.
+ *
+ * Memory handed to the caller to release with free(3), like the results of
+ * hvsc_sldb_get_lengths(), is allocated with malloc(3) and isn't accounted.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hvsc.h"
+
+#include "stats.h"
+#include "alloc.h"
+
+
+/** \brief  Relaxed atomic counter operations, the add/sub return the new value
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define MEM_ADD(p, n)  __atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+# define MEM_SUB(p, n)  __atomic_sub_fetch((p), (n), __ATOMIC_RELAXED)
+# define MEM_LOAD(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+# define MEM_STORE(p, n) __atomic_store_n((p), (n), __ATOMIC_RELAXED)
+#else
+# define MEM_ADD(p, n)  (*(p) += (n))
+# define MEM_SUB(p, n)  (*(p) -= (n))
+# define MEM_LOAD(p)    (*(p))
+# define MEM_STORE(p, n) (*(p) = (n))
+#endif
+
+
+/** \brief  Header in front of each block
+ *
+ * The union makes sure the memory following the header is suitably aligned
+ * for any type.
+ */
+typedef union alloc_header_u {
+    struct {
+        size_t  size;       /**< size requested by the caller */
+        int     subsys;     /**< subsystem the block is accounted to */
+    } info;                 /**< block info */
+    long double align_ld;   /**< alignment */
+    uint64_t    align_u64;  /**< alignment */
+    void *      align_ptr;  /**< alignment */
+} alloc_header_t;
+
+
+/** \brief  Default malloc hook
+ *
+ * \param[in]   data    unused
+ * \param[in]   size    number of bytes to allocate
+ *
+ * \return  pointer to memory or `NULL`
+ */
+static void *default_malloc(void *data, size_t size)
+{
+    (void)data;
+    return malloc(size);
+}
+
+
+/** \brief  Default realloc hook
+ *
+ * \param[in]   data    unused
+ * \param[in]   ptr     memory to resize
+ * \param[in]   size    new size
+ *
+ * \return  pointer to memory or `NULL`
+ */
+static void *default_realloc(void *data, void *ptr, size_t size)
+{
+    (void)data;
+    return realloc(ptr, size);
+}
+
+
+/** \brief  Default free hook
+ *
+ * \param[in]   data    unused
+ * \param[in]   ptr     memory to free
+ */
+static void default_free(void *data, void *ptr)
+{
+    (void)data;
+    free(ptr);
+}
+
+
+/** \brief  Allocator in use
+ */
+static hvsc_allocator_t allocator = {
+    default_malloc, default_realloc, default_free, NULL
+};
+
+/** \brief  Memory counters per subsystem
+ */
+static hvsc_mem_counters_t mem_subsys[HVSC_STATS_SUBSYS_COUNT];
+
+/** \brief  Memory counters for all subsystems
+ */
+static hvsc_mem_counters_t mem_total;
+
+
+/** \brief  Raise \a peak to \a value if it's lower
+ *
+ * \param[in,out]   peak    peak counter
+ * \param[in]       value   current value
+ */
+static void mem_update_peak(uint64_t *peak, uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    uint64_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+
+    while (value > old
+            && !__atomic_compare_exchange_n(peak, &old, value, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+        /* old was updated, try again */
+    }
+#else
+    if (value > *peak) {
+        *peak = value;
+    }
+#endif
+}
+
+
+/** \brief  Account \a size bytes more to \a subsys
+ *
+ * \param[in]   subsys  subsystem
+ * \param[in]   size    number of bytes
+ */
+static void mem_grow(int subsys, size_t size)
+{
+    mem_update_peak(&(mem_subsys[subsys].peak),
+                    MEM_ADD(&(mem_subsys[subsys].current), (uint64_t)size));
+    mem_update_peak(&(mem_total.peak),
+                    MEM_ADD(&(mem_total.current), (uint64_t)size));
+}
+
+
+/** \brief  Account \a size bytes less to \a subsys
+ *
+ * \param[in]   subsys  subsystem
+ * \param[in]   size    number of bytes
+ */
+static void mem_shrink(int subsys, size_t size)
+{
+    MEM_SUB(&(mem_subsys[subsys].current), (uint64_t)size);
+    MEM_SUB(&(mem_total.current), (uint64_t)size);
+}
+
+
+/** \brief  Allocate \a size bytes, accounted to the current subsystem
+ *
+ * \param[in]   size    number of bytes
+ *
+ * \return  pointer to memory or `NULL` on failure
+ */
+void *hvsc_malloc(size_t size)
+{
+    alloc_header_t *header;
+    int subsys;
+
+    if (size > SIZE_MAX - sizeof *header) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    header = allocator.malloc_func(allocator.data, sizeof *header + size);
+    if (header == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    subsys = hvsc_stats_subsys();
+    header->info.size = size;
+    header->info.subsys = subsys;
+
+    MEM_ADD(&(mem_subsys[subsys].allocations), 1);
+    MEM_ADD(&(mem_total.allocations), 1);
+    mem_grow(subsys, size);
+    hvsc_stats_add_alloc();
+    return header + 1;
+}
+
+
+/** \brief  Allocate \a nmemb elements of \a size bytes, cleared to zero
+ *
+ * \param[in]   nmemb   number of elements
+ * \param[in]   size    size of an element
+ *
+ * \return  pointer to memory or `NULL` on failure
+ */
+void *hvsc_calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if (size > 0 && nmemb > SIZE_MAX / size) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    ptr = hvsc_malloc(nmemb * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+
+/** \brief  Resize \a ptr to \a size bytes
+ *
+ * The block stays accounted to the subsystem that allocated it. On failure
+ * \a ptr is left untouched, like realloc(3).
+ *
+ * \param[in]   ptr     memory from hvsc_malloc() (can be `NULL`)
+ * \param[in]   size    new size
+ *
+ * \return  pointer to memory or `NULL` on failure
+ */
+void *hvsc_realloc(void *ptr, size_t size)
+{
+    alloc_header_t *header;
+    size_t old;
+
+    if (ptr == NULL) {
+        return hvsc_malloc(size);
+    }
+    if (size > SIZE_MAX - sizeof *header) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    header = (alloc_header_t *)ptr - 1;
+    old = header->info.size;
+    header = allocator.realloc_func(allocator.data, header,
+                                    sizeof *header + size);
+    if (header == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    header->info.size = size;
+    if (size > old) {
+        mem_grow(header->info.subsys, size - old);
+    } else {
+        mem_shrink(header->info.subsys, old - size);
+    }
+    return header + 1;
+}
+
+
+/** \brief  Free memory allocated with hvsc_malloc() and friends
+ *
+ * \param[in]   ptr     memory (can be `NULL`)
+ */
+void hvsc_free(void *ptr)
+{
+    alloc_header_t *header;
+    int subsys;
+
+    if (ptr == NULL) {
+        return;
+    }
+    header = (alloc_header_t *)ptr - 1;
+    subsys = header->info.subsys;
+    MEM_ADD(&(mem_subsys[subsys].frees), 1);
+    MEM_ADD(&(mem_total.frees), 1);
+    mem_shrink(subsys, header->info.size);
+    allocator.free_func(allocator.data, header);
+}
+
+
+/** \brief  Set the allocator used by the library
+ *
+ * Can only be changed while the library holds no memory, so before
+ * hvsc_init() or after hvsc_exit(). Passing `NULL` restores the default
+ * allocator using malloc(3), realloc(3) and free(3).
+ *
+ * \param[in]   alloc   allocator (copied, all three functions are required)
+ *
+ * \return  bool (false with HVSC_ERR_INVALID when the library holds memory or
+ *          a function is missing)
+ *
+ * \ingroup alloc
+ */
+bool hvsc_set_allocator(const hvsc_allocator_t *alloc)
+{
+    if (MEM_LOAD(&(mem_total.allocations)) != MEM_LOAD(&(mem_total.frees))) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    if (alloc == NULL) {
+        allocator.malloc_func = default_malloc;
+        allocator.realloc_func = default_realloc;
+        allocator.free_func = default_free;
+        allocator.data = NULL;
+        return true;
+    }
+    if (alloc->malloc_func == NULL || alloc->realloc_func == NULL
+            || alloc->free_func == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    allocator = *alloc;
+    return true;
+}
+
+
+/** \brief  Copy one set of memory counters
+ *
+ * \param[out]  dest    destination
+ * \param[in]   src     counters, other threads may be updating them
+ */
+static void mem_copy(hvsc_mem_counters_t *dest, const hvsc_mem_counters_t *src)
+{
+    dest->current = MEM_LOAD(&(src->current));
+    dest->peak = MEM_LOAD(&(src->peak));
+    dest->allocations = MEM_LOAD(&(src->allocations));
+    dest->frees = MEM_LOAD(&(src->frees));
+}
+
+
+/** \brief  Get the memory counters
+ *
+ * \param[out]  stats   memory counters per subsystem and in total
+ *
+ * \ingroup alloc
+ */
+void hvsc_mem_get(hvsc_mem_stats_t *stats)
+{
+    int i;
+
+    for (i = 0; i < HVSC_STATS_SUBSYS_COUNT; i++) {
+        mem_copy(&(stats->subsys[i]), &(mem_subsys[i]));
+    }
+    mem_copy(&(stats->total), &mem_total);
+}
+
+
+/** \brief  Reset the peaks to the current memory use
+ *
+ * \ingroup alloc
+ */
+void hvsc_mem_reset_peak(void)
+{
+    int i;
+
+    for (i = 0; i < HVSC_STATS_SUBSYS_COUNT; i++) {
+        MEM_STORE(&(mem_subsys[i].peak), MEM_LOAD(&(mem_subsys[i].current)));
+    }
+    MEM_STORE(&(mem_total.peak), MEM_LOAD(&(mem_total.current)));
+}
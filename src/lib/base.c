@@ -33,12 +33,21 @@
 #include <limits.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "hvsc.h"
 
 #include "hvsc_defs.h"
 
 #include "base.h"
+#include "alloc.h"
+#include "stats.h"
+#include "trace.h"
+#include "index.h"
 
 /** \brief  Size of chunks to read in hvsc_read_file()
  */
@@ -61,6 +70,7 @@ static const char *hvsc_err_messages[HVSC_ERR_CODE_COUNT] = {
     "malformed timestamp",
     "object not found",
     "invalid data or operation",
+    "failed to start thread",
 };
 
 
@@ -101,8 +111,10 @@ static const char *invalid_err_msg = "<unknown error code>";
 
 
 /** \brief  Error code for the library
+ *
+ * Thread-local, see HVSC_THREAD_LOCAL.
  */
-int hvsc_errno;
+HVSC_THREAD_LOCAL int hvsc_errno;
 
 
 /** \brief  Absolute path to the HVSC root directory
@@ -179,6 +191,12 @@ void hvsc_text_file_init_handle(hvsc_text_file_t *handle)
     handle->linelen = 0;
     handle->buffer = NULL;
     handle->buflen = 0;
+    handle->mem = NULL;
+    handle->mem_size = 0;
+    handle->mem_pos = 0;
+    handle->bytes = 0;
+    handle->index = NULL;
+    handle->mem_owned = NULL;
 }
 
 
@@ -193,32 +211,146 @@ bool hvsc_text_file_open(const char *path, hvsc_text_file_t *handle)
 {
     hvsc_text_file_init_handle(handle);
 
+    HVSC_TRACE_BEGIN(HVSC_TRACE_OPEN, path);
     handle->fp = fopen(path, "rb");
     if (handle->fp == NULL) {
         hvsc_errno = HVSC_ERR_IO;
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
         return false;
     }
     handle->path = hvsc_strdup(path);
     if (handle->path == NULL) {
         fclose(handle->fp);
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
         return false;
     }
 
     handle->lineno = 0;
 
-    handle->buffer = malloc(READFILE_LINE_SIZE);
+    handle->buffer = hvsc_malloc(READFILE_LINE_SIZE);
     if (handle->buffer == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
-        free(handle->path);
+        hvsc_free(handle->path);
         fclose(handle->fp);
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
         return false;
     }
     handle->buflen = READFILE_LINE_SIZE;
 
+    HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, true);
     return true;
 }
 
 
+/** \brief  Open text in memory for reading with hvsc_text_file_read()
+ *
+ * The \a text isn't copied, so it must stay valid until the handle is closed.
+ * For text owned by the index, hand a reference to the index over to the
+ * handle by setting its \a index member, heap-allocated text can be handed
+ * over by setting \a mem_owned. Reading starts at \a offset, allowing to
+ * jump straight to a line found earlier, for example through the index.
+ *
+ * \param[in]       text    text
+ * \param[in]       size    size of \a text
+ * \param[in]       offset  offset in \a text of the first line to read
+ * \param[in]       name    name used in error messages (usually the path of
+ *                          the file the text was read from)
+ * \param[in,out]   handle  file handle, must be allocated by the caller
+ *
+ * \return  bool
+ */
+bool hvsc_text_file_open_mem(const char *text, size_t size, size_t offset,
+                             const char *name, hvsc_text_file_t *handle)
+{
+    hvsc_text_file_init_handle(handle);
+
+    handle->path = hvsc_strdup(name);
+    if (handle->path == NULL) {
+        return false;
+    }
+    handle->buffer = hvsc_malloc(READFILE_LINE_SIZE);
+    if (handle->buffer == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        hvsc_free(handle->path);
+        handle->path = NULL;
+        return false;
+    }
+    handle->buflen = READFILE_LINE_SIZE;
+    handle->mem = text;
+    handle->mem_size = size;
+    handle->mem_pos = offset < size ? offset : size;
+    return true;
+}
+
+
+/** \brief  Check if the end of the text file has been reached
+ *
+ * Use this instead of feof(3) on the `fp` member to tell EOF from I/O errors
+ * after hvsc_text_file_read() returns `NULL`, it works for both file and
+ * memory handles.
+ *
+ * \param[in]   handle  text file handle
+ *
+ * \return  bool
+ */
+bool hvsc_text_file_eof(const hvsc_text_file_t *handle)
+{
+    if (handle->mem != NULL) {
+        return handle->mem_pos >= handle->mem_size;
+    }
+    return handle->fp != NULL && feof(handle->fp);
+}
+
+
+/** \brief  Read a line from a text in memory
+ *
+ * \param[in,out]   handle  text file handle
+ *
+ * \return  pointer to current line or `NULL` on EOF or failure
+ */
+static const char *text_file_read_mem(hvsc_text_file_t *handle)
+{
+    const char *start = handle->mem + handle->mem_pos;
+    size_t avail = handle->mem_size - handle->mem_pos;
+    const char *eol;
+    size_t len;
+
+    if (avail == 0) {
+        return NULL;
+    }
+    eol = memchr(start, '\n', avail);
+    len = eol != NULL ? (size_t)(eol - start) : avail;
+    handle->mem_pos += len + (eol != NULL ? 1 : 0);
+    handle->bytes += len + (eol != NULL ? 1 : 0);
+
+    if (len + 1 > handle->buflen) {
+        size_t size = handle->buflen;
+        char *tmp;
+
+        while (size < len + 1) {
+            size *= 2;
+        }
+        tmp = hvsc_realloc(handle->buffer, size);
+        if (tmp == NULL) {
+            hvsc_errno = HVSC_ERR_OOM;
+            return NULL;
+        }
+        handle->buffer = tmp;
+        handle->buflen = size;
+    }
+    memcpy(handle->buffer, start, len);
+    /* Strip Windows CR */
+    if (len > 0 && handle->buffer[len - 1] == '\r') {
+        len--;
+    }
+    handle->buffer[len] = '\0';
+    handle->lineno++;
+    handle->linelen = len;
+    hvsc_stats_add_lines(1);
+    return handle->buffer;
+}
+
+
 /** \brief  Close text file via \a handle
  *
  * Cleans up memory used by the members of \a handle, but not \a handle itself
@@ -228,17 +360,25 @@ bool hvsc_text_file_open(const char *path, hvsc_text_file_t *handle)
 void hvsc_text_file_close(hvsc_text_file_t *handle)
 {
     if (handle->path != NULL) {
-        free(handle->path);
+        hvsc_free(handle->path);
         handle->path = NULL;
     }
     if (handle->buffer != NULL) {
-        free(handle->buffer);
+        hvsc_free(handle->buffer);
         handle->buffer = NULL;
     }
     if (handle->fp != NULL) {
         fclose(handle->fp);
         handle->fp = NULL;
     }
+    if (handle->index != NULL) {
+        hvsc_index_release(handle->index);
+        handle->index = NULL;
+    }
+    if (handle->mem_owned != NULL) {
+        hvsc_free(handle->mem_owned);
+        handle->mem_owned = NULL;
+    }
 }
 
 
@@ -252,6 +392,10 @@ const char *hvsc_text_file_read(hvsc_text_file_t *handle)
 {
     size_t i = 0;
 
+    if (handle->mem != NULL) {
+        return text_file_read_mem(handle);
+    }
+
     while (true) {
         int ch;
 
@@ -262,7 +406,7 @@ const char *hvsc_text_file_read(hvsc_text_file_t *handle)
             printf("RESIZING BUFFER TO %lu, lineno %ld\n",
                     (unsigned long)(handle->buflen  * 2), handle->lineno);
 #endif
-            char *tmp = realloc(handle->buffer, handle->buflen * 2);
+            char *tmp = hvsc_realloc(handle->buffer, handle->buflen * 2);
             if (tmp == NULL) {
                 hvsc_errno = HVSC_ERR_OOM;
                 return NULL;
@@ -279,6 +423,9 @@ const char *hvsc_text_file_read(hvsc_text_file_t *handle)
                 if (i == 0) {
                     return NULL;
                 } else {
+                    hvsc_stats_add_lines(1);
+                    hvsc_stats_add_bytes(i);
+                    handle->bytes += i;
                     return handle->buffer;
                 }
             } else {
@@ -290,6 +437,9 @@ const char *hvsc_text_file_read(hvsc_text_file_t *handle)
         if (ch == '\n') {
             /* Unix EOL, strip */
             handle->buffer[i] = '\0';
+            hvsc_stats_add_lines(1);
+            hvsc_stats_add_bytes(i + 1);
+            handle->bytes += i + 1;
             /* Strip Windows CR */
             if (i > 0 && handle->buffer[i - 1] == '\r') {
                 handle->buffer[--i] = '\0';
@@ -328,7 +478,7 @@ const char *hvsc_text_file_read(hvsc_text_file_t *handle)
  *      fprintf(stderr, "oeps!\n");
  *  } else {
  *      printf("OK, read %ld bytes\n", result);
- *      free(data);
+ *      hvsc_free(data);
  *  }
  * @endcode
  *
@@ -346,16 +496,25 @@ long hvsc_read_file(uint8_t **dest, const char *path)
     size_t size = READFILE_BLOCK_SIZE;
     size_t result;
 
+    HVSC_TRACE_BEGIN(HVSC_TRACE_OPEN, path);
     fd = fopen(path, "rb");
     if (fd == NULL) {
         hvsc_errno = HVSC_ERR_IO;
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
         return -1;
     }
+    HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, true);
 
-    data = malloc(READFILE_BLOCK_SIZE);
+    HVSC_TRACE_BEGIN(HVSC_TRACE_ALLOC, path);
+    data = hvsc_malloc(READFILE_BLOCK_SIZE);
     if (data == NULL) {
+        HVSC_TRACE_END(HVSC_TRACE_ALLOC, READFILE_BLOCK_SIZE, false);
+        fclose(fd);
         return -1;
     }
+    HVSC_TRACE_END(HVSC_TRACE_ALLOC, READFILE_BLOCK_SIZE, true);
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_READ, path);
 
     /* keep reading chunks until EOF */
     while (true) {
@@ -366,15 +525,17 @@ long hvsc_read_file(uint8_t **dest, const char *path)
             /* check limit */
             if (size == (size_t)LONG_MAX + 1) {
                 hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
-                free(data);
+                hvsc_free(data);
                 fclose(fd);
+                HVSC_TRACE_END(HVSC_TRACE_READ, offset, false);
                 return -1;
             }
 
-            tmp = realloc(data, size * 2);
+            tmp = hvsc_realloc(data, size * 2);
             if (tmp == NULL) {
                 fclose(fd);
-                free(data);
+                hvsc_free(data);
+                HVSC_TRACE_END(HVSC_TRACE_READ, offset, false);
                 return -1;
             }
             data = tmp;
@@ -385,7 +546,7 @@ long hvsc_read_file(uint8_t **dest, const char *path)
             if (feof(fd)) {
                 /* OK: EOF */
                 /* try to realloc to minimum size required */
-                tmp = realloc(data, offset + result);
+                tmp = hvsc_realloc(data, offset + result);
                 if (tmp != NULL) {
                     /* OK, no worries if it fails, the C standard guarantees
                      * the original data is still intact */
@@ -393,13 +554,16 @@ long hvsc_read_file(uint8_t **dest, const char *path)
                 }
                 *dest = data;
                 fclose(fd);
+                hvsc_stats_add_bytes(offset + result);
+                HVSC_TRACE_END(HVSC_TRACE_READ, offset + result, true);
                 return (long)(offset + result);
             } else {
                 /* IO error */
                 hvsc_errno = HVSC_ERR_IO;
-                free(data);
+                hvsc_free(data);
                 *dest = NULL;
                 fclose(fd);
+                HVSC_TRACE_END(HVSC_TRACE_READ, offset + result, false);
                 return -1;
             }
         }
@@ -409,6 +573,147 @@ long hvsc_read_file(uint8_t **dest, const char *path)
 }
 
 
+/** \brief  Read all data from \a path into \a dest using a single allocation
+ *
+ * Unlike hvsc_read_file(), this function uses the size reported by fstat(2)
+ * to allocate the exact amount of memory needed and reads the file with
+ * pread(2), avoiding stdio buffering and repeated realloc() calls. Only
+ * works on regular files.
+ *
+ * \param[out]  dest    destination of data
+ * \param[in]   path    path to file
+ *
+ * \return  number of bytes read, or -1 on failure
+ */
+long hvsc_pread_file(uint8_t **dest, const char *path)
+{
+    struct stat st;
+
+    return hvsc_pread_file_stat(dest, path, &st);
+}
+
+
+/** \brief  Read all data from \a path into \a dest and report the file status
+ *
+ * Like hvsc_pread_file(), but also stores the result of the fstat(2) call
+ * on the opened file in \a st, so the status matches the data read.
+ *
+ * \param[out]  dest    destination of data
+ * \param[in]   path    path to file
+ * \param[out]  st      file status
+ *
+ * \return  number of bytes read, or -1 on failure
+ */
+long hvsc_pread_file_stat(uint8_t **dest, const char *path, struct stat *st)
+{
+    uint8_t *data;
+    size_t size;
+    size_t offset = 0;
+    int fd;
+
+    *dest = NULL;
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_OPEN, path);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
+        return -1;
+    }
+    if (fstat(fd, st) != 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        close(fd);
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
+        return -1;
+    }
+    HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, true);
+    if (st->st_size > LONG_MAX) {
+        hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
+        close(fd);
+        return -1;
+    }
+    size = (size_t)st->st_size;
+
+    /* always allocate at least one byte, malloc(0) may return NULL */
+    HVSC_TRACE_BEGIN(HVSC_TRACE_ALLOC, path);
+    data = hvsc_malloc(size > 0 ? size : 1);
+    if (data == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        close(fd);
+        HVSC_TRACE_END(HVSC_TRACE_ALLOC, size, false);
+        return -1;
+    }
+    HVSC_TRACE_END(HVSC_TRACE_ALLOC, size, true);
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_READ, path);
+    while (offset < size) {
+        ssize_t result = pread(fd, data + offset, size - offset, (off_t)offset);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            hvsc_errno = HVSC_ERR_IO;
+            hvsc_free(data);
+            close(fd);
+            HVSC_TRACE_END(HVSC_TRACE_READ, offset, false);
+            return -1;
+        }
+        if (result == 0) {
+            /* file shrunk while reading */
+            break;
+        }
+        offset += (size_t)result;
+    }
+
+    close(fd);
+    *dest = data;
+    hvsc_stats_add_bytes(offset);
+    HVSC_TRACE_END(HVSC_TRACE_READ, offset, true);
+    return (long)offset;
+}
+
+
+/** \brief  Write all data described by \a iov to \a fd
+ *
+ * Calls writev(2) until all data has been written, advancing \a iov past the
+ * data written by short writes. The contents of \a iov are modified.
+ *
+ * \param[in]       fd      file descriptor
+ * \param[in,out]   iov     I/O vector
+ * \param[in]       count   number of elements in \a iov
+ *
+ * \return  bool
+ */
+bool hvsc_writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t result = writev(fd, iov, count);
+        size_t written;
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            hvsc_errno = HVSC_ERR_IO;
+            return false;
+        }
+
+        /* skip fully written vectors, adjust the partially written one */
+        written = (size_t)result;
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+
 /** \brief  Copy at most \a n chars of \a s
  *
  * This function appends a nul-byte after \a n bytes.
@@ -421,7 +726,7 @@ long hvsc_read_file(uint8_t **dest, const char *path)
  */
 char *hvsc_strndup(const char *s, size_t n)
 {
-    char *t = calloc(n + 1, 1);
+    char *t = hvsc_calloc(n + 1, 1);
 
     if (t == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
@@ -445,6 +750,30 @@ char *hvsc_strdup(const char *s)
     char *t;
     size_t len = strlen(s);
 
+    t = hvsc_malloc(len + 1);
+    if (t == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    memcpy(t, s, len + 1);
+    return t;
+}
+
+
+/** \brief  Create a copy of \a s to return to the caller of a public function
+ *
+ * Unlike hvsc_strdup(), the copy is allocated with malloc(3), so the caller
+ * can release it with free(3) whatever allocator the library uses.
+ *
+ * \param[in]   s   string to copy
+ *
+ * \return  copy of \a s or `NULL` on error
+ */
+char *hvsc_strdup_result(const char *s)
+{
+    char *t;
+    size_t len = strlen(s);
+
     t = malloc(len + 1);
     if (t == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
@@ -482,7 +811,7 @@ char *hvsc_paths_join(const char *p1, const char *p2)
     len1 = strlen(p1);
     len2 = strlen(p2);
 
-    result = malloc(len1 + len2 + 2);   /* +2 for / and '\0' */
+    result = hvsc_malloc(len1 + len2 + 2);   /* +2 for / and '\0' */
     if (result == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
         return NULL;
@@ -513,7 +842,7 @@ bool hvsc_set_paths(const char *path)
     /* set SLDB path */
     hvsc_sldb_path = hvsc_paths_join(hvsc_root_path, HVSC_SLDB_FILE);
     if (hvsc_sldb_path == NULL) {
-        free(hvsc_root_path);
+        hvsc_free(hvsc_root_path);
         hvsc_root_path = NULL;
         return false;
     }
@@ -521,8 +850,8 @@ bool hvsc_set_paths(const char *path)
     /* set STIL path */
     hvsc_stil_path = hvsc_paths_join(hvsc_root_path, HVSC_STIL_FILE);
     if (hvsc_stil_path == NULL) {
-        free(hvsc_root_path);
-        free(hvsc_sldb_path);
+        hvsc_free(hvsc_root_path);
+        hvsc_free(hvsc_sldb_path);
         hvsc_root_path = NULL;
         hvsc_sldb_path = NULL;
         return false;
@@ -531,9 +860,9 @@ bool hvsc_set_paths(const char *path)
     /* set BUGlist path */
     hvsc_bugs_path = hvsc_paths_join(hvsc_root_path, HVSC_BUGS_FILE);
     if (hvsc_bugs_path == NULL) {
-        free(hvsc_root_path);
-        free(hvsc_sldb_path);
-        free(hvsc_stil_path);
+        hvsc_free(hvsc_root_path);
+        hvsc_free(hvsc_sldb_path);
+        hvsc_free(hvsc_stil_path);
         hvsc_root_path = NULL;
         hvsc_sldb_path = NULL;
         hvsc_stil_path = NULL;
@@ -553,19 +882,19 @@ bool hvsc_set_paths(const char *path)
 void hvsc_free_paths(void)
 {
     if (hvsc_root_path != NULL) {
-        free(hvsc_root_path);
+        hvsc_free(hvsc_root_path);
         hvsc_root_path = NULL;
     }
     if (hvsc_sldb_path != NULL) {
-        free(hvsc_sldb_path);
+        hvsc_free(hvsc_sldb_path);
         hvsc_sldb_path = NULL;
     }
     if (hvsc_stil_path != NULL) {
-        free(hvsc_stil_path);
+        hvsc_free(hvsc_stil_path);
         hvsc_stil_path = NULL;
     }
     if (hvsc_bugs_path != NULL) {
-        free(hvsc_bugs_path);
+        hvsc_free(hvsc_bugs_path);
         hvsc_bugs_path = NULL;
     }
 }
@@ -591,7 +920,7 @@ char *hvsc_path_strip_root(const char *path)
 
     if (memcmp(path, hvsc_root_path, rlen) == 0) {
         /* got HSVC root path */
-        result = malloc(plen - rlen + 1);
+        result = hvsc_malloc(plen - rlen + 1);
         if (result == NULL) {
             hvsc_errno = HVSC_ERR_OOM;
             return NULL;
@@ -755,3 +1084,39 @@ void hvsc_get_longword_be(uint32_t *dest, const uint8_t *src)
 {
     *dest = (uint32_t)((src[0] << 24) + (src[1] << 16) + (src[2] << 8) + src[3]);
 }
+
+
+/** \brief  Calculate 64-bit hash of \a len bytes of \a data
+ *
+ * Processes eight bytes at a time, it's used for the content hashes of the
+ * index which cover the entire SLDB and STIL. Not suited for hash tables
+ * exposed to hostile input.
+ *
+ * \param[in]   data    data
+ * \param[in]   len     length of \a data
+ *
+ * \return  hash
+ */
+uint64_t hvsc_hash_bytes(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (uint64_t)len;
+    uint64_t w;
+
+    while (len >= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+        p += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        w = 0;
+        memcpy(&w, p, len);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    }
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
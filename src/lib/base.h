@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "hvsc_defs.h"
 
@@ -73,13 +75,22 @@ extern char *hvsc_stil_path;
 extern char *hvsc_bugs_path;
 
 char *      hvsc_strdup(const char *s);
+char *      hvsc_strdup_result(const char *s);
 char *      hvsc_strndup(const char *s, size_t n);
 char *      hvsc_paths_join(const char *p1, const char *p2);
 long        hvsc_read_file(uint8_t **dest, const char *path);
+long        hvsc_pread_file(uint8_t **dest, const char *path);
+long        hvsc_pread_file_stat(uint8_t **dest, const char *path,
+                                 struct stat *st);
+bool        hvsc_writev_all(int fd, struct iovec *iov, int count);
 bool        hvsc_set_paths(const char *path);
 void        hvsc_free_paths(void);
 void        hvsc_text_file_init_handle(hvsc_text_file_t *handle);
 bool        hvsc_text_file_open(const char *path, hvsc_text_file_t *handle);
+bool        hvsc_text_file_open_mem(const char *text, size_t size,
+                                    size_t offset, const char *name,
+                                    hvsc_text_file_t *handle);
+bool        hvsc_text_file_eof(const hvsc_text_file_t *handle);
 const char *hvsc_text_file_read(hvsc_text_file_t *handle);
 void        hvsc_text_file_close(hvsc_text_file_t *handle);
 
@@ -93,5 +104,6 @@ const char *hvsc_get_field_display(int type);
 void        hvsc_get_word_be(uint16_t *dest, const uint8_t *src);
 void        hvsc_get_word_le(uint16_t *dest, const uint8_t *src);
 void        hvsc_get_longword_be(uint32_t *dest, const uint8_t *src);
+uint64_t    hvsc_hash_bytes(const void *data, size_t len);
 
 #endif
@@ -0,0 +1,187 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/batch.c
+ * \brief   Batch loading of PSID files
+ *
+ * Opens a large number of PSID files using a pool of worker threads, so many
+ * open/read requests are in flight at the same time instead of handling the
+ * files one by one.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "pool.h"
+
+#include "batch.h"
+
+
+/** \brief  Shared state of a batch load
+ *
+ * \ingroup psid
+ */
+typedef struct batch_state_s {
+    hvsc_psid_batch_cb_t    callback;       /**< completion callback */
+    void *                  data;           /**< user data for \a callback */
+    bool                    header_only;    /**< only load headers */
+    pthread_mutex_t         lock;           /**< serializes \a callback calls */
+} batch_state_t;
+
+
+/** \brief  Single file to load in a batch
+ *
+ * \ingroup psid
+ */
+typedef struct batch_item_s {
+    batch_state_t * state;  /**< shared state */
+    const char *    path;   /**< path to PSID file */
+    size_t          index;  /**< index of \a path in the caller's list */
+} batch_item_t;
+
+
+/** \brief  Worker job: load a single PSID file and report back
+ *
+ * \param[in]   arg batch item
+ *
+ * \ingroup psid
+ */
+static void batch_load_item(void *arg)
+{
+    batch_item_t *item = arg;
+    batch_state_t *state = item->state;
+    hvsc_psid_t handle;
+    bool keep = false;
+    bool ok;
+    int err = 0;
+
+    hvsc_errno = 0;
+    if (state->header_only) {
+        ok = hvsc_psid_open_header(item->path, &handle);
+    } else {
+        ok = hvsc_psid_open(item->path, &handle);
+    }
+    if (!ok) {
+        err = hvsc_errno != 0 ? hvsc_errno : HVSC_ERR_IO;
+    }
+
+    pthread_mutex_lock(&(state->lock));
+    keep = state->callback(item->index, item->path,
+                           err == 0 ? &handle : NULL, err, state->data);
+    pthread_mutex_unlock(&(state->lock));
+
+    if (err == 0 && !keep) {
+        hvsc_psid_close(&handle);
+    }
+}
+
+
+/** \brief  Open a list of PSID files using multiple threads
+ *
+ * Each file in \a paths is opened with hvsc_psid_open() (or with
+ * hvsc_psid_open_header() when \a header_only is `true`) on one of \a threads
+ * worker threads. When a file has been loaded (or failed to load), \a callback
+ * is called with its index in \a paths, its path, the PSID handle and an
+ * error code (0 on success, one of the hvsc_err_t values on failure, in which
+ * case the handle is `NULL`).
+ *
+ * Calls of \a callback are serialized, so the callback doesn't need to do its
+ * own locking, but the order in which files are reported is undefined. The
+ * handle passed to \a callback is only valid during the call: when the
+ * callback wants to keep the data it can copy the handle struct and return
+ * `true`, after which it is responsible for calling hvsc_psid_close() on the
+ * copy. When the callback returns `false` the handle is closed by the loader.
+ *
+ * This function returns when all files have been reported.
+ *
+ * \param[in]   paths       list of paths to PSID files
+ * \param[in]   count       number of elements in \a paths
+ * \param[in]   threads     number of worker threads (<= 0 for the default)
+ * \param[in]   header_only only read the headers, not the payloads
+ * \param[in]   callback    completion callback
+ * \param[in]   data        user data passed to \a callback
+ *
+ * \return  bool (false means the batch couldn't be started, individual file
+ *          errors are reported via \a callback)
+ *
+ * \ingroup psid
+ */
+bool hvsc_psid_batch_load(const char **paths, size_t count, int threads,
+                          bool header_only,
+                          hvsc_psid_batch_cb_t callback, void *data)
+{
+    hvsc_pool_t pool;
+    batch_state_t state;
+    batch_item_t *items;
+    size_t i;
+
+    if (count == 0) {
+        return true;
+    }
+    if (threads <= 0) {
+        threads = HVSC_PSID_BATCH_THREADS;
+    }
+    if ((size_t)threads > count) {
+        threads = (int)count;
+    }
+
+    items = hvsc_malloc(count * sizeof *items);
+    if (items == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    state.callback = callback;
+    state.data = data;
+    state.header_only = header_only;
+    pthread_mutex_init(&(state.lock), NULL);
+
+    if (!hvsc_pool_init(&pool, threads)) {
+        pthread_mutex_destroy(&(state.lock));
+        hvsc_free(items);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        items[i].state = &state;
+        items[i].path = paths[i];
+        items[i].index = i;
+        if (!hvsc_pool_submit(&pool, batch_load_item, &(items[i]))) {
+            /* run the rest on this thread */
+            batch_load_item(&(items[i]));
+        }
+    }
+
+    hvsc_pool_wait(&pool);
+    hvsc_pool_free(&pool);
+    pthread_mutex_destroy(&(state.lock));
+    hvsc_free(items);
+    return true;
+}
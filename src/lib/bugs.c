@@ -38,6 +38,12 @@
 
 #include "hvsc_defs.h"
 #include "base.h"
+#include "alloc.h"
+#include "index.h"
+#include "stats.h"
+#include "trace.h"
+#include "record.h"
+#include "client.h"
 
 #include "bugs.h"
 
@@ -64,10 +70,10 @@ static void bugs_free_handle(hvsc_bugs_t *handle)
 {
     hvsc_text_file_close(&(handle->bugs));
     if (handle->text != NULL) {
-        free(handle->text);
+        hvsc_free(handle->text);
     }
     if (handle->user != NULL) {
-        free(handle->user);
+        hvsc_free(handle->user);
     }
 }
 
@@ -78,7 +84,7 @@ static void bugs_free_handle(hvsc_bugs_t *handle)
  *
  * \return  bool
  */
-static bool bugs_parse(hvsc_bugs_t *handle)
+static bool bugs_parse_entry(hvsc_bugs_t *handle)
 {
     const char *line;
     char *bug;
@@ -106,7 +112,7 @@ static bool bugs_parse(hvsc_bugs_t *handle)
         line = hvsc_text_file_read(&(handle->bugs));
         if (line == NULL) {
             /* not supposed to happen */
-            free(bug);
+            hvsc_free(bug);
             return false;
         }
 
@@ -117,10 +123,10 @@ static bool bugs_parse(hvsc_bugs_t *handle)
 
             /* strip off 8 spaces, leaving one to add to the result */
             len = strlen(line) - 8;
-            tmp = realloc(bug, strlen(bug) + len + 1);
+            tmp = hvsc_realloc(bug, strlen(bug) + len + 1);
             if (tmp == NULL) {
                 hvsc_errno = HVSC_ERR_OOM;
-                free(bug);
+                hvsc_free(bug);
                 return false;
             }
             bug = tmp;
@@ -131,7 +137,7 @@ static bool bugs_parse(hvsc_bugs_t *handle)
             /* assume (user) field */
             handle->user = hvsc_strdup(line);
             if (handle->user == NULL) {
-                free(handle->text);
+                hvsc_free(handle->text);
                 handle->text = NULL;
                 return false;
             }
@@ -142,17 +148,134 @@ static bool bugs_parse(hvsc_bugs_t *handle)
 }
 
 
-/** \brief  Open BUGlist and search for file \a psid
+/** \brief  Parse the entry at the current position of \a handle, tracing it
+ *
+ * \param[in,out]   handle  BUGlist handle
+ *
+ * \return  bool
+ */
+static bool bugs_parse(hvsc_bugs_t *handle)
+{
+    size_t start = handle->bugs.bytes;
+    bool result;
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_PARSE, handle->psid_path);
+    result = bugs_parse_entry(handle);
+    HVSC_TRACE_END(HVSC_TRACE_PARSE, handle->bugs.bytes - start, result);
+    return result;
+}
+
+
+/** \brief  Look up PSID file \a psid in the index and parse its BUGlist entry
+ *
+ * The entry is read from the BUGlist text in memory. \a psid can be outside
+ * the HVSC, in which case its digest is used to find the entry and the path
+ * in \a handle is set to the path in the HVSC. The reference to \a index is
+ * handed over to \a handle.
+ *
+ * \param[in]       index   index, referenced by the caller
+ * \param[in]       psid    path to PSID file
+ * \param[in,out]   handle  BUGlist handle
+ *
+ * \return  bool
+ */
+static bool bugs_open_indexed(hvsc_index_t *index, const char *psid,
+                              hvsc_bugs_t *handle)
+{
+    long tune;
+
+    tune = hvsc_index_find_psid(index, psid);
+    if (tune < 0 || index->bugs[tune] == HVSC_INDEX_NONE) {
+        hvsc_errno = HVSC_ERR_NOT_FOUND;
+        hvsc_index_release(index);
+        return false;
+    }
+    handle->psid_path = hvsc_index_path(index, (size_t)tune);
+    if (handle->psid_path == NULL
+            || !hvsc_text_file_open_mem(index->bugs_text, index->bugs_size,
+                                        index->bugs[tune], hvsc_bugs_path,
+                                        &(handle->bugs))) {
+        hvsc_index_release(index);
+        hvsc_bugs_close(handle);
+        return false;
+    }
+    handle->bugs.index = index;
+    if (!bugs_parse(handle)) {
+        hvsc_bugs_close(handle);
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Get the BUGlist entry of PSID file \a psid from hvscd
+ *
+ * The daemon sends the path of the tune, the bug text and the user, each
+ * nul-terminated except for the last.
+ *
+ * \param[in]       psid    path to PSID file
+ * \param[in,out]   handle  BUGlist handle
+ *
+ * \return  bool
+ */
+static bool bugs_open_client(const char *psid, hvsc_bugs_t *handle)
+{
+    char *body;
+    const char *text;
+    const char *user;
+    size_t size;
+
+    body = hvsc_client_lookup(HVSC_PROTO_BUGS, psid, NULL, &size);
+    if (body == NULL) {
+        return false;
+    }
+    text = body + strlen(body) + 1;
+    if (text > body + size) {
+        hvsc_free(body);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    user = text + strlen(text) + 1;
+    if (user > body + size) {
+        hvsc_free(body);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    handle->psid_path = hvsc_strdup(body);
+    handle->text = hvsc_strdup(text);
+    handle->user = hvsc_strdup(user);
+    hvsc_free(body);
+    if (handle->psid_path == NULL || handle->text == NULL
+            || handle->user == NULL) {
+        hvsc_bugs_close(handle);
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Open BUGlist and parse the entry of \a psid (untimed)
  *
  * \param[in]       psid    absolute path to PSID file
  * \param[in,out]   handle  BUGlist handle
  *
  * \return  bool
  */
-bool hvsc_bugs_open(const char *psid, hvsc_bugs_t *handle)
+static bool bugs_open(const char *psid, hvsc_bugs_t *handle)
 {
+    hvsc_index_t *index;
+
     bugs_init_handle(handle);
 
+    if (HVSC_CLIENT_ACTIVE()) {
+        return bugs_open_client(psid, handle);
+    }
+
+    index = hvsc_index_acquire();
+    if (index != NULL) {
+        return bugs_open_indexed(index, psid, handle);
+    }
+
     /* open BUGlist.txt */
     if (!hvsc_text_file_open(hvsc_bugs_path, &(handle->bugs))) {
         return false;
@@ -167,15 +290,17 @@ bool hvsc_bugs_open(const char *psid, hvsc_bugs_t *handle)
     }
 
     /* find the entry */
+    HVSC_TRACE_BEGIN(HVSC_TRACE_SCAN, hvsc_bugs_path);
     while (true) {
         const char *line;
 
         line = hvsc_text_file_read(&(handle->bugs));
         if (line == NULL) {
-            if (feof(handle->bugs.fp)) {
+            if (hvsc_text_file_eof(&(handle->bugs))) {
                 /* EOF, so simply not found */
                 hvsc_errno = HVSC_ERR_NOT_FOUND;
             }
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle->bugs.bytes, false);
             hvsc_bugs_close(handle);
             /* I/O error is already set */
             return false;
@@ -183,7 +308,12 @@ bool hvsc_bugs_open(const char *psid, hvsc_bugs_t *handle)
 
         if (strcmp(line, handle->psid_path) == 0) {
             hvsc_dbg("Found '%s' at line %ld\n", line, handle->bugs.lineno);
-            return bugs_parse(handle);
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle->bugs.bytes, true);
+            if (!bugs_parse(handle)) {
+                hvsc_bugs_close(handle);
+                return false;
+            }
+            return true;
         }
     }
 
@@ -194,6 +324,26 @@ bool hvsc_bugs_open(const char *psid, hvsc_bugs_t *handle)
 }
 
 
+/** \brief  Open BUGlist and search for file \a psid
+ *
+ * \param[in]       psid    absolute path to PSID file
+ * \param[in,out]   handle  BUGlist handle
+ *
+ * \return  bool
+ */
+bool hvsc_bugs_open(const char *psid, hvsc_bugs_t *handle)
+{
+    hvsc_stats_timer_t timer;
+    bool result;
+
+    HVSC_RECORD_PATH(HVSC_OP_BUGS_OPEN, psid);
+    hvsc_stats_begin(&timer, HVSC_STATS_BUGS);
+    result = bugs_open(psid, handle);
+    hvsc_stats_end(&timer, result);
+    return result;
+}
+
+
 /** \brief  Clean up memory used by the members of \a handle
  *
  * \param[in,out]   handle  BUGlist handle
@@ -202,6 +352,6 @@ void hvsc_bugs_close(hvsc_bugs_t *handle)
 {
     bugs_free_handle(handle);
     if (handle->psid_path != NULL) {
-        free(handle->psid_path);
+        hvsc_free(handle->psid_path);
     }
 }
@@ -0,0 +1,1263 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/catalog.c
+ * \brief   PSID header catalog
+ *
+ * Crawls a directory tree (usually the entire HVSC) for PSID files and stores
+ * their header data in a 'struct of arrays' catalog: one array per header
+ * field, with the text fields interned into a single string pool.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "pool.h"
+
+#include "catalog.h"
+
+
+/** \brief  Shared state of the crawler
+ *
+ * \ingroup catalog
+ */
+typedef struct crawl_state_s {
+    hvsc_catalog_t *    catalog;    /**< catalog to add rows to */
+    hvsc_pool_t         pool;       /**< worker threads */
+    pthread_mutex_t     lock;       /**< lock for \a catalog and \a error */
+    size_t              root_len;   /**< length of the root path */
+    int                 error;      /**< first fatal error (OOM) */
+    hvsc_catalog_skipped_t *skipped;    /**< unreadable PSID files (can be
+                                             `NULL`) */
+} crawl_state_t;
+
+
+/** \brief  Directory job for the crawler
+ *
+ * \ingroup catalog
+ */
+typedef struct crawl_dir_s {
+    crawl_state_t * state;  /**< shared state */
+    char *          path;   /**< absolute path of the directory */
+} crawl_dir_t;
+
+
+/** \brief  Calculate FNV-1a hash of \a s
+ *
+ * \param[in]   s   string
+ *
+ * \return  hash
+ */
+static uint32_t catalog_hash(const char *s)
+{
+    uint32_t h = 2166136261U;
+
+    while (*s != '\0') {
+        h ^= (uint8_t)*s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+
+/** \brief  Append \a s to the string pool of \a catalog
+ *
+ * \param[in,out]   catalog catalog
+ * \param[in]       s       string
+ *
+ * \return  offset of the string in the pool, or `HVSC_CATALOG_NONE` on error
+ */
+static uint32_t catalog_pool_add(hvsc_catalog_t *catalog, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    uint32_t offset;
+
+    if (catalog->strings_size + len > UINT32_MAX) {
+        hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
+        return HVSC_CATALOG_NONE;
+    }
+
+    if (catalog->strings_size + len > catalog->strings_max) {
+        size_t max = catalog->strings_max * 2;
+        char *tmp;
+
+        while (catalog->strings_size + len > max) {
+            max *= 2;
+        }
+        tmp = hvsc_realloc(catalog->strings, max);
+        if (tmp == NULL) {
+            hvsc_errno = HVSC_ERR_OOM;
+            return HVSC_CATALOG_NONE;
+        }
+        catalog->strings = tmp;
+        catalog->strings_max = max;
+    }
+
+    offset = (uint32_t)catalog->strings_size;
+    memcpy(catalog->strings + offset, s, len);
+    catalog->strings_size += len;
+    return offset;
+}
+
+
+/** \brief  Resize the intern table of \a catalog to \a size slots
+ *
+ * \param[in,out]   catalog catalog
+ * \param[in]       size    new number of slots (power of two)
+ *
+ * \return  bool
+ */
+static bool catalog_intern_resize(hvsc_catalog_t *catalog, size_t size)
+{
+    uint32_t *slots;
+    size_t i;
+
+    slots = hvsc_malloc(size * sizeof *slots);
+    if (slots == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    for (i = 0; i < size; i++) {
+        slots[i] = HVSC_CATALOG_NONE;
+    }
+
+    /* rehash existing strings */
+    for (i = 0; i < catalog->intern_size; i++) {
+        uint32_t offset = catalog->intern[i];
+        if (offset != HVSC_CATALOG_NONE) {
+            size_t s = catalog_hash(catalog->strings + offset) & (size - 1);
+            while (slots[s] != HVSC_CATALOG_NONE) {
+                s = (s + 1) & (size - 1);
+            }
+            slots[s] = offset;
+        }
+    }
+
+    hvsc_free(catalog->intern);
+    catalog->intern = slots;
+    catalog->intern_size = size;
+    return true;
+}
+
+
+/** \brief  Intern string \a s in \a catalog
+ *
+ * Identical strings (author names, copyright strings) are only stored once.
+ *
+ * \param[in,out]   catalog catalog
+ * \param[in]       s       string
+ *
+ * \return  offset of the string in the pool, or `HVSC_CATALOG_NONE` on error
+ */
+static uint32_t catalog_intern(hvsc_catalog_t *catalog, const char *s)
+{
+    size_t slot;
+    uint32_t offset;
+
+    /* keep load factor below 50% */
+    if ((catalog->intern_used + 1) * 2 > catalog->intern_size) {
+        if (!catalog_intern_resize(catalog, catalog->intern_size * 2)) {
+            return HVSC_CATALOG_NONE;
+        }
+    }
+
+    slot = catalog_hash(s) & (catalog->intern_size - 1);
+    while (catalog->intern[slot] != HVSC_CATALOG_NONE) {
+        if (strcmp(catalog->strings + catalog->intern[slot], s) == 0) {
+            return catalog->intern[slot];
+        }
+        slot = (slot + 1) & (catalog->intern_size - 1);
+    }
+
+    offset = catalog_pool_add(catalog, s);
+    if (offset != HVSC_CATALOG_NONE) {
+        catalog->intern[slot] = offset;
+        catalog->intern_used++;
+    }
+    return offset;
+}
+
+
+/** \brief  Resize the columns of \a catalog to hold \a max rows
+ *
+ * \param[in,out]   catalog catalog
+ * \param[in]       max     new number of rows
+ *
+ * \return  bool
+ */
+static bool catalog_resize(hvsc_catalog_t *catalog, size_t max)
+{
+    void *tmp;
+
+#define CATALOG_RESIZE_COLUMN(col) \
+    tmp = hvsc_realloc(catalog->col, max * sizeof *(catalog->col)); \
+    if (tmp == NULL) { \
+        hvsc_errno = HVSC_ERR_OOM; \
+        return false; \
+    } \
+    catalog->col = tmp;
+
+    CATALOG_RESIZE_COLUMN(path);
+    CATALOG_RESIZE_COLUMN(name);
+    CATALOG_RESIZE_COLUMN(author);
+    CATALOG_RESIZE_COLUMN(copyright);
+    CATALOG_RESIZE_COLUMN(version);
+    CATALOG_RESIZE_COLUMN(load_address);
+    CATALOG_RESIZE_COLUMN(init_address);
+    CATALOG_RESIZE_COLUMN(play_address);
+    CATALOG_RESIZE_COLUMN(songs);
+    CATALOG_RESIZE_COLUMN(start_song);
+    CATALOG_RESIZE_COLUMN(speed);
+    CATALOG_RESIZE_COLUMN(flags);
+    CATALOG_RESIZE_COLUMN(models);
+    CATALOG_RESIZE_COLUMN(second_sid);
+    CATALOG_RESIZE_COLUMN(third_sid);
+
+#undef CATALOG_RESIZE_COLUMN
+
+    catalog->max = max;
+    return true;
+}
+
+
+/** \brief  Add a row for PSID \a handle to \a catalog
+ *
+ * \param[in,out]   catalog catalog
+ * \param[in]       path    path relative to the catalog root
+ * \param[in]       handle  PSID handle
+ *
+ * \return  bool
+ */
+static bool catalog_add_row(hvsc_catalog_t *catalog,
+                            const char *path,
+                            const hvsc_psid_t *handle)
+{
+    size_t row = catalog->count;
+
+    if (row == catalog->max) {
+        if (!catalog_resize(catalog, catalog->max * 2)) {
+            return false;
+        }
+    }
+
+    /* paths are unique, so don't bother interning them */
+    catalog->path[row] = catalog_pool_add(catalog, path);
+    catalog->name[row] = catalog_intern(catalog, handle->name);
+    catalog->author[row] = catalog_intern(catalog, handle->author);
+    catalog->copyright[row] = catalog_intern(catalog, handle->copyright);
+    if (catalog->path[row] == HVSC_CATALOG_NONE
+            || catalog->name[row] == HVSC_CATALOG_NONE
+            || catalog->author[row] == HVSC_CATALOG_NONE
+            || catalog->copyright[row] == HVSC_CATALOG_NONE) {
+        return false;
+    }
+
+    catalog->version[row] = handle->version;
+    catalog->load_address[row] = handle->load_address;
+    catalog->init_address[row] = handle->init_address;
+    catalog->play_address[row] = handle->play_address;
+    catalog->songs[row] = handle->songs;
+    catalog->start_song[row] = handle->start_song;
+    catalog->speed[row] = handle->speed;
+    catalog->flags[row] = handle->flags;
+    catalog->models[row] = (uint8_t)(hvsc_psid_get_model_id(handle, 1)
+            | (hvsc_psid_get_model_id(handle, 2) << 2)
+            | (hvsc_psid_get_model_id(handle, 3) << 4));
+    catalog->second_sid[row] = handle->second_sid;
+    catalog->third_sid[row] = handle->third_sid;
+
+    catalog->count++;
+    return true;
+}
+
+
+/** \brief  Check if \a name has a .sid extension
+ *
+ * \param[in]   name    file name
+ *
+ * \return  bool
+ */
+static bool crawl_is_sid_file(const char *name)
+{
+    size_t len = strlen(name);
+
+    return len > 4 && strcasecmp(name + len - 4, ".sid") == 0;
+}
+
+
+/** \brief  Record fatal error \a err in the crawler \a state
+ *
+ * \param[in,out]   state   crawler state
+ * \param[in]       err     error code
+ */
+static void crawl_set_error(crawl_state_t *state, int err)
+{
+    pthread_mutex_lock(&(state->lock));
+    if (state->error == 0) {
+        state->error = err;
+    }
+    pthread_mutex_unlock(&(state->lock));
+}
+
+
+/** \brief  Add \a path to the skipped PSID files of \a state
+ *
+ * \param[in,out]   state   crawler state
+ * \param[in]       path    absolute path of the PSID file
+ */
+static void crawl_add_skipped(crawl_state_t *state, const char *path)
+{
+    hvsc_catalog_skipped_t *skipped = state->skipped;
+    char *rel;
+
+    if (skipped == NULL) {
+        return;
+    }
+    rel = hvsc_strdup(path + state->root_len);
+    if (rel == NULL) {
+        crawl_set_error(state, HVSC_ERR_OOM);
+        return;
+    }
+
+    pthread_mutex_lock(&(state->lock));
+    if (skipped->count == skipped->max) {
+        size_t max = skipped->max > 0 ? skipped->max * 2 : 16;
+        char **tmp = hvsc_realloc(skipped->paths, max * sizeof *tmp);
+
+        if (tmp == NULL) {
+            pthread_mutex_unlock(&(state->lock));
+            hvsc_free(rel);
+            crawl_set_error(state, HVSC_ERR_OOM);
+            return;
+        }
+        skipped->paths = tmp;
+        skipped->max = max;
+    }
+    skipped->paths[skipped->count++] = rel;
+    pthread_mutex_unlock(&(state->lock));
+}
+
+
+static void crawl_dir(void *arg);
+
+
+/** \brief  Queue directory \a path for crawling
+ *
+ * \param[in,out]   state   crawler state
+ * \param[in]       path    absolute path of directory (taken over)
+ *
+ * \return  bool
+ */
+static bool crawl_submit_dir(crawl_state_t *state, char *path)
+{
+    crawl_dir_t *job = hvsc_malloc(sizeof *job);
+
+    if (job == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        hvsc_free(path);
+        return false;
+    }
+    job->state = state;
+    job->path = path;
+    if (!hvsc_pool_submit(&(state->pool), crawl_dir, job)) {
+        hvsc_free(path);
+        hvsc_free(job);
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Worker job: crawl a single directory
+ *
+ * Subdirectories are submitted as new jobs, PSID files in the directory are
+ * parsed and added to the catalog.
+ *
+ * \param[in]   arg directory job
+ */
+static void crawl_dir(void *arg)
+{
+    crawl_dir_t *job = arg;
+    crawl_state_t *state = job->state;
+    DIR *dir;
+    struct dirent *ent;
+
+    dir = opendir(job->path);
+    if (dir == NULL) {
+        hvsc_dbg("failed to open '%s'\n", job->path);
+        hvsc_free(job->path);
+        hvsc_free(job);
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        char *path;
+        bool is_dir;
+        bool is_file;
+
+        if (ent->d_name[0] == '.') {
+            /* skip '.', '..' and hidden files */
+            continue;
+        }
+
+        path = hvsc_paths_join(job->path, ent->d_name);
+        if (path == NULL) {
+            crawl_set_error(state, HVSC_ERR_OOM);
+            break;
+        }
+
+        /* symlinks are skipped: following them can loop or crawl parts of
+         * the tree more than once */
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (ent->d_type != DT_UNKNOWN) {
+            is_dir = ent->d_type == DT_DIR;
+            is_file = ent->d_type == DT_REG;
+        } else
+#endif
+        {
+            struct stat st;
+
+            if (lstat(path, &st) != 0) {
+                hvsc_free(path);
+                continue;
+            }
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode);
+        }
+
+        if (is_dir) {
+            if (!crawl_submit_dir(state, path)) {
+                crawl_set_error(state, hvsc_errno);
+                break;
+            }
+        } else if (is_file && crawl_is_sid_file(ent->d_name)) {
+            hvsc_psid_t handle;
+
+            if (hvsc_psid_open_header(path, &handle)) {
+                bool ok;
+
+                pthread_mutex_lock(&(state->lock));
+                ok = catalog_add_row(state->catalog, path + state->root_len,
+                                     &handle);
+                if (!ok && state->error == 0) {
+                    state->error = hvsc_errno;
+                }
+                pthread_mutex_unlock(&(state->lock));
+                hvsc_psid_close(&handle);
+            } else {
+                hvsc_dbg("skipping '%s': %s\n",
+                         path, hvsc_strerror(hvsc_errno));
+                crawl_add_skipped(state, path);
+            }
+            hvsc_free(path);
+        } else {
+            hvsc_free(path);
+        }
+    }
+
+    closedir(dir);
+    hvsc_free(job->path);
+    hvsc_free(job);
+}
+
+
+/** \brief  Entry used to sort the catalog rows on path
+ */
+typedef struct catalog_sort_s {
+    const char *    path;   /**< path of the row */
+    size_t          row;    /**< row index */
+} catalog_sort_t;
+
+
+/** \brief  Compare function for qsort()
+ *
+ * \param[in]   p1  first sort entry
+ * \param[in]   p2  second sort entry
+ *
+ * \return  <0, 0 or >0
+ */
+static int catalog_sort_cmp(const void *p1, const void *p2)
+{
+    const catalog_sort_t *s1 = p1;
+    const catalog_sort_t *s2 = p2;
+
+    return strcmp(s1->path, s2->path);
+}
+
+
+/** \brief  Sort the rows in \a catalog on path
+ *
+ * The crawler adds rows in whatever order the worker threads finish, sorting
+ * makes the result deterministic and allows binary search on path.
+ *
+ * \param[in,out]   catalog catalog
+ *
+ * \return  bool
+ */
+static bool catalog_sort(hvsc_catalog_t *catalog)
+{
+    catalog_sort_t *order;
+    size_t i;
+    void *tmp;
+
+    if (catalog->count < 2) {
+        return true;
+    }
+
+    order = hvsc_malloc(catalog->count * sizeof *order);
+    if (order == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    for (i = 0; i < catalog->count; i++) {
+        order[i].path = catalog->strings + catalog->path[i];
+        order[i].row = i;
+    }
+    qsort(order, catalog->count, sizeof *order, catalog_sort_cmp);
+
+#define CATALOG_PERMUTE_COLUMN(col, type) \
+    tmp = hvsc_malloc(catalog->max * sizeof(type)); \
+    if (tmp == NULL) { \
+        hvsc_errno = HVSC_ERR_OOM; \
+        hvsc_free(order); \
+        return false; \
+    } \
+    for (i = 0; i < catalog->count; i++) { \
+        ((type *)tmp)[i] = catalog->col[order[i].row]; \
+    } \
+    hvsc_free(catalog->col); \
+    catalog->col = tmp;
+
+    CATALOG_PERMUTE_COLUMN(path, uint32_t);
+    CATALOG_PERMUTE_COLUMN(name, uint32_t);
+    CATALOG_PERMUTE_COLUMN(author, uint32_t);
+    CATALOG_PERMUTE_COLUMN(copyright, uint32_t);
+    CATALOG_PERMUTE_COLUMN(version, uint16_t);
+    CATALOG_PERMUTE_COLUMN(load_address, uint16_t);
+    CATALOG_PERMUTE_COLUMN(init_address, uint16_t);
+    CATALOG_PERMUTE_COLUMN(play_address, uint16_t);
+    CATALOG_PERMUTE_COLUMN(songs, uint16_t);
+    CATALOG_PERMUTE_COLUMN(start_song, uint16_t);
+    CATALOG_PERMUTE_COLUMN(speed, uint32_t);
+    CATALOG_PERMUTE_COLUMN(flags, uint16_t);
+    CATALOG_PERMUTE_COLUMN(models, uint8_t);
+    CATALOG_PERMUTE_COLUMN(second_sid, uint16_t);
+    CATALOG_PERMUTE_COLUMN(third_sid, uint16_t);
+
+#undef CATALOG_PERMUTE_COLUMN
+
+    hvsc_free(order);
+    return true;
+}
+
+
+/** \brief  Initialize \a catalog
+ *
+ * All members are set to 0/`NULL`, call this before hvsc_catalog_free() can
+ * safely be used on a catalog that wasn't built.
+ *
+ * \param[out]  catalog catalog
+ *
+ * \ingroup catalog
+ */
+void hvsc_catalog_init(hvsc_catalog_t *catalog)
+{
+    memset(catalog, 0, sizeof *catalog);
+}
+
+
+/** \brief  Compare function for qsort() on an array of strings
+ *
+ * \param[in]   p1  first string pointer
+ * \param[in]   p2  second string pointer
+ *
+ * \return  <0, 0 or >0
+ */
+static int catalog_skipped_cmp(const void *p1, const void *p2)
+{
+    return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+
+/** \brief  Crawl \a root for PSID files and build a catalog of their headers
+ *
+ * Like hvsc_catalog_build(), but the paths of the .sid files that couldn't be
+ * opened or parsed are stored in \a skipped, sorted, instead of being dropped
+ * silently.
+ *
+ * \param[out]  catalog catalog, free with hvsc_catalog_free()
+ * \param[in]   root    directory to crawl (usually the HVSC root)
+ * \param[in]   threads number of worker threads (<= 0 for the default)
+ * \param[out]  skipped skipped PSID files, free with
+ *                      hvsc_catalog_skipped_free() (can be `NULL`)
+ *
+ * \return  bool
+ *
+ * \ingroup catalog
+ */
+bool hvsc_catalog_crawl(hvsc_catalog_t *catalog, const char *root,
+                        int threads, hvsc_catalog_skipped_t *skipped)
+{
+    crawl_state_t state;
+    size_t root_len;
+    char *path;
+
+    hvsc_catalog_init(catalog);
+    if (skipped != NULL) {
+        memset(skipped, 0, sizeof *skipped);
+    }
+
+    /* strip trailing separators from root */
+    root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') {
+        root_len--;
+    }
+    path = hvsc_strndup(root, root_len);
+    if (path == NULL) {
+        return false;
+    }
+
+    catalog->strings = hvsc_malloc(HVSC_CATALOG_STRINGS_INIT);
+    if (catalog->strings == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        hvsc_free(path);
+        return false;
+    }
+    catalog->strings_max = HVSC_CATALOG_STRINGS_INIT;
+    if (!catalog_resize(catalog, HVSC_CATALOG_ROWS_INIT)
+            || !catalog_intern_resize(catalog, HVSC_CATALOG_INTERN_INIT)) {
+        hvsc_catalog_free(catalog);
+        hvsc_free(path);
+        return false;
+    }
+
+    state.catalog = catalog;
+    state.root_len = root_len;
+    state.error = 0;
+    state.skipped = skipped;
+    pthread_mutex_init(&(state.lock), NULL);
+    if (!hvsc_pool_init(&(state.pool), threads)) {
+        pthread_mutex_destroy(&(state.lock));
+        hvsc_catalog_free(catalog);
+        hvsc_free(path);
+        return false;
+    }
+
+    if (crawl_submit_dir(&state, path)) {
+        hvsc_pool_wait(&(state.pool));
+    } else {
+        state.error = hvsc_errno;
+    }
+    hvsc_pool_free(&(state.pool));
+    pthread_mutex_destroy(&(state.lock));
+
+    if (state.error != 0) {
+        hvsc_errno = state.error;
+        hvsc_catalog_free(catalog);
+        if (skipped != NULL) {
+            hvsc_catalog_skipped_free(skipped);
+        }
+        return false;
+    }
+    if (!catalog_sort(catalog)) {
+        hvsc_catalog_free(catalog);
+        if (skipped != NULL) {
+            hvsc_catalog_skipped_free(skipped);
+        }
+        return false;
+    }
+    if (skipped != NULL && skipped->count > 1) {
+        qsort(skipped->paths, skipped->count, sizeof *(skipped->paths),
+              catalog_skipped_cmp);
+    }
+    hvsc_dbg("got %zu rows, %zu bytes of strings\n",
+            catalog->count, catalog->strings_size);
+    return true;
+}
+
+
+/** \brief  Free memory used by the members of \a skipped
+ *
+ * \param[in,out]   skipped skipped PSID files
+ *
+ * \ingroup catalog
+ */
+void hvsc_catalog_skipped_free(hvsc_catalog_skipped_t *skipped)
+{
+    size_t i;
+
+    for (i = 0; i < skipped->count; i++) {
+        hvsc_free(skipped->paths[i]);
+    }
+    hvsc_free(skipped->paths);
+    memset(skipped, 0, sizeof *skipped);
+}
+
+
+/** \brief  Crawl \a root for PSID files and build a catalog of their headers
+ *
+ * Walks the directory tree below \a root using \a threads worker threads,
+ * each handling a directory at a time. Every file with a .sid extension and
+ * a valid PSID/RSID header gets a row in the catalog, files that fail to
+ * parse are skipped. The rows are sorted on path, which is stored relative to
+ * \a root, with a leading '/', like the paths in the SLDB and STIL. Symbolic
+ * links below \a root are not followed.
+ *
+ * \param[out]  catalog catalog, free with hvsc_catalog_free()
+ * \param[in]   root    directory to crawl (usually the HVSC root)
+ * \param[in]   threads number of worker threads (<= 0 for the default)
+ *
+ * \return  bool
+ *
+ * \ingroup catalog
+ */
+bool hvsc_catalog_build(hvsc_catalog_t *catalog, const char *root, int threads)
+{
+    return hvsc_catalog_crawl(catalog, root, threads, NULL);
+}
+
+
+/** \brief  Free memory used by the members of \a catalog
+ *
+ * \param[in,out]   catalog catalog
+ *
+ * \ingroup catalog
+ */
+void hvsc_catalog_free(hvsc_catalog_t *catalog)
+{
+    if (catalog->map != NULL) {
+        /* loaded with hvsc_catalog_load(): columns point into the mapping */
+        munmap(catalog->map, catalog->map_size);
+        hvsc_catalog_init(catalog);
+        return;
+    }
+
+    hvsc_free(catalog->path);
+    hvsc_free(catalog->name);
+    hvsc_free(catalog->author);
+    hvsc_free(catalog->copyright);
+    hvsc_free(catalog->version);
+    hvsc_free(catalog->load_address);
+    hvsc_free(catalog->init_address);
+    hvsc_free(catalog->play_address);
+    hvsc_free(catalog->songs);
+    hvsc_free(catalog->start_song);
+    hvsc_free(catalog->speed);
+    hvsc_free(catalog->flags);
+    hvsc_free(catalog->models);
+    hvsc_free(catalog->second_sid);
+    hvsc_free(catalog->third_sid);
+    hvsc_free(catalog->strings);
+    hvsc_free(catalog->intern);
+    hvsc_catalog_init(catalog);
+}
+
+
+/** \brief  Find the row of PSID file \a path in \a catalog
+ *
+ * \param[in]   catalog catalog
+ * \param[in]   path    path relative to the catalog root (ie "/MUSICIANS/..")
+ *
+ * \return  row index or -1 when not found
+ *
+ * \ingroup catalog
+ */
+long hvsc_catalog_find(const hvsc_catalog_t *catalog, const char *path)
+{
+    size_t lo = 0;
+    size_t hi = catalog->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int result = strcmp(catalog->strings + catalog->path[mid], path);
+
+        if (result == 0) {
+            return (long)mid;
+        } else if (result < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    hvsc_errno = HVSC_ERR_NOT_FOUND;
+    return -1;
+}
+
+
+/** \brief  Get string at \a offset in the string pool of \a catalog
+ *
+ * \param[in]   catalog catalog
+ * \param[in]   offset  offset in the pool (ie `catalog->author[row]`)
+ *
+ * \return  nul-terminated string
+ *
+ * \ingroup catalog
+ */
+const char *hvsc_catalog_string(const hvsc_catalog_t *catalog, uint32_t offset)
+{
+    return catalog->strings + offset;
+}
+
+
+/** \brief  Write \a catalog to \a path as tab-separated text
+ *
+ * Writes a header line followed by a line per row with the path, the header
+ * fields and the strings.
+ *
+ * \param[in]   catalog catalog
+ * \param[in]   path    file to write
+ *
+ * \return  bool
+ *
+ * \ingroup catalog
+ */
+bool hvsc_catalog_write_text(const hvsc_catalog_t *catalog, const char *path)
+{
+    FILE *fp;
+    size_t row;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+
+    fprintf(fp, "path\tversion\tload\tinit\tplay\tsongs\tstart\tspeed\tflags"
+            "\tmodels\tsid2\tsid3\tname\tauthor\tcopyright\n");
+    for (row = 0; row < catalog->count; row++) {
+        fprintf(fp, "%s\t%u\t$%04x\t$%04x\t$%04x\t%u\t%u\t$%08lx\t$%04x"
+                "\t$%02x\t$%04x\t$%04x\t%s\t%s\t%s\n",
+                catalog->strings + catalog->path[row],
+                (unsigned int)catalog->version[row],
+                (unsigned int)catalog->load_address[row],
+                (unsigned int)catalog->init_address[row],
+                (unsigned int)catalog->play_address[row],
+                (unsigned int)catalog->songs[row],
+                (unsigned int)catalog->start_song[row],
+                (unsigned long)catalog->speed[row],
+                (unsigned int)catalog->flags[row],
+                (unsigned int)catalog->models[row],
+                (unsigned int)catalog->second_sid[row],
+                (unsigned int)catalog->third_sid[row],
+                catalog->strings + catalog->name[row],
+                catalog->strings + catalog->author[row],
+                catalog->strings + catalog->copyright[row]);
+    }
+
+    if (ferror(fp)) {
+        hvsc_errno = HVSC_ERR_IO;
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    return true;
+}
+
+
+/** \brief  Element sizes of the columns, in file order
+ */
+static const size_t catalog_column_sizes[HVSC_CATALOG_COLUMNS] = {
+    sizeof(uint32_t),   /* path */
+    sizeof(uint32_t),   /* name */
+    sizeof(uint32_t),   /* author */
+    sizeof(uint32_t),   /* copyright */
+    sizeof(uint16_t),   /* version */
+    sizeof(uint16_t),   /* load_address */
+    sizeof(uint16_t),   /* init_address */
+    sizeof(uint16_t),   /* play_address */
+    sizeof(uint16_t),   /* songs */
+    sizeof(uint16_t),   /* start_song */
+    sizeof(uint32_t),   /* speed */
+    sizeof(uint16_t),   /* flags */
+    sizeof(uint8_t),    /* models */
+    sizeof(uint16_t),   /* second_sid */
+    sizeof(uint16_t)    /* third_sid */
+};
+
+
+/** \brief  Round \a n up to the alignment of the sections in a catalog file
+ *
+ * \param[in]   n   offset
+ *
+ * \return  aligned offset
+ */
+static uint64_t catalog_file_align(uint64_t n)
+{
+    return (n + HVSC_CATALOG_FILE_ALIGN - 1)
+        & ~(uint64_t)(HVSC_CATALOG_FILE_ALIGN - 1);
+}
+
+
+/** \brief  Calculate the section offsets of a catalog file
+ *
+ * \param[out]  header  file header to store the offsets and sizes in
+ * \param[in]   count   number of rows
+ * \param[in]   strings size of the string pool
+ *
+ * \return  total size of the file
+ */
+static uint64_t catalog_file_layout(catalog_file_header_t *header,
+                                    uint64_t count, uint64_t strings)
+{
+    uint64_t offset = catalog_file_align(sizeof *header);
+    int i;
+
+    for (i = 0; i < HVSC_CATALOG_COLUMNS; i++) {
+        header->columns[i] = offset;
+        offset = catalog_file_align(offset + count * catalog_column_sizes[i]);
+    }
+    header->strings = offset;
+    header->count = count;
+    header->strings_size = strings;
+    return offset + strings;
+}
+
+
+/** \brief  Write \a size bytes of \a data to \a fp, followed by padding
+ *
+ * \param[in,out]   fp      file pointer
+ * \param[in]       data    data to write
+ * \param[in]       size    number of bytes in \a data
+ *
+ * \return  bool
+ */
+static bool catalog_file_write_section(FILE *fp, const void *data, size_t size)
+{
+    static const uint8_t padding[HVSC_CATALOG_FILE_ALIGN];
+    size_t pad;
+
+    if (size > 0 && fwrite(data, 1U, size, fp) != size) {
+        return false;
+    }
+    pad = (size_t)(catalog_file_align(size) - size);
+    return pad == 0 || fwrite(padding, 1U, pad, fp) == pad;
+}
+
+
+/** \brief  Save \a catalog in binary form to \a path
+ *
+ * The file contains a versioned header followed by each column as a packed
+ * array and finally the string pool. All sections are aligned so the file can
+ * be mapped into memory and used directly, see hvsc_catalog_load(). Data is
+ * stored in host byte order, loading a file on a host with a different byte
+ * order fails.
+ *
+ * The file is written to a temporary file first which is then renamed to
+ * \a path, so readers never see a partially written catalog.
+ *
+ * \param[in]   catalog catalog
+ * \param[in]   path    path of file to write
+ *
+ * \return  bool
+ *
+ * \ingroup catalog
+ */
+bool hvsc_catalog_save(const hvsc_catalog_t *catalog, const char *path)
+{
+    catalog_file_header_t header;
+    const void *columns[HVSC_CATALOG_COLUMNS];
+    char *tmp_path;
+    FILE *fp;
+    bool ok;
+    int i;
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, HVSC_CATALOG_MAGIC, sizeof header.magic);
+    header.version = HVSC_CATALOG_VERSION;
+    header.byte_order = HVSC_CATALOG_BYTE_ORDER;
+    catalog_file_layout(&header, catalog->count, catalog->strings_size);
+
+    columns[0] = catalog->path;
+    columns[1] = catalog->name;
+    columns[2] = catalog->author;
+    columns[3] = catalog->copyright;
+    columns[4] = catalog->version;
+    columns[5] = catalog->load_address;
+    columns[6] = catalog->init_address;
+    columns[7] = catalog->play_address;
+    columns[8] = catalog->songs;
+    columns[9] = catalog->start_song;
+    columns[10] = catalog->speed;
+    columns[11] = catalog->flags;
+    columns[12] = catalog->models;
+    columns[13] = catalog->second_sid;
+    columns[14] = catalog->third_sid;
+
+    tmp_path = hvsc_malloc(strlen(path) + 5);
+    if (tmp_path == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        hvsc_errno = HVSC_ERR_IO;
+        hvsc_free(tmp_path);
+        return false;
+    }
+
+    ok = catalog_file_write_section(fp, &header, sizeof header);
+    for (i = 0; ok && i < HVSC_CATALOG_COLUMNS; i++) {
+        ok = catalog_file_write_section(fp, columns[i],
+                catalog->count * catalog_column_sizes[i]);
+    }
+    if (ok && catalog->strings_size > 0) {
+        ok = fwrite(catalog->strings, 1U, catalog->strings_size, fp)
+            == catalog->strings_size;
+    }
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp_path, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        hvsc_errno = HVSC_ERR_IO;
+        remove(tmp_path);
+    }
+    hvsc_free(tmp_path);
+    return ok;
+}
+
+
+/** \brief  Load catalog file \a path into \a catalog
+ *
+ * The file is mapped into memory read-only and the columns of \a catalog
+ * point directly into the mapping, so loading is cheap regardless of the
+ * size of the catalog: pages are only read from disk when they're accessed.
+ * The catalog must not be modified and must be freed with hvsc_catalog_free().
+ *
+ * \param[out]  catalog catalog
+ * \param[in]   path    path to catalog file written by hvsc_catalog_save()
+ *
+ * \return  bool
+ *
+ * \ingroup catalog
+ */
+bool hvsc_catalog_load(hvsc_catalog_t *catalog, const char *path)
+{
+    catalog_file_header_t header;
+    catalog_file_header_t layout;
+    struct stat st;
+    uint8_t *base;
+    bool valid;
+    int fd;
+    int i;
+
+    hvsc_catalog_init(catalog);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+    if (fstat(fd, &st) != 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        close(fd);
+        return false;
+    }
+    if ((uint64_t)st.st_size < sizeof header) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        close(fd);
+        return false;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+
+    /* check header */
+    memcpy(&header, base, sizeof header);
+    if (memcmp(header.magic, HVSC_CATALOG_MAGIC, sizeof header.magic) != 0
+            || header.version != HVSC_CATALOG_VERSION
+            || header.byte_order != HVSC_CATALOG_BYTE_ORDER
+            || header.count > UINT32_MAX) {
+        hvsc_dbg("invalid catalog header\n");
+        hvsc_errno = HVSC_ERR_INVALID;
+        munmap(base, (size_t)st.st_size);
+        return false;
+    }
+    catalog_file_layout(&layout, header.count, header.strings_size);
+    /* compare without adding, a huge string pool size would wrap around */
+    valid = header.strings == layout.strings
+        && layout.strings <= (uint64_t)st.st_size
+        && header.strings_size <= (uint64_t)st.st_size - layout.strings;
+    for (i = 0; i < HVSC_CATALOG_COLUMNS; i++) {
+        if (header.columns[i] != layout.columns[i]) {
+            valid = false;
+        }
+    }
+    if (!valid || (header.strings_size > 0
+                && base[header.strings + header.strings_size - 1] != '\0')) {
+        hvsc_dbg("invalid catalog layout\n");
+        hvsc_errno = HVSC_ERR_INVALID;
+        munmap(base, (size_t)st.st_size);
+        return false;
+    }
+
+    catalog->map = base;
+    catalog->map_size = (size_t)st.st_size;
+    catalog->count = (size_t)header.count;
+    catalog->max = (size_t)header.count;
+
+    catalog->path = (uint32_t *)(base + header.columns[0]);
+    catalog->name = (uint32_t *)(base + header.columns[1]);
+    catalog->author = (uint32_t *)(base + header.columns[2]);
+    catalog->copyright = (uint32_t *)(base + header.columns[3]);
+    catalog->version = (uint16_t *)(base + header.columns[4]);
+    catalog->load_address = (uint16_t *)(base + header.columns[5]);
+    catalog->init_address = (uint16_t *)(base + header.columns[6]);
+    catalog->play_address = (uint16_t *)(base + header.columns[7]);
+    catalog->songs = (uint16_t *)(base + header.columns[8]);
+    catalog->start_song = (uint16_t *)(base + header.columns[9]);
+    catalog->speed = (uint32_t *)(base + header.columns[10]);
+    catalog->flags = (uint16_t *)(base + header.columns[11]);
+    catalog->models = (uint8_t *)(base + header.columns[12]);
+    catalog->second_sid = (uint16_t *)(base + header.columns[13]);
+    catalog->third_sid = (uint16_t *)(base + header.columns[14]);
+
+    catalog->strings = (char *)(base + header.strings);
+    catalog->strings_size = (size_t)header.strings_size;
+    catalog->strings_max = (size_t)header.strings_size;
+
+    /* validate string offsets, so lookups can't run off the mapping */
+    for (i = 0; i < 4; i++) {
+        const uint32_t *column = (const uint32_t *)(base + header.columns[i]);
+        size_t row;
+
+        for (row = 0; row < catalog->count; row++) {
+            if (column[row] >= header.strings_size) {
+                hvsc_dbg("invalid string offset in row %zu\n", row);
+                hvsc_errno = HVSC_ERR_INVALID;
+                hvsc_catalog_free(catalog);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Initialize \a filter to match every row
+ *
+ * \param[out]  filter  catalog filter
+ *
+ * \ingroup catalog
+ */
+void hvsc_catalog_filter_init(hvsc_catalog_filter_t *filter)
+{
+    filter->min_songs = 0;
+    filter->max_songs = 0xffff;
+    filter->min_sids = 1;
+    filter->max_sids = 3;
+    filter->clock_mask = 0x0f;
+    filter->model_mask = 0x0f;
+}
+
+
+/** \brief  Find all rows in \a catalog matching \a filter
+ *
+ * The columns are scanned a block of rows at a time: for each block the
+ * predicates are evaluated for every row without branching, producing a
+ * match mask, which is then compacted into \a rows. The predicate loops are
+ * written so the compiler can vectorize them.
+ *
+ * Clock and model matching use the same bits as hvsc_psid_get_clock_id() and
+ * hvsc_psid_get_model_id(): a row matches when bit (1 << id) is set in the
+ * filter's mask. So to find tunes playable on NTSC, use a clock mask of
+ * `(1 << 2) | (1 << 3)` (NTSC, and PAL and NTSC).
+ *
+ * \param[in]   catalog catalog
+ * \param[in]   filter  filter, initialize with hvsc_catalog_filter_init()
+ * \param[out]  rows    array to store the matching row indexes, must be able
+ *                      to hold `catalog->count` elements
+ *
+ * \return  number of matching rows stored in \a rows
+ *
+ * \ingroup catalog
+ */
+size_t hvsc_catalog_filter(const hvsc_catalog_t *catalog,
+                           const hvsc_catalog_filter_t *filter,
+                           uint32_t *rows)
+{
+    uint8_t mask[HVSC_CATALOG_FILTER_BLOCK];
+    const unsigned int min_songs = filter->min_songs;
+    const unsigned int max_songs = filter->max_songs;
+    const unsigned int min_sids = filter->min_sids;
+    const unsigned int max_sids = filter->max_sids;
+    const unsigned int clock_mask = filter->clock_mask;
+    const unsigned int model_mask = filter->model_mask;
+    size_t found = 0;
+    size_t base;
+
+    for (base = 0; base < catalog->count; base += HVSC_CATALOG_FILTER_BLOCK) {
+        size_t n = catalog->count - base;
+        const uint16_t *songs = catalog->songs + base;
+        const uint16_t *flags = catalog->flags + base;
+        const uint16_t *sid2 = catalog->second_sid + base;
+        const uint16_t *sid3 = catalog->third_sid + base;
+        size_t i;
+
+        if (n > HVSC_CATALOG_FILTER_BLOCK) {
+            n = HVSC_CATALOG_FILTER_BLOCK;
+        }
+
+        for (i = 0; i < n; i++) {
+            unsigned int s = songs[i];
+            unsigned int f = flags[i];
+            unsigned int sids = 1U + (sid2[i] != 0) + (sid3[i] != 0);
+            unsigned int clock = (f & HVSC_PSID_FLAGS_CLOCK) >> 2;
+            unsigned int model = (f & HVSC_PSID_FLAGS_SID_MODEL1) >> 4;
+
+            mask[i] = (uint8_t)((s >= min_songs) & (s <= max_songs)
+                    & (sids >= min_sids) & (sids <= max_sids)
+                    & (clock_mask >> clock) & (model_mask >> model) & 1U);
+        }
+
+        for (i = 0; i < n; i++) {
+            rows[found] = (uint32_t)(base + i);
+            found += mask[i];
+        }
+    }
+    return found;
+}
@@ -0,0 +1,109 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/catalog.h
+ * \brief   PSID header catalog - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_CATALOG_H
+#define HVSC_CATALOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+#include "hvsc_defs.h"
+
+/** \brief  Marker for an invalid string pool offset
+ */
+#define HVSC_CATALOG_NONE   UINT32_MAX
+
+
+/** \brief  Number of columns in a catalog
+ */
+#define HVSC_CATALOG_COLUMNS    15
+
+
+/** \brief  Magic bytes of a catalog file
+ */
+#define HVSC_CATALOG_MAGIC      "HVSCCAT"
+
+
+/** \brief  Version of the catalog file format
+ *
+ * Increment when the layout changes, older files are then rejected.
+ */
+#define HVSC_CATALOG_VERSION    1
+
+
+/** \brief  Byte order marker of a catalog file
+ *
+ * Stored in host byte order, so a file written on a host with a different
+ * byte order can be detected.
+ */
+#define HVSC_CATALOG_BYTE_ORDER 0x01020304U
+
+
+/** \brief  Alignment of the sections in a catalog file
+ */
+#define HVSC_CATALOG_FILE_ALIGN 16
+
+
+/** \brief  Number of rows evaluated at a time by hvsc_catalog_filter()
+ */
+#define HVSC_CATALOG_FILTER_BLOCK   256
+
+
+/** \brief  Header of a catalog file
+ *
+ * All offsets are relative to the start of the file.
+ */
+typedef struct catalog_file_header_s {
+    char        magic[8];       /**< HVSC_CATALOG_MAGIC */
+    uint32_t    version;        /**< HVSC_CATALOG_VERSION */
+    uint32_t    byte_order;     /**< HVSC_CATALOG_BYTE_ORDER */
+    uint64_t    count;          /**< number of rows */
+    uint64_t    strings_size;   /**< size of the string pool */
+    uint64_t    columns[HVSC_CATALOG_COLUMNS];  /**< offsets of the columns */
+    uint64_t    strings;        /**< offset of the string pool */
+} catalog_file_header_t;
+
+
+/** \brief  PSID files skipped by the crawler
+ *
+ * Paths of .sid files that couldn't be opened or parsed, relative to the root
+ * with a leading '/', like the catalog rows.
+ */
+typedef struct hvsc_catalog_skipped_s {
+    char ** paths;  /**< paths, sorted */
+    size_t  count;  /**< number of paths */
+    size_t  max;    /**< number of allocated paths */
+} hvsc_catalog_skipped_t;
+
+
+bool hvsc_catalog_crawl(hvsc_catalog_t *catalog, const char *root,
+                        int threads, hvsc_catalog_skipped_t *skipped);
+void hvsc_catalog_skipped_free(hvsc_catalog_skipped_t *skipped);
+
+
+#endif
@@ -0,0 +1,563 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/client.c
+ * \brief   Client mode: lookups through hvscd
+ *
+ * After hvsc_client_connect() the SLDB, STIL, BUGlist and index lookups of
+ * the library are answered by hvscd instead of reading the DOCUMENTS files
+ * in this process, so many players on a host share a single index. PSID
+ * files themselves are still read locally.
+ *
+ * There's one connection per process, calls from several threads take turns.
+ * When the connection fails the client mode ends and lookups fall back to
+ * the local files.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "proto.h"
+
+#include "client.h"
+
+
+/** \brief  Socket connected to hvscd, -1 when not in client mode
+ *
+ * Only changed with client_lock held.
+ */
+int hvsc_client_fd = -1;
+
+/** \brief  Lock for the connection, held for a whole request/response
+ */
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  ID of the last request sent
+ */
+static uint32_t client_id = 0;
+
+/** \brief  Requests to send
+ */
+static hvsc_proto_buffer_t client_out = { NULL, 0, 0 };
+
+/** \brief  Responses received
+ */
+static hvsc_proto_buffer_t client_in = { NULL, 0, 0 };
+
+
+/** \brief  End the client mode (called with client_lock held)
+ */
+static void client_close(void)
+{
+    int fd = hvsc_client_fd;
+
+    __atomic_store_n(&hvsc_client_fd, -1, __ATOMIC_RELAXED);
+    if (fd >= 0) {
+        close(fd);
+    }
+    hvsc_proto_buffer_free(&client_out);
+    hvsc_proto_buffer_free(&client_in);
+}
+
+
+/** \brief  Send the requests in client_out over \a fd
+ *
+ * \param[in]   fd  socket
+ *
+ * \return  bool
+ */
+static bool client_send(int fd)
+{
+    size_t pos = 0;
+
+    while (pos < client_out.size) {
+        /* no SIGPIPE when the daemon went away */
+        ssize_t n = send(fd, client_out.data + pos, client_out.size - pos,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            hvsc_errno = HVSC_ERR_IO;
+            return false;
+        }
+        pos += (size_t)n;
+    }
+    client_out.size = 0;
+    return true;
+}
+
+
+/** \brief  Receive from \a fd until client_in holds \a size bytes
+ *
+ * \param[in]   fd      socket
+ * \param[in]   size    number of bytes required
+ *
+ * \return  bool
+ */
+static bool client_fill(int fd, size_t size)
+{
+    while (client_in.size < size) {
+        ssize_t n;
+
+        if (!hvsc_proto_buffer_reserve(&client_in,
+                    size - client_in.size > HVSC_CLIENT_READ_SIZE
+                    ? size - client_in.size : HVSC_CLIENT_READ_SIZE)) {
+            return false;
+        }
+        n = recv(fd, client_in.data + client_in.size,
+                 client_in.max - client_in.size, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            hvsc_errno = HVSC_ERR_IO;
+            return false;
+        }
+        client_in.size += (size_t)n;
+    }
+    return true;
+}
+
+
+/** \brief  Receive the response to request \a id at offset \a pos in client_in
+ *
+ * \param[in]   fd      socket
+ * \param[in]   pos     offset of the response in client_in
+ * \param[in]   id      ID of the request
+ * \param[out]  status  status of the response
+ * \param[out]  size    size of the body of the response
+ *
+ * \return  bool
+ */
+static bool client_receive(int fd, size_t pos, uint32_t id, int *status,
+                           size_t *size)
+{
+    const uint8_t *header;
+
+    if (!client_fill(fd, pos + HVSC_PROTO_HEADER_SIZE)) {
+        return false;
+    }
+    header = client_in.data + pos;
+    *size = hvsc_proto_get_u32(header);
+    *status = header[8];
+    if (hvsc_proto_get_u32(header + 4) != id || *size > HVSC_PROTO_BODY_MAX) {
+        /* out of sync with the daemon */
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    return client_fill(fd, pos + HVSC_PROTO_HEADER_SIZE + *size);
+}
+
+
+/** \brief  Add a request for \a op on \a psid or \a digest to client_out
+ *
+ * A file inside the HVSC is looked up by its path relative to the HVSC root,
+ * which makes the daemon independent of where the client's copy of the HVSC
+ * lives. Other files are looked up by digest, except for SLDB lookups by
+ * path, which don't resolve files outside the HVSC.
+ *
+ * \param[in]   op      HVSC_PROTO_* op
+ * \param[in]   psid    path to PSID file
+ * \param[in]   digest  digest (`NULL` to look up \a psid)
+ * \param[in]   id      request ID
+ *
+ * \return  bool
+ */
+static bool client_add_request(int op, const char *psid,
+                               const uint8_t *digest, uint32_t id)
+{
+    uint8_t file_digest[HVSC_DIGEST_SIZE];
+    const char *key = psid;
+    size_t rlen;
+    size_t frame;
+
+    if (digest == NULL) {
+        rlen = strlen(hvsc_root_path);
+        if (strlen(psid) > rlen && memcmp(psid, hvsc_root_path, rlen) == 0) {
+            key = psid + rlen;
+        } else if (op != HVSC_PROTO_SLDB) {
+            if (!hvsc_dcache_digest(psid, file_digest)) {
+                return false;
+            }
+            digest = file_digest;
+        }
+    }
+    if (digest != NULL) {
+        op |= HVSC_PROTO_DIGEST;
+    }
+
+    if (!hvsc_proto_begin_frame(&client_out, id, op, &frame)) {
+        return false;
+    }
+    if (digest != NULL) {
+        if (!hvsc_proto_buffer_append(&client_out, digest, HVSC_DIGEST_SIZE)) {
+            return false;
+        }
+    } else if (!hvsc_proto_buffer_append(&client_out, key, strlen(key))) {
+        return false;
+    }
+    hvsc_proto_end_frame(&client_out, frame);
+    return true;
+}
+
+
+/** \brief  Look up \a psid or \a digest through hvscd
+ *
+ * \param[in]   op      HVSC_PROTO_* op
+ * \param[in]   psid    path to PSID file
+ * \param[in]   digest  digest (`NULL` to look up \a psid)
+ * \param[out]  size    size of the response body (can be `NULL`)
+ *
+ * \return  heap-allocated, nul-terminated response body, or `NULL` on
+ *          failure
+ */
+char *hvsc_client_lookup(int op, const char *psid, const uint8_t *digest,
+                         size_t *size)
+{
+    char *body = NULL;
+    size_t len;
+    int status;
+    int fd;
+
+    pthread_mutex_lock(&client_lock);
+    fd = hvsc_client_fd;
+    if (fd < 0) {
+        /* disconnected by another thread */
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return NULL;
+    }
+    client_out.size = 0;
+    if (!client_add_request(op, psid, digest, ++client_id)) {
+        pthread_mutex_unlock(&client_lock);
+        return NULL;
+    }
+    if (!client_send(fd) || !client_receive(fd, 0, client_id, &status, &len)) {
+        client_close();
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return NULL;
+    }
+
+    if (status != 0) {
+        hvsc_errno = status;
+    } else {
+        body = hvsc_malloc(len + 1);
+        if (body == NULL) {
+            hvsc_errno = HVSC_ERR_OOM;
+        } else {
+            memcpy(body, client_in.data + HVSC_PROTO_HEADER_SIZE, len);
+            body[len] = '\0';
+            if (size != NULL) {
+                *size = len;
+            }
+        }
+    }
+    hvsc_proto_buffer_consume(&client_in, HVSC_PROTO_HEADER_SIZE + len);
+    pthread_mutex_unlock(&client_lock);
+    return body;
+}
+
+
+/** \brief  Look up \a psid or \a digest through hvscd for a public function
+ *
+ * \param[in]   op      HVSC_PROTO_* op
+ * \param[in]   psid    path to PSID file
+ * \param[in]   digest  digest (`NULL` to look up \a psid)
+ *
+ * \return  response body allocated with malloc(3), or `NULL` on failure
+ */
+char *hvsc_client_lookup_result(int op, const char *psid,
+                                const uint8_t *digest)
+{
+    char *body;
+    char *result;
+
+    body = hvsc_client_lookup(op, psid, digest, NULL);
+    if (body == NULL) {
+        return NULL;
+    }
+    result = hvsc_strdup_result(body);
+    hvsc_free(body);
+    return result;
+}
+
+
+/** \brief  Send up to \a count requests and receive their responses
+ *
+ * The responses are moved to \a replies, so the callbacks can run without
+ * holding the lock.
+ *
+ * \param[in]   op      HVSC_PROTO_* op
+ * \param[in]   psids   paths to PSID files
+ * \param[in]   count   number of paths in \a psids
+ * \param[out]  errors  error code per request that couldn't be sent
+ * \param[out]  replies responses
+ *
+ * \return  bool
+ */
+static bool client_exchange(int op, const char **psids, size_t count,
+                            int *errors, hvsc_proto_buffer_t *replies)
+{
+    hvsc_proto_buffer_t tmp;
+    uint32_t first;
+    size_t pos = 0;
+    size_t i;
+    int fd;
+
+    pthread_mutex_lock(&client_lock);
+    fd = hvsc_client_fd;
+    if (fd < 0) {
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+
+    /* pipeline all requests, the daemon answers them in order */
+    client_out.size = 0;
+    first = client_id + 1;
+    for (i = 0; i < count; i++) {
+        size_t size = client_out.size;
+
+        errors[i] = 0;
+        if (!client_add_request(op, psids[i], NULL, first + (uint32_t)i)) {
+            errors[i] = hvsc_errno != 0 ? hvsc_errno : HVSC_ERR_INVALID;
+            client_out.size = size;
+        }
+    }
+    client_id = first + (uint32_t)count - 1;
+    if (!client_send(fd)) {
+        client_close();
+        pthread_mutex_unlock(&client_lock);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        size_t size;
+        int status;
+
+        if (errors[i] != 0) {
+            continue;
+        }
+        if (!client_receive(fd, pos, first + (uint32_t)i, &status, &size)) {
+            client_close();
+            pthread_mutex_unlock(&client_lock);
+            hvsc_errno = HVSC_ERR_IO;
+            return false;
+        }
+        pos += HVSC_PROTO_HEADER_SIZE + size;
+    }
+
+    /* hand the responses over, keeping the buffer of the previous batch */
+    tmp = client_in;
+    client_in = *replies;
+    client_in.size = 0;
+    *replies = tmp;
+    pthread_mutex_unlock(&client_lock);
+    return true;
+}
+
+
+/** \brief  Look up a list of PSID files through hvscd
+ *
+ * Requests are sent in batches of HVSC_CLIENT_BATCH without waiting for the
+ * responses in between, saving a round trip per file. \a callback is called
+ * for every file, in order, and must not keep the body after returning.
+ *
+ * \param[in]   op          HVSC_PROTO_* op
+ * \param[in]   psids       paths to PSID files
+ * \param[in]   count       number of paths in \a psids
+ * \param[in]   callback    function to call with each response
+ * \param[in]   data        user data for \a callback
+ *
+ * \return  `false` when the connection failed
+ */
+bool hvsc_client_lookup_many(int op, const char **psids, size_t count,
+                             hvsc_client_reply_cb_t callback, void *data)
+{
+    hvsc_proto_buffer_t replies;
+    int errors[HVSC_CLIENT_BATCH];
+    size_t start;
+    bool result = true;
+
+    hvsc_proto_buffer_init(&replies);
+    for (start = 0; start < count && result; start += HVSC_CLIENT_BATCH) {
+        size_t n = count - start < HVSC_CLIENT_BATCH
+            ? count - start : HVSC_CLIENT_BATCH;
+        size_t pos = 0;
+        size_t i;
+
+        result = client_exchange(op, psids + start, n, errors, &replies);
+        for (i = 0; i < n && result; i++) {
+            uint8_t *header;
+            size_t size;
+            uint8_t next;
+
+            if (errors[i] != 0) {
+                callback(start + i, NULL, 0, errors[i], data);
+                continue;
+            }
+            header = replies.data + pos;
+            size = hvsc_proto_get_u32(header);
+            pos += HVSC_PROTO_HEADER_SIZE + size;
+            if (header[8] != 0) {
+                callback(start + i, NULL, 0, header[8], data);
+                continue;
+            }
+            /* terminate the body in place, temporarily */
+            if (pos == replies.size
+                    && !hvsc_proto_buffer_reserve(&replies, 1)) {
+                result = false;
+                break;
+            }
+            header = replies.data + pos - size - HVSC_PROTO_HEADER_SIZE;
+            next = replies.data[pos];
+            replies.data[pos] = '\0';
+            callback(start + i, (const char *)header + HVSC_PROTO_HEADER_SIZE,
+                     size, 0, data);
+            replies.data[pos] = next;
+        }
+    }
+    hvsc_proto_buffer_free(&replies);
+    return result;
+}
+
+
+/** \brief  Connect to hvscd and route lookups to it
+ *
+ * Requires hvsc_init(), paths inside the HVSC are sent relative to the HVSC
+ * root so the daemon can use another copy of the same HVSC. Loading the
+ * index in the client isn't required and only costs memory.
+ *
+ * \param[in]   path    path of the socket of the daemon (`NULL` for
+ *                      HVSC_CLIENT_SOCKET_DEFAULT)
+ *
+ * \return  bool (false with HVSC_ERR_INVALID when already connected or the
+ *          daemon speaks another protocol version)
+ *
+ * \ingroup client
+ */
+bool hvsc_client_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    uint8_t version[4];
+    size_t frame;
+    size_t size;
+    int status = 0;
+    int fd;
+
+    if (path == NULL) {
+        path = HVSC_CLIENT_SOCKET_DEFAULT;
+    }
+    if (hvsc_root_path == NULL || strlen(path) >= sizeof addr.sun_path) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    pthread_mutex_lock(&client_lock);
+    if (hvsc_client_fd >= 0) {
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    /* say hello to check the protocol version */
+    hvsc_proto_put_u32(version, HVSC_PROTO_VERSION);
+    client_out.size = 0;
+    client_in.size = 0;
+    if (connect(fd, (const struct sockaddr *)&addr, sizeof addr) != 0
+            || !hvsc_proto_begin_frame(&client_out, ++client_id,
+                                       HVSC_PROTO_HELLO, &frame)
+            || !hvsc_proto_buffer_append(&client_out, version,
+                                         sizeof version)) {
+        close(fd);
+        hvsc_proto_buffer_free(&client_out);
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+    hvsc_proto_end_frame(&client_out, frame);
+    if (!client_send(fd) || !client_receive(fd, 0, client_id, &status, &size)
+            || status != 0) {
+        close(fd);
+        hvsc_proto_buffer_free(&client_out);
+        hvsc_proto_buffer_free(&client_in);
+        pthread_mutex_unlock(&client_lock);
+        hvsc_errno = status != 0 ? status : HVSC_ERR_IO;
+        return false;
+    }
+    hvsc_proto_buffer_consume(&client_in, HVSC_PROTO_HEADER_SIZE + size);
+
+    __atomic_store_n(&hvsc_client_fd, fd, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&client_lock);
+    return true;
+}
+
+
+/** \brief  Disconnect from hvscd, lookups use the local files again
+ *
+ * Also called by hvsc_exit().
+ *
+ * \ingroup client
+ */
+void hvsc_client_disconnect(void)
+{
+    pthread_mutex_lock(&client_lock);
+    client_close();
+    pthread_mutex_unlock(&client_lock);
+}
+
+
+/** \brief  Check if lookups are routed to hvscd
+ *
+ * \return  bool
+ *
+ * \ingroup client
+ */
+bool hvsc_client_is_connected(void)
+{
+    return HVSC_CLIENT_ACTIVE();
+}
@@ -0,0 +1,71 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/client.h
+ * \brief   Client mode: lookups through hvscd - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_CLIENT_H
+#define HVSC_CLIENT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+#include "proto.h"
+
+
+extern int hvsc_client_fd;
+
+
+/** \brief  Check if lookups go to hvscd, not connected is the expected case
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define HVSC_CLIENT_ACTIVE() \
+    __builtin_expect(__atomic_load_n(&hvsc_client_fd, __ATOMIC_RELAXED) >= 0, 0)
+#else
+# define HVSC_CLIENT_ACTIVE()   (hvsc_client_fd >= 0)
+#endif
+
+
+/** \brief  Callback for the responses of hvsc_client_lookup_many()
+ *
+ * \param[in]   index   index of the PSID file in the list
+ * \param[in]   body    response body, nul-terminated (`NULL` on error)
+ * \param[in]   size    size of \a body without the terminator
+ * \param[in]   error   error code (0 on success)
+ * \param[in]   data    user data
+ */
+typedef void (*hvsc_client_reply_cb_t)(size_t index, const char *body,
+                                       size_t size, int error, void *data);
+
+
+char *  hvsc_client_lookup(int op, const char *psid, const uint8_t *digest,
+                           size_t *size);
+char *  hvsc_client_lookup_result(int op, const char *psid,
+                                  const uint8_t *digest);
+bool    hvsc_client_lookup_many(int op, const char **psids, size_t count,
+                                hvsc_client_reply_cb_t callback, void *data);
+
+#endif
@@ -0,0 +1,516 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/dcache.c
+ * \brief   Persistent digest cache
+ *
+ * Caches the MD5 digest and raw header of PSID files, keyed on device, inode,
+ * size and modification time, so unchanged files don't have to be read again
+ * to calculate their digest or parse their header. The cache is global to the
+ * library, protected by a mutex, and only active after hvsc_dcache_open().
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "md5.h"
+#include "stats.h"
+#include "trace.h"
+
+#include "dcache.h"
+
+
+/** \brief  Lock for the cache
+ */
+static pthread_mutex_t dcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Path of the cache file, `NULL` when the cache isn't open
+ */
+static char *dcache_path = NULL;
+
+/** \brief  Hash table of entries (open addressing)
+ */
+static hvsc_dcache_entry_t *dcache_slots = NULL;
+
+/** \brief  Number of slots in the hash table, a power of two
+ */
+static size_t dcache_size = 0;
+
+/** \brief  Number of used slots in the hash table
+ */
+static size_t dcache_used = 0;
+
+/** \brief  The cache was modified since it was loaded/saved
+ */
+static bool dcache_dirty = false;
+
+
+/** \brief  Get modification time of \a st in nanoseconds
+ *
+ * \param[in]   st  file status
+ *
+ * \return  mtime in ns
+ */
+static int64_t dcache_mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL
+        + (int64_t)st->st_mtim.tv_nsec;
+}
+
+
+/** \brief  Calculate hash of a device/inode pair
+ *
+ * \param[in]   dev device ID
+ * \param[in]   ino inode number
+ *
+ * \return  hash
+ */
+static size_t dcache_hash(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = (ino ^ (dev << 32) ^ (dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+
+    return (size_t)(h ^ (h >> 29));
+}
+
+
+/** \brief  Find the slot of \a dev and \a ino, or the empty slot to use for it
+ *
+ * \param[in]   dev device ID
+ * \param[in]   ino inode number
+ *
+ * \return  slot index
+ */
+static size_t dcache_find_slot(uint64_t dev, uint64_t ino)
+{
+    size_t mask = dcache_size - 1;
+    size_t i = dcache_hash(dev, ino) & mask;
+
+    while (dcache_slots[i].flags != 0
+            && (dcache_slots[i].dev != dev || dcache_slots[i].ino != ino)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+
+/** \brief  Resize the hash table to \a size slots
+ *
+ * \param[in]   size    new number of slots (power of two)
+ *
+ * \return  bool
+ */
+static bool dcache_resize(size_t size)
+{
+    hvsc_dcache_entry_t *old = dcache_slots;
+    size_t old_size = dcache_size;
+    size_t i;
+    int prev;
+
+    /* the table grows during lookups of other subsystems */
+    prev = hvsc_stats_set_subsys(HVSC_STATS_DCACHE);
+    dcache_slots = hvsc_calloc(size, sizeof *dcache_slots);
+    hvsc_stats_set_subsys(prev);
+    if (dcache_slots == NULL) {
+        dcache_slots = old;
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    dcache_size = size;
+
+    for (i = 0; i < old_size; i++) {
+        if (old[i].flags != 0) {
+            dcache_slots[dcache_find_slot(old[i].dev, old[i].ino)] = old[i];
+        }
+    }
+    hvsc_free(old);
+    return true;
+}
+
+
+/** \brief  Add \a entry to the hash table, replacing an entry for its inode
+ *
+ * Call with the lock held.
+ *
+ * \param[in]   entry   cache entry
+ *
+ * \return  bool
+ */
+static bool dcache_insert(const hvsc_dcache_entry_t *entry)
+{
+    size_t i;
+
+    /* keep load factor <= 0.5 */
+    if ((dcache_used + 1) * 2 > dcache_size
+            && !dcache_resize(dcache_size * 2)) {
+        return false;
+    }
+    i = dcache_find_slot(entry->dev, entry->ino);
+    if (dcache_slots[i].flags == 0) {
+        dcache_used++;
+    }
+    dcache_slots[i] = *entry;
+    return true;
+}
+
+
+/** \brief  Load entries from cache file \a path
+ *
+ * Call with the lock held. A missing, outdated or corrupt file leaves the
+ * cache empty.
+ *
+ * \param[in]   path    path to cache file
+ */
+static void dcache_load(const char *path)
+{
+    uint8_t *data;
+    dcache_file_header_t header;
+    const hvsc_dcache_entry_t *entries;
+    long size;
+    size_t i;
+
+    size = hvsc_pread_file(&data, path);
+    if (size < 0) {
+        return;
+    }
+    if ((size_t)size < sizeof header) {
+        hvsc_free(data);
+        return;
+    }
+    memcpy(&header, data, sizeof header);
+    if (memcmp(header.magic, HVSC_DCACHE_MAGIC, sizeof HVSC_DCACHE_MAGIC) != 0
+            || header.version != HVSC_DCACHE_VERSION
+            || header.byte_order != HVSC_DCACHE_BYTE_ORDER
+            || header.entry_size != sizeof *entries
+            || header.count
+                > ((size_t)size - sizeof header) / sizeof *entries) {
+        hvsc_dbg("ignoring invalid cache file %s\n", path);
+        hvsc_free(data);
+        return;
+    }
+
+    /* header size is a multiple of 8, so the entries are properly aligned */
+    entries = (const hvsc_dcache_entry_t *)(data + sizeof header);
+    for (i = 0; i < header.count; i++) {
+        if (entries[i].flags != 0 && !dcache_insert(&(entries[i]))) {
+            break;
+        }
+    }
+    hvsc_free(data);
+    hvsc_dbg("loaded %zu entries\n", dcache_used);
+}
+
+
+/** \brief  Open the digest cache, loading entries from \a path
+ *
+ * When \a path doesn't exist (or isn't a valid cache file) the cache starts
+ * out empty. Once open, the cache is used by hvsc_dcache_digest(),
+ * hvsc_sldb_get_entry_md5(), hvsc_psid_open_header() and the bulk functions
+ * that use them. Use hvsc_dcache_save() to write new entries back to
+ * \a path.
+ *
+ * \param[in]   path    path to cache file
+ *
+ * \return  bool
+ *
+ * \ingroup dcache
+ */
+bool hvsc_dcache_open(const char *path)
+{
+    char *copy = hvsc_strdup(path);
+
+    if (copy == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&dcache_lock);
+    hvsc_free(dcache_path);
+    hvsc_free(dcache_slots);
+    dcache_path = copy;
+    dcache_slots = NULL;
+    dcache_size = 0;
+    dcache_used = 0;
+    dcache_dirty = false;
+    if (!dcache_resize(HVSC_DCACHE_SLOTS_INIT)) {
+        hvsc_free(dcache_path);
+        dcache_path = NULL;
+        pthread_mutex_unlock(&dcache_lock);
+        return false;
+    }
+    dcache_load(path);
+    pthread_mutex_unlock(&dcache_lock);
+    return true;
+}
+
+
+/** \brief  Write the digest cache to the file passed to hvsc_dcache_open()
+ *
+ * Does nothing if the cache wasn't modified. The file is written to a
+ * temporary file first which is then renamed.
+ *
+ * \return  bool
+ *
+ * \ingroup dcache
+ */
+bool hvsc_dcache_save(void)
+{
+    dcache_file_header_t header;
+    char *tmp_path;
+    FILE *fp;
+    bool ok = true;
+    size_t i;
+
+    pthread_mutex_lock(&dcache_lock);
+    if (dcache_path == NULL) {
+        pthread_mutex_unlock(&dcache_lock);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    if (!dcache_dirty) {
+        pthread_mutex_unlock(&dcache_lock);
+        return true;
+    }
+
+    tmp_path = hvsc_malloc(strlen(dcache_path) + 5);
+    if (tmp_path == NULL) {
+        pthread_mutex_unlock(&dcache_lock);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    sprintf(tmp_path, "%s.tmp", dcache_path);
+
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        pthread_mutex_unlock(&dcache_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        hvsc_free(tmp_path);
+        return false;
+    }
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, HVSC_DCACHE_MAGIC, sizeof HVSC_DCACHE_MAGIC);
+    header.version = HVSC_DCACHE_VERSION;
+    header.byte_order = HVSC_DCACHE_BYTE_ORDER;
+    header.count = dcache_used;
+    header.entry_size = sizeof *dcache_slots;
+
+    ok = fwrite(&header, sizeof header, 1U, fp) == 1U;
+    for (i = 0; ok && i < dcache_size; i++) {
+        if (dcache_slots[i].flags != 0) {
+            ok = fwrite(&(dcache_slots[i]), sizeof *dcache_slots, 1U, fp) == 1U;
+        }
+    }
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp_path, dcache_path) != 0) {
+        ok = false;
+    }
+    if (ok) {
+        dcache_dirty = false;
+    } else {
+        hvsc_errno = HVSC_ERR_IO;
+        remove(tmp_path);
+    }
+    pthread_mutex_unlock(&dcache_lock);
+    hvsc_free(tmp_path);
+    return ok;
+}
+
+
+/** \brief  Close the digest cache without saving it
+ *
+ * \ingroup dcache
+ */
+void hvsc_dcache_close(void)
+{
+    pthread_mutex_lock(&dcache_lock);
+    hvsc_free(dcache_path);
+    hvsc_free(dcache_slots);
+    dcache_path = NULL;
+    dcache_slots = NULL;
+    dcache_size = 0;
+    dcache_used = 0;
+    dcache_dirty = false;
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+
+/** \brief  Check if the cache is open
+ *
+ * Used to avoid the stat(2) call needed for a lookup when there's no cache.
+ *
+ * \return  bool
+ */
+bool hvsc_dcache_is_open(void)
+{
+    bool result;
+
+    pthread_mutex_lock(&dcache_lock);
+    result = dcache_path != NULL;
+    pthread_mutex_unlock(&dcache_lock);
+    return result;
+}
+
+
+/** \brief  Look up the cached digest and/or header for the file \a st
+ *
+ * \param[in]   st      status of the file
+ * \param[out]  digest  MD5 digest (`NULL` if not needed)
+ * \param[out]  header  raw header (`NULL` if not needed)
+ *
+ * \return  true when all requested data was found
+ */
+bool hvsc_dcache_get(const struct stat *st, uint8_t *digest, uint8_t *header)
+{
+    const hvsc_dcache_entry_t *entry;
+    bool found = false;
+    bool open;
+
+    pthread_mutex_lock(&dcache_lock);
+    open = dcache_path != NULL;
+    if (open) {
+        entry = &(dcache_slots[dcache_find_slot((uint64_t)st->st_dev,
+                                                (uint64_t)st->st_ino)]);
+        if (entry->flags != 0
+                && entry->size == (uint64_t)st->st_size
+                && entry->mtime_ns == dcache_mtime_ns(st)
+                && (digest == NULL
+                    || (entry->flags & HVSC_DCACHE_HAS_DIGEST))
+                && (header == NULL
+                    || (entry->flags & HVSC_DCACHE_HAS_HEADER))) {
+            if (digest != NULL) {
+                memcpy(digest, entry->digest, HVSC_DIGEST_SIZE);
+            }
+            if (header != NULL) {
+                memcpy(header, entry->header, HVSC_PSID_HEADER_MIN_SIZE);
+            }
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&dcache_lock);
+    if (open) {
+        hvsc_stats_lookup(HVSC_STATS_DCACHE, found);
+    }
+    return found;
+}
+
+
+/** \brief  Store the digest and/or header of the file \a st in the cache
+ *
+ * Data already cached for the same version of the file is kept, data for
+ * an older version of the file is replaced.
+ *
+ * \param[in]   st      status of the file
+ * \param[in]   digest  MD5 digest (`NULL` if not available)
+ * \param[in]   header  raw header (`NULL` if not available)
+ */
+void hvsc_dcache_put(const struct stat *st, const uint8_t *digest,
+                     const uint8_t *header)
+{
+    hvsc_dcache_entry_t entry;
+    const hvsc_dcache_entry_t *old;
+
+    pthread_mutex_lock(&dcache_lock);
+    if (dcache_path == NULL) {
+        pthread_mutex_unlock(&dcache_lock);
+        return;
+    }
+
+    memset(&entry, 0, sizeof entry);
+    old = &(dcache_slots[dcache_find_slot((uint64_t)st->st_dev,
+                                          (uint64_t)st->st_ino)]);
+    if (old->flags != 0
+            && old->size == (uint64_t)st->st_size
+            && old->mtime_ns == dcache_mtime_ns(st)) {
+        entry = *old;
+    } else {
+        entry.dev = (uint64_t)st->st_dev;
+        entry.ino = (uint64_t)st->st_ino;
+        entry.size = (uint64_t)st->st_size;
+        entry.mtime_ns = dcache_mtime_ns(st);
+    }
+    if (digest != NULL) {
+        memcpy(entry.digest, digest, HVSC_DIGEST_SIZE);
+        entry.flags |= HVSC_DCACHE_HAS_DIGEST;
+    }
+    if (header != NULL) {
+        memcpy(entry.header, header, HVSC_PSID_HEADER_MIN_SIZE);
+        entry.flags |= HVSC_DCACHE_HAS_HEADER;
+    }
+    if (dcache_insert(&entry)) {
+        dcache_dirty = true;
+    }
+    pthread_mutex_unlock(&dcache_lock);
+}
+
+
+/** \brief  Get the MD5 digest of file \a path
+ *
+ * When the digest cache is open and contains the digest of the current
+ * version of the file, only a stat(2) call is required. Otherwise the file is
+ * read and hashed, and the digest and header are added to the cache.
+ *
+ * \param[in]   path    path to file
+ * \param[out]  digest  MD5 digest (HVSC_DIGEST_SIZE bytes)
+ *
+ * \return  bool
+ *
+ * \ingroup dcache
+ */
+bool hvsc_dcache_digest(const char *path, uint8_t *digest)
+{
+    struct stat st;
+    uint8_t *data;
+    long size;
+
+    if (hvsc_dcache_is_open() && stat(path, &st) == 0 && S_ISREG(st.st_mode)
+            && hvsc_dcache_get(&st, digest, NULL)) {
+        return true;
+    }
+
+    size = hvsc_pread_file_stat(&data, path, &st);
+    if (size < 0) {
+        return false;
+    }
+    HVSC_TRACE_BEGIN(HVSC_TRACE_HASH, path);
+    hvsc_md5(data, (size_t)size, digest);
+    HVSC_TRACE_END(HVSC_TRACE_HASH, (size_t)size, true);
+    /* don't cache when the file changed size while reading */
+    if ((uint64_t)size == (uint64_t)st.st_size) {
+        hvsc_dcache_put(&st, digest,
+                        size >= HVSC_PSID_HEADER_MIN_SIZE ? data : NULL);
+    }
+    hvsc_free(data);
+    return true;
+}
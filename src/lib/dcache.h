@@ -0,0 +1,102 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/dcache.h
+ * \brief   Persistent digest cache - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_DCACHE_H
+#define HVSC_DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "hvsc_defs.h"
+#include "psid.h"
+
+/** \brief  Magic bytes of a digest cache file
+ */
+#define HVSC_DCACHE_MAGIC       "HVSCDC"
+
+
+/** \brief  Version of the digest cache file format
+ *
+ * Increment when the layout changes, older files are then ignored.
+ */
+#define HVSC_DCACHE_VERSION     1
+
+
+/** \brief  Byte order marker of a digest cache file
+ */
+#define HVSC_DCACHE_BYTE_ORDER  0x01020304U
+
+
+/** \brief  Entry flag: the digest is valid
+ */
+#define HVSC_DCACHE_HAS_DIGEST  0x01
+
+
+/** \brief  Entry flag: the header is valid
+ */
+#define HVSC_DCACHE_HAS_HEADER  0x02
+
+
+/** \brief  Digest cache entry
+ *
+ * Entries are keyed on device and inode, the size and modification time
+ * must match for the entry to be valid. Entries are stored as-is in the
+ * cache file.
+ */
+typedef struct hvsc_dcache_entry_s {
+    uint64_t    dev;        /**< device ID */
+    uint64_t    ino;        /**< inode number */
+    uint64_t    size;       /**< file size */
+    int64_t     mtime_ns;   /**< modification time in nanoseconds */
+    uint8_t     digest[HVSC_DIGEST_SIZE];   /**< MD5 digest of the file */
+    uint8_t     header[HVSC_PSID_HEADER_MIN_SIZE];  /**< raw PSID header */
+    uint8_t     flags;      /**< HVSC_DCACHE_HAS_* flags, 0 = unused slot */
+    uint8_t     padding;    /**< padding, always 0 */
+} hvsc_dcache_entry_t;
+
+
+/** \brief  Header of a digest cache file
+ *
+ * Followed by `count` hvsc_dcache_entry_t records.
+ */
+typedef struct dcache_file_header_s {
+    char        magic[8];   /**< HVSC_DCACHE_MAGIC */
+    uint32_t    version;    /**< HVSC_DCACHE_VERSION */
+    uint32_t    byte_order; /**< HVSC_DCACHE_BYTE_ORDER */
+    uint64_t    count;      /**< number of entries */
+    uint64_t    entry_size; /**< sizeof(hvsc_dcache_entry_t) */
+} dcache_file_header_t;
+
+
+bool    hvsc_dcache_is_open(void);
+bool    hvsc_dcache_get(const struct stat *st, uint8_t *digest,
+                        uint8_t *header);
+void    hvsc_dcache_put(const struct stat *st, const uint8_t *digest,
+                        const uint8_t *header);
+
+#endif
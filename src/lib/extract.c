@@ -0,0 +1,586 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/extract.c
+ * \brief   Bulk extraction of SID binaries
+ *
+ * Converts many PSID files to C64 binaries (.prg) using a pool of worker
+ * threads. The binaries can be written as loose files, or streamed into a
+ * single tar archive or 'pack' file.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "pool.h"
+#include "psid.h"
+
+#include "extract.h"
+
+
+/** \brief  Shared state of a bulk extraction
+ *
+ * \ingroup psid
+ */
+typedef struct extract_state_s {
+    const char **           paths;      /**< paths to PSID files */
+    const char **           outputs;    /**< output paths (loose files) */
+    hvsc_psid_extract_cb_t  callback;   /**< report callback (optional) */
+    void *                  data;       /**< user data for \a callback */
+    pthread_mutex_t         lock;       /**< lock for \a callback and `done` */
+    pthread_cond_t          ready;      /**< signalled when an item is done */
+} extract_state_t;
+
+
+/** \brief  Single file in a bulk extraction
+ *
+ * \ingroup psid
+ */
+typedef struct extract_item_s {
+    extract_state_t *   state;  /**< shared state */
+    size_t              index;  /**< index in the caller's list */
+    hvsc_psid_t         handle; /**< PSID handle (archive mode) */
+    int                 error;  /**< error code */
+    bool                done;   /**< item has been loaded */
+} extract_item_t;
+
+
+/** \brief  Block of zeroes used for tar padding and the end-of-archive marker
+ */
+static const uint8_t zero_block[HVSC_TAR_BLOCK_SIZE];
+
+
+/** \brief  Get error code after a failed library call
+ *
+ * \return  hvsc_errno, or HVSC_ERR_IO if not set
+ */
+static int extract_error(void)
+{
+    return hvsc_errno != 0 ? hvsc_errno : HVSC_ERR_IO;
+}
+
+
+/** \brief  Report result of a single item to the callback, if any
+ *
+ * \param[in]   state   shared state
+ * \param[in]   index   index of file
+ * \param[in]   error   error code
+ */
+static void extract_report(extract_state_t *state, size_t index, int error)
+{
+    if (state->callback != NULL) {
+        state->callback(index, state->paths[index], error, state->data);
+    }
+}
+
+
+/** \brief  Worker job: convert a single PSID file to a loose binary file
+ *
+ * \param[in]   arg extract item
+ */
+static void extract_file_item(void *arg)
+{
+    extract_item_t *item = arg;
+    extract_state_t *state = item->state;
+    hvsc_psid_t handle;
+    int err = 0;
+
+    hvsc_errno = 0;
+    if (!hvsc_psid_open(state->paths[item->index], &handle)) {
+        err = extract_error();
+    } else {
+        if (!hvsc_psid_write_bin(&handle, state->outputs[item->index])) {
+            err = extract_error();
+        }
+        hvsc_psid_close(&handle);
+    }
+
+    pthread_mutex_lock(&(state->lock));
+    extract_report(state, item->index, err);
+    pthread_mutex_unlock(&(state->lock));
+}
+
+
+/** \brief  Worker job: load a single PSID file for the archive writer
+ *
+ * \param[in]   arg extract item
+ */
+static void extract_load_item(void *arg)
+{
+    extract_item_t *item = arg;
+    extract_state_t *state = item->state;
+    int err = 0;
+
+    hvsc_errno = 0;
+    if (!hvsc_psid_open(state->paths[item->index], &(item->handle))) {
+        err = extract_error();
+    }
+
+    pthread_mutex_lock(&(state->lock));
+    item->error = err;
+    item->done = true;
+    pthread_cond_broadcast(&(state->ready));
+    pthread_mutex_unlock(&(state->lock));
+}
+
+
+/** \brief  Generate archive member name for \a path
+ *
+ * Strips the HVSC root (if set and present) and leading slashes and replaces
+ * a '.sid' extension with '.prg'.
+ *
+ * \param[in]   path    path to PSID file
+ *
+ * \return  heap-allocated name or `NULL` on failure
+ */
+static char *extract_default_name(const char *path)
+{
+    char *name;
+    size_t len;
+
+    if (hvsc_root_path != NULL) {
+        size_t rlen = strlen(hvsc_root_path);
+        if (strncmp(path, hvsc_root_path, rlen) == 0) {
+            path += rlen;
+        }
+    }
+    while (*path == '/') {
+        path++;
+    }
+
+    name = hvsc_strdup(path);
+    if (name == NULL) {
+        return NULL;
+    }
+    len = strlen(name);
+    if (len > 4 && strcasecmp(name + len - 4, ".sid") == 0) {
+        memcpy(name + len - 4, ".prg", 4);
+    }
+    return name;
+}
+
+
+/** \brief  Store \a value as nul-terminated octal number in \a dest
+ *
+ * \param[out]  dest    destination
+ * \param[in]   size    size of field, including the terminating nul
+ * \param[in]   value   value
+ */
+static void tar_octal(char *dest, size_t size, unsigned long value)
+{
+    dest[--size] = '\0';
+    while (size > 0) {
+        dest[--size] = (char)('0' + (value & 7));
+        value >>= 3;
+    }
+}
+
+
+/** \brief  Create POSIX ustar header for a regular file
+ *
+ * Names over 100 characters are split over the prefix and name fields.
+ *
+ * \param[out]  header  header block (HVSC_TAR_BLOCK_SIZE bytes)
+ * \param[in]   name    member name
+ * \param[in]   size    member size
+ * \param[in]   mtime   modification time
+ *
+ * \return  false if \a name doesn't fit the header
+ */
+static bool tar_header(uint8_t *header, const char *name, size_t size,
+                       time_t mtime)
+{
+    char *h = (char *)header;
+    size_t len = strlen(name);
+    unsigned long sum = 0;
+    size_t i;
+
+    memset(header, 0, HVSC_TAR_BLOCK_SIZE);
+
+    if (len <= 100) {
+        memcpy(h, name, len);
+    } else {
+        /* find the first slash that splits the name into prefix <= 155 and
+         * name <= 100 */
+        const char *split = NULL;
+
+        for (i = len - 1; i > 0; i--) {
+            if (name[i] == '/') {
+                if (len - i - 1 > 100) {
+                    break;
+                }
+                if (i <= 155) {
+                    split = name + i;
+                    break;
+                }
+            }
+        }
+        if (split == NULL || split[1] == '\0') {
+            return false;
+        }
+        memcpy(h + 345, name, (size_t)(split - name));
+        memcpy(h, split + 1, len - (size_t)(split - name) - 1);
+    }
+
+    tar_octal(h + 100, 8, 0644);                /* mode */
+    tar_octal(h + 108, 8, 0);                   /* uid */
+    tar_octal(h + 116, 8, 0);                   /* gid */
+    tar_octal(h + 124, 12, (unsigned long)size);
+    tar_octal(h + 136, 12, (unsigned long)mtime);
+    h[156] = '0';                               /* regular file */
+    memcpy(h + 257, "ustar", 6);
+    memcpy(h + 263, "00", 2);
+
+    /* checksum is calculated with the checksum field set to spaces */
+    memset(h + 148, ' ', 8);
+    for (i = 0; i < HVSC_TAR_BLOCK_SIZE; i++) {
+        sum += header[i];
+    }
+    tar_octal(h + 148, 7, sum);
+    return true;
+}
+
+
+/** \brief  Write a loaded PSID file to the archive
+ *
+ * \param[in]   fd      archive file descriptor
+ * \param[in]   format  archive format
+ * \param[in]   name    member name
+ * \param[in]   handle  PSID handle
+ * \param[in]   mtime   modification time for tar headers
+ * \param[out]  fatal   set to `true` when writing to the archive failed
+ *
+ * \return  error code for the member
+ */
+static int extract_write_member(int fd, int format, const char *name,
+                                const hvsc_psid_t *handle, time_t mtime,
+                                bool *fatal)
+{
+    uint8_t header[HVSC_TAR_BLOCK_SIZE];
+    uint8_t address[2];
+    uint8_t length[4];
+    struct iovec iov[5];
+    size_t size;
+    int count = 0;
+    int bin;
+
+    /* leave room for the member header */
+    bin = hvsc_psid_bin_iov(handle, iov + 2, address);
+    if (bin == 0) {
+        /* bogus data offset: skip the member, the archive is still fine */
+        return HVSC_ERR_INVALID;
+    }
+    size = iov[2].iov_len + (bin > 1 ? iov[3].iov_len : 0);
+
+    if (format == HVSC_EXTRACT_TAR) {
+        size_t pad = (HVSC_TAR_BLOCK_SIZE - (size % HVSC_TAR_BLOCK_SIZE))
+            % HVSC_TAR_BLOCK_SIZE;
+
+        if (!tar_header(header, name, size, mtime)) {
+            return HVSC_ERR_INVALID;
+        }
+        iov[1].iov_base = header;
+        iov[1].iov_len = HVSC_TAR_BLOCK_SIZE;
+        count = 1 + bin;
+        if (pad > 0) {
+            iov[2 + bin].iov_base = (void *)zero_block;
+            iov[2 + bin].iov_len = pad;
+            count++;
+        }
+        if (!hvsc_writev_all(fd, iov + 1, count)) {
+            *fatal = true;
+            return HVSC_ERR_IO;
+        }
+    } else {
+        /* nul-terminated name, 32-bit little endian size, binary */
+        if (size > UINT32_MAX) {
+            return HVSC_ERR_FILE_TOO_LARGE;
+        }
+        length[0] = (uint8_t)(size & 0xff);
+        length[1] = (uint8_t)((size >> 8) & 0xff);
+        length[2] = (uint8_t)((size >> 16) & 0xff);
+        length[3] = (uint8_t)((size >> 24) & 0xff);
+        iov[0].iov_base = (void *)name;
+        iov[0].iov_len = strlen(name) + 1;
+        iov[1].iov_base = length;
+        iov[1].iov_len = sizeof length;
+        count = 2 + bin;
+        if (!hvsc_writev_all(fd, iov, count)) {
+            *fatal = true;
+            return HVSC_ERR_IO;
+        }
+    }
+    return 0;
+}
+
+
+/** \brief  Convert a list of PSID files to binaries using multiple threads
+ *
+ * Each file in \a paths is converted as with hvsc_psid_write_bin() and written
+ * to the corresponding path in \a outputs, on one of \a threads worker
+ * threads. The optional \a callback is called for each file with its index,
+ * its path and an error code (0 on success). Calls of \a callback are
+ * serialized, their order is undefined.
+ *
+ * \param[in]   paths       list of paths to PSID files
+ * \param[in]   outputs     list of paths of the binaries to write
+ * \param[in]   count       number of elements in \a paths and \a outputs
+ * \param[in]   threads     number of worker threads (<= 0 for the default)
+ * \param[in]   callback    report callback (can be `NULL`)
+ * \param[in]   data        user data passed to \a callback
+ *
+ * \return  bool (false means the extraction couldn't be started, individual
+ *          file errors are reported via \a callback)
+ *
+ * \ingroup psid
+ */
+bool hvsc_psid_extract_files(const char **paths, const char **outputs,
+                             size_t count, int threads,
+                             hvsc_psid_extract_cb_t callback, void *data)
+{
+    hvsc_pool_t pool;
+    extract_state_t state;
+    extract_item_t *items;
+    size_t i;
+
+    if (count == 0) {
+        return true;
+    }
+    if (threads <= 0) {
+        threads = HVSC_PSID_BATCH_THREADS;
+    }
+    if ((size_t)threads > count) {
+        threads = (int)count;
+    }
+
+    items = hvsc_malloc(count * sizeof *items);
+    if (items == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    state.paths = paths;
+    state.outputs = outputs;
+    state.callback = callback;
+    state.data = data;
+    pthread_mutex_init(&(state.lock), NULL);
+    pthread_cond_init(&(state.ready), NULL);
+
+    if (!hvsc_pool_init(&pool, threads)) {
+        pthread_cond_destroy(&(state.ready));
+        pthread_mutex_destroy(&(state.lock));
+        hvsc_free(items);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        items[i].state = &state;
+        items[i].index = i;
+        if (!hvsc_pool_submit(&pool, extract_file_item, &(items[i]))) {
+            extract_file_item(&(items[i]));
+        }
+    }
+
+    hvsc_pool_wait(&pool);
+    hvsc_pool_free(&pool);
+    pthread_cond_destroy(&(state.ready));
+    pthread_mutex_destroy(&(state.lock));
+    hvsc_free(items);
+    return true;
+}
+
+
+/** \brief  Convert a list of PSID files to binaries stored in a single archive
+ *
+ * The PSID files are loaded by \a threads worker threads, while the calling
+ * thread streams the binaries into \a archive in the order of \a paths. Each
+ * member is written with a single writev(2) call.
+ *
+ * Supported formats:
+ *  - HVSC_EXTRACT_TAR: POSIX ustar archive
+ *  - HVSC_EXTRACT_PACK: for each member the nul-terminated name, the size of
+ *    the binary as a 32-bit little endian value and the binary itself
+ *
+ * When \a names is `NULL` the member names are derived from \a paths: the HVSC
+ * root is stripped and a '.sid' extension is replaced with '.prg'.
+ *
+ * Members that can't be loaded or stored are skipped and reported via
+ * \a callback, which is called from the calling thread in the order of
+ * \a paths.
+ *
+ * \param[in]   archive     path of the archive to write
+ * \param[in]   format      archive format (hvsc_extract_format_t)
+ * \param[in]   paths       list of paths to PSID files
+ * \param[in]   names       list of member names (can be `NULL`)
+ * \param[in]   count       number of elements in \a paths (and \a names)
+ * \param[in]   threads     number of worker threads (<= 0 for the default)
+ * \param[in]   callback    report callback (can be `NULL`)
+ * \param[in]   data        user data passed to \a callback
+ *
+ * \return  bool (false on I/O error writing the archive)
+ *
+ * \ingroup psid
+ */
+bool hvsc_psid_extract_archive(const char *archive, int format,
+                               const char **paths, const char **names,
+                               size_t count, int threads,
+                               hvsc_psid_extract_cb_t callback, void *data)
+{
+    hvsc_pool_t pool;
+    extract_state_t state;
+    extract_item_t *items;
+    size_t submitted = 0;
+    size_t i;
+    time_t mtime = time(NULL);
+    bool fatal = false;
+    int fd;
+
+    if (format != HVSC_EXTRACT_TAR && format != HVSC_EXTRACT_PACK) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    if (threads <= 0) {
+        threads = HVSC_PSID_BATCH_THREADS;
+    }
+    if (count > 0 && (size_t)threads > count) {
+        threads = (int)count;
+    }
+
+    fd = open(archive, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+
+    items = hvsc_malloc((count > 0 ? count : 1) * sizeof *items);
+    if (items == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        close(fd);
+        return false;
+    }
+
+    state.paths = paths;
+    state.outputs = NULL;
+    state.callback = callback;
+    state.data = data;
+    pthread_mutex_init(&(state.lock), NULL);
+    pthread_cond_init(&(state.ready), NULL);
+
+    if (!hvsc_pool_init(&pool, threads)) {
+        pthread_cond_destroy(&(state.ready));
+        pthread_mutex_destroy(&(state.lock));
+        hvsc_free(items);
+        close(fd);
+        return false;
+    }
+
+    for (i = 0; i < count && !fatal; i++) {
+        extract_item_t *item = &(items[i]);
+        char *name = NULL;
+        int err;
+
+        /* keep a limited number of loaded files ahead of the writer */
+        while (submitted < count && submitted < i + HVSC_EXTRACT_WINDOW) {
+            extract_item_t *next = &(items[submitted]);
+
+            next->state = &state;
+            next->index = submitted;
+            next->error = 0;
+            next->done = false;
+            if (!hvsc_pool_submit(&pool, extract_load_item, next)) {
+                extract_load_item(next);
+            }
+            submitted++;
+        }
+
+        pthread_mutex_lock(&(state.lock));
+        while (!item->done) {
+            pthread_cond_wait(&(state.ready), &(state.lock));
+        }
+        pthread_mutex_unlock(&(state.lock));
+
+        err = item->error;
+        if (err == 0) {
+            if (names == NULL) {
+                name = extract_default_name(paths[i]);
+            }
+            if (names == NULL && name == NULL) {
+                err = HVSC_ERR_OOM;
+            } else {
+                err = extract_write_member(fd, format,
+                                           names != NULL ? names[i] : name,
+                                           &(item->handle), mtime, &fatal);
+            }
+            hvsc_free(name);
+            hvsc_psid_close(&(item->handle));
+        }
+        extract_report(&state, i, err);
+    }
+
+    /* after a write error, drop whatever is still being loaded */
+    hvsc_pool_wait(&pool);
+    hvsc_pool_free(&pool);
+    for (; i < submitted; i++) {
+        if (items[i].error == 0) {
+            hvsc_psid_close(&(items[i].handle));
+        }
+    }
+
+    if (!fatal && format == HVSC_EXTRACT_TAR) {
+        struct iovec iov[2];
+
+        iov[0].iov_base = (void *)zero_block;
+        iov[0].iov_len = HVSC_TAR_BLOCK_SIZE;
+        iov[1] = iov[0];
+        if (!hvsc_writev_all(fd, iov, 2)) {
+            fatal = true;
+        }
+    }
+    if (close(fd) != 0 && !fatal) {
+        hvsc_errno = HVSC_ERR_IO;
+        fatal = true;
+    }
+
+    pthread_cond_destroy(&(state.ready));
+    pthread_mutex_destroy(&(state.lock));
+    hvsc_free(items);
+    if (fatal) {
+        hvsc_errno = HVSC_ERR_IO;
+    }
+    return !fatal;
+}
@@ -51,6 +51,7 @@ typedef enum hvsc_err_e {
     HVSC_ERR_TIMESTAMP,         /**< error parsing a timestamp */
     HVSC_ERR_NOT_FOUND,         /**< entry/tune not found */
     HVSC_ERR_INVALID,           /**< invalid data or operation detected */
+    HVSC_ERR_THREAD,            /**< failed to start a worker thread */
 
     HVSC_ERR_CODE_COUNT         /**< number of error messages */
 
@@ -81,6 +82,14 @@ typedef struct hvsc_text_file_s {
     size_t  linelen;    /**< line length */
     char *  buffer; /**< buffer for line data, grows when required */
     size_t  buflen; /**< size of buffer, grows when needed */
+    const char *mem;    /**< text in memory (`NULL` when reading \a fp) */
+    size_t  mem_size;   /**< size of \a mem */
+    size_t  mem_pos;    /**< read position in \a mem */
+    size_t  bytes;      /**< number of bytes read through the handle */
+    struct hvsc_index_s *index; /**< index snapshot owning \a mem, released
+                                     on close (`NULL` if none) */
+    char *  mem_owned;  /**< heap-allocated text \a mem points to, freed on
+                             close (`NULL` if none) */
 } hvsc_text_file_t;
 
 
@@ -233,7 +242,8 @@ typedef struct hvsc_psid_s {
      * information on the entire file
      */
     char *      path;   /**< path to psid file */
-    uint8_t *   data;   /**< data of psid file */
+    uint8_t *   data;   /**< data of psid file (`NULL` when opened with
+                             hvsc_psid_open_header()) */
     size_t      size;   /**< size of psid file */
 
     /*
@@ -270,11 +280,486 @@ typedef struct hvsc_psid_s {
 } hvsc_psid_t;
 
 
+/** \brief  Completion callback for hvsc_psid_batch_load()
+ *
+ * \param[in]   index   index of the file in the list of paths
+ * \param[in]   path    path of the file
+ * \param[in]   handle  PSID handle (`NULL` on error)
+ * \param[in]   error   error code (0 on success)
+ * \param[in]   data    user data
+ *
+ * \return  `true` when the callback takes ownership of the handle's data
+ * \ingroup psid
+ */
+typedef bool (*hvsc_psid_batch_cb_t)(size_t index, const char *path,
+                                     hvsc_psid_t *handle, int error,
+                                     void *data);
+
+
+/** \brief  Report callback for the bulk extraction functions
+ *
+ * \param[in]   index   index of the file in the list of paths
+ * \param[in]   path    path of the file
+ * \param[in]   error   error code (0 on success)
+ * \param[in]   data    user data
+ *
+ * \ingroup psid
+ */
+typedef void (*hvsc_psid_extract_cb_t)(size_t index, const char *path,
+                                       int error, void *data);
+
+
+/** \brief  Archive formats for hvsc_psid_extract_archive()
+ *
+ * \ingroup psid
+ */
+typedef enum hvsc_extract_format_e {
+    HVSC_EXTRACT_TAR,   /**< POSIX ustar archive */
+    HVSC_EXTRACT_PACK   /**< concatenated name/size/binary records */
+} hvsc_extract_format_t;
+
+
+/** \brief  Problems reported by hvsc_sldb_verify()
+ *
+ * \ingroup sldb
+ */
+typedef enum hvsc_verify_problem_e {
+    HVSC_VERIFY_MISSING,    /**< PSID file has no SLDB entry */
+    HVSC_VERIFY_SONGS,      /**< song count of header and SLDB differ */
+    HVSC_VERIFY_ORPHAN,     /**< SLDB entry without PSID file */
+    HVSC_VERIFY_IO          /**< PSID file couldn't be read or parsed */
+} hvsc_verify_problem_t;
+
+
+/** \brief  Problem callback for hvsc_sldb_verify()
+ *
+ * \param[in]   problem     problem type (hvsc_verify_problem_t)
+ * \param[in]   path        path of the PSID file, relative to the HVSC root
+ * \param[in]   psid_songs  number of songs in the PSID header (-1 for
+ *                          orphans and unreadable PSID files)
+ * \param[in]   sldb_songs  number of songs in the SLDB (-1 if not found)
+ * \param[in]   data        user data
+ *
+ * \ingroup sldb
+ */
+typedef void (*hvsc_sldb_verify_cb_t)(int problem, const char *path,
+                                      int psid_songs, int sldb_songs,
+                                      void *data);
+
+
+/** \brief  Totals of a hvsc_sldb_verify() run
+ *
+ * \ingroup sldb
+ */
+typedef struct hvsc_sldb_verify_s {
+    size_t  files;      /**< number of PSID files checked */
+    size_t  entries;    /**< number of SLDB entries */
+    size_t  ok;         /**< PSID files with a matching entry */
+    size_t  missing;    /**< PSID files without entry */
+    size_t  mismatches; /**< PSID files with a different song count */
+    size_t  orphans;    /**< SLDB entries without PSID file */
+    size_t  errors;     /**< PSID files that couldn't be read or parsed */
+} hvsc_sldb_verify_t;
+
+
+/** \brief  Catalog of PSID headers
+ *
+ * Stores header data of a collection of PSID files as a 'struct of arrays':
+ * each header field is stored in its own array, indexed by row number. The
+ * text fields (path, name, author, copyright) are stored as offsets into a
+ * single string pool, use hvsc_catalog_string() to get the actual string.
+ * Identical name/author/copyright strings are only stored once.
+ *
+ * Rows are sorted on path, the row index doubles as tune ID: use
+ * hvsc_catalog_find() to map a path to its tune ID.
+ *
+ * \ingroup catalog
+ */
+typedef struct hvsc_catalog_s {
+    size_t      count;          /**< number of rows */
+    size_t      max;            /**< number of allocated rows */
+
+    uint32_t *  path;           /**< path relative to the root (offset) */
+    uint32_t *  name;           /**< SID name (offset) */
+    uint32_t *  author;         /**< SID author (offset) */
+    uint32_t *  copyright;      /**< SID copyright (offset) */
+
+    uint16_t *  version;        /**< PSID version */
+    uint16_t *  load_address;   /**< load address */
+    uint16_t *  init_address;   /**< init address */
+    uint16_t *  play_address;   /**< play address */
+    uint16_t *  songs;          /**< number of songs */
+    uint16_t *  start_song;     /**< starting song */
+    uint32_t *  speed;          /**< speed flags */
+    uint16_t *  flags;          /**< PSIDv2NG flags */
+    uint8_t *   models;         /**< SID models: bits 0-1 for the first SID,
+                                     bits 2-3 for the second and bits 4-5
+                                     for the third SID */
+    uint16_t *  second_sid;     /**< second SID address (0 = none) */
+    uint16_t *  third_sid;      /**< third SID address (0 = none) */
+
+    char *      strings;        /**< string pool */
+    size_t      strings_size;   /**< used bytes in the string pool */
+    size_t      strings_max;    /**< allocated bytes for the string pool */
+
+    uint32_t *  intern;         /**< string intern hash table (offsets) */
+    size_t      intern_size;    /**< number of slots in \a intern */
+    size_t      intern_used;    /**< number of used slots in \a intern */
+
+    void *      map;            /**< file mapping (hvsc_catalog_load()) */
+    size_t      map_size;       /**< size of \a map */
+} hvsc_catalog_t;
+
+
+/** \brief  Catalog filter
+ *
+ * A row matches when all conditions are true. The masks contain a bit for
+ * each accepted value as returned by hvsc_psid_get_clock_id() and
+ * hvsc_psid_get_model_id() (first SID), ie bit 2 set in \a clock_mask means
+ * NTSC tunes are accepted.
+ *
+ * \ingroup catalog
+ */
+typedef struct hvsc_catalog_filter_s {
+    unsigned int    min_songs;  /**< minimum number of songs */
+    unsigned int    max_songs;  /**< maximum number of songs */
+    unsigned int    min_sids;   /**< minimum number of SIDs (1-3) */
+    unsigned int    max_sids;   /**< maximum number of SIDs (1-3) */
+    unsigned int    clock_mask; /**< accepted clock IDs */
+    unsigned int    model_mask; /**< accepted models of the first SID */
+} hvsc_catalog_filter_t;
+
+
+/** \brief  Subsystems tracked by the statistics
+ *
+ * \ingroup stats
+ */
+typedef enum hvsc_stats_subsys_e {
+    HVSC_STATS_SLDB = 0,    /**< song length database */
+    HVSC_STATS_STIL,        /**< STIL */
+    HVSC_STATS_BUGS,        /**< BUGlist */
+    HVSC_STATS_PSID,        /**< PSID files */
+    HVSC_STATS_INDEX,       /**< index lookups (hvsc_index_load()) */
+    HVSC_STATS_DCACHE,      /**< digest cache lookups */
+    HVSC_STATS_OTHER,       /**< work outside the other subsystems */
+
+    HVSC_STATS_SUBSYS_COUNT /**< number of subsystems */
+} hvsc_stats_subsys_t;
+
+
+/** \brief  Number of linear latency buckets (0-15ns)
+ *
+ * \ingroup stats
+ */
+#define HVSC_STATS_HIST_LINEAR  16
+
+/** \brief  Number of latency buckets per power of two above the linear ones
+ *
+ * \ingroup stats
+ */
+#define HVSC_STATS_HIST_SUB     4
+
+/** \brief  Number of latency buckets, the last one is for everything >= ~15m
+ *
+ * \ingroup stats
+ */
+#define HVSC_STATS_HIST_BUCKETS 160
+
+
+/** \brief  Statistics of a subsystem
+ *
+ * Lookups, hits, misses, errors and latencies are recorded for calls of the
+ * public functions of a subsystem (only the outermost call when functions
+ * call each other), the index and digest cache count their own lookups.
+ * Bytes, lines and allocations are accounted to the subsystem whose function
+ * is running.
+ *
+ * The buckets of \a histogram are described by hvsc_stats_bucket_limit().
+ * Must only contain uint64_t members.
+ *
+ * \ingroup stats
+ */
+typedef struct hvsc_stats_counters_s {
+    uint64_t    lookups;        /**< number of calls/lookups */
+    uint64_t    hits;           /**< successful lookups */
+    uint64_t    misses;         /**< lookups that found nothing */
+    uint64_t    errors;         /**< lookups that failed otherwise */
+    uint64_t    bytes_read;     /**< bytes read from files */
+    uint64_t    lines_scanned;  /**< lines of text read */
+    uint64_t    allocations;    /**< heap allocations */
+    uint64_t    latency_ns;     /**< total latency of the timed calls */
+    uint64_t    histogram[HVSC_STATS_HIST_BUCKETS]; /**< latency histogram */
+} hvsc_stats_counters_t;
+
+
+/** \brief  Statistics of all subsystems
+ *
+ * \ingroup stats
+ */
+typedef struct hvsc_stats_s {
+    hvsc_stats_counters_t subsys[HVSC_STATS_SUBSYS_COUNT]; /**< per subsystem */
+} hvsc_stats_t;
+
+
+/** \brief  Allocator used for the memory owned by the library
+ *
+ * \ingroup alloc
+ */
+typedef struct hvsc_allocator_s {
+    void *(*malloc_func)(void *data, size_t size);  /**< allocate memory */
+    void *(*realloc_func)(void *data, void *ptr, size_t size);
+                                                    /**< resize memory */
+    void  (*free_func)(void *data, void *ptr);      /**< free memory */
+    void *  data;                                   /**< data for the
+                                                         functions */
+} hvsc_allocator_t;
+
+
+/** \brief  Memory counters of a subsystem
+ *
+ * \ingroup alloc
+ */
+typedef struct hvsc_mem_counters_s {
+    uint64_t    current;        /**< bytes currently allocated */
+    uint64_t    peak;           /**< highest value of \a current */
+    uint64_t    allocations;    /**< number of allocations */
+    uint64_t    frees;          /**< number of frees */
+} hvsc_mem_counters_t;
+
+
+/** \brief  Memory counters of all subsystems
+ *
+ * \ingroup alloc
+ */
+typedef struct hvsc_mem_stats_s {
+    hvsc_mem_counters_t subsys[HVSC_STATS_SUBSYS_COUNT];  /**< per subsystem */
+    hvsc_mem_counters_t total;  /**< all subsystems, \a peak is the peak of
+                                     the total */
+} hvsc_mem_stats_t;
+
+
+/** \brief  Phases reported to the trace hooks
+ *
+ * \ingroup trace
+ */
+typedef enum hvsc_trace_phase_e {
+    HVSC_TRACE_OPEN = 0,    /**< opening a file */
+    HVSC_TRACE_READ,        /**< reading a file or an entry into memory */
+    HVSC_TRACE_SCAN,        /**< scanning a text file for an entry */
+    HVSC_TRACE_PARSE,       /**< parsing an entry or PSID header */
+    HVSC_TRACE_HASH,        /**< calculating an MD5 digest */
+    HVSC_TRACE_ALLOC,       /**< allocating a file buffer */
+
+    HVSC_TRACE_PHASE_COUNT  /**< number of phases */
+} hvsc_trace_phase_t;
+
+
+/** \brief  Trace hook called when a phase begins
+ *
+ * \param[in]   data    data passed to hvsc_trace_set_hooks()
+ * \param[in]   phase   phase (hvsc_trace_phase_t)
+ * \param[in]   subsys  subsystem the phase is run for (hvsc_stats_subsys_t)
+ * \param[in]   subject file path or other subject of the phase (can be
+ *                      `NULL`), only valid during the call
+ *
+ * \ingroup trace
+ */
+typedef void (*hvsc_trace_begin_func_t)(void *data, int phase, int subsys,
+                                        const char *subject);
+
+/** \brief  Trace hook called when a phase ends
+ *
+ * \param[in]   data    data passed to hvsc_trace_set_hooks()
+ * \param[in]   phase   phase (hvsc_trace_phase_t)
+ * \param[in]   subsys  subsystem the phase is run for (hvsc_stats_subsys_t)
+ * \param[in]   bytes   number of bytes read, scanned, parsed, hashed or
+ *                      allocated by the phase
+ * \param[in]   result  phase succeeded
+ *
+ * \ingroup trace
+ */
+typedef void (*hvsc_trace_end_func_t)(void *data, int phase, int subsys,
+                                      size_t bytes, bool result);
+
+
+/** \brief  Public API calls logged by the workload recorder
+ *
+ * \ingroup record
+ */
+typedef enum hvsc_record_op_e {
+    HVSC_OP_SLDB_LENGTHS = 0,       /**< hvsc_sldb_get_lengths() */
+    HVSC_OP_SLDB_LENGTHS_PSID,      /**< hvsc_sldb_get_lengths_psid(), the
+                                         path of the PSID handle */
+    HVSC_OP_SLDB_ENTRY_MD5,         /**< hvsc_sldb_get_entry_md5() */
+    HVSC_OP_SLDB_ENTRY_TXT,         /**< hvsc_sldb_get_entry_txt() */
+    HVSC_OP_SLDB_ENTRY_DIGEST,      /**< hvsc_sldb_get_entry_digest(),
+                                         hvsc_sldb_get_entry_data() and
+                                         hvsc_sldb_get_entry_psid(), the
+                                         digest */
+    HVSC_OP_STIL_OPEN,              /**< hvsc_stil_open() */
+    HVSC_OP_STIL_GET,               /**< hvsc_stil_get() */
+    HVSC_OP_BUGS_OPEN,              /**< hvsc_bugs_open() */
+    HVSC_OP_PSID_OPEN,              /**< hvsc_psid_open() */
+    HVSC_OP_PSID_OPEN_HEADER,       /**< hvsc_psid_open_header() */
+    HVSC_OP_INDEX_RESOLVE,          /**< hvsc_index_resolve() */
+    HVSC_OP_INDEX_RESOLVE_DIGEST,   /**< hvsc_index_resolve_digest() */
+    HVSC_OP_STIL_CACHE_GET,         /**< hvsc_stil_cache_get() */
+
+    HVSC_OP_COUNT                   /**< number of operations */
+} hvsc_record_op_t;
+
+
+/** \brief  Subject flag: path is relative to the HVSC root
+ *
+ * \ingroup record
+ */
+#define HVSC_WORKLOAD_RELATIVE  0x01
+
+/** \brief  Subject flag: subject is an MD5 digest in hex, not a path
+ *
+ * \ingroup record
+ */
+#define HVSC_WORKLOAD_DIGEST    0x02
+
+
+/** \brief  Workload loaded from a file written by the recorder
+ *
+ * Each call has an operation, the number of the thread that made it, its
+ * time and a subject: the path or digest passed to the call. Subjects are
+ * stored once, in \a strings.
+ *
+ * \ingroup record
+ */
+typedef struct hvsc_workload_s {
+    size_t      count;          /**< number of calls */
+    uint8_t *   op;             /**< operation (hvsc_record_op_t) */
+    uint32_t *  thread;         /**< recording thread */
+    uint64_t *  time_ns;        /**< time since the start of the recording */
+    uint32_t *  subject;        /**< subject number */
+    size_t      subjects;       /**< number of subjects */
+    uint32_t *  subject_text;   /**< offset of the subject in \a strings */
+    uint8_t *   subject_flags;  /**< HVSC_WORKLOAD_* flags of the subject */
+    char *      strings;        /**< subject strings */
+    uint32_t    threads;        /**< number of recording threads */
+} hvsc_workload_t;
+
+
+/** \brief  Statistics of the STIL cache
+ *
+ * \ingroup stilcache
+ */
+typedef struct hvsc_stil_cache_stats_s {
+    size_t      entries;    /**< number of cached entries */
+    size_t      bytes;      /**< memory used by the cached entries */
+    size_t      max_bytes;  /**< memory cap */
+    uint64_t    hits;       /**< lookups answered from the cache */
+    uint64_t    misses;     /**< lookups that parsed the entry */
+    uint64_t    admitted;   /**< parsed entries added to the cache */
+    uint64_t    rejected;   /**< parsed entries refused by the admission
+                                 policy */
+    uint64_t    evicted;    /**< entries evicted to make room */
+    uint64_t    prefetched; /**< entries added by hvsc_prefetch() */
+} hvsc_stil_cache_stats_t;
+
+
+/** \brief  Statistics of the DOCUMENTS watcher
+ *
+ * \ingroup watch
+ */
+typedef struct hvsc_watch_stats_s {
+    uint64_t    events;     /**< change events for the SLDB, STIL and BUGlist */
+    uint64_t    reloads;    /**< batches of changes applied */
+    uint64_t    failures;   /**< rebuilds that failed, keeping the old index */
+} hvsc_watch_stats_t;
+
+
+/** \brief  Statistics of the prefetcher
+ *
+ * \ingroup prefetch
+ */
+typedef struct hvsc_prefetch_stats_s {
+    uint64_t    queued;     /**< paths passed to hvsc_prefetch() */
+    uint64_t    warmed;     /**< paths prefetched */
+    uint64_t    dropped;    /**< paths replaced by a later call before they
+                                 were prefetched */
+} hvsc_prefetch_stats_t;
+
+
+/** \brief  Default path of the hvscd socket
+ *
+ * \ingroup client
+ */
+#define HVSC_CLIENT_SOCKET_DEFAULT  "/tmp/hvscd.sock"
+
+
+/** \brief  hvsc_init_ex() flag: attach to the index shared by another process
+ *
+ * \ingroup main
+ */
+#define HVSC_INIT_ATTACH_INDEX  0x01
+
+/** \brief  hvsc_init_ex() flag: load the index and share it with other
+ *          processes, unless already attached to a shared index
+ *
+ * \ingroup main
+ */
+#define HVSC_INIT_SHARE_INDEX   0x02
+
+
+/** \brief  Callback for hvsc_sldb_get_lengths_batch()
+ *
+ * \param[in]   index   index of the file in the list of paths
+ * \param[in]   path    path of the file
+ * \param[in]   songs   number of songs or -1 on error
+ * \param[in]   lengths song lengths in seconds, only valid during the call
+ *                      (`NULL` on error)
+ * \param[in]   error   error code (0 on success)
+ * \param[in]   data    user data
+ *
+ * \ingroup sldb
+ */
+typedef void (*hvsc_sldb_lengths_cb_t)(size_t index, const char *path,
+                                       int songs, const long *lengths,
+                                       int error, void *data);
+
+
+/** \brief  Totals of the tunes under a path prefix
+ *
+ * \ingroup index
+ */
+typedef struct hvsc_index_totals_s {
+    size_t      tunes;      /**< number of tunes in the SLDB */
+    uint64_t    playtime;   /**< total length of their songs in seconds */
+    size_t      stil;       /**< number of tunes with a STIL entry */
+    size_t      bugs;       /**< number of tunes with a BUGlist entry */
+} hvsc_index_totals_t;
+
+
+/** \brief  Callback for hvsc_index_list()
+ *
+ * \param[in]   tune    tune ID, the position of the tune in the sorted index
+ *                      (changes when the index is reloaded)
+ * \param[in]   path    path relative to the HVSC root, only valid during the
+ *                      call
+ * \param[in]   songs   number of songs
+ * \param[in]   lengths song lengths in seconds, only valid during the call
+ * \param[in]   data    user data
+ *
+ * \return  `false` to stop listing
+ *
+ * \ingroup index
+ */
+typedef bool (*hvsc_index_list_cb_t)(size_t tune, const char *path,
+                                     int songs, const long *lengths,
+                                     void *data);
+
+
 /*
  * main.c stuff
  */
 
 bool        hvsc_init(const char *path);
+bool        hvsc_init_ex(const char *path, int flags);
 void        hvsc_exit(void);
 const char *hvsc_lib_version_str(void);
 void        hvsc_lib_version_num(int *major, int *minor, int *revision);
@@ -284,21 +769,126 @@ void        hvsc_lib_version_num(int *major, int *minor, int *revision);
  */
 
 
-extern int hvsc_errno;
+/** \brief  Storage class of the library's error code
+ *
+ * Each thread gets its own copy of hvsc_errno, so worker threads can report
+ * errors without clobbering the error code of the caller.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define HVSC_THREAD_LOCAL __thread
+#else
+# define HVSC_THREAD_LOCAL
+#endif
+
+extern HVSC_THREAD_LOCAL int hvsc_errno;
 
 const char *hvsc_strerror(int n);
 void        hvsc_perror(const char *prefix);
 
 
+/*
+ * stats.c stuff
+ */
+
+void        hvsc_stats_get(hvsc_stats_t *stats);
+void        hvsc_stats_reset(void);
+double      hvsc_stats_hit_ratio(const hvsc_stats_counters_t *counters);
+uint64_t    hvsc_stats_bucket_limit(int bucket);
+uint64_t    hvsc_stats_percentile(const hvsc_stats_counters_t *counters,
+                                  double p);
+const char *hvsc_stats_subsys_name(int subsys);
+
+
+/*
+ * alloc.c stuff
+ */
+
+bool        hvsc_set_allocator(const hvsc_allocator_t *alloc);
+void        hvsc_mem_get(hvsc_mem_stats_t *stats);
+void        hvsc_mem_reset_peak(void);
+
+
+/*
+ * trace.c stuff
+ */
+
+void        hvsc_trace_set_hooks(hvsc_trace_begin_func_t begin,
+                                 hvsc_trace_end_func_t end,
+                                 void *data);
+const char *hvsc_trace_phase_name(int phase);
+
+
+/*
+ * md5.c stuff
+ */
+
+void        hvsc_md5(const uint8_t *data, size_t size, uint8_t *digest);
+
+
+/*
+ * record.c stuff
+ */
+
+bool        hvsc_record_start(const char *path);
+bool        hvsc_record_stop(void);
+const char *hvsc_record_op_name(int op);
+void        hvsc_workload_init(hvsc_workload_t *workload);
+bool        hvsc_workload_load(hvsc_workload_t *workload, const char *path);
+void        hvsc_workload_free(hvsc_workload_t *workload);
+const char *hvsc_workload_subject(const hvsc_workload_t *workload,
+                                  size_t call);
+
+
 /*
  * sldb.c stuff
  */
 
-#ifdef HVSC_USE_MD5
 char *      hvsc_sldb_get_entry_md5(const char *psid);
-#endif
+char *      hvsc_sldb_get_entry_digest(const uint8_t *digest);
+char *      hvsc_sldb_get_entry_data(const uint8_t *data, size_t size);
+char *      hvsc_sldb_get_entry_psid(const hvsc_psid_t *handle);
 char *      hvsc_sldb_get_entry_txt(const char *psid);
 int         hvsc_sldb_get_lengths(const char *psid, long **lengths);
+int         hvsc_sldb_get_lengths_psid(const hvsc_psid_t *handle,
+                                       long **lengths);
+bool        hvsc_sldb_get_lengths_batch(const char **psids, size_t count,
+                                        hvsc_sldb_lengths_cb_t callback,
+                                        void *data);
+
+
+/*
+ * dcache.c stuff
+ */
+
+bool        hvsc_dcache_open(const char *path);
+bool        hvsc_dcache_save(void);
+void        hvsc_dcache_close(void);
+bool        hvsc_dcache_digest(const char *path, uint8_t *digest);
+
+
+/*
+ * index.c stuff
+ */
+
+bool        hvsc_index_load(void);
+void        hvsc_index_free(void);
+char *      hvsc_index_resolve_digest(const uint8_t *digest);
+char *      hvsc_index_resolve(const char *psid);
+bool        hvsc_index_share(void);
+bool        hvsc_index_attach(void);
+bool        hvsc_index_unshare(void);
+long        hvsc_index_list(const char *prefix,
+                            hvsc_index_list_cb_t callback, void *data);
+bool        hvsc_index_get_totals(const char *prefix,
+                                  hvsc_index_totals_t *totals);
+
+
+/*
+ * verify.c stuff
+ */
+
+bool        hvsc_sldb_verify(hvsc_sldb_verify_t *result, int threads,
+                             hvsc_sldb_verify_cb_t callback, void *data);
 
 
 /*
@@ -324,6 +914,43 @@ bool        hvsc_stil_get_tune_entry(const hvsc_stil_t *handle,
                                      int tune);
 void        hvsc_stil_dump_tune_entry(const hvsc_stil_tune_entry_t *entry);
 
+
+/*
+ * stilcache.c stuff
+ */
+
+bool        hvsc_stil_cache_open(size_t max_bytes);
+void        hvsc_stil_cache_close(void);
+void        hvsc_stil_cache_clear(void);
+const hvsc_stil_t *hvsc_stil_cache_get(const char *psid);
+void        hvsc_stil_cache_release(const hvsc_stil_t *stil);
+void        hvsc_stil_cache_get_stats(hvsc_stil_cache_stats_t *stats);
+
+/*
+ * watch.c stuff
+ */
+
+bool        hvsc_watch_start(void);
+void        hvsc_watch_stop(void);
+void        hvsc_watch_get_stats(hvsc_watch_stats_t *stats);
+
+/*
+ * prefetch.c stuff
+ */
+
+bool        hvsc_prefetch(const char **paths, size_t count);
+void        hvsc_prefetch_wait(void);
+void        hvsc_prefetch_stop(void);
+void        hvsc_prefetch_get_stats(hvsc_prefetch_stats_t *stats);
+
+/*
+ * client.c stuff
+ */
+
+bool        hvsc_client_connect(const char *path);
+void        hvsc_client_disconnect(void);
+bool        hvsc_client_is_connected(void);
+
 /*
  * bugs.c stuff
  */
@@ -337,6 +964,10 @@ void        hvsc_bugs_close(hvsc_bugs_t *handle);
  */
 
 bool            hvsc_psid_open(const char *path, hvsc_psid_t *handle);
+bool            hvsc_psid_open_header(const char *path, hvsc_psid_t *handle);
+bool            hvsc_psid_load_data(hvsc_psid_t *handle);
+bool            hvsc_psid_get_digest(const hvsc_psid_t *handle,
+                                     uint8_t *digest);
 void            hvsc_psid_close(hvsc_psid_t *handle);
 void            hvsc_psid_dump(const hvsc_psid_t *handle);
 bool            hvsc_psid_write_bin(const hvsc_psid_t *handle, const char *path);
@@ -345,4 +976,51 @@ const char *    hvsc_psid_get_model_str(const hvsc_psid_t *handle, int sid);
 unsigned int    hvsc_psid_get_clock_id(const hvsc_psid_t *handle);
 const char *    hvsc_psid_get_clock_str(const hvsc_psid_t *handle);
 
+/*
+ * batch.c stuff
+ */
+
+bool            hvsc_psid_batch_load(const char **paths, size_t count,
+                                     int threads, bool header_only,
+                                     hvsc_psid_batch_cb_t callback,
+                                     void *data);
+
+/*
+ * extract.c stuff
+ */
+
+bool            hvsc_psid_extract_files(const char **paths,
+                                        const char **outputs, size_t count,
+                                        int threads,
+                                        hvsc_psid_extract_cb_t callback,
+                                        void *data);
+bool            hvsc_psid_extract_archive(const char *archive, int format,
+                                          const char **paths,
+                                          const char **names, size_t count,
+                                          int threads,
+                                          hvsc_psid_extract_cb_t callback,
+                                          void *data);
+
+/*
+ * catalog.c stuff
+ */
+
+void            hvsc_catalog_init(hvsc_catalog_t *catalog);
+bool            hvsc_catalog_build(hvsc_catalog_t *catalog, const char *root,
+                                   int threads);
+void            hvsc_catalog_free(hvsc_catalog_t *catalog);
+long            hvsc_catalog_find(const hvsc_catalog_t *catalog,
+                                  const char *path);
+const char *    hvsc_catalog_string(const hvsc_catalog_t *catalog,
+                                    uint32_t offset);
+bool            hvsc_catalog_write_text(const hvsc_catalog_t *catalog,
+                                        const char *path);
+bool            hvsc_catalog_save(const hvsc_catalog_t *catalog,
+                                  const char *path);
+bool            hvsc_catalog_load(hvsc_catalog_t *catalog, const char *path);
+void            hvsc_catalog_filter_init(hvsc_catalog_filter_t *filter);
+size_t          hvsc_catalog_filter(const hvsc_catalog_t *catalog,
+                                    const hvsc_catalog_filter_t *filter,
+                                    uint32_t *rows);
+
 #endif
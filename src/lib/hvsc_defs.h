@@ -119,6 +119,116 @@
 #define HVSC_HANDLE_BLOCKS_INIT    32
 
 
+/** \brief  Default number of worker threads in a thread pool
+ */
+#define HVSC_POOL_THREADS   8
+
+
+/** \brief  Default number of worker threads for the batch PSID loader
+ *
+ * Loading PSID files is mostly waiting on I/O, so use a lot more threads than
+ * there are CPU cores to keep enough requests in flight.
+ */
+#define HVSC_PSID_BATCH_THREADS 64
+
+
+/** \brief  Maximum number of PSID files loaded ahead of the archive writer
+ *
+ * Limits the memory used by hvsc_psid_extract_archive().
+ */
+#define HVSC_EXTRACT_WINDOW     256
+
+
+/** \brief  Number of PSID files hashed by a single job of the SLDB verifier
+ */
+#define HVSC_VERIFY_CHUNK       64
+
+
+/** \brief  Initial number of slots in the digest cache hash table
+ *
+ * Must be a power of two.
+ */
+#define HVSC_DCACHE_SLOTS_INIT  4096
+
+
+/** \brief  Initial number of rows in a PSID catalog
+ */
+#define HVSC_CATALOG_ROWS_INIT  1024
+
+
+/** \brief  Initial size in bytes of the string pool of a PSID catalog
+ */
+#define HVSC_CATALOG_STRINGS_INIT   65536
+
+
+/** \brief  Initial number of slots in the string intern table of a catalog
+ *
+ * Must be a power of two.
+ */
+#define HVSC_CATALOG_INTERN_INIT    4096
+
+
+/** \brief  Initial number of slots in the subject table of the recorder
+ *
+ * Must be a power of two.
+ */
+#define HVSC_RECORD_SLOTS_INIT  1024
+
+
+/** \brief  Size of the stdio buffer of the workload recorder
+ */
+#define HVSC_RECORD_BUFFER_SIZE 65536
+
+
+/** \brief  Default memory cap of the STIL cache in bytes
+ */
+#define HVSC_STIL_CACHE_SIZE_DEFAULT    (4 * 1024 * 1024)
+
+
+/** \brief  Initial number of buckets of the STIL cache hash table
+ *
+ * Must be a power of two.
+ */
+#define HVSC_STIL_CACHE_BUCKETS_INIT    256
+
+
+/** \brief  Average size of a cached STIL entry, used to size the sketch
+ *
+ * The frequency sketch of the STIL cache gets a counter per row for every
+ * HVSC_STIL_CACHE_ENTRY_AVG bytes of the memory cap.
+ */
+#define HVSC_STIL_CACHE_ENTRY_AVG       512
+
+
+/** \brief  Time in milliseconds without changes before the watcher reloads
+ *
+ * An HVSC update replaces several files, often by writing them in pieces, so
+ * the watcher waits for things to settle instead of reloading on every event.
+ */
+#define HVSC_WATCH_SETTLE_MS            500
+
+
+/** \brief  Minimum number of bytes the client reads from hvscd at once
+ */
+#define HVSC_CLIENT_READ_SIZE           16384
+
+
+/** \brief  Number of requests the client sends to hvscd without waiting
+ *
+ * Small enough for the requests and responses to fit in the socket buffers,
+ * so neither side blocks on a full buffer while the other one is writing.
+ */
+#define HVSC_CLIENT_BATCH               64
+
+
+/** \brief  Directory of the shared index segments
+ *
+ * A tmpfs, so a segment lives in memory and is shared by every process that
+ * maps it, like a segment created with shm_open(3).
+ */
+#define HVSC_SHM_INDEX_DIR              "/dev/shm"
+
+
 #include "hvsc.h"
 
 /** \brief  STIL parser state
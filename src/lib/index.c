@@ -0,0 +1,1363 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/index.c
+ * \brief   In-memory index of the SLDB, STIL and BUGlist
+ *
+ * Joins the Songlengths.md5, STIL.txt and BUGlist.txt files on path, so a
+ * tune can be found by path or by MD5 digest in constant time, and its SLDB,
+ * STIL and BUGlist entries can be read without scanning the files. Since the
+ * SLDB lists the path of each digest, this also resolves SID files from
+ * outside the HVSC to their HVSC path.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "dcache.h"
+#include "sldb.h"
+#include "stats.h"
+#include "record.h"
+#include "stilcache.h"
+#include "client.h"
+#include "shmindex.h"
+#include "pathdict.h"
+
+#include "index.h"
+
+
+/** \brief  Source of an index record
+ */
+enum {
+    INDEX_SRC_SLDB,     /**< SLDB comment */
+    INDEX_SRC_STIL,     /**< STIL entry */
+    INDEX_SRC_BUGS      /**< BUGlist entry */
+};
+
+
+/** \brief  Path found in one of the files, used while building the index
+ */
+typedef struct index_record_s {
+    const char *    path;   /**< path (not nul-terminated) */
+    uint32_t        len;    /**< length of \a path */
+    uint32_t        src;    /**< INDEX_SRC_* */
+    uint32_t        value;  /**< SLDB entry index or offset of entry text */
+    uint64_t        content;    /**< hash of the entry text (STIL/BUGlist) */
+} index_record_t;
+
+
+/** \brief  Growable list of index records
+ */
+typedef struct index_records_s {
+    index_record_t *    list;   /**< records */
+    size_t              count;  /**< number of records used */
+    size_t              max;    /**< number of records allocated */
+} index_records_t;
+
+
+/** \brief  Index in use by the library, `NULL` when not loaded
+ *
+ * Readers take a reference with hvsc_index_acquire(), so a new index can be
+ * published while lookups on the previous one are still running.
+ */
+static hvsc_index_t *index_current = NULL;
+
+/** \brief  Lock for \a index_current
+ */
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Index is shared with other processes, write it again on reload
+ */
+static bool index_sharing = false;
+
+
+/** \brief  Calculate hash of MD5 \a digest
+ *
+ * The digest is already uniformly distributed, so just use part of it.
+ *
+ * \param[in]   digest  MD5 digest
+ *
+ * \return  hash
+ */
+static size_t index_hash_digest(const uint8_t *digest)
+{
+    return (size_t)digest[0] | ((size_t)digest[1] << 8)
+        | ((size_t)digest[2] << 16) | ((size_t)digest[3] << 24);
+}
+
+
+/** \brief  Add record to \a records
+ *
+ * \param[in,out]   records record list
+ * \param[in]       path    path (not nul-terminated)
+ * \param[in]       len     length of \a path
+ * \param[in]       src     INDEX_SRC_* value
+ * \param[in]       value   SLDB entry index or text offset
+ *
+ * \return  bool
+ */
+static bool index_add_record(index_records_t *records, const char *path,
+                             size_t len, uint32_t src, uint32_t value)
+{
+    index_record_t *rec;
+
+    if (records->count == records->max) {
+        size_t max = records->max > 0 ? records->max * 2 : 4096;
+        index_record_t *tmp = hvsc_realloc(records->list, max * sizeof *tmp);
+
+        if (tmp == NULL) {
+            hvsc_errno = HVSC_ERR_OOM;
+            return false;
+        }
+        records->list = tmp;
+        records->max = max;
+    }
+    rec = &(records->list[records->count++]);
+    rec->path = path;
+    rec->len = (uint32_t)len;
+    rec->src = src;
+    rec->value = value;
+    rec->content = 0;
+    return true;
+}
+
+
+/** \brief  Add records for the entries in a STIL or BUGlist text
+ *
+ * Entries start with a line containing an absolute path and run up to the
+ * next one, the records get a hash of their entry text.
+ *
+ * \param[in,out]   records record list
+ * \param[in]       text    file contents
+ * \param[in]       size    size of \a text
+ * \param[in]       src     INDEX_SRC_STIL or INDEX_SRC_BUGS
+ *
+ * \return  bool
+ */
+static bool index_scan_text(index_records_t *records, const char *text,
+                            size_t size, uint32_t src)
+{
+    size_t pos = 0;
+    size_t first = records->count;
+
+    while (pos < size) {
+        const char *line = text + pos;
+        const char *eol = memchr(line, '\n', size - pos);
+        size_t len = eol != NULL ? (size_t)(eol - line) : size - pos;
+        size_t next = pos + len + (eol != NULL ? 1 : 0);
+
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        if (len > 0 && *line == '/') {
+            if (records->count > first) {
+                index_record_t *prev = &(records->list[records->count - 1]);
+
+                prev->content = hvsc_hash_bytes(text + prev->value,
+                                                pos - prev->value);
+            }
+            if (!index_add_record(records, line, len, src, (uint32_t)next)) {
+                return false;
+            }
+        }
+        pos = next;
+    }
+    if (records->count > first) {
+        index_record_t *prev = &(records->list[records->count - 1]);
+
+        prev->content = hvsc_hash_bytes(text + prev->value,
+                                        size - prev->value);
+    }
+    return true;
+}
+
+
+/** \brief  Compare index records on path
+ *
+ * \param[in]   p1  first record
+ * \param[in]   p2  second record
+ *
+ * \return  <0, 0 or >0
+ */
+static int index_record_cmp(const void *p1, const void *p2)
+{
+    const index_record_t *r1 = p1;
+    const index_record_t *r2 = p2;
+    size_t len = r1->len < r2->len ? r1->len : r2->len;
+    int result = memcmp(r1->path, r2->path, len);
+
+    if (result != 0) {
+        return result;
+    }
+    return r1->len < r2->len ? -1 : r1->len > r2->len;
+}
+
+
+/** \brief  Get number of hash slots for \a count items (load factor <= 0.5)
+ *
+ * \param[in]   count   number of items
+ *
+ * \return  power of two
+ */
+static size_t index_hash_size(size_t count)
+{
+    size_t size = 16;
+
+    while (size < count * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+
+/** \brief  Find the tune in \a old of each record
+ *
+ * The paths of \a old are front-coded, so rather than looking up every
+ * record in \a old, the records are hashed and the paths of \a old are
+ * decoded once, in order.
+ *
+ * \param[in]   records records
+ * \param[in]   old     previous index
+ * \param[out]  tune_of tune ID in \a old per record, or HVSC_INDEX_NONE
+ *
+ * \return  bool
+ */
+static bool index_match_records(const index_records_t *records,
+                                const hvsc_index_t *old, uint32_t *tune_of)
+{
+    hvsc_pathdict_iter_t iter;
+    const char *path;
+    uint32_t *slots;
+    size_t size = index_hash_size(records->count);
+    size_t mask = size - 1;
+    size_t tune;
+    size_t i;
+
+    slots = hvsc_calloc(size, sizeof *slots);
+    if (slots == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    if (!hvsc_pathdict_iter_init(&iter, &(old->paths), 0)) {
+        hvsc_free(slots);
+        return false;
+    }
+    for (i = 0; i < records->count; i++) {
+        const index_record_t *rec = &(records->list[i]);
+        size_t slot = hvsc_hash_bytes(rec->path, rec->len) & mask;
+
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = (uint32_t)i + 1;
+        tune_of[i] = HVSC_INDEX_NONE;
+    }
+
+    /* records with the same path are in consecutive slots */
+    for (tune = 0; (path = hvsc_pathdict_iter_next(&iter)) != NULL; tune++) {
+        size_t slot = hvsc_hash_bytes(path, iter.len) & mask;
+
+        while (slots[slot] != 0) {
+            const index_record_t *rec = &(records->list[slots[slot] - 1]);
+
+            if (rec->len == iter.len
+                    && memcmp(rec->path, path, iter.len) == 0) {
+                tune_of[slots[slot] - 1] = (uint32_t)tune;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+    hvsc_pathdict_iter_free(&iter);
+    hvsc_free(slots);
+    return true;
+}
+
+
+/** \brief  Sort \a records on path, reusing the tune order of \a old
+ *
+ * Records of paths in \a old are put in the order of their tunes in \a old
+ * with a counting sort, only records of new paths are sorted and then merged
+ * with them. Without \a old all records are sorted.
+ *
+ * \param[in,out]   records records
+ * \param[in]       old     previous index or `NULL`
+ *
+ * \return  bool
+ */
+static bool index_sort_records(index_records_t *records,
+                               const hvsc_index_t *old)
+{
+    index_record_t *sorted;
+    index_record_t *added;
+    uint32_t *tune_of;
+    size_t *start;
+    size_t count = records->count;
+    size_t n = 0;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    if (old == NULL) {
+        qsort(records->list, count, sizeof *(records->list),
+              index_record_cmp);
+        return true;
+    }
+
+    sorted = hvsc_malloc((count > 0 ? count : 1) * sizeof *sorted);
+    added = hvsc_malloc((count > 0 ? count : 1) * sizeof *added);
+    tune_of = hvsc_malloc((count > 0 ? count : 1) * sizeof *tune_of);
+    start = hvsc_calloc(old->count + 1, sizeof *start);
+    if (sorted == NULL || added == NULL || tune_of == NULL || start == NULL
+            || !index_match_records(records, old, tune_of)) {
+        hvsc_free(sorted);
+        hvsc_free(added);
+        hvsc_free(tune_of);
+        hvsc_free(start);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (tune_of[i] != HVSC_INDEX_NONE) {
+            start[tune_of[i] + 1]++;
+        } else {
+            added[n++] = records->list[i];
+        }
+    }
+    for (i = 1; i <= old->count; i++) {
+        start[i] += start[i - 1];
+    }
+    /* known paths go to the back of `sorted`, in the order of the old tunes */
+    for (i = 0; i < count; i++) {
+        if (tune_of[i] != HVSC_INDEX_NONE) {
+            sorted[n + start[tune_of[i]]++] = records->list[i];
+        }
+    }
+    hvsc_free(tune_of);
+    hvsc_free(start);
+    qsort(added, n, sizeof *added, index_record_cmp);
+
+    /* merge front to back, the write position never passes the known
+     * records still to be read */
+    i = n;
+    j = 0;
+    k = 0;
+    while (i < count || j < n) {
+        if (j == n || (i < count
+                       && index_record_cmp(&(sorted[i]), &(added[j])) <= 0)) {
+            sorted[k++] = sorted[i++];
+        } else {
+            sorted[k++] = added[j++];
+        }
+    }
+    hvsc_dbg("%zu of %zu records for new paths\n", n, count);
+    hvsc_free(added);
+    hvsc_free(records->list);
+    records->list = sorted;
+    records->max = count;
+    return true;
+}
+
+
+/** \brief  Read text file \a path into memory
+ *
+ * \param[in]   path    path to file
+ * \param[out]  size    size of the text
+ *
+ * \return  heap-allocated text or `NULL` on failure
+ */
+static char *index_read_text(const char *path, size_t *size)
+{
+    uint8_t *data;
+    long result;
+
+    result = hvsc_pread_file(&data, path);
+    if (result < 0) {
+        return NULL;
+    }
+    if ((unsigned long)result >= UINT32_MAX) {
+        hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
+        hvsc_free(data);
+        return NULL;
+    }
+    *size = (size_t)result;
+    return (char *)data;
+}
+
+
+/** \brief  Free memory used by \a index and \a index itself
+ *
+ * \param[in,out]   index   index
+ */
+static void index_free(hvsc_index_t *index)
+{
+    if (index->map != NULL) {
+        /* the arrays point into the shared segment */
+        munmap(index->map, index->map_size);
+        hvsc_free(index);
+        return;
+    }
+    hvsc_sldb_table_free(&(index->sldb));
+    hvsc_free(index->stil_text);
+    hvsc_free(index->bugs_text);
+    hvsc_pathdict_free(&(index->paths));
+    hvsc_free(index->sldb_entry);
+    hvsc_free(index->stil);
+    hvsc_free(index->stil_hash);
+    hvsc_free(index->bugs);
+    hvsc_free(index->sum_tunes);
+    hvsc_free(index->sum_playtime);
+    hvsc_free(index->sum_stil);
+    hvsc_free(index->sum_bugs);
+    hvsc_free(index->digest_slots);
+    hvsc_free(index);
+}
+
+
+/** \brief  Build the tunes, paths and digest hash of \a index from \a records
+ *
+ * \param[in,out]   index   index
+ * \param[in]       records records, sorted on path
+ *
+ * \return  bool
+ */
+static bool index_build_tunes(hvsc_index_t *index,
+                              const index_records_t *records)
+{
+    hvsc_pathdict_builder_t builder;
+    size_t unique = 0;
+    size_t i;
+    size_t tune;
+
+    /* count unique paths */
+    for (i = 0; i < records->count; i++) {
+        if (i == 0 || index_record_cmp(&(records->list[i - 1]),
+                                       &(records->list[i])) != 0) {
+            unique++;
+        }
+    }
+
+    index->count = unique;
+    index->sldb_entry = hvsc_malloc((unique > 0 ? unique : 1)
+                                    * sizeof *(index->sldb_entry));
+    index->stil = hvsc_malloc((unique > 0 ? unique : 1)
+                              * sizeof *(index->stil));
+    index->stil_hash = hvsc_calloc(unique > 0 ? unique : 1,
+                                   sizeof *(index->stil_hash));
+    index->bugs = hvsc_malloc((unique > 0 ? unique : 1)
+                              * sizeof *(index->bugs));
+    index->digest_size = index_hash_size(index->sldb.count);
+    index->digest_slots = hvsc_calloc(index->digest_size,
+                                      sizeof *(index->digest_slots));
+    if (index->sldb_entry == NULL || index->stil == NULL
+            || index->stil_hash == NULL || index->bugs == NULL
+            || index->digest_slots == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    /* merge records with the same path into a single tune */
+    hvsc_pathdict_builder_init(&builder, &(index->paths));
+    tune = 0;
+    for (i = 0; i < records->count; i++) {
+        const index_record_t *rec = &(records->list[i]);
+
+        if (i == 0 || index_record_cmp(&(records->list[i - 1]), rec) != 0) {
+            if (i > 0) {
+                tune++;
+            }
+            if (!hvsc_pathdict_add(&builder, rec->path, rec->len)) {
+                return false;
+            }
+            index->sldb_entry[tune] = HVSC_INDEX_NONE;
+            index->stil[tune] = HVSC_INDEX_NONE;
+            index->bugs[tune] = HVSC_INDEX_NONE;
+        }
+
+        switch (rec->src) {
+            case INDEX_SRC_SLDB:
+                index->sldb_entry[tune] = rec->value;
+                break;
+            case INDEX_SRC_STIL:
+                index->stil[tune] = rec->value;
+                index->stil_hash[tune] = rec->content;
+                break;
+            default:
+                index->bugs[tune] = rec->value;
+                break;
+        }
+    }
+
+    hvsc_pathdict_finish(&builder);
+
+    /* digest hash, entries without a path comment can't be resolved */
+    for (tune = 0; tune < index->count; tune++) {
+        if (index->sldb_entry[tune] != HVSC_INDEX_NONE) {
+            const uint8_t *digest =
+                index->sldb.entries[index->sldb_entry[tune]].digest;
+            size_t mask = index->digest_size - 1;
+            size_t slot = index_hash_digest(digest) & mask;
+
+            while (index->digest_slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            index->digest_slots[slot] = (uint32_t)tune + 1;
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Calculate the totals of the tunes before each tune of \a index
+ *
+ * Directory entries in the STIL and BUGlist aren't counted as tunes.
+ *
+ * \param[in,out]   index   index
+ *
+ * \return  bool
+ */
+static bool index_build_sums(hvsc_index_t *index)
+{
+    hvsc_pathdict_iter_t iter;
+    const char *path;
+    size_t tune;
+
+    index->sum_tunes = hvsc_malloc((index->count + 1)
+                                   * sizeof *(index->sum_tunes));
+    index->sum_playtime = hvsc_malloc((index->count + 1)
+                                      * sizeof *(index->sum_playtime));
+    index->sum_stil = hvsc_malloc((index->count + 1)
+                                  * sizeof *(index->sum_stil));
+    index->sum_bugs = hvsc_malloc((index->count + 1)
+                                  * sizeof *(index->sum_bugs));
+    if (index->sum_tunes == NULL || index->sum_playtime == NULL
+            || index->sum_stil == NULL || index->sum_bugs == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    if (!hvsc_pathdict_iter_init(&iter, &(index->paths), 0)) {
+        return false;
+    }
+
+    index->sum_tunes[0] = 0;
+    index->sum_playtime[0] = 0;
+    index->sum_stil[0] = 0;
+    index->sum_bugs[0] = 0;
+    for (tune = 0; (path = hvsc_pathdict_iter_next(&iter)) != NULL; tune++) {
+        uint32_t row = index->sldb_entry[tune];
+        bool dir = iter.len > 0 && path[iter.len - 1] == '/';
+        uint64_t playtime = 0;
+
+        if (row != HVSC_INDEX_NONE) {
+            playtime = index->sldb.entries[row].playtime;
+        }
+        index->sum_tunes[tune + 1] = index->sum_tunes[tune]
+            + (row != HVSC_INDEX_NONE);
+        index->sum_playtime[tune + 1] = index->sum_playtime[tune] + playtime;
+        index->sum_stil[tune + 1] = index->sum_stil[tune]
+            + (!dir && index->stil[tune] != HVSC_INDEX_NONE);
+        index->sum_bugs[tune + 1] = index->sum_bugs[tune]
+            + (!dir && index->bugs[tune] != HVSC_INDEX_NONE);
+    }
+    hvsc_pathdict_iter_free(&iter);
+    return true;
+}
+
+
+/** \brief  Load the SLDB, STIL and BUGlist into memory and index them
+ *
+ * When \a old is given, SLDB entries and tunes that didn't change are taken
+ * from it instead of being parsed and sorted again.
+ *
+ * \param[in]   old     previous index or `NULL`
+ *
+ * \return  new index with a single reference, or `NULL` on failure
+ */
+static hvsc_index_t *index_build(const hvsc_index_t *old)
+{
+    bool result;
+    hvsc_index_t *index;
+    index_records_t records = { NULL, 0, 0 };
+    size_t i;
+
+    index = hvsc_calloc(1, sizeof *index);
+    if (index == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    index->refs = 1;
+
+    if (!hvsc_index_stamp_files(index->stamps)) {
+        hvsc_free(index);
+        return NULL;
+    }
+    if (old != NULL) {
+        result = hvsc_sldb_table_update(&(index->sldb), hvsc_sldb_path,
+                                        &(old->sldb));
+    } else {
+        result = hvsc_sldb_table_load(&(index->sldb), hvsc_sldb_path);
+    }
+    if (!result) {
+        hvsc_free(index);
+        return NULL;
+    }
+    index->stil_text = index_read_text(hvsc_stil_path, &(index->stil_size));
+    if (index->stil_text == NULL) {
+        index_free(index);
+        return NULL;
+    }
+    index->bugs_text = index_read_text(hvsc_bugs_path, &(index->bugs_size));
+    if (index->bugs_text == NULL) {
+        index_free(index);
+        return NULL;
+    }
+
+    for (i = 0; i < index->sldb.count; i++) {
+        const char *path = hvsc_sldb_table_path(&(index->sldb), i);
+
+        if (path != NULL && *path == '/'
+                && !index_add_record(&records, path, strlen(path),
+                                     INDEX_SRC_SLDB, (uint32_t)i)) {
+            hvsc_free(records.list);
+            index_free(index);
+            return NULL;
+        }
+    }
+    if (!index_scan_text(&records, index->stil_text, index->stil_size,
+                         INDEX_SRC_STIL)
+            || !index_scan_text(&records, index->bugs_text, index->bugs_size,
+                                INDEX_SRC_BUGS)
+            || !index_sort_records(&records, old)
+            || !index_build_tunes(index, &records)
+            || !index_build_sums(index)) {
+        hvsc_free(records.list);
+        index_free(index);
+        return NULL;
+    }
+    hvsc_free(records.list);
+
+    hvsc_dbg("indexed %zu tunes\n", index->count);
+    return index;
+}
+
+
+/** \brief  Make \a index the index in use
+ *
+ * The library's reference to the previous index is dropped, it is freed as
+ * soon as the last reader releases it.
+ *
+ * \param[in]   index   new index (`NULL` to unload)
+ * \param[in]   replace only publish when an index is loaded
+ *
+ * \return  false when \a replace is set and no index is loaded (\a index is
+ *          freed)
+ */
+static bool index_publish(hvsc_index_t *index, bool replace)
+{
+    hvsc_index_t *old;
+
+    pthread_mutex_lock(&index_lock);
+    old = index_current;
+    if (replace && old == NULL) {
+        pthread_mutex_unlock(&index_lock);
+        hvsc_index_release(index);
+        return false;
+    }
+    index_current = index;
+    pthread_mutex_unlock(&index_lock);
+    hvsc_index_release(old);
+    return true;
+}
+
+
+/** \brief  Load the SLDB, STIL and BUGlist into memory and index them
+ *
+ * After this call hvsc_stil_open(), hvsc_bugs_open() and the SLDB functions
+ * use the index instead of scanning the files, and SID files outside the HVSC
+ * are found by their MD5 digest. Loading an index replaces an index loaded
+ * earlier. The new index is built before it is swapped in, so this can be
+ * called while other threads use the library: lookups that already started,
+ * and open STIL and BUGlist handles, keep using the previous index.
+ *
+ * \return  bool
+ *
+ * \ingroup index
+ */
+bool hvsc_index_load(void)
+{
+    int prev = hvsc_stats_set_subsys(HVSC_STATS_INDEX);
+    hvsc_index_t *index;
+
+    index = index_build(NULL);
+    hvsc_stats_set_subsys(prev);
+    if (index == NULL) {
+        return false;
+    }
+    index_publish(index, false);
+    return true;
+}
+
+
+/** \brief  Drop STIL cache entries that differ between \a index and \a old
+ *
+ * Uses the hashes of the STIL entries, so only changed and removed entries
+ * are parsed again. Both path lists are sorted, so they're walked side by
+ * side.
+ *
+ * \param[in]   index   new index
+ * \param[in]   old     previous index
+ */
+static void index_invalidate_stil(const hvsc_index_t *index,
+                                  const hvsc_index_t *old)
+{
+    hvsc_pathdict_iter_t old_iter;
+    hvsc_pathdict_iter_t new_iter;
+    const char *old_path;
+    const char *new_path;
+    size_t tune;
+    size_t changed = 0;
+
+    if (!hvsc_stil_cache_is_open()) {
+        return;
+    }
+    if (!hvsc_pathdict_iter_init(&old_iter, &(old->paths), 0)) {
+        /* drop all entries rather than keep stale ones */
+        hvsc_stil_cache_clear();
+        return;
+    }
+    if (!hvsc_pathdict_iter_init(&new_iter, &(index->paths), 0)) {
+        hvsc_pathdict_iter_free(&old_iter);
+        hvsc_stil_cache_clear();
+        return;
+    }
+    new_path = hvsc_pathdict_iter_next(&new_iter);
+    for (tune = 0; (old_path = hvsc_pathdict_iter_next(&old_iter)) != NULL;
+            tune++) {
+        int result = 1;
+
+        /* skip new paths before the old one */
+        while (new_path != NULL
+                && (result = strcmp(new_path, old_path)) < 0) {
+            new_path = hvsc_pathdict_iter_next(&new_iter);
+        }
+        if (new_path == NULL) {
+            result = 1;
+        }
+        if (old->stil[tune] != HVSC_INDEX_NONE) {
+            size_t found = new_iter.id - 1;
+
+            if (result != 0 || index->stil[found] == HVSC_INDEX_NONE
+                    || index->stil_hash[found] != old->stil_hash[tune]) {
+                hvsc_stil_cache_invalidate(old_path);
+                changed++;
+            }
+        }
+    }
+    hvsc_pathdict_iter_free(&new_iter);
+    hvsc_pathdict_iter_free(&old_iter);
+    hvsc_dbg("invalidated %zu STIL entries\n", changed);
+}
+
+
+/** \brief  Rebuild the index from the changed files when it's loaded
+ *
+ * Unchanged entries are reused from the current index (see index_build()),
+ * and cached STIL entries that changed are dropped. On failure the current
+ * index stays in use.
+ *
+ * \param[out]  loaded  an index was loaded
+ *
+ * \return  bool
+ */
+bool hvsc_index_reload(bool *loaded)
+{
+    hvsc_index_t *old;
+    hvsc_index_t *index;
+    int prev;
+
+    old = hvsc_index_acquire();
+    *loaded = old != NULL;
+    if (old == NULL) {
+        return true;
+    }
+
+    prev = hvsc_stats_set_subsys(HVSC_STATS_INDEX);
+    index = NULL;
+    if (old->map != NULL
+            && !__atomic_load_n(&index_sharing, __ATOMIC_RELAXED)) {
+        /* the sharing process could have updated the segment already */
+        index = hvsc_shm_index_attach();
+    }
+    if (index == NULL) {
+        index = index_build(old);
+    }
+    hvsc_stats_set_subsys(prev);
+    if (index == NULL) {
+        hvsc_index_release(old);
+        return false;
+    }
+    /* keep the new index alive for the STIL check */
+    __atomic_add_fetch(&(index->refs), 1, __ATOMIC_RELAXED);
+    /* the index could have been freed while building the new one */
+    if (index_publish(index, true)) {
+        index_invalidate_stil(index, old);
+        if (__atomic_load_n(&index_sharing, __ATOMIC_RELAXED)
+                && !hvsc_shm_index_write(index)) {
+            hvsc_dbg("failed to update the shared index\n");
+        }
+    }
+    hvsc_index_release(index);
+    hvsc_index_release(old);
+    return true;
+}
+
+
+/** \brief  Free the index loaded with hvsc_index_load()
+ *
+ * The library falls back to scanning the files. Readers still using the
+ * index keep it alive until they release it.
+ *
+ * \ingroup index
+ */
+void hvsc_index_free(void)
+{
+    index_publish(NULL, false);
+}
+
+
+/** \brief  Share the index with other processes on this host
+ *
+ * Copies the index into a shared memory segment for the HVSC root, where
+ * other processes can attach to it with hvsc_index_attach() instead of
+ * building their own. The index is loaded first when it isn't. While shared,
+ * a reload (see hvsc_watch_start()) updates the segment as well.
+ *
+ * \return  bool
+ *
+ * \ingroup index
+ */
+bool hvsc_index_share(void)
+{
+    hvsc_index_t *index;
+    bool result;
+
+    index = hvsc_index_acquire();
+    if (index == NULL) {
+        if (!hvsc_index_load()) {
+            return false;
+        }
+        index = hvsc_index_acquire();
+        if (index == NULL) {
+            hvsc_errno = HVSC_ERR_INVALID;
+            return false;
+        }
+    }
+    result = hvsc_shm_index_write(index);
+    hvsc_index_release(index);
+    if (result) {
+        __atomic_store_n(&index_sharing, true, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+
+/** \brief  Use the index shared by another process
+ *
+ * Maps the segment written by hvsc_index_share() read-only, which takes a
+ * fraction of the time and memory of hvsc_index_load(). The segment is only
+ * used when it was built from the current SLDB, STIL and BUGlist.
+ *
+ * \return  bool, hvsc_errno is HVSC_ERR_NOT_FOUND when no index is shared
+ *          and HVSC_ERR_INVALID when the shared index is out of date
+ *
+ * \ingroup index
+ */
+bool hvsc_index_attach(void)
+{
+    int prev = hvsc_stats_set_subsys(HVSC_STATS_INDEX);
+    hvsc_index_t *index;
+
+    index = hvsc_shm_index_attach();
+    hvsc_stats_set_subsys(prev);
+    if (index == NULL) {
+        return false;
+    }
+    index_publish(index, false);
+    return true;
+}
+
+
+/** \brief  Stop sharing the index
+ *
+ * Removes the shared memory segment. Processes attached to it keep using it
+ * until they load another index or exit.
+ *
+ * \return  bool
+ *
+ * \ingroup index
+ */
+bool hvsc_index_unshare(void)
+{
+    __atomic_store_n(&index_sharing, false, __ATOMIC_RELAXED);
+    return hvsc_shm_index_remove();
+}
+
+
+/** \brief  Get a reference to the index in use
+ *
+ * The index stays valid until the reference is dropped with
+ * hvsc_index_release(), even when a new index is loaded in the meantime.
+ *
+ * \return  index or `NULL` when not loaded
+ */
+hvsc_index_t *hvsc_index_acquire(void)
+{
+    hvsc_index_t *index;
+
+    pthread_mutex_lock(&index_lock);
+    index = index_current;
+    if (index != NULL) {
+        __atomic_add_fetch(&(index->refs), 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&index_lock);
+    return index;
+}
+
+
+/** \brief  Drop a reference to \a index
+ *
+ * \param[in,out]   index   index (`NULL` is ignored)
+ */
+void hvsc_index_release(hvsc_index_t *index)
+{
+    if (index != NULL
+            && __atomic_sub_fetch(&(index->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+        int prev = hvsc_stats_set_subsys(HVSC_STATS_INDEX);
+
+        index_free(index);
+        hvsc_stats_set_subsys(prev);
+    }
+}
+
+
+/** \brief  Find tune ID of \a path
+ *
+ * \param[in]   index   index
+ * \param[in]   path    path relative to the HVSC root (with leading '/')
+ *
+ * \return  tune ID or -1 when not found
+ */
+long hvsc_index_find_path(const hvsc_index_t *index, const char *path)
+{
+    long tune = hvsc_pathdict_find(&(index->paths), path, strlen(path));
+
+    hvsc_stats_lookup(HVSC_STATS_INDEX, tune >= 0);
+    if (tune < 0) {
+        hvsc_errno = HVSC_ERR_NOT_FOUND;
+    }
+    return tune;
+}
+
+
+/** \brief  Find tune ID of MD5 \a digest
+ *
+ * \param[in]   index   index
+ * \param[in]   digest  MD5 digest (HVSC_DIGEST_SIZE bytes)
+ *
+ * \return  tune ID or -1 when not found
+ */
+long hvsc_index_find_digest(const hvsc_index_t *index, const uint8_t *digest)
+{
+    size_t mask = index->digest_size - 1;
+    size_t slot = index_hash_digest(digest) & mask;
+
+    while (index->digest_slots[slot] != 0) {
+        size_t tune = index->digest_slots[slot] - 1;
+        const hvsc_sldb_entry_t *entry =
+            &(index->sldb.entries[index->sldb_entry[tune]]);
+
+        if (memcmp(entry->digest, digest, HVSC_DIGEST_SIZE) == 0) {
+            hvsc_stats_lookup(HVSC_STATS_INDEX, true);
+            return (long)tune;
+        }
+        slot = (slot + 1) & mask;
+    }
+    hvsc_stats_lookup(HVSC_STATS_INDEX, false);
+    hvsc_errno = HVSC_ERR_NOT_FOUND;
+    return -1;
+}
+
+
+/** \brief  Find tune ID of PSID file \a psid
+ *
+ * Looks up the path of \a psid with the HVSC root stripped. If the path isn't
+ * known, the file is probably outside the HVSC or renamed, so its MD5 digest
+ * is calculated (using the digest cache, if open) and looked up instead.
+ *
+ * \param[in]   index   index
+ * \param[in]   psid    path to PSID file
+ *
+ * \return  tune ID or -1 when not found
+ */
+long hvsc_index_find_psid(const hvsc_index_t *index, const char *psid)
+{
+    uint8_t digest[HVSC_DIGEST_SIZE];
+    char *path;
+    long tune;
+
+    path = hvsc_path_strip_root(psid);
+    if (path == NULL) {
+        return -1;
+    }
+    tune = hvsc_index_find_path(index, path);
+    hvsc_free(path);
+    if (tune >= 0) {
+        return tune;
+    }
+
+    if (!hvsc_dcache_digest(psid, digest)) {
+        hvsc_errno = HVSC_ERR_NOT_FOUND;
+        return -1;
+    }
+    return hvsc_index_find_digest(index, digest);
+}
+
+
+/** \brief  Get path of \a tune
+ *
+ * The paths are front-coded, so the path is decoded into a new string.
+ *
+ * \param[in]   index   index
+ * \param[in]   tune    tune ID
+ *
+ * \return  heap-allocated path relative to the HVSC root, or `NULL` when out
+ *          of memory
+ */
+char *hvsc_index_path(const hvsc_index_t *index, size_t tune)
+{
+    return hvsc_pathdict_get(&(index->paths), tune);
+}
+
+
+/** \brief  Get path of \a tune as a result for the caller of the library
+ *
+ * \param[in]   index   index
+ * \param[in]   tune    tune ID
+ *
+ * \return  path allocated with malloc() or `NULL` when out of memory
+ */
+static char *index_path_result(const hvsc_index_t *index, size_t tune)
+{
+    char *path;
+    char *result;
+
+    path = hvsc_index_path(index, tune);
+    if (path == NULL) {
+        return NULL;
+    }
+    result = hvsc_strdup_result(path);
+    hvsc_free(path);
+    return result;
+}
+
+
+/** \brief  Get the identity of the SLDB, STIL and BUGlist
+ *
+ * \param[out]  stamps  stamps of the SLDB, STIL and BUGlist, in that order
+ *
+ * \return  bool
+ */
+bool hvsc_index_stamp_files(hvsc_index_stamp_t *stamps)
+{
+    const char *paths[HVSC_INDEX_FILES];
+    int i;
+
+    paths[0] = hvsc_sldb_path;
+    paths[1] = hvsc_stil_path;
+    paths[2] = hvsc_bugs_path;
+    memset(stamps, 0, HVSC_INDEX_FILES * sizeof *stamps);
+    for (i = 0; i < HVSC_INDEX_FILES; i++) {
+        struct stat st;
+
+        if (stat(paths[i], &st) != 0) {
+            hvsc_errno = HVSC_ERR_IO;
+            return false;
+        }
+        stamps[i].dev = (uint64_t)st.st_dev;
+        stamps[i].ino = (uint64_t)st.st_ino;
+        stamps[i].size = (uint64_t)st.st_size;
+        stamps[i].mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL
+            + (uint64_t)st.st_mtim.tv_nsec;
+    }
+    return true;
+}
+
+
+/** \brief  Resolve MD5 \a digest to the path of the tune in the HVSC
+ *
+ * \param[in]   digest  MD5 digest (HVSC_DIGEST_SIZE bytes)
+ *
+ * In client mode hvscd resolves the digest with its index.
+ *
+ * \return  heap-allocated path relative to the HVSC root, or `NULL` when
+ *          not found or the index isn't loaded
+ *
+ * \ingroup index
+ */
+char *hvsc_index_resolve_digest(const uint8_t *digest)
+{
+    hvsc_index_t *index;
+    char *result = NULL;
+    long tune;
+
+    HVSC_RECORD_DIGEST(HVSC_OP_INDEX_RESOLVE_DIGEST, digest);
+    if (HVSC_CLIENT_ACTIVE()) {
+        return hvsc_client_lookup_result(HVSC_PROTO_RESOLVE, NULL, digest);
+    }
+    index = hvsc_index_acquire();
+    if (index == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return NULL;
+    }
+    tune = hvsc_index_find_digest(index, digest);
+    if (tune >= 0) {
+        result = index_path_result(index, (size_t)tune);
+    }
+    hvsc_index_release(index);
+    return result;
+}
+
+
+/** \brief  Resolve SID file \a psid to the path of the tune in the HVSC
+ *
+ * \a psid can be anywhere: a file inside the HVSC resolves to its own path, a
+ * copy of a HVSC file elsewhere resolves through its MD5 digest.
+ *
+ * In client mode hvscd resolves the file with its index.
+ *
+ * \param[in]   psid    path to PSID file
+ *
+ * \return  heap-allocated path relative to the HVSC root, or `NULL` when
+ *          not found or the index isn't loaded
+ *
+ * \ingroup index
+ */
+char *hvsc_index_resolve(const char *psid)
+{
+    hvsc_index_t *index;
+    char *result = NULL;
+    long tune;
+
+    HVSC_RECORD_PATH(HVSC_OP_INDEX_RESOLVE, psid);
+    if (HVSC_CLIENT_ACTIVE()) {
+        return hvsc_client_lookup_result(HVSC_PROTO_RESOLVE, psid, NULL);
+    }
+    index = hvsc_index_acquire();
+    if (index == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return NULL;
+    }
+    tune = hvsc_index_find_psid(index, psid);
+    if (tune >= 0) {
+        result = index_path_result(index, (size_t)tune);
+    }
+    hvsc_index_release(index);
+    return result;
+}
+
+
+/** \brief  Find the range of tunes in directory \a prefix
+ *
+ * A '/' is appended to a non-empty \a prefix that doesn't end with one, so
+ * "/MUSICIANS/H/Hubbard" doesn't also match "/MUSICIANS/H/Hubbard_Rob/".
+ *
+ * \param[in]   index   index
+ * \param[in]   prefix  directory relative to the HVSC root ("" for all)
+ * \param[out]  first   first tune in the directory
+ * \param[out]  last    tune after the last tune in the directory
+ *
+ * \return  bool
+ */
+static bool index_dir_range(const hvsc_index_t *index, const char *prefix,
+                            size_t *first, size_t *last)
+{
+    size_t len = strlen(prefix);
+    char *dir;
+    bool result;
+
+    if (len == 0 || prefix[len - 1] == '/') {
+        return hvsc_pathdict_prefix(&(index->paths), prefix, len,
+                                    first, last);
+    }
+
+    dir = hvsc_malloc(len + 2);
+    if (dir == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    memcpy(dir, prefix, len);
+    dir[len] = '/';
+    dir[len + 1] = '\0';
+    result = hvsc_pathdict_prefix(&(index->paths), dir, len + 1, first, last);
+    hvsc_free(dir);
+    return result;
+}
+
+
+/** \brief  List the tunes with song lengths under \a prefix
+ *
+ * Calls \a callback for every tune in the SLDB in directory \a prefix or its
+ * subdirectories, in sorted order, with its song lengths. The paths are sorted in
+ * the index, so the tunes with a prefix are found with two binary searches
+ * and listed without touching the file system: pass a directory like
+ * "/MUSICIANS/H/Hubbard_Rob/" to list it with the lengths of its tunes, or
+ * "" to list the whole collection.
+ *
+ * Needs the index in this process, loaded or attached.
+ *
+ * \param[in]   prefix      directory relative to the HVSC root, a missing
+ *                          trailing '/' is added
+ * \param[in]   callback    function to call for each tune
+ * \param[in]   data        user data passed to \a callback
+ *
+ * \return  number of tunes listed or -1 on error
+ *
+ * \ingroup index
+ */
+long hvsc_index_list(const char *prefix, hvsc_index_list_cb_t callback,
+                     void *data)
+{
+    hvsc_index_t *index;
+    hvsc_pathdict_iter_t iter;
+    const char *path;
+    long *lengths = NULL;
+    int lengths_max = 0;
+    long listed = 0;
+    size_t first;
+    size_t last;
+    size_t tune;
+
+    index = hvsc_index_acquire();
+    if (index == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return -1;
+    }
+    if (!index_dir_range(index, prefix, &first, &last)
+            || !hvsc_pathdict_iter_init(&iter, &(index->paths), first)) {
+        hvsc_index_release(index);
+        return -1;
+    }
+
+    for (tune = first; tune < last; tune++) {
+        uint32_t row = index->sldb_entry[tune];
+        int songs;
+
+        path = hvsc_pathdict_iter_next(&iter);
+        if (row == HVSC_INDEX_NONE) {
+            /* only in the STIL or BUGlist, or a directory */
+            continue;
+        }
+        songs = index->sldb.entries[row].songs;
+        if (songs > lengths_max) {
+            long *tmp = hvsc_realloc(lengths, (size_t)songs * sizeof *tmp);
+
+            if (tmp == NULL) {
+                hvsc_errno = HVSC_ERR_OOM;
+                listed = -1;
+                break;
+            }
+            lengths = tmp;
+            lengths_max = songs;
+        }
+        songs = hvsc_sldb_table_lengths(&(index->sldb), row, lengths);
+        if (songs < 0) {
+            hvsc_errno = HVSC_ERR_TIMESTAMP;
+            listed = -1;
+            break;
+        }
+        listed++;
+        if (!callback(tune, path, songs, lengths, data)) {
+            break;
+        }
+    }
+    hvsc_free(lengths);
+    hvsc_pathdict_iter_free(&iter);
+    hvsc_index_release(index);
+    return listed;
+}
+
+
+/** \brief  Get the totals of the tunes under \a prefix
+ *
+ * The index keeps running totals over its sorted paths, calculated when it's
+ * built, so the totals of a directory are the difference of the totals at
+ * the ends of its range of tunes: no tunes are looked up or counted. Pass a
+ * directory like "/MUSICIANS/H/Hubbard_Rob/" for the totals of a composer,
+ * or "" for the whole collection; a missing trailing '/' is added, so
+ * "/MUSICIANS/H/Hubbard" doesn't include Hubbard_Rob. Directory entries in
+ * the STIL and BUGlist aren't counted.
+ *
+ * Needs the index in this process, loaded or attached.
+ *
+ * \param[in]   prefix  directory relative to the HVSC root
+ * \param[out]  totals  totals of the tunes in \a prefix
+ *
+ * \return  bool
+ *
+ * \ingroup index
+ */
+bool hvsc_index_get_totals(const char *prefix, hvsc_index_totals_t *totals)
+{
+    hvsc_index_t *index;
+    size_t first;
+    size_t last;
+
+    index = hvsc_index_acquire();
+    if (index == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    if (!index_dir_range(index, prefix, &first, &last)) {
+        hvsc_index_release(index);
+        return false;
+    }
+    totals->tunes = index->sum_tunes[last] - index->sum_tunes[first];
+    totals->playtime = index->sum_playtime[last]
+        - index->sum_playtime[first];
+    totals->stil = index->sum_stil[last] - index->sum_stil[first];
+    totals->bugs = index->sum_bugs[last] - index->sum_bugs[first];
+    hvsc_index_release(index);
+    return true;
+}
@@ -0,0 +1,124 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/index.h
+ * \brief   In-memory index of the SLDB, STIL and BUGlist - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_INDEX_H
+#define HVSC_INDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc_defs.h"
+#include "sldb.h"
+#include "pathdict.h"
+
+/** \brief  Marker for a tune without an entry in one of the files
+ */
+#define HVSC_INDEX_NONE     UINT32_MAX
+
+
+/** \brief  Number of files an index is built from: SLDB, STIL and BUGlist
+ */
+#define HVSC_INDEX_FILES    3
+
+
+/** \brief  Identity of one of the files an index was built from
+ *
+ * Taken before the file is read, so a file changed while building the index
+ * doesn't match its stamp anymore.
+ */
+typedef struct hvsc_index_stamp_s {
+    uint64_t    dev;    /**< device */
+    uint64_t    ino;    /**< inode */
+    uint64_t    size;   /**< size in bytes */
+    uint64_t    mtime;  /**< modification time in nanoseconds */
+} hvsc_index_stamp_t;
+
+
+/** \brief  Index of the SLDB, STIL and BUGlist
+ *
+ * Every path found in one of the files is a 'tune', the tunes are sorted on
+ * path and the index in the sorted list is the tune ID. For each tune the
+ * index stores where to find its entries in the three files, which are kept
+ * in memory. The paths are kept in a front-coded dictionary (see pathdict.c),
+ * which maps them to tune IDs, a hash table maps digests to tune IDs.
+ *
+ * All references between the arrays are offsets or indexes, so the index can
+ * be copied into a shared memory segment as is and used by other processes
+ * (see shmindex.c). An index attached that way has \a map set and its arrays
+ * point into the read-only mapping.
+ */
+typedef struct hvsc_index_s {
+    hvsc_sldb_table_t   sldb;       /**< SLDB table (owns the SLDB text) */
+    char *              stil_text;  /**< contents of STIL.txt */
+    size_t              stil_size;  /**< size of \a stil_text */
+    char *              bugs_text;  /**< contents of BUGlist.txt */
+    size_t              bugs_size;  /**< size of \a bugs_text */
+
+    hvsc_pathdict_t     paths;      /**< paths, tune ID is the path ID */
+
+    size_t              count;      /**< number of tunes */
+    uint32_t *          sldb_entry; /**< index in the SLDB table per tune */
+    uint32_t *          stil;       /**< offset in \a stil_text of the line
+                                         following the path, per tune */
+    uint64_t *          stil_hash;  /**< hash of the STIL entry text per
+                                         tune, to find changed entries */
+    uint32_t *          bugs;       /**< offset in \a bugs_text of the line
+                                         following the path, per tune */
+
+    /* totals of the tunes before each tune ID, `count + 1` entries: the
+     * totals of a range of tunes are the difference of two entries */
+    uint32_t *          sum_tunes;      /**< tunes in the SLDB */
+    uint64_t *          sum_playtime;   /**< song lengths in seconds */
+    uint32_t *          sum_stil;       /**< tunes with a STIL entry */
+    uint32_t *          sum_bugs;       /**< tunes with a BUGlist entry */
+
+    uint32_t *          digest_slots;   /**< digest hash: tune ID + 1 */
+    size_t              digest_size;    /**< number of digest slots */
+
+    hvsc_index_stamp_t  stamps[HVSC_INDEX_FILES];   /**< SLDB, STIL and
+                                                         BUGlist identity */
+    void *              map;        /**< shared memory mapping or `NULL` */
+    size_t              map_size;   /**< size of \a map */
+
+    size_t              refs;       /**< references: one held by the library
+                                         while in use, one per reader */
+} hvsc_index_t;
+
+
+hvsc_index_t *hvsc_index_acquire(void);
+void        hvsc_index_release(hvsc_index_t *index);
+bool        hvsc_index_reload(bool *loaded);
+
+long        hvsc_index_find_path(const hvsc_index_t *index, const char *path);
+long        hvsc_index_find_digest(const hvsc_index_t *index,
+                                   const uint8_t *digest);
+long        hvsc_index_find_psid(const hvsc_index_t *index, const char *psid);
+char *      hvsc_index_path(const hvsc_index_t *index, size_t tune);
+bool        hvsc_index_stamp_files(hvsc_index_stamp_t *stamps);
+
+#endif
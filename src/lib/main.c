@@ -38,8 +38,10 @@
 
 #include "hvsc_defs.h"
 #include "base.h"
+#include "alloc.h"
 #include "stil.h"
 #include "sldb.h"
+#include "record.h"
 
 #include "main.h"
 
@@ -69,19 +71,71 @@
  */
 bool hvsc_init(const char *path)
 {
+    return hvsc_init_ex(path, 0);
+}
+
+
+/** \brief  Initialize the library, optionally with a shared index
+ *
+ * Like hvsc_init(), with \a flags to set up an index shared between the
+ * processes using the same HVSC on this host:
+ *
+ * - HVSC_INIT_ATTACH_INDEX: attach to the shared index if present and up to
+ *   date (see hvsc_index_attach()), otherwise continue without an index
+ * - HVSC_INIT_SHARE_INDEX: when not attached, load the index and share it
+ *   (see hvsc_index_share())
+ *
+ * With both flags the first process builds the index and later processes
+ * only map it.
+ *
+ * \param[in]   path    absolute path to HVSC root directory
+ * \param[in]   flags   HVSC_INIT_* flags or 0
+ *
+ * \return  bool
+ *
+ * \ingroup main
+ */
+bool hvsc_init_ex(const char *path, int flags)
+{
+    bool attached = false;
+
+    hvsc_errno = 0;
+    if (!hvsc_set_paths(path)) {
+        return false;
+    }
+    if (flags & HVSC_INIT_ATTACH_INDEX) {
+        attached = hvsc_index_attach();
+        if (!attached && hvsc_errno == HVSC_ERR_OOM) {
+            return false;
+        }
+    }
+    if ((flags & HVSC_INIT_SHARE_INDEX) && !attached) {
+        return hvsc_index_share();
+    }
     hvsc_errno = 0;
-    return hvsc_set_paths(path);
+    return true;
 }
 
 
 /** \brief  Clean up memory used by the library
  *
- * Free all memory used by the library.
+ * Free all memory used by the library, disconnect from hvscd, and stop the
+ * DOCUMENTS watcher, the prefetcher and the workload recorder when they're
+ * running.
  *
  * \ingroup main
  */
 void hvsc_exit(void)
 {
+    hvsc_watch_stop();
+    hvsc_prefetch_stop();
+    hvsc_client_disconnect();
+    if (HVSC_RECORD_ENABLED()) {
+        hvsc_record_stop();
+    }
+    hvsc_stil_cache_close();
+    hvsc_index_free();
+    hvsc_dcache_close();
     hvsc_free_paths();
 }
 
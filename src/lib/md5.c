@@ -0,0 +1,232 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/md5.c
+ * \brief   MD5 message digest
+ *
+ * Implementation of the MD5 algorithm as described in RFC 1321, used to
+ * calculate the digests used as keys in the Songlengths.md5 file. This
+ * removes the need to link against libgcrypt.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+
+#include "md5.h"
+
+
+/** \brief  Per-round shift amounts
+ */
+static const uint8_t md5_shifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+/** \brief  Per-round constants: floor(abs(sin(i + 1)) * 2^32)
+ */
+static const uint32_t md5_constants[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+
+/** \brief  Process a single 64-byte block
+ *
+ * \param[in,out]   ctx     MD5 context
+ * \param[in]       block   64 bytes of input
+ */
+static void md5_transform(hvsc_md5_ctx_t *ctx, const uint8_t *block)
+{
+    uint32_t m[16];
+    uint32_t a = ctx->state[0];
+    uint32_t b = ctx->state[1];
+    uint32_t c = ctx->state[2];
+    uint32_t d = ctx->state[3];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        m[i] = (uint32_t)block[i * 4]
+            | ((uint32_t)block[i * 4 + 1] << 8)
+            | ((uint32_t)block[i * 4 + 2] << 16)
+            | ((uint32_t)block[i * 4 + 3] << 24);
+    }
+
+    for (i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) & 15;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+
+        f += a + md5_constants[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (f << md5_shifts[i]) | (f >> (32 - md5_shifts[i]));
+    }
+
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+}
+
+
+/** \brief  Initialize MD5 context
+ *
+ * \param[out]  ctx MD5 context
+ */
+void hvsc_md5_init(hvsc_md5_ctx_t *ctx)
+{
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xefcdab89;
+    ctx->state[2] = 0x98badcfe;
+    ctx->state[3] = 0x10325476;
+    ctx->length = 0;
+}
+
+
+/** \brief  Add \a size bytes of \a data to the digest
+ *
+ * \param[in,out]   ctx     MD5 context
+ * \param[in]       data    data
+ * \param[in]       size    number of bytes in \a data
+ */
+void hvsc_md5_update(hvsc_md5_ctx_t *ctx, const uint8_t *data, size_t size)
+{
+    size_t used = (size_t)(ctx->length & 63);
+
+    ctx->length += size;
+
+    /* fill up partial block */
+    if (used > 0) {
+        size_t n = 64 - used;
+
+        if (n > size) {
+            n = size;
+        }
+        memcpy(ctx->buffer + used, data, n);
+        data += n;
+        size -= n;
+        if (used + n < 64) {
+            return;
+        }
+        md5_transform(ctx, ctx->buffer);
+    }
+
+    /* full blocks straight from the input */
+    while (size >= 64) {
+        md5_transform(ctx, data);
+        data += 64;
+        size -= 64;
+    }
+
+    if (size > 0) {
+        memcpy(ctx->buffer, data, size);
+    }
+}
+
+
+/** \brief  Finish calculating the digest and store it in \a digest
+ *
+ * \param[in,out]   ctx     MD5 context
+ * \param[out]      digest  memory to store digest (HVSC_DIGEST_SIZE bytes)
+ */
+void hvsc_md5_final(hvsc_md5_ctx_t *ctx, uint8_t *digest)
+{
+    uint64_t bits = ctx->length * 8;
+    size_t used = (size_t)(ctx->length & 63);
+    int i;
+
+    /* pad with 0x80 followed by zeroes up to 56 bytes mod 64 */
+    ctx->buffer[used++] = 0x80;
+    if (used > 56) {
+        memset(ctx->buffer + used, 0, 64 - used);
+        md5_transform(ctx, ctx->buffer);
+        used = 0;
+    }
+    memset(ctx->buffer + used, 0, 56 - used);
+
+    /* message length in bits, little endian */
+    for (i = 0; i < 8; i++) {
+        ctx->buffer[56 + i] = (uint8_t)(bits >> (i * 8));
+    }
+    md5_transform(ctx, ctx->buffer);
+
+    for (i = 0; i < 4; i++) {
+        digest[i * 4] = (uint8_t)ctx->state[i];
+        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 8);
+        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 16);
+        digest[i * 4 + 3] = (uint8_t)(ctx->state[i] >> 24);
+    }
+}
+
+
+/** \brief  Calculate MD5 digest of \a size bytes of \a data
+ *
+ * \param[in]   data    data
+ * \param[in]   size    size of \a data
+ * \param[out]  digest  memory to store digest (HVSC_DIGEST_SIZE bytes)
+ */
+void hvsc_md5(const uint8_t *data, size_t size, uint8_t *digest)
+{
+    hvsc_md5_ctx_t ctx;
+
+    hvsc_md5_init(&ctx);
+    hvsc_md5_update(&ctx, data, size);
+    hvsc_md5_final(&ctx, digest);
+}
@@ -0,0 +1,50 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/md5.h
+ * \brief   MD5 message digest - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_MD5_H
+#define HVSC_MD5_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "hvsc_defs.h"
+
+/** \brief  MD5 context
+ */
+typedef struct hvsc_md5_ctx_s {
+    uint32_t    state[4];       /**< intermediate digest (A, B, C, D) */
+    uint64_t    length;         /**< number of bytes processed */
+    uint8_t     buffer[64];     /**< partial block */
+} hvsc_md5_ctx_t;
+
+
+void    hvsc_md5_init(hvsc_md5_ctx_t *ctx);
+void    hvsc_md5_update(hvsc_md5_ctx_t *ctx, const uint8_t *data, size_t size);
+void    hvsc_md5_final(hvsc_md5_ctx_t *ctx, uint8_t *digest);
+
+
+#endif
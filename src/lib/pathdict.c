@@ -0,0 +1,594 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/pathdict.c
+ * \brief   Front-coded sorted path dictionary
+ *
+ * HVSC paths share long prefixes ("/MUSICIANS/H/Hubbard_Rob/..."), so storing
+ * each path after the previous one as the length of the shared prefix plus
+ * the remainder takes a fraction of the memory of separate strings. Paths are
+ * grouped in blocks that start with a full path: a lookup binary searches the
+ * block heads and then scans a single block, without decoding any path.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "alloc.h"
+
+#include "pathdict.h"
+
+
+/** \brief  Initialize \a dict as empty
+ *
+ * \param[out]  dict    dictionary
+ */
+void hvsc_pathdict_init(hvsc_pathdict_t *dict)
+{
+    dict->data = NULL;
+    dict->data_size = 0;
+    dict->blocks = NULL;
+    dict->count = 0;
+    dict->max_len = 0;
+}
+
+
+/** \brief  Free memory used by \a dict, leaving it empty
+ *
+ * \param[in,out]   dict    dictionary
+ */
+void hvsc_pathdict_free(hvsc_pathdict_t *dict)
+{
+    hvsc_free(dict->data);
+    hvsc_free(dict->blocks);
+    hvsc_pathdict_init(dict);
+}
+
+
+/** \brief  Get number of blocks of \a dict
+ *
+ * \param[in]   dict    dictionary
+ *
+ * \return  number of blocks
+ */
+size_t hvsc_pathdict_block_count(const hvsc_pathdict_t *dict)
+{
+    return (dict->count + HVSC_PATHDICT_BLOCK - 1) / HVSC_PATHDICT_BLOCK;
+}
+
+
+/** \brief  Read a variable length integer at \a pos in \a data
+ *
+ * \param[in]       data    data
+ * \param[in,out]   pos     offset in \a data, moved past the integer
+ *
+ * \return  value
+ */
+static size_t pathdict_read_num(const uint8_t *data, size_t *pos)
+{
+    size_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+
+    do {
+        byte = data[(*pos)++];
+        value |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+
+/** \brief  Read a variable length integer, checking the bounds of \a data
+ *
+ * \param[in]       data    data
+ * \param[in]       size    size of \a data
+ * \param[in,out]   pos     offset in \a data, moved past the integer
+ * \param[out]      value   value
+ *
+ * \return  `false` when the integer runs past \a size or is too large
+ */
+static bool pathdict_read_num_checked(const uint8_t *data, size_t size,
+                                      size_t *pos, size_t *value)
+{
+    int shift = 0;
+    uint8_t byte;
+
+    *value = 0;
+    do {
+        if (*pos >= size || shift > 28) {
+            return false;
+        }
+        byte = data[(*pos)++];
+        *value |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return true;
+}
+
+
+/** \brief  Check that the paths in \a dict can be decoded safely
+ *
+ * For a dictionary from an untrusted source, like a mapped file.
+ *
+ * \param[in]   dict    dictionary
+ *
+ * \return  bool
+ */
+bool hvsc_pathdict_check(const hvsc_pathdict_t *dict)
+{
+    size_t pos = 0;
+    size_t prev_len = 0;
+    size_t id;
+
+    for (id = 0; id < dict->count; id++) {
+        size_t prefix;
+        size_t suffix;
+
+        if (id % HVSC_PATHDICT_BLOCK == 0) {
+            if (dict->blocks[id / HVSC_PATHDICT_BLOCK] != pos) {
+                return false;
+            }
+            prev_len = 0;
+        }
+        if (!pathdict_read_num_checked(dict->data, dict->data_size, &pos,
+                                       &prefix)
+                || !pathdict_read_num_checked(dict->data, dict->data_size,
+                                              &pos, &suffix)
+                || prefix > prev_len
+                || suffix > dict->max_len - prefix
+                || suffix > dict->data_size - pos) {
+            return false;
+        }
+        pos += suffix;
+        prev_len = prefix + suffix;
+    }
+    return pos == dict->data_size;
+}
+
+
+/** \brief  Append a variable length integer to the dictionary being built
+ *
+ * Room must have been reserved by the caller.
+ *
+ * \param[in,out]   dict    dictionary
+ * \param[in]       value   value
+ */
+static void pathdict_write_num(hvsc_pathdict_t *dict, size_t value)
+{
+    while (value >= 0x80) {
+        dict->data[dict->data_size++] = (uint8_t)((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    dict->data[dict->data_size++] = (uint8_t)value;
+}
+
+
+/** \brief  Start building \a dict
+ *
+ * \param[out]  builder builder state
+ * \param[out]  dict    dictionary, initialized as empty
+ */
+void hvsc_pathdict_builder_init(hvsc_pathdict_builder_t *builder,
+                                hvsc_pathdict_t *dict)
+{
+    hvsc_pathdict_init(dict);
+    builder->dict = dict;
+    builder->data_max = 0;
+    builder->blocks_max = 0;
+    builder->prev = NULL;
+    builder->prev_len = 0;
+}
+
+
+/** \brief  Add \a path to the dictionary being built
+ *
+ * Paths must be added in strictly increasing order (bytewise), the first path
+ * added gets ID 0. \a path must stay valid until the next path is added.
+ *
+ * \param[in,out]   builder builder state
+ * \param[in]       path    path (not nul-terminated)
+ * \param[in]       len     length of \a path
+ *
+ * \return  bool
+ */
+bool hvsc_pathdict_add(hvsc_pathdict_builder_t *builder, const char *path,
+                       size_t len)
+{
+    hvsc_pathdict_t *dict = builder->dict;
+    size_t prefix = 0;
+    size_t need;
+
+    if (builder->prev != NULL) {
+        size_t max = len < builder->prev_len ? len : builder->prev_len;
+
+        while (prefix < max && path[prefix] == builder->prev[prefix]) {
+            prefix++;
+        }
+        if (prefix == len || (prefix < builder->prev_len
+                    && (uint8_t)path[prefix]
+                        < (uint8_t)builder->prev[prefix])) {
+            /* not sorted or a duplicate */
+            hvsc_errno = HVSC_ERR_INVALID;
+            return false;
+        }
+    }
+
+    if (dict->count % HVSC_PATHDICT_BLOCK == 0) {
+        /* the head of a block is stored in full */
+        prefix = 0;
+        if (dict->data_size >= UINT32_MAX) {
+            hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
+            return false;
+        }
+        if (dict->count / HVSC_PATHDICT_BLOCK == builder->blocks_max) {
+            size_t max = builder->blocks_max > 0
+                ? builder->blocks_max * 2 : 256;
+            uint32_t *tmp = hvsc_realloc(dict->blocks, max * sizeof *tmp);
+
+            if (tmp == NULL) {
+                hvsc_errno = HVSC_ERR_OOM;
+                return false;
+            }
+            dict->blocks = tmp;
+            builder->blocks_max = max;
+        }
+        dict->blocks[dict->count / HVSC_PATHDICT_BLOCK] =
+            (uint32_t)dict->data_size;
+    }
+
+    /* two integers of at most 10 bytes each */
+    need = dict->data_size + (len - prefix) + 20;
+    if (need > builder->data_max) {
+        size_t max = builder->data_max > 0 ? builder->data_max : 4096;
+        uint8_t *tmp;
+
+        while (max < need) {
+            max *= 2;
+        }
+        tmp = hvsc_realloc(dict->data, max);
+        if (tmp == NULL) {
+            hvsc_errno = HVSC_ERR_OOM;
+            return false;
+        }
+        dict->data = tmp;
+        builder->data_max = max;
+    }
+    pathdict_write_num(dict, prefix);
+    pathdict_write_num(dict, len - prefix);
+    memcpy(dict->data + dict->data_size, path + prefix, len - prefix);
+    dict->data_size += len - prefix;
+    dict->count++;
+    if (len > dict->max_len) {
+        dict->max_len = len;
+    }
+    builder->prev = path;
+    builder->prev_len = len;
+    return true;
+}
+
+
+/** \brief  Finish building the dictionary, releasing unused memory
+ *
+ * \param[in,out]   builder builder state
+ */
+void hvsc_pathdict_finish(hvsc_pathdict_builder_t *builder)
+{
+    hvsc_pathdict_t *dict = builder->dict;
+    size_t blocks = hvsc_pathdict_block_count(dict);
+    void *tmp;
+
+    /* shrinking can't really fail, but keep the larger buffers if it does */
+    if (dict->data_size > 0 && dict->data_size < builder->data_max) {
+        tmp = hvsc_realloc(dict->data, dict->data_size);
+        if (tmp != NULL) {
+            dict->data = tmp;
+            builder->data_max = dict->data_size;
+        }
+    }
+    if (blocks > 0 && blocks < builder->blocks_max) {
+        tmp = hvsc_realloc(dict->blocks, blocks * sizeof *(dict->blocks));
+        if (tmp != NULL) {
+            dict->blocks = tmp;
+            builder->blocks_max = blocks;
+        }
+    }
+}
+
+
+/** \brief  Get length of the common prefix of two strings
+ *
+ * \param[in]   s1      first string
+ * \param[in]   len1    length of \a s1
+ * \param[in]   s2      second string
+ * \param[in]   len2    length of \a s2
+ *
+ * \return  length of the common prefix
+ */
+static size_t pathdict_common(const uint8_t *s1, size_t len1,
+                              const uint8_t *s2, size_t len2)
+{
+    size_t max = len1 < len2 ? len1 : len2;
+    size_t n = 0;
+
+    while (n < max && s1[n] == s2[n]) {
+        n++;
+    }
+    return n;
+}
+
+
+/** \brief  Find the first path in \a dict that isn't smaller than \a key
+ *
+ * The block is found by binary search over the block heads. Within the
+ * block the shared prefix lengths tell whether a path can still match, so
+ * the paths are compared without decoding them.
+ *
+ * \param[in]   dict    dictionary
+ * \param[in]   key     key (not nul-terminated)
+ * \param[in]   len     length of \a key
+ * \param[out]  exact   path found is equal to \a key
+ *
+ * \return  ID of the path, `dict->count` when all paths are smaller
+ */
+static size_t pathdict_search(const hvsc_pathdict_t *dict, const char *key,
+                              size_t len, bool *exact)
+{
+    const uint8_t *k = (const uint8_t *)key;
+    size_t lo = 0;
+    size_t hi = hvsc_pathdict_block_count(dict);
+    size_t match;
+    size_t pos;
+    size_t id;
+    size_t end;
+
+    *exact = false;
+
+    /* first block with a head larger than the key */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t head_len;
+        size_t common;
+
+        pos = dict->blocks[mid];
+        pathdict_read_num(dict->data, &pos);
+        head_len = pathdict_read_num(dict->data, &pos);
+        common = pathdict_common(dict->data + pos, head_len, k, len);
+        if (common == head_len && common == len) {
+            *exact = true;
+            return mid * HVSC_PATHDICT_BLOCK;
+        }
+        if (common == head_len
+                || (common < len && dict->data[pos + common] < k[common])) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return 0;
+    }
+
+    /* scan the block, keeping the common prefix of key and current path;
+     * every path passed is smaller than the key */
+    id = (lo - 1) * HVSC_PATHDICT_BLOCK;
+    end = id + HVSC_PATHDICT_BLOCK < dict->count
+        ? id + HVSC_PATHDICT_BLOCK : dict->count;
+    pos = dict->blocks[lo - 1];
+    pathdict_read_num(dict->data, &pos);
+    match = pathdict_read_num(dict->data, &pos);
+    pos += match;
+    match = pathdict_common(dict->data + pos - match, match, k, len);
+
+    for (id++; id < end; id++) {
+        size_t prefix = pathdict_read_num(dict->data, &pos);
+        size_t suffix = pathdict_read_num(dict->data, &pos);
+        const uint8_t *s = dict->data + pos;
+        size_t common;
+
+        pos += suffix;
+        if (prefix > match) {
+            /* same as the previous path where that was smaller */
+            continue;
+        }
+        if (prefix < match) {
+            /* larger than the previous path where that equalled the key */
+            return id;
+        }
+        common = pathdict_common(s, suffix, k + match, len - match);
+        if (common == suffix && common == len - match) {
+            *exact = true;
+            return id;
+        }
+        if (common < suffix && (common == len - match
+                    || s[common] > k[match + common])) {
+            return id;
+        }
+        match += common;
+    }
+    return end;
+}
+
+
+/** \brief  Find the ID of \a path in \a dict
+ *
+ * \param[in]   dict    dictionary
+ * \param[in]   path    path (not nul-terminated)
+ * \param[in]   len     length of \a path
+ *
+ * \return  ID or -1 when not found
+ */
+long hvsc_pathdict_find(const hvsc_pathdict_t *dict, const char *path,
+                        size_t len)
+{
+    bool exact;
+    size_t id = pathdict_search(dict, path, len, &exact);
+
+    return exact ? (long)id : -1;
+}
+
+
+/** \brief  Find the range of IDs of the paths starting with \a prefix
+ *
+ * The paths with a common prefix are consecutive, they end before the first
+ * path that is larger than every string starting with \a prefix.
+ *
+ * \param[in]   dict    dictionary
+ * \param[in]   prefix  prefix (not nul-terminated)
+ * \param[in]   len     length of \a prefix
+ * \param[out]  first   ID of the first path with \a prefix
+ * \param[out]  last    ID after the last path with \a prefix
+ *
+ * \return  bool
+ */
+bool hvsc_pathdict_prefix(const hvsc_pathdict_t *dict, const char *prefix,
+                          size_t len, size_t *first, size_t *last)
+{
+    char *upper;
+    bool exact;
+
+    *first = pathdict_search(dict, prefix, len, &exact);
+    *last = *first;
+    if (len > dict->max_len) {
+        return true;
+    }
+
+    /* the upper bound is the prefix with its last byte incremented, bytes
+     * that can't be incremented are dropped */
+    while (len > 0 && (uint8_t)prefix[len - 1] == 0xff) {
+        len--;
+    }
+    if (len == 0) {
+        *last = dict->count;
+        return true;
+    }
+    upper = hvsc_malloc(len);
+    if (upper == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    memcpy(upper, prefix, len);
+    upper[len - 1] = (char)((uint8_t)upper[len - 1] + 1);
+    *last = pathdict_search(dict, upper, len, &exact);
+    hvsc_free(upper);
+    return true;
+}
+
+
+/** \brief  Start iterating over the paths of \a dict at ID \a id
+ *
+ * \param[out]  iter    iterator, free with hvsc_pathdict_iter_free()
+ * \param[in]   dict    dictionary
+ * \param[in]   id      ID of the first path returned
+ *
+ * \return  bool
+ */
+bool hvsc_pathdict_iter_init(hvsc_pathdict_iter_t *iter,
+                             const hvsc_pathdict_t *dict, size_t id)
+{
+    iter->dict = dict;
+    iter->id = dict->count;
+    iter->pos = dict->data_size;
+    iter->len = 0;
+    iter->path = hvsc_malloc(dict->max_len + 1);
+    if (iter->path == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    iter->path[0] = '\0';
+    if (id < dict->count) {
+        /* decode from the head of the block up to the path before `id` */
+        iter->id = id - id % HVSC_PATHDICT_BLOCK;
+        iter->pos = dict->blocks[id / HVSC_PATHDICT_BLOCK];
+        while (iter->id < id) {
+            hvsc_pathdict_iter_next(iter);
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Get the next path of \a iter
+ *
+ * \param[in,out]   iter    iterator
+ *
+ * \return  path, valid until the next call, or `NULL` at the end
+ */
+const char *hvsc_pathdict_iter_next(hvsc_pathdict_iter_t *iter)
+{
+    const hvsc_pathdict_t *dict = iter->dict;
+    size_t prefix;
+    size_t suffix;
+
+    if (iter->id >= dict->count) {
+        return NULL;
+    }
+    prefix = pathdict_read_num(dict->data, &(iter->pos));
+    suffix = pathdict_read_num(dict->data, &(iter->pos));
+    memcpy(iter->path + prefix, dict->data + iter->pos, suffix);
+    iter->pos += suffix;
+    iter->len = prefix + suffix;
+    iter->path[iter->len] = '\0';
+    iter->id++;
+    return iter->path;
+}
+
+
+/** \brief  Free memory used by \a iter
+ *
+ * \param[in,out]   iter    iterator
+ */
+void hvsc_pathdict_iter_free(hvsc_pathdict_iter_t *iter)
+{
+    hvsc_free(iter->path);
+    iter->path = NULL;
+}
+
+
+/** \brief  Get the path with ID \a id
+ *
+ * \param[in]   dict    dictionary
+ * \param[in]   id      ID
+ *
+ * \return  heap-allocated path or `NULL` on failure
+ */
+char *hvsc_pathdict_get(const hvsc_pathdict_t *dict, size_t id)
+{
+    hvsc_pathdict_iter_t iter;
+
+    if (id >= dict->count) {
+        hvsc_errno = HVSC_ERR_NOT_FOUND;
+        return NULL;
+    }
+    if (!hvsc_pathdict_iter_init(&iter, dict, id)) {
+        return NULL;
+    }
+    hvsc_pathdict_iter_next(&iter);
+    return iter.path;
+}
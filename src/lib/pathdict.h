@@ -0,0 +1,109 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/pathdict.h
+ * \brief   Front-coded sorted path dictionary - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_PATHDICT_H
+#define HVSC_PATHDICT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc_defs.h"
+
+
+/** \brief  Number of paths in a block of a path dictionary
+ *
+ * The first path of a block is stored in full, so lookups can binary search
+ * the blocks; larger blocks compress better but take longer to scan.
+ */
+#define HVSC_PATHDICT_BLOCK     16
+
+
+/** \brief  Sorted set of paths, front-coded in blocks
+ *
+ * The ID of a path is its position in sorted order. Each path is stored as
+ * the length of the prefix it shares with the previous path and the rest of
+ * the path, both lengths as 7-bit variable length integers. The first path
+ * of a block shares nothing. The dictionary only uses offsets, so it can be
+ * mapped into memory as is.
+ */
+typedef struct hvsc_pathdict_s {
+    uint8_t *   data;       /**< blocks of front-coded paths */
+    size_t      data_size;  /**< size of \a data */
+    uint32_t *  blocks;     /**< offset in \a data per block */
+    size_t      count;      /**< number of paths */
+    size_t      max_len;    /**< length of the longest path */
+} hvsc_pathdict_t;
+
+
+/** \brief  State while adding paths to a dictionary
+ */
+typedef struct hvsc_pathdict_builder_s {
+    hvsc_pathdict_t *   dict;       /**< dictionary being built */
+    size_t              data_max;   /**< bytes allocated for `dict->data` */
+    size_t              blocks_max; /**< blocks allocated */
+    const char *        prev;       /**< previous path added */
+    size_t              prev_len;   /**< length of \a prev */
+} hvsc_pathdict_builder_t;
+
+
+/** \brief  Iterator over the paths of a dictionary in sorted order
+ */
+typedef struct hvsc_pathdict_iter_s {
+    const hvsc_pathdict_t * dict;   /**< dictionary */
+    size_t                  id;     /**< ID of the next path */
+    size_t                  pos;    /**< offset in `dict->data` of the next
+                                         path */
+    char *                  path;   /**< current path, nul-terminated */
+    size_t                  len;    /**< length of \a path */
+} hvsc_pathdict_iter_t;
+
+
+void        hvsc_pathdict_init(hvsc_pathdict_t *dict);
+void        hvsc_pathdict_free(hvsc_pathdict_t *dict);
+size_t      hvsc_pathdict_block_count(const hvsc_pathdict_t *dict);
+bool        hvsc_pathdict_check(const hvsc_pathdict_t *dict);
+
+void        hvsc_pathdict_builder_init(hvsc_pathdict_builder_t *builder,
+                                       hvsc_pathdict_t *dict);
+bool        hvsc_pathdict_add(hvsc_pathdict_builder_t *builder,
+                              const char *path, size_t len);
+void        hvsc_pathdict_finish(hvsc_pathdict_builder_t *builder);
+
+long        hvsc_pathdict_find(const hvsc_pathdict_t *dict, const char *path,
+                               size_t len);
+char *      hvsc_pathdict_get(const hvsc_pathdict_t *dict, size_t id);
+bool        hvsc_pathdict_prefix(const hvsc_pathdict_t *dict,
+                                 const char *prefix, size_t len,
+                                 size_t *first, size_t *last);
+
+bool        hvsc_pathdict_iter_init(hvsc_pathdict_iter_t *iter,
+                                    const hvsc_pathdict_t *dict, size_t id);
+const char *hvsc_pathdict_iter_next(hvsc_pathdict_iter_t *iter);
+void        hvsc_pathdict_iter_free(hvsc_pathdict_iter_t *iter);
+
+#endif
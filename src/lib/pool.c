@@ -0,0 +1,214 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/pool.c
+ * \brief   Worker thread pool
+ *
+ * A small fixed-size pool of worker threads pulling jobs from a FIFO queue.
+ * Used internally to overlap file I/O when processing many files at once.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "record.h"
+
+#include "pool.h"
+
+
+/** \brief  Worker thread main loop
+ *
+ * Takes jobs from the queue until the pool is told to quit.
+ *
+ * \param[in,out]   arg pool
+ *
+ * \return  `NULL`
+ */
+static void *pool_worker(void *arg)
+{
+    hvsc_pool_t *pool = arg;
+
+    /* calls made by jobs are part of the host's call, don't record them */
+    hvsc_record_ignore_thread();
+
+    while (true) {
+        hvsc_pool_job_t *job;
+
+        pthread_mutex_lock(&(pool->lock));
+        while (pool->head == NULL && !pool->quit) {
+            pthread_cond_wait(&(pool->work), &(pool->lock));
+        }
+        if (pool->head == NULL) {
+            /* quit and nothing left to do */
+            pthread_mutex_unlock(&(pool->lock));
+            return NULL;
+        }
+        job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&(pool->lock));
+
+        job->func(job->arg);
+        hvsc_free(job);
+
+        pthread_mutex_lock(&(pool->lock));
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&(pool->done));
+        }
+        pthread_mutex_unlock(&(pool->lock));
+    }
+}
+
+
+/** \brief  Initialize \a pool and start its worker threads
+ *
+ * \param[out]  pool    thread pool
+ * \param[in]   threads number of worker threads (<= 0 to use the default)
+ *
+ * \return  bool
+ */
+bool hvsc_pool_init(hvsc_pool_t *pool, int threads)
+{
+    int i;
+
+    if (threads <= 0) {
+        threads = HVSC_POOL_THREADS;
+    }
+
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->pending = 0;
+    pool->quit = false;
+    pool->count = 0;
+    pool->threads = hvsc_malloc((size_t)threads * sizeof *(pool->threads));
+    if (pool->threads == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->work), NULL);
+    pthread_cond_init(&(pool->done), NULL);
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&(pool->threads[i]), NULL, pool_worker, pool) != 0) {
+            break;
+        }
+        pool->count++;
+    }
+    if (pool->count == 0) {
+        hvsc_errno = HVSC_ERR_THREAD;
+        hvsc_pool_free(pool);
+        return false;
+    }
+    hvsc_dbg("started %d worker threads\n", pool->count);
+    return true;
+}
+
+
+/** \brief  Add a job to \a pool
+ *
+ * \param[in,out]   pool    thread pool
+ * \param[in]       func    job function
+ * \param[in]       arg     argument for \a func
+ *
+ * \return  bool
+ */
+bool hvsc_pool_submit(hvsc_pool_t *pool, hvsc_pool_func_t func, void *arg)
+{
+    hvsc_pool_job_t *job = hvsc_malloc(sizeof *job);
+
+    if (job == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    job->func = func;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->tail == NULL) {
+        pool->head = job;
+    } else {
+        pool->tail->next = job;
+    }
+    pool->tail = job;
+    pool->pending++;
+    pthread_cond_signal(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+    return true;
+}
+
+
+/** \brief  Wait until all jobs submitted to \a pool have finished
+ *
+ * Jobs are allowed to submit new jobs, this function only returns once the
+ * queue is empty and no job is running.
+ *
+ * \param[in,out]   pool    thread pool
+ */
+void hvsc_pool_wait(hvsc_pool_t *pool)
+{
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->pending > 0) {
+        pthread_cond_wait(&(pool->done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+
+/** \brief  Stop the worker threads and free memory used by \a pool
+ *
+ * Jobs still in the queue are run before the workers exit. Doesn't free
+ * \a pool itself.
+ *
+ * \param[in,out]   pool    thread pool
+ */
+void hvsc_pool_free(hvsc_pool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->quit = true;
+    pthread_cond_broadcast(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+
+    for (i = 0; i < pool->count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    hvsc_free(pool->threads);
+    pool->threads = NULL;
+    pool->count = 0;
+
+    pthread_cond_destroy(&(pool->done));
+    pthread_cond_destroy(&(pool->work));
+    pthread_mutex_destroy(&(pool->lock));
+}
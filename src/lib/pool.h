@@ -0,0 +1,70 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/pool.h
+ * \brief   Worker thread pool - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_POOL_H
+#define HVSC_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/** \brief  Job function prototype
+ *
+ * \param[in]   arg     argument passed to hvsc_pool_submit()
+ */
+typedef void (*hvsc_pool_func_t)(void *arg);
+
+
+/** \brief  Job in the pool's queue
+ */
+typedef struct hvsc_pool_job_s {
+    hvsc_pool_func_t        func;   /**< job function */
+    void *                  arg;    /**< argument for \a func */
+    struct hvsc_pool_job_s *next;   /**< next job in the queue */
+} hvsc_pool_job_t;
+
+
+/** \brief  Worker thread pool
+ */
+typedef struct hvsc_pool_s {
+    pthread_t *         threads;    /**< worker threads */
+    int                 count;      /**< number of worker threads */
+    hvsc_pool_job_t *   head;       /**< first job in the queue */
+    hvsc_pool_job_t *   tail;       /**< last job in the queue */
+    size_t              pending;    /**< jobs queued or running */
+    bool                quit;       /**< workers should exit */
+    pthread_mutex_t     lock;       /**< lock for the queue */
+    pthread_cond_t      work;       /**< signalled when a job is queued */
+    pthread_cond_t      done;       /**< signalled when `pending` hits 0 */
+} hvsc_pool_t;
+
+
+bool    hvsc_pool_init(hvsc_pool_t *pool, int threads);
+bool    hvsc_pool_submit(hvsc_pool_t *pool, hvsc_pool_func_t func, void *arg);
+void    hvsc_pool_wait(hvsc_pool_t *pool);
+void    hvsc_pool_free(hvsc_pool_t *pool);
+
+#endif
@@ -0,0 +1,351 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/prefetch.c
+ * \brief   Prefetching upcoming tunes
+ *
+ * A background thread looks up the tunes a player is about to play, so the
+ * lookups on the next track change are answered from memory: the PSID file
+ * is read ahead into the page cache, its digest and header go into the
+ * digest cache and its parsed STIL entry into the STIL cache. With the index
+ * loaded the SLDB and BUGlist lookups are done as well, which pages in an
+ * index attached from shared memory.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "dcache.h"
+#include "index.h"
+#include "record.h"
+#include "stilcache.h"
+
+
+/** \brief  Lock for starting and stopping the prefetcher
+ */
+static pthread_mutex_t prefetch_ctl_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Lock for the queue and the state of the prefetcher thread
+ */
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Signalled when paths are queued or the thread should quit
+ */
+static pthread_cond_t prefetch_work = PTHREAD_COND_INITIALIZER;
+
+/** \brief  Signalled when the queue has been worked off
+ */
+static pthread_cond_t prefetch_idle = PTHREAD_COND_INITIALIZER;
+
+/** \brief  Prefetcher thread is running
+ */
+static bool prefetch_running = false;
+
+/** \brief  Prefetcher thread should exit
+ */
+static bool prefetch_quit = false;
+
+/** \brief  Prefetcher thread is working on a path
+ */
+static bool prefetch_busy = false;
+
+/** \brief  Prefetcher thread ID
+ */
+static pthread_t prefetch_thread;
+
+/** \brief  Paths to prefetch, in order (taken paths are set to `NULL`)
+ */
+static char **prefetch_queue = NULL;
+
+/** \brief  Number of paths in \a prefetch_queue
+ */
+static size_t prefetch_count = 0;
+
+/** \brief  Index in \a prefetch_queue of the next path to prefetch
+ */
+static size_t prefetch_next = 0;
+
+/** \brief  Statistics, guarded by \a prefetch_lock
+ */
+static hvsc_prefetch_stats_t prefetch_stats;
+
+
+/** \brief  Free the paths in the queue that haven't been prefetched
+ *
+ * Call with \a prefetch_lock held.
+ *
+ * \return  number of paths dropped
+ */
+static size_t prefetch_clear(void)
+{
+    size_t dropped = prefetch_count - prefetch_next;
+    size_t i;
+
+    for (i = prefetch_next; i < prefetch_count; i++) {
+        hvsc_free(prefetch_queue[i]);
+    }
+    hvsc_free(prefetch_queue);
+    prefetch_queue = NULL;
+    prefetch_count = 0;
+    prefetch_next = 0;
+    return dropped;
+}
+
+
+/** \brief  Look up \a path to get its data into the caches
+ *
+ * Failures are ignored, the lookup on the track change reports them.
+ *
+ * \param[in]   path    path to PSID file
+ */
+static void prefetch_warm(const char *path)
+{
+    uint8_t digest[HVSC_DIGEST_SIZE];
+    hvsc_index_t *index;
+    int fd;
+
+    /* the whole file is read on the track change, start reading it now */
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    if (hvsc_dcache_is_open()) {
+        hvsc_dcache_digest(path, digest);
+    }
+    if (hvsc_stil_cache_is_open()) {
+        hvsc_stil_cache_prefetch(path);
+    }
+
+    /* without the index these are full scans of the files, with nothing to
+     * keep in memory afterwards */
+    index = hvsc_index_acquire();
+    if (index != NULL) {
+        hvsc_bugs_t bugs;
+        long *lengths = NULL;
+
+        if (hvsc_sldb_get_lengths(path, &lengths) >= 0) {
+            free(lengths);
+        }
+        if (hvsc_bugs_open(path, &bugs)) {
+            hvsc_bugs_close(&bugs);
+        }
+        hvsc_index_release(index);
+    }
+}
+
+
+/** \brief  Prefetcher thread main loop
+ *
+ * \param[in]   arg unused
+ *
+ * \return  `NULL`
+ */
+static void *prefetch_main(void *arg)
+{
+    (void)arg;
+    /* prefetches aren't part of the host's workload */
+    hvsc_record_ignore_thread();
+
+    pthread_mutex_lock(&prefetch_lock);
+    while (true) {
+        char *path;
+
+        while (!prefetch_quit && prefetch_next == prefetch_count) {
+            prefetch_busy = false;
+            pthread_cond_broadcast(&prefetch_idle);
+            pthread_cond_wait(&prefetch_work, &prefetch_lock);
+        }
+        if (prefetch_quit) {
+            break;
+        }
+        path = prefetch_queue[prefetch_next];
+        prefetch_queue[prefetch_next++] = NULL;
+        prefetch_busy = true;
+        pthread_mutex_unlock(&prefetch_lock);
+
+        prefetch_warm(path);
+        hvsc_free(path);
+
+        pthread_mutex_lock(&prefetch_lock);
+        prefetch_stats.warmed++;
+    }
+    prefetch_busy = false;
+    pthread_cond_broadcast(&prefetch_idle);
+    pthread_mutex_unlock(&prefetch_lock);
+    return NULL;
+}
+
+
+/** \brief  Prefetch the data of the tunes in \a paths in the background
+ *
+ * Pass the tunes a player is about to play, in the order they will be
+ * played. A background thread looks them up so the lookups on the track
+ * change are answered from memory: the PSID file is read ahead, its digest
+ * and header are added to the digest cache (when open, see
+ * hvsc_dcache_open()) and its parsed STIL entry to the STIL cache (when open,
+ * see hvsc_stil_cache_open()), bypassing the cache's admission policy. With
+ * the index loaded the SLDB and BUGlist entries are looked up too.
+ *
+ * Paths from an earlier call that haven't been prefetched yet are dropped:
+ * each call replaces the queue with the player's latest view of what comes
+ * next. Pass a \a count of 0 to just drop them.
+ *
+ * Requires hvsc_init(), the thread is started on the first call and stopped
+ * by hvsc_prefetch_stop() or hvsc_exit().
+ *
+ * \param[in]   paths   paths to PSID files
+ * \param[in]   count   number of \a paths
+ *
+ * \return  bool
+ *
+ * \ingroup prefetch
+ */
+bool hvsc_prefetch(const char **paths, size_t count)
+{
+    char **queue;
+    size_t i;
+
+    if (hvsc_root_path == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    queue = hvsc_malloc((count > 0 ? count : 1) * sizeof *queue);
+    if (queue == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        queue[i] = hvsc_strdup(paths[i]);
+        if (queue[i] == NULL) {
+            while (i > 0) {
+                hvsc_free(queue[--i]);
+            }
+            hvsc_free(queue);
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&prefetch_ctl_lock);
+    if (!prefetch_running) {
+        pthread_mutex_lock(&prefetch_lock);
+        memset(&prefetch_stats, 0, sizeof prefetch_stats);
+        prefetch_quit = false;
+        pthread_mutex_unlock(&prefetch_lock);
+        if (pthread_create(&prefetch_thread, NULL, prefetch_main, NULL) != 0) {
+            pthread_mutex_unlock(&prefetch_ctl_lock);
+            for (i = 0; i < count; i++) {
+                hvsc_free(queue[i]);
+            }
+            hvsc_free(queue);
+            hvsc_errno = HVSC_ERR_THREAD;
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&prefetch_lock);
+    prefetch_running = true;
+    prefetch_stats.dropped += prefetch_clear();
+    prefetch_stats.queued += count;
+    prefetch_queue = queue;
+    prefetch_count = count;
+    prefetch_next = 0;
+    pthread_cond_signal(&prefetch_work);
+    pthread_mutex_unlock(&prefetch_lock);
+    pthread_mutex_unlock(&prefetch_ctl_lock);
+    return true;
+}
+
+
+/** \brief  Wait until all queued paths have been prefetched
+ *
+ * Returns immediately when the prefetcher isn't running.
+ *
+ * \ingroup prefetch
+ */
+void hvsc_prefetch_wait(void)
+{
+    pthread_mutex_lock(&prefetch_lock);
+    while (prefetch_running && !prefetch_quit
+            && (prefetch_next < prefetch_count || prefetch_busy)) {
+        pthread_cond_wait(&prefetch_idle, &prefetch_lock);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+
+/** \brief  Stop the prefetcher
+ *
+ * Waits for the path in progress to finish and drops the others. Does
+ * nothing when the prefetcher isn't running.
+ *
+ * \ingroup prefetch
+ */
+void hvsc_prefetch_stop(void)
+{
+    pthread_mutex_lock(&prefetch_ctl_lock);
+    if (prefetch_running) {
+        pthread_mutex_lock(&prefetch_lock);
+        prefetch_quit = true;
+        pthread_cond_signal(&prefetch_work);
+        pthread_mutex_unlock(&prefetch_lock);
+
+        pthread_join(prefetch_thread, NULL);
+
+        pthread_mutex_lock(&prefetch_lock);
+        prefetch_stats.dropped += prefetch_clear();
+        prefetch_running = false;
+        pthread_mutex_unlock(&prefetch_lock);
+    }
+    pthread_mutex_unlock(&prefetch_ctl_lock);
+}
+
+
+/** \brief  Get statistics of the prefetcher
+ *
+ * The statistics are kept after the prefetcher is stopped and reset when
+ * it's started again.
+ *
+ * \param[out]  stats   statistics
+ *
+ * \ingroup prefetch
+ */
+void hvsc_prefetch_get_stats(hvsc_prefetch_stats_t *stats)
+{
+    pthread_mutex_lock(&prefetch_lock);
+    *stats = prefetch_stats;
+    pthread_mutex_unlock(&prefetch_lock);
+}
@@ -0,0 +1,202 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/proto.c
+ * \brief   hvscd wire protocol
+ *
+ * Frame buffers and byte order helpers shared by the client mode and the
+ * hvscd daemon, see proto.h for the layout of the frames.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "alloc.h"
+
+#include "proto.h"
+
+
+/** \brief  Initialize \a buf as empty
+ *
+ * \param[out]  buf buffer
+ */
+void hvsc_proto_buffer_init(hvsc_proto_buffer_t *buf)
+{
+    buf->data = NULL;
+    buf->size = 0;
+    buf->max = 0;
+}
+
+
+/** \brief  Free the data of \a buf, leaving it empty
+ *
+ * \param[in,out]   buf buffer
+ */
+void hvsc_proto_buffer_free(hvsc_proto_buffer_t *buf)
+{
+    hvsc_free(buf->data);
+    hvsc_proto_buffer_init(buf);
+}
+
+
+/** \brief  Make room for \a size more bytes in \a buf
+ *
+ * \param[in,out]   buf     buffer
+ * \param[in]       size    number of bytes to add
+ *
+ * \return  bool
+ */
+bool hvsc_proto_buffer_reserve(hvsc_proto_buffer_t *buf, size_t size)
+{
+    size_t max = buf->max > 0 ? buf->max : 4096;
+    uint8_t *tmp;
+
+    if (buf->size + size <= buf->max) {
+        return true;
+    }
+    while (max < buf->size + size) {
+        max *= 2;
+    }
+    tmp = hvsc_realloc(buf->data, max);
+    if (tmp == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    buf->data = tmp;
+    buf->max = max;
+    return true;
+}
+
+
+/** \brief  Append \a size bytes of \a data to \a buf
+ *
+ * \param[in,out]   buf     buffer
+ * \param[in]       data    data
+ * \param[in]       size    size of \a data
+ *
+ * \return  bool
+ */
+bool hvsc_proto_buffer_append(hvsc_proto_buffer_t *buf,
+                              const void *data, size_t size)
+{
+    if (!hvsc_proto_buffer_reserve(buf, size)) {
+        return false;
+    }
+    if (size > 0) {
+        memcpy(buf->data + buf->size, data, size);
+        buf->size += size;
+    }
+    return true;
+}
+
+
+/** \brief  Remove the first \a size bytes from \a buf
+ *
+ * \param[in,out]   buf     buffer
+ * \param[in]       size    number of bytes to remove
+ */
+void hvsc_proto_buffer_consume(hvsc_proto_buffer_t *buf, size_t size)
+{
+    if (size >= buf->size) {
+        buf->size = 0;
+        return;
+    }
+    memmove(buf->data, buf->data + size, buf->size - size);
+    buf->size -= size;
+}
+
+
+/** \brief  Store \a value as little endian 32-bit integer at \a dest
+ *
+ * \param[out]  dest    destination
+ * \param[in]   value   value
+ */
+void hvsc_proto_put_u32(uint8_t *dest, uint32_t value)
+{
+    dest[0] = (uint8_t)(value & 0xff);
+    dest[1] = (uint8_t)((value >> 8) & 0xff);
+    dest[2] = (uint8_t)((value >> 16) & 0xff);
+    dest[3] = (uint8_t)((value >> 24) & 0xff);
+}
+
+
+/** \brief  Get little endian 32-bit integer at \a src
+ *
+ * \param[in]   src source
+ *
+ * \return  value
+ */
+uint32_t hvsc_proto_get_u32(const uint8_t *src)
+{
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8)
+        | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+
+/** \brief  Start a frame in \a buf
+ *
+ * Appends a header with an empty body, append the body to \a buf and call
+ * hvsc_proto_end_frame() to set its size.
+ *
+ * \param[in,out]   buf     buffer
+ * \param[in]       id      request ID
+ * \param[in]       code    op of a request, status of a response
+ * \param[out]      frame   offset of the frame in \a buf
+ *
+ * \return  bool
+ */
+bool hvsc_proto_begin_frame(hvsc_proto_buffer_t *buf, uint32_t id,
+                            int code, size_t *frame)
+{
+    uint8_t *header;
+
+    if (!hvsc_proto_buffer_reserve(buf, HVSC_PROTO_HEADER_SIZE)) {
+        return false;
+    }
+    *frame = buf->size;
+    header = buf->data + buf->size;
+    hvsc_proto_put_u32(header, 0);
+    hvsc_proto_put_u32(header + 4, id);
+    header[8] = (uint8_t)code;
+    header[9] = header[10] = header[11] = 0;
+    buf->size += HVSC_PROTO_HEADER_SIZE;
+    return true;
+}
+
+
+/** \brief  Set the body size of the frame at \a frame in \a buf
+ *
+ * \param[in,out]   buf     buffer
+ * \param[in]       frame   offset of the frame from hvsc_proto_begin_frame()
+ */
+void hvsc_proto_end_frame(hvsc_proto_buffer_t *buf, size_t frame)
+{
+    hvsc_proto_put_u32(buf->data + frame,
+            (uint32_t)(buf->size - frame - HVSC_PROTO_HEADER_SIZE));
+}
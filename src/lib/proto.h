@@ -0,0 +1,109 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/proto.h
+ * \brief   hvscd wire protocol - header
+ *
+ * Requests and responses are frames of a fixed size header followed by a
+ * body, all integers are little endian:
+ *
+ * | offset | size | request              | response                   |
+ * |--------|------|----------------------|----------------------------|
+ * | 0      | 4    | size of body         | size of body               |
+ * | 4      | 4    | request ID           | ID of the request          |
+ * | 8      | 1    | HVSC_PROTO_* op/key  | status (hvsc_errno value)  |
+ * | 9      | 3    | reserved, 0          | reserved, 0                |
+ *
+ * The body of a lookup is a path relative to the HVSC root (without
+ * terminator), or a 16-byte MD5 digest when HVSC_PROTO_DIGEST is set in
+ * the op. Clients can send any number of requests before reading the
+ * responses, which are sent in the same order.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_PROTO_H
+#define HVSC_PROTO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+
+/** \brief  Version of the protocol, sent by the client in the hello request
+ *
+ * Increment when the layout of frames or bodies changes.
+ */
+#define HVSC_PROTO_VERSION      1
+
+/** \brief  Size of a frame header
+ */
+#define HVSC_PROTO_HEADER_SIZE  12
+
+/** \brief  Maximum size of a frame body, larger frames close the connection
+ */
+#define HVSC_PROTO_BODY_MAX     (1024 * 1024)
+
+/** \brief  Op flag: the key in the body is a digest instead of a path
+ */
+#define HVSC_PROTO_DIGEST       0x80
+
+/** \brief  Mask for the operation in the op byte
+ */
+#define HVSC_PROTO_OP_MASK      0x7f
+
+
+/** \brief  Operations
+ */
+enum {
+    HVSC_PROTO_HELLO = 1,   /**< body: version (4 bytes), response: empty */
+    HVSC_PROTO_SLDB,        /**< response: SLDB entry line */
+    HVSC_PROTO_STIL,        /**< response: path, nul, STIL entry text */
+    HVSC_PROTO_BUGS,        /**< response: path, nul, bug text, nul, user */
+    HVSC_PROTO_RESOLVE      /**< response: path relative to the HVSC root */
+};
+
+
+/** \brief  Growing byte buffer for frames
+ */
+typedef struct hvsc_proto_buffer_s {
+    uint8_t *   data;   /**< data */
+    size_t      size;   /**< number of bytes used */
+    size_t      max;    /**< number of bytes allocated */
+} hvsc_proto_buffer_t;
+
+
+void    hvsc_proto_buffer_init(hvsc_proto_buffer_t *buf);
+void    hvsc_proto_buffer_free(hvsc_proto_buffer_t *buf);
+bool    hvsc_proto_buffer_reserve(hvsc_proto_buffer_t *buf, size_t size);
+bool    hvsc_proto_buffer_append(hvsc_proto_buffer_t *buf,
+                                 const void *data, size_t size);
+void    hvsc_proto_buffer_consume(hvsc_proto_buffer_t *buf, size_t size);
+
+void    hvsc_proto_put_u32(uint8_t *dest, uint32_t value);
+uint32_t hvsc_proto_get_u32(const uint8_t *src);
+bool    hvsc_proto_begin_frame(hvsc_proto_buffer_t *buf, uint32_t id,
+                               int code, size_t *frame);
+void    hvsc_proto_end_frame(hvsc_proto_buffer_t *buf, size_t frame);
+
+#endif
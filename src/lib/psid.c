@@ -33,9 +33,20 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "hvsc.h"
 #include "base.h"
+#include "alloc.h"
+#include "md5.h"
+#include "dcache.h"
+#include "stats.h"
+#include "trace.h"
+#include "record.h"
 
 #include "psid.h"
 
@@ -47,7 +58,7 @@ static const uint8_t psid_magic[HVSC_PSID_MAGIC_LEN] = { 0x50, 0x53, 0x49, 0x44
 /** \brief  Magic bytes to indicate an RSID file
  * \ingroup psid
  */
-static const uint8_t rsid_magic[HVSC_PSID_MAGIC_LEN] = { 0x50, 0x53, 0x49, 0x44 };
+static const uint8_t rsid_magic[HVSC_PSID_MAGIC_LEN] = { 0x52, 0x53, 0x49, 0x44 };
 
 
 /** \brief  SID models
@@ -103,6 +114,7 @@ static void psid_handle_init(hvsc_psid_t *handle)
     memset(handle->copyright, 0, HVSC_PSID_TEXT_LEN);
     handle->flags = 0;
     handle->start_page = 0;
+    handle->page_length = 0;
     handle->second_sid = 0;
     handle->third_sid = 0;
 }
@@ -128,7 +140,7 @@ static bool psid_header_is_valid(const uint8_t *header)
  * \param[in]   src     location of non-terminated string
  * \ingroup psid
  */
-static void psid_copy_string(char *dest, uint8_t *src)
+static void psid_copy_string(char *dest, const uint8_t *src)
 {
     memcpy(dest, src, HVSC_PSID_TEXT_LEN);
     dest[HVSC_PSID_TEXT_LEN] = '\0';
@@ -162,44 +174,46 @@ static bool psid_sid_address_is_valid(uint8_t address)
 /** \brief  Parse the PSID header
  *
  * \param[in,out]   handle  PSID handle
+ * \param[in]       data    raw header data (at least
+ *                          HVSC_PSID_HEADER_MIN_SIZE bytes)
  * \ingroup psid
  */
-static void psid_parse_header(hvsc_psid_t *handle)
+void hvsc_psid_parse_header(hvsc_psid_t *handle, const uint8_t *data)
 {
     uint8_t sid_addr;
 
     /* magic */
-    memcpy(handle->magic, handle->data + HVSC_PSID_MAGIC, HVSC_PSID_MAGIC_LEN);
+    memcpy(handle->magic, data + HVSC_PSID_MAGIC, HVSC_PSID_MAGIC_LEN);
     /* version */
     hvsc_get_word_be(&(handle->version),
-            handle->data + HVSC_PSID_VERSION);
+            data + HVSC_PSID_VERSION);
     /* data offset */
     hvsc_get_word_be(&(handle->data_offset),
-            handle->data + HVSC_PSID_DATA_OFFSET);
+            data + HVSC_PSID_DATA_OFFSET);
 
     /* load address */
     hvsc_get_word_be(&(handle->load_address),
-            handle->data + HVSC_PSID_LOAD_ADDRESS);
+            data + HVSC_PSID_LOAD_ADDRESS);
     /* init address */
     hvsc_get_word_be(&(handle->init_address),
-            handle->data + HVSC_PSID_INIT_ADDRESS);
+            data + HVSC_PSID_INIT_ADDRESS);
     /* play address */
     hvsc_get_word_be(&(handle->play_address),
-            handle->data + HVSC_PSID_PLAY_ADDRESS);
+            data + HVSC_PSID_PLAY_ADDRESS);
 
     /* song count */
-    hvsc_get_word_be(&(handle->songs), handle->data + HVSC_PSID_SONGS);
+    hvsc_get_word_be(&(handle->songs), data + HVSC_PSID_SONGS);
     /* starting song */
-    hvsc_get_word_be(&(handle->start_song), handle->data + HVSC_PSID_START_SONG);
+    hvsc_get_word_be(&(handle->start_song), data + HVSC_PSID_START_SONG);
     /* speed flags */
-    hvsc_get_longword_be(&(handle->speed), handle->data + HVSC_PSID_SPEED);
+    hvsc_get_longword_be(&(handle->speed), data + HVSC_PSID_SPEED);
 
     /* name */
-    psid_copy_string(handle->name, handle->data + HVSC_PSID_NAME);
+    psid_copy_string(handle->name, data + HVSC_PSID_NAME);
     /* author */
-    psid_copy_string(handle->author, handle->data + HVSC_PSID_AUTHOR);
+    psid_copy_string(handle->author, data + HVSC_PSID_AUTHOR);
     /* copyright */
-    psid_copy_string(handle->copyright, handle->data + HVSC_PSID_COPYRIGHT);
+    psid_copy_string(handle->copyright, data + HVSC_PSID_COPYRIGHT);
 
     if (handle->version < 2) {
         return;
@@ -210,37 +224,59 @@ static void psid_parse_header(hvsc_psid_t *handle)
      */
 
     /* flags */
-    hvsc_get_word_be(&(handle->flags), handle->data + HVSC_PSID_FLAGS);
+    hvsc_get_word_be(&(handle->flags), data + HVSC_PSID_FLAGS);
     /* start page */
-    handle->start_page = handle->data[HVSC_PSID_START_PAGE];
+    handle->start_page = data[HVSC_PSID_START_PAGE];
     /* page length */
-    handle->page_length = handle->data[HVSC_PSID_PAGE_LENGTH];
+    handle->page_length = data[HVSC_PSID_PAGE_LENGTH];
 
     /* second SID */
     if (handle->version >= 3) {
-        sid_addr = handle->data[HVSC_PSID_SECOND_SID];
+        sid_addr = data[HVSC_PSID_SECOND_SID];
         handle->second_sid = psid_sid_address_is_valid(sid_addr)
             ? (uint16_t)(sid_addr * 16 + 0xd000) : 0;
     }
 
     /* third SID */
     if (handle->version >= 4) {
-        sid_addr = handle->data[HVSC_PSID_THIRD_SID];
+        sid_addr = data[HVSC_PSID_THIRD_SID];
         handle->third_sid = psid_sid_address_is_valid(sid_addr)
             ? (uint16_t)(sid_addr * 16 + 0xd000) : 0;
     }
 }
 
 
-/** \brief  Open PSID file and parse its header
+/** \brief  Check if the data offset in \a handle fits a file of \a size bytes
+ *
+ * The payload must start inside the file, and when the load address isn't in
+ * the header, the payload must at least contain the 2-byte load address.
+ *
+ * \param[in]   handle  PSID handle with parsed header
+ * \param[in]   size    size of the file
+ *
+ * \return  bool
+ * \ingroup psid
+ */
+static bool psid_data_offset_is_valid(const hvsc_psid_t *handle, size_t size)
+{
+    if (handle->data_offset > size) {
+        return false;
+    }
+    if (handle->load_address == 0 && size - handle->data_offset < 2) {
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Open PSID file and parse its header (untimed)
  *
  * \param[in]       path    path to PSID file
  * \param[in,out]   handle  PSID handle
  *
  * \return  bool
- * \ingroup psid
  */
-bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
+static bool psid_open(const char *path, hvsc_psid_t *handle)
 {
     long size;
     uint8_t *data;
@@ -249,7 +285,7 @@ bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
 
     hvsc_dbg("Attempting to read %s .. ", path);
 
-    size = hvsc_read_file(&data, path);
+    size = hvsc_pread_file(&data, path);
     /* check for errors */
     if (size < 0) {
 #ifdef HVSC_DBG
@@ -264,7 +300,7 @@ bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
         hvsc_perror("failed");
 #endif
         hvsc_errno = HVSC_ERR_INVALID;
-        free(data);
+        hvsc_free(data);
         return false;
     }
     hvsc_dbg("OK, got %ld bytes\n", size);
@@ -273,7 +309,7 @@ bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
     if (!psid_header_is_valid(data)) {
         hvsc_dbg("got invalid header magic\n");
         hvsc_errno = HVSC_ERR_INVALID;
-        free(data);
+        hvsc_free(data);
         return false;
     }
 
@@ -283,11 +319,217 @@ bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
     /* copy path */
     handle->path = hvsc_strdup(path);
     if (handle->path == NULL) {
-        free(handle->data);
+        hvsc_free(handle->data);
+        return false;
+    }
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_PARSE, path);
+    hvsc_psid_parse_header(handle, handle->data);
+    HVSC_TRACE_END(HVSC_TRACE_PARSE, HVSC_PSID_HEADER_MIN_SIZE, true);
+
+    if (!psid_data_offset_is_valid(handle, handle->size)) {
+        hvsc_dbg("invalid data offset $%04x\n", handle->data_offset);
+        hvsc_errno = HVSC_ERR_INVALID;
+        hvsc_psid_close(handle);
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Open PSID file and parse its header
+ *
+ * \param[in]       path    path to PSID file
+ * \param[in,out]   handle  PSID handle
+ *
+ * \return  bool
+ * \ingroup psid
+ */
+bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
+{
+    hvsc_stats_timer_t timer;
+    bool result;
+
+    HVSC_RECORD_PATH(HVSC_OP_PSID_OPEN, path);
+    hvsc_stats_begin(&timer, HVSC_STATS_PSID);
+    result = psid_open(path, handle);
+    hvsc_stats_end(&timer, result);
+    return result;
+}
+
+
+/** \brief  Open PSID file and parse its header only (untimed)
+ *
+ * \param[in]       path    path to PSID file
+ * \param[in,out]   handle  PSID handle
+ *
+ * \return  bool
+ */
+static bool psid_open_header(const char *path, hvsc_psid_t *handle)
+{
+    uint8_t header[HVSC_PSID_HEADER_MIN_SIZE];
+    struct stat st;
+    ssize_t result;
+    int fd;
+
+    psid_handle_init(handle);
+
+    if (hvsc_dcache_is_open()
+            && stat(path, &st) == 0 && S_ISREG(st.st_mode)
+            && hvsc_dcache_get(&st, NULL, header)) {
+        result = HVSC_PSID_HEADER_MIN_SIZE;
+    } else {
+        HVSC_TRACE_BEGIN(HVSC_TRACE_OPEN, path);
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            hvsc_errno = HVSC_ERR_IO;
+            HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
+            return false;
+        }
+        if (fstat(fd, &st) != 0) {
+            hvsc_errno = HVSC_ERR_IO;
+            close(fd);
+            HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, false);
+            return false;
+        }
+        HVSC_TRACE_END(HVSC_TRACE_OPEN, 0, true);
+
+        HVSC_TRACE_BEGIN(HVSC_TRACE_READ, path);
+        do {
+            result = pread(fd, header, sizeof header, 0);
+        } while (result < 0 && errno == EINTR);
+        close(fd);
+        HVSC_TRACE_END(HVSC_TRACE_READ, result > 0 ? (size_t)result : 0,
+                       result >= 0);
+
+        if (result < 0) {
+            hvsc_errno = HVSC_ERR_IO;
+            return false;
+        }
+        if (result == HVSC_PSID_HEADER_MIN_SIZE) {
+            hvsc_dcache_put(&st, NULL, header);
+        }
+    }
+    /* same size requirement as hvsc_psid_open() */
+    if (result < HVSC_PSID_HEADER_MIN_SIZE || !psid_header_is_valid(header)) {
+        hvsc_dbg("invalid header in %s\n", path);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    handle->path = hvsc_strdup(path);
+    if (handle->path == NULL) {
         return false;
     }
+    handle->size = (size_t)st.st_size;
 
-    psid_parse_header(handle);
+    HVSC_TRACE_BEGIN(HVSC_TRACE_PARSE, path);
+    hvsc_psid_parse_header(handle, header);
+    HVSC_TRACE_END(HVSC_TRACE_PARSE, HVSC_PSID_HEADER_MIN_SIZE, true);
+
+    if (!psid_data_offset_is_valid(handle, handle->size)) {
+        hvsc_dbg("invalid data offset $%04x in %s\n",
+                 handle->data_offset, path);
+        hvsc_errno = HVSC_ERR_INVALID;
+        hvsc_psid_close(handle);
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Open PSID file and parse its header, without loading the payload
+ *
+ * Reads only the header of the file with a single pread(2) call and parses
+ * it into \a handle. The `data` member of \a handle is set to `NULL`, the
+ * `size` member is set to the size of the file. The payload can be loaded
+ * later with hvsc_psid_load_data(), if required.
+ *
+ * This is a lot cheaper than hvsc_psid_open() for callers that only need the
+ * header fields, such as a file browser. When the digest cache is open and
+ * contains the header of the current version of the file, the file isn't
+ * opened at all.
+ *
+ * \param[in]       path    path to PSID file
+ * \param[in,out]   handle  PSID handle
+ *
+ * \return  bool
+ * \ingroup psid
+ */
+bool hvsc_psid_open_header(const char *path, hvsc_psid_t *handle)
+{
+    hvsc_stats_timer_t timer;
+    bool result;
+
+    HVSC_RECORD_PATH(HVSC_OP_PSID_OPEN_HEADER, path);
+    hvsc_stats_begin(&timer, HVSC_STATS_PSID);
+    result = psid_open_header(path, handle);
+    hvsc_stats_end(&timer, result);
+    return result;
+}
+
+
+/** \brief  Load the payload of a PSID file opened with hvsc_psid_open_header()
+ *
+ * Reads the entire file into the `data` member of \a handle and updates the
+ * `size` member. Does nothing if the data was already loaded.
+ *
+ * \param[in,out]   handle  PSID handle
+ *
+ * \return  bool
+ * \ingroup psid
+ */
+bool hvsc_psid_load_data(hvsc_psid_t *handle)
+{
+    uint8_t *data;
+    long size;
+
+    if (handle->data != NULL) {
+        return true;
+    }
+    if (handle->path == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    size = hvsc_pread_file(&data, handle->path);
+    if (size < 0) {
+        return false;
+    }
+    /* make sure the file didn't change into something else in between */
+    if (size < HVSC_PSID_HEADER_MIN_SIZE || !psid_header_is_valid(data)
+            || (size_t)size <= handle->data_offset) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        hvsc_free(data);
+        return false;
+    }
+
+    handle->data = data;
+    handle->size = (size_t)size;
+    return true;
+}
+
+
+/** \brief  Calculate the MD5 digest of the PSID file in \a handle
+ *
+ * The digest is calculated over the data already in memory, so the file isn't
+ * read again. This is the digest used as key in the Songlengths.md5 file.
+ *
+ * \param[in]   handle  PSID handle with data loaded
+ * \param[out]  digest  memory to store digest (HVSC_DIGEST_SIZE bytes)
+ *
+ * \return  bool (false when \a handle only contains the header)
+ * \ingroup psid
+ */
+bool hvsc_psid_get_digest(const hvsc_psid_t *handle, uint8_t *digest)
+{
+    if (handle->data == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    HVSC_TRACE_BEGIN(HVSC_TRACE_HASH, handle->path);
+    hvsc_md5(handle->data, handle->size, digest);
+    HVSC_TRACE_END(HVSC_TRACE_HASH, handle->size, true);
     return true;
 }
 
@@ -300,10 +542,10 @@ bool hvsc_psid_open(const char *path, hvsc_psid_t *handle)
 void hvsc_psid_close(hvsc_psid_t *handle)
 {
     if (handle->data != NULL) {
-        free(handle->data);
+        hvsc_free(handle->data);
     }
     if (handle->path != NULL) {
-        free(handle->path);
+        hvsc_free(handle->path);
     }
     psid_handle_init(handle);
 }
@@ -402,7 +644,11 @@ void hvsc_psid_dump(const hvsc_psid_t *handle)
     magic[HVSC_PSID_MAGIC_LEN] = '\0';
 
     /* get load and end addresses */
-    if (handle->load_address == 0) {
+    if (handle->load_address == 0 && handle->data == NULL) {
+        /* header only: load address is in the payload, which isn't loaded */
+        load = 0;
+        end = 0;
+    } else if (handle->load_address == 0) {
         /* load address inside C64 binary */
         hvsc_get_word_le(&load, handle->data + handle->data_offset);
         end = (uint16_t)(handle->size - handle->data_offset - 2 - 1 + load);
@@ -462,7 +708,50 @@ void hvsc_psid_dump(const hvsc_psid_t *handle)
 }
 
 
+/** \brief  Set up I/O vectors describing the SID binary in \a handle
+ *
+ * The binary is the payload of the PSID file, preceded by the load address in
+ * little endian order if the header contains one. \a iov needs room for two
+ * elements, \a address for two bytes, the vectors point into \a address and
+ * the data of \a handle.
+ *
+ * \param[in]   handle  PSID handle with data loaded
+ * \param[out]  iov     I/O vectors
+ * \param[out]  address storage for the load address
+ *
+ * \return  number of vectors used, 0 when the data offset of \a handle
+ *          doesn't fit the data (sets hvsc_errno to HVSC_ERR_INVALID)
+ *
+ * \ingroup psid
+ */
+int hvsc_psid_bin_iov(const hvsc_psid_t *handle, struct iovec *iov,
+                      uint8_t *address)
+{
+    int count = 0;
+
+    if (!psid_data_offset_is_valid(handle, handle->size)) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return 0;
+    }
+
+    /* do we need to write a 2-byte start address? */
+    if (handle->load_address != 0) {
+        address[0] = (uint8_t)(handle->load_address & 0xff);
+        address[1] = (uint8_t)(handle->load_address >> 8);
+        iov[count].iov_base = address;
+        iov[count].iov_len = 2;
+        count++;
+    }
+    iov[count].iov_base = handle->data + handle->data_offset;
+    iov[count].iov_len = handle->size - handle->data_offset;
+    count++;
+    return count;
+}
+
+
 /** \brief  Extract SID binary from \a handle and write to \a path
+ *
+ * The load address and the binary data are written with a single writev(2).
  *
  * \param[in]   handle  PSID handle
  * \param[in]   path    path/filename to write data to
@@ -473,41 +762,35 @@ void hvsc_psid_dump(const hvsc_psid_t *handle)
  */
 bool hvsc_psid_write_bin(const hvsc_psid_t *handle, const char *path)
 {
-    FILE *fp;
-    size_t size;
-    size_t result;
-
-    fp = fopen(path, "wb");
-    if (fp == NULL) {
-        hvsc_errno = HVSC_ERR_IO;
+    struct iovec iov[2];
+    uint8_t address[2];
+    int count;
+    int fd;
+    bool result;
+
+    if (handle->data == NULL) {
+        /* opened with hvsc_psid_open_header() */
+        hvsc_errno = HVSC_ERR_INVALID;
         return false;
     }
 
-    /* do we need to write a 2-byte start address? */
-    if (handle->load_address != 0) {
-        /* write start address in little endian order */
-        if (fputc(handle->load_address & 0xff, fp) == EOF) {
-            hvsc_errno = HVSC_ERR_IO;
-            fclose(fp);
-            return false;
-        }
-        if (fputc(handle->load_address >> 8, fp) == EOF) {
-            hvsc_errno = HVSC_ERR_IO;
-            fclose(fp);
-            return false;
-        }
+    /* check the data offset before creating the output file */
+    count = hvsc_psid_bin_iov(handle, iov, address);
+    if (count == 0) {
+        return false;
     }
-    /* write binary data */
-    size = handle->size - handle->data_offset;
-    hvsc_dbg("writing %zu bytes\n", size);
-    result = fwrite(handle->data + handle->data_offset, 1U, size, fp);
-    hvsc_dbg("wrote %zu bytes\n", result);
-    if (result != size) {
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         hvsc_errno = HVSC_ERR_IO;
-        fclose(fp);
         return false;
     }
 
-    fclose(fp);
-    return true;
+    hvsc_dbg("writing %zu bytes\n", iov[count - 1].iov_len);
+    result = hvsc_writev_all(fd, iov, count);
+    if (close(fd) != 0 && result) {
+        hvsc_errno = HVSC_ERR_IO;
+        result = false;
+    }
+    return result;
 }
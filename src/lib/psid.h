@@ -118,4 +118,14 @@
  */
 #define HVSC_PSID_THIRD_SID     0x7b
 
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "hvsc.h"
+
+int hvsc_psid_bin_iov(const hvsc_psid_t *handle, struct iovec *iov,
+                      uint8_t *address);
+void hvsc_psid_parse_header(hvsc_psid_t *handle, const uint8_t *data);
+
 #endif
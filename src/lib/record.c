@@ -0,0 +1,846 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/record.c
+ * \brief   Workload recording
+ *
+ * The recorder logs the public API calls made by the host to a compact binary
+ * file, which the benchmark tool can replay. Calls made by other library
+ * functions or by the library's worker threads are not logged.
+ *
+ * The file starts with HVSC_RECORD_MAGIC (8 bytes, including the nul) and a
+ * version byte, followed by the calls. Each call is:
+ *
+ * - a byte with the operation and HVSC_RECORD_* flags
+ * - the thread number (varint)
+ * - the nanoseconds since the previous call (varint)
+ * - for a new subject: its length and text, or 16 bytes for a digest
+ * - for a subject seen before: its number (varint)
+ *
+ * Varints are little-endian base-128, so repeated calls on popular tunes
+ * take only a few bytes.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "stats.h"
+
+#include "record.h"
+
+
+/** \brief  Names of the operations
+ */
+static const char *op_names[HVSC_OP_COUNT] = {
+    "sldb-lengths", "sldb-lengths-psid", "sldb-md5", "sldb-txt",
+    "sldb-digest", "stil-open", "stil-get", "bugs-open", "psid-open",
+    "psid-header", "resolve", "resolve-digest", "stil-cache-get"
+};
+
+
+/** \brief  Recorder is running
+ *
+ * Checked by HVSC_RECORD_PATH() and HVSC_RECORD_DIGEST().
+ */
+int hvsc_record_enabled = 0;
+
+/** \brief  Lock for the recorder state
+ */
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Output file, `NULL` when not recording
+ */
+static FILE *record_fp = NULL;
+
+/** \brief  A write failed
+ */
+static bool record_failed = false;
+
+/** \brief  Time of the previous call
+ */
+static uint64_t record_last;
+
+/** \brief  Number of the recording, invalidates thread numbers of earlier
+ *          recordings
+ */
+static uint32_t record_gen = 0;
+
+/** \brief  Number of threads seen in the current recording
+ */
+static uint32_t record_threads;
+
+/** \brief  Subject strings, each prefixed with its HVSC_RECORD_* flags byte
+ */
+static char *record_pool = NULL;
+
+/** \brief  Size of \a record_pool
+ */
+static size_t record_pool_size;
+
+/** \brief  Used bytes of \a record_pool
+ */
+static size_t record_pool_used;
+
+/** \brief  Offset in \a record_pool per subject number
+ */
+static uint32_t *record_subjects = NULL;
+
+/** \brief  Number of subjects
+ */
+static uint32_t record_count;
+
+/** \brief  Hash table of subject numbers + 1 (0 = empty slot)
+ */
+static uint32_t *record_slots = NULL;
+
+/** \brief  Size of \a record_slots, a power of two
+ */
+static size_t record_slots_size;
+
+/** \brief  Recording the calling thread's number belongs to
+ */
+static HVSC_THREAD_LOCAL uint32_t record_thread_gen = 0;
+
+/** \brief  Number of the calling thread in the current recording
+ */
+static HVSC_THREAD_LOCAL uint32_t record_thread_num;
+
+/** \brief  Calling thread is a worker of the library, don't log its calls
+ */
+static HVSC_THREAD_LOCAL bool record_ignored = false;
+
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time
+ */
+static uint64_t record_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/** \brief  Hash subject \a text with \a flags (FNV-1a)
+ *
+ * \param[in]   flags   HVSC_RECORD_REL/HVSC_RECORD_MD5
+ * \param[in]   text    subject
+ * \param[in]   len     length of \a text
+ *
+ * \return  hash
+ */
+static uint32_t record_hash(int flags, const char *text, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+
+    hash = (hash ^ (uint32_t)flags) * 16777619U;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)text[i]) * 16777619U;
+    }
+    return hash;
+}
+
+
+/** \brief  Free the subject tables of the recorder
+ */
+static void record_free_subjects(void)
+{
+    hvsc_free(record_pool);
+    hvsc_free(record_subjects);
+    hvsc_free(record_slots);
+    record_pool = NULL;
+    record_subjects = NULL;
+    record_slots = NULL;
+    record_count = 0;
+}
+
+
+/** \brief  Double the size of the subject hash table
+ *
+ * \return  bool
+ */
+static bool record_grow_slots(void)
+{
+    size_t size = record_slots_size * 2;
+    uint32_t *slots;
+    uint32_t i;
+
+    slots = hvsc_calloc(size, sizeof *slots);
+    if (slots == NULL) {
+        return false;
+    }
+    for (i = 0; i < record_count; i++) {
+        const char *s = record_pool + record_subjects[i];
+        size_t slot = record_hash((uint8_t)s[0], s + 1, strlen(s + 1))
+                      & (size - 1);
+
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    hvsc_free(record_slots);
+    record_slots = slots;
+    record_slots_size = size;
+    return true;
+}
+
+
+/** \brief  Find or add subject \a text
+ *
+ * Call with the lock held.
+ *
+ * \param[in]   flags   HVSC_RECORD_REL/HVSC_RECORD_MD5
+ * \param[in]   text    subject
+ * \param[in]   len     length of \a text
+ * \param[out]  added   subject is new
+ *
+ * \return  subject number or -1 when out of memory
+ */
+static long record_subject(int flags, const char *text, size_t len,
+                           bool *added)
+{
+    uint32_t hash = record_hash(flags, text, len);
+    size_t slot = hash & (record_slots_size - 1);
+    uint32_t *subjects;
+    size_t need;
+
+    *added = false;
+    while (record_slots[slot] != 0) {
+        const char *s = record_pool + record_subjects[record_slots[slot] - 1];
+
+        if ((uint8_t)s[0] == flags && strncmp(s + 1, text, len) == 0
+                && s[len + 1] == '\0') {
+            return (long)record_slots[slot] - 1;
+        }
+        slot = (slot + 1) & (record_slots_size - 1);
+    }
+
+    /* add to the pool: flags byte, text and nul */
+    need = len + 2;
+    if (record_pool_used + need > record_pool_size) {
+        size_t size = record_pool_size * 2;
+        char *pool;
+
+        while (record_pool_used + need > size) {
+            size *= 2;
+        }
+        pool = hvsc_realloc(record_pool, size);
+        if (pool == NULL) {
+            return -1;
+        }
+        record_pool = pool;
+        record_pool_size = size;
+    }
+    subjects = hvsc_realloc(record_subjects,
+                            (record_count + 1) * sizeof *subjects);
+    if (subjects == NULL) {
+        return -1;
+    }
+    record_subjects = subjects;
+    record_subjects[record_count] = (uint32_t)record_pool_used;
+    record_pool[record_pool_used] = (char)flags;
+    memcpy(record_pool + record_pool_used + 1, text, len);
+    record_pool[record_pool_used + 1 + len] = '\0';
+    record_pool_used += need;
+    record_slots[slot] = record_count + 1;
+    record_count++;
+    *added = true;
+
+    if (record_count * 2 > record_slots_size && !record_grow_slots()) {
+        return -1;
+    }
+    return (long)record_count - 1;
+}
+
+
+/** \brief  Write \a value as varint
+ *
+ * \param[in]   value   value
+ */
+static void record_put_varint(uint64_t value)
+{
+    while (value >= 0x80) {
+        putc((int)((value & 0x7f) | 0x80), record_fp);
+        value >>= 7;
+    }
+    putc((int)value, record_fp);
+}
+
+
+/** \brief  Parse hex digest \a text into 16 bytes
+ *
+ * \param[in]   text    32 hex digits
+ * \param[out]  digest  digest
+ */
+static void record_hex_to_digest(const char *text, uint8_t *digest)
+{
+    int i;
+
+    for (i = 0; i < HVSC_DIGEST_SIZE; i++) {
+        unsigned int byte;
+
+        sscanf(text + i * 2, "%2x", &byte);
+        digest[i] = (uint8_t)byte;
+    }
+}
+
+
+/** \brief  Log a call of \a op with subject \a text
+ *
+ * \param[in]   op      operation
+ * \param[in]   flags   HVSC_RECORD_REL/HVSC_RECORD_MD5
+ * \param[in]   text    subject
+ * \param[in]   len     length of \a text
+ */
+static void record_write(int op, int flags, const char *text, size_t len)
+{
+    uint64_t now;
+    long subject;
+    bool added;
+
+    pthread_mutex_lock(&record_lock);
+    if (record_fp == NULL || record_failed) {
+        pthread_mutex_unlock(&record_lock);
+        return;
+    }
+    if (record_thread_gen != record_gen) {
+        record_thread_gen = record_gen;
+        record_thread_num = record_threads++;
+    }
+
+    subject = record_subject(flags, text, len, &added);
+    if (subject < 0) {
+        record_failed = true;
+        pthread_mutex_unlock(&record_lock);
+        return;
+    }
+
+    now = record_now();
+    putc(op | (added ? HVSC_RECORD_NEW | flags : 0), record_fp);
+    record_put_varint(record_thread_num);
+    record_put_varint(now > record_last ? now - record_last : 0);
+    record_last = now;
+    if (!added) {
+        record_put_varint((uint64_t)subject);
+    } else if (flags & HVSC_RECORD_MD5) {
+        uint8_t digest[HVSC_DIGEST_SIZE];
+
+        record_hex_to_digest(text, digest);
+        fwrite(digest, 1, sizeof digest, record_fp);
+    } else {
+        record_put_varint(len);
+        fwrite(text, 1, len, record_fp);
+    }
+    if (ferror(record_fp)) {
+        record_failed = true;
+    }
+    pthread_mutex_unlock(&record_lock);
+}
+
+
+/** \brief  Log a call of \a op on \a path
+ *
+ * Paths inside the HVSC are stored relative to the root, so the workload can
+ * be replayed on a copy of the HVSC in another location. Nested calls and
+ * calls by worker threads are ignored.
+ *
+ * \param[in]   op      operation (hvsc_record_op_t)
+ * \param[in]   path    path passed to the call
+ */
+void hvsc_record_path(int op, const char *path)
+{
+    int flags = 0;
+
+    if (record_ignored || hvsc_stats_depth() > 0 || path == NULL) {
+        return;
+    }
+    if (hvsc_root_path != NULL) {
+        size_t rlen = strlen(hvsc_root_path);
+
+        if (strncmp(path, hvsc_root_path, rlen) == 0 && path[rlen] == '/') {
+            path += rlen;
+            flags = HVSC_RECORD_REL;
+        }
+    }
+    record_write(op, flags, path, strlen(path));
+}
+
+
+/** \brief  Log a call of \a op on \a digest
+ *
+ * \param[in]   op      operation (hvsc_record_op_t)
+ * \param[in]   digest  MD5 digest passed to or calculated by the call
+ */
+void hvsc_record_digest(int op, const uint8_t *digest)
+{
+    char hex[HVSC_DIGEST_SIZE * 2 + 1];
+    int i;
+
+    if (record_ignored || hvsc_stats_depth() > 0) {
+        return;
+    }
+    for (i = 0; i < HVSC_DIGEST_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+    record_write(op, HVSC_RECORD_MD5, hex, HVSC_DIGEST_SIZE * 2);
+}
+
+
+/** \brief  Don't log calls made by the calling thread
+ *
+ * Called by the worker threads of the library.
+ */
+void hvsc_record_ignore_thread(void)
+{
+    record_ignored = true;
+}
+
+
+/** \brief  Start logging the public API calls to \a path
+ *
+ * Only one recording can run at a time. The calls of all threads of the host
+ * go to the same file, each thread gets its own number.
+ *
+ * \param[in]   path    path of the workload file to write
+ *
+ * \return  bool
+ *
+ * \ingroup record
+ */
+bool hvsc_record_start(const char *path)
+{
+    pthread_mutex_lock(&record_lock);
+    if (record_fp != NULL) {
+        pthread_mutex_unlock(&record_lock);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    record_pool_size = HVSC_RECORD_SLOTS_INIT * 32;
+    record_pool_used = 0;
+    record_slots_size = HVSC_RECORD_SLOTS_INIT;
+    record_count = 0;
+    record_pool = hvsc_malloc(record_pool_size);
+    record_slots = hvsc_calloc(record_slots_size, sizeof *record_slots);
+    if (record_pool == NULL || record_slots == NULL) {
+        record_free_subjects();
+        pthread_mutex_unlock(&record_lock);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    record_fp = fopen(path, "wb");
+    if (record_fp == NULL) {
+        record_free_subjects();
+        pthread_mutex_unlock(&record_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+    setvbuf(record_fp, NULL, _IOFBF, HVSC_RECORD_BUFFER_SIZE);
+    fwrite(HVSC_RECORD_MAGIC, 1, sizeof HVSC_RECORD_MAGIC, record_fp);
+    putc(HVSC_RECORD_VERSION, record_fp);
+
+    record_failed = false;
+    record_gen++;
+    record_threads = 0;
+    record_last = record_now();
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&hvsc_record_enabled, 1, __ATOMIC_RELAXED);
+#else
+    hvsc_record_enabled = 1;
+#endif
+    pthread_mutex_unlock(&record_lock);
+    return true;
+}
+
+
+/** \brief  Stop logging and close the workload file
+ *
+ * \return  bool (false with HVSC_ERR_IO when writing failed, or
+ *          HVSC_ERR_INVALID when not recording)
+ *
+ * \ingroup record
+ */
+bool hvsc_record_stop(void)
+{
+    bool ok;
+
+    pthread_mutex_lock(&record_lock);
+    if (record_fp == NULL) {
+        pthread_mutex_unlock(&record_lock);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&hvsc_record_enabled, 0, __ATOMIC_RELAXED);
+#else
+    hvsc_record_enabled = 0;
+#endif
+    ok = !record_failed;
+    if (fclose(record_fp) != 0) {
+        ok = false;
+    }
+    record_fp = NULL;
+    record_free_subjects();
+    pthread_mutex_unlock(&record_lock);
+
+    if (!ok) {
+        hvsc_errno = HVSC_ERR_IO;
+    }
+    return ok;
+}
+
+
+/** \brief  Get name of operation \a op
+ *
+ * \param[in]   op  operation (hvsc_record_op_t)
+ *
+ * \return  name or "unknown"
+ *
+ * \ingroup record
+ */
+const char *hvsc_record_op_name(int op)
+{
+    if (op < 0 || op >= HVSC_OP_COUNT) {
+        return "unknown";
+    }
+    return op_names[op];
+}
+
+
+/** \brief  Initialize \a workload to an empty workload
+ *
+ * \param[out]  workload    workload
+ *
+ * \ingroup record
+ */
+void hvsc_workload_init(hvsc_workload_t *workload)
+{
+    memset(workload, 0, sizeof *workload);
+}
+
+
+/** \brief  Read a varint from \a data
+ *
+ * \param[in]       data    data
+ * \param[in]       size    size of \a data
+ * \param[in,out]   pos     position in \a data
+ * \param[out]      value   value
+ *
+ * \return  bool (false when \a data is truncated or the varint too long)
+ */
+static bool workload_get_varint(const uint8_t *data, size_t size, size_t *pos,
+                                uint64_t *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    while (*pos < size && shift < 64) {
+        uint8_t byte = data[(*pos)++];
+
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+
+/** \brief  Make room for one more call in \a workload
+ *
+ * \param[in,out]   workload    workload
+ * \param[in,out]   max         allocated number of calls
+ *
+ * \return  bool
+ */
+static bool workload_grow_calls(hvsc_workload_t *workload, size_t *max)
+{
+    size_t n = *max > 0 ? *max * 2 : 1024;
+    void *tmp;
+
+    if (workload->count < *max) {
+        return true;
+    }
+#define WORKLOAD_RESIZE_COLUMN(col) \
+    tmp = hvsc_realloc(workload->col, n * sizeof *(workload->col)); \
+    if (tmp == NULL) { \
+        return false; \
+    } \
+    workload->col = tmp;
+
+    WORKLOAD_RESIZE_COLUMN(op);
+    WORKLOAD_RESIZE_COLUMN(thread);
+    WORKLOAD_RESIZE_COLUMN(time_ns);
+    WORKLOAD_RESIZE_COLUMN(subject);
+#undef WORKLOAD_RESIZE_COLUMN
+    *max = n;
+    return true;
+}
+
+
+/** \brief  Add subject \a text to \a workload
+ *
+ * \param[in,out]   workload    workload
+ * \param[in,out]   max         allocated number of subjects
+ * \param[in,out]   strings_max allocated size of the strings
+ * \param[in,out]   used        used size of the strings
+ * \param[in]       flags       HVSC_WORKLOAD_* flags
+ * \param[in]       text        subject
+ * \param[in]       len         length of \a text
+ *
+ * \return  bool
+ */
+static bool workload_add_subject(hvsc_workload_t *workload, size_t *max,
+                                 size_t *strings_max, size_t *used,
+                                 int flags, const char *text, size_t len)
+{
+    if (workload->subjects == *max) {
+        size_t n = *max > 0 ? *max * 2 : 256;
+        uint32_t *offsets;
+        uint8_t *fl;
+
+        offsets = hvsc_realloc(workload->subject_text, n * sizeof *offsets);
+        if (offsets == NULL) {
+            return false;
+        }
+        workload->subject_text = offsets;
+        fl = hvsc_realloc(workload->subject_flags, n * sizeof *fl);
+        if (fl == NULL) {
+            return false;
+        }
+        workload->subject_flags = fl;
+        *max = n;
+    }
+    if (*used + len + 1 > *strings_max) {
+        size_t n = *strings_max > 0 ? *strings_max * 2 : 4096;
+        char *tmp;
+
+        while (*used + len + 1 > n) {
+            n *= 2;
+        }
+        if (n > UINT32_MAX) {
+            hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
+            return false;
+        }
+        tmp = hvsc_realloc(workload->strings, n);
+        if (tmp == NULL) {
+            return false;
+        }
+        workload->strings = tmp;
+        *strings_max = n;
+    }
+    memcpy(workload->strings + *used, text, len);
+    workload->strings[*used + len] = '\0';
+    workload->subject_text[workload->subjects] = (uint32_t)*used;
+    workload->subject_flags[workload->subjects] = (uint8_t)flags;
+    workload->subjects++;
+    *used += len + 1;
+    return true;
+}
+
+
+/** \brief  Parse the calls in workload file \a data
+ *
+ * \param[in,out]   workload    workload
+ * \param[in]       data        contents of the workload file
+ * \param[in]       size        size of \a data
+ *
+ * \return  bool (false with HVSC_ERR_INVALID when the file is damaged)
+ */
+static bool workload_parse(hvsc_workload_t *workload, const uint8_t *data,
+                           size_t size)
+{
+    size_t pos = sizeof HVSC_RECORD_MAGIC + 1;
+    size_t calls_max = 0;
+    size_t subjects_max = 0;
+    size_t strings_max = 0;
+    size_t strings_used = 0;
+    uint64_t time_ns = 0;
+
+    while (pos < size) {
+        int byte = data[pos++];
+        int op = byte & HVSC_RECORD_OP_MASK;
+        uint64_t thread;
+        uint64_t delta;
+        uint64_t subject;
+
+        if (op >= HVSC_OP_COUNT
+                || !workload_get_varint(data, size, &pos, &thread)
+                || !workload_get_varint(data, size, &pos, &delta)
+                || thread >= UINT32_MAX) {
+            hvsc_errno = HVSC_ERR_INVALID;
+            return false;
+        }
+
+        if (byte & HVSC_RECORD_NEW) {
+            int flags = 0;
+            bool ok;
+
+            if (byte & HVSC_RECORD_REL) {
+                flags |= HVSC_WORKLOAD_RELATIVE;
+            }
+            if (byte & HVSC_RECORD_MD5) {
+                char hex[HVSC_DIGEST_SIZE * 2 + 1];
+                int i;
+
+                if (size - pos < HVSC_DIGEST_SIZE) {
+                    hvsc_errno = HVSC_ERR_INVALID;
+                    return false;
+                }
+                for (i = 0; i < HVSC_DIGEST_SIZE; i++) {
+                    snprintf(hex + i * 2, 3, "%02x", data[pos + (size_t)i]);
+                }
+                pos += HVSC_DIGEST_SIZE;
+                flags |= HVSC_WORKLOAD_DIGEST;
+                ok = workload_add_subject(workload, &subjects_max,
+                                          &strings_max, &strings_used,
+                                          flags, hex, HVSC_DIGEST_SIZE * 2);
+            } else {
+                uint64_t len;
+
+                if (!workload_get_varint(data, size, &pos, &len)
+                        || len > size - pos) {
+                    hvsc_errno = HVSC_ERR_INVALID;
+                    return false;
+                }
+                ok = workload_add_subject(workload, &subjects_max,
+                                          &strings_max, &strings_used, flags,
+                                          (const char *)data + pos,
+                                          (size_t)len);
+                pos += (size_t)len;
+            }
+            if (!ok) {
+                return false;
+            }
+            subject = workload->subjects - 1;
+        } else if (!workload_get_varint(data, size, &pos, &subject)
+                || subject >= workload->subjects) {
+            hvsc_errno = HVSC_ERR_INVALID;
+            return false;
+        }
+
+        if (!workload_grow_calls(workload, &calls_max)) {
+            return false;
+        }
+        time_ns += delta;
+        workload->op[workload->count] = (uint8_t)op;
+        workload->thread[workload->count] = (uint32_t)thread;
+        workload->time_ns[workload->count] = time_ns;
+        workload->subject[workload->count] = (uint32_t)subject;
+        workload->count++;
+        if (thread >= workload->threads) {
+            workload->threads = (uint32_t)thread + 1;
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Load the workload file \a path written by the recorder
+ *
+ * \param[out]  workload    workload, free with hvsc_workload_free()
+ * \param[in]   path        path of the workload file
+ *
+ * \return  bool (false with HVSC_ERR_INVALID when the file is damaged)
+ *
+ * \ingroup record
+ */
+bool hvsc_workload_load(hvsc_workload_t *workload, const char *path)
+{
+    uint8_t *data;
+    long size;
+
+    hvsc_workload_init(workload);
+
+    size = hvsc_pread_file(&data, path);
+    if (size < 0) {
+        return false;
+    }
+    if ((size_t)size < sizeof HVSC_RECORD_MAGIC + 1
+            || memcmp(data, HVSC_RECORD_MAGIC, sizeof HVSC_RECORD_MAGIC) != 0
+            || data[sizeof HVSC_RECORD_MAGIC] != HVSC_RECORD_VERSION) {
+        hvsc_free(data);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    if (!workload_parse(workload, data, (size_t)size)) {
+        hvsc_free(data);
+        hvsc_workload_free(workload);
+        return false;
+    }
+    hvsc_free(data);
+    return true;
+}
+
+
+/** \brief  Free memory used by \a workload
+ *
+ * \param[in,out]   workload    workload
+ *
+ * \ingroup record
+ */
+void hvsc_workload_free(hvsc_workload_t *workload)
+{
+    hvsc_free(workload->op);
+    hvsc_free(workload->thread);
+    hvsc_free(workload->time_ns);
+    hvsc_free(workload->subject);
+    hvsc_free(workload->subject_text);
+    hvsc_free(workload->subject_flags);
+    hvsc_free(workload->strings);
+    hvsc_workload_init(workload);
+}
+
+
+/** \brief  Get the subject of \a call in \a workload
+ *
+ * \param[in]   workload    workload
+ * \param[in]   call        call number
+ *
+ * \return  path (relative to the HVSC root when the subject has the
+ *          HVSC_WORKLOAD_RELATIVE flag) or digest in hex
+ *
+ * \ingroup record
+ */
+const char *hvsc_workload_subject(const hvsc_workload_t *workload,
+                                  size_t call)
+{
+    return workload->strings
+        + workload->subject_text[workload->subject[call]];
+}
@@ -0,0 +1,97 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/record.h
+ * \brief   Workload recording - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_RECORD_H
+#define HVSC_RECORD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+
+/** \brief  Magic bytes at the start of a workload file
+ */
+#define HVSC_RECORD_MAGIC       "HVSCWKL"
+
+/** \brief  Version of the workload file format
+ */
+#define HVSC_RECORD_VERSION     1
+
+/** \brief  Call flag: the subject is new, its text follows
+ */
+#define HVSC_RECORD_NEW         0x80
+
+/** \brief  Call flag: the (new) subject is a path relative to the HVSC root
+ */
+#define HVSC_RECORD_REL         0x40
+
+/** \brief  Call flag: the (new) subject is a digest, stored as 16 bytes
+ */
+#define HVSC_RECORD_MD5         0x20
+
+/** \brief  Mask for the operation in the first byte of a call
+ */
+#define HVSC_RECORD_OP_MASK     0x1f
+
+
+extern int hvsc_record_enabled;
+
+
+/** \brief  Check if the recorder is running, not running is the expected case
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define HVSC_RECORD_ENABLED() \
+    __builtin_expect(__atomic_load_n(&hvsc_record_enabled, __ATOMIC_RELAXED), 0)
+#else
+# define HVSC_RECORD_ENABLED()  (hvsc_record_enabled)
+#endif
+
+/** \brief  Log a call of \a op on \a path when the recorder is running
+ */
+#define HVSC_RECORD_PATH(op, path) \
+    do { \
+        if (HVSC_RECORD_ENABLED()) { \
+            hvsc_record_path((op), (path)); \
+        } \
+    } while (0)
+
+/** \brief  Log a call of \a op on \a digest when the recorder is running
+ */
+#define HVSC_RECORD_DIGEST(op, digest) \
+    do { \
+        if (HVSC_RECORD_ENABLED()) { \
+            hvsc_record_digest((op), (digest)); \
+        } \
+    } while (0)
+
+
+void    hvsc_record_path(int op, const char *path);
+void    hvsc_record_digest(int op, const uint8_t *digest);
+void    hvsc_record_ignore_thread(void);
+
+#endif
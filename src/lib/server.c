@@ -0,0 +1,343 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/server.c
+ * \brief   Answering hvscd requests
+ *
+ * Turns a request frame into a response frame using the normal lookup
+ * functions, so the daemon answers exactly like the library would in the
+ * client's process. The event loop lives in hvscd, this file only knows
+ * about frames.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "index.h"
+#include "proto.h"
+
+#include "server.h"
+
+
+/** \brief  Check if path key \a body stays inside the HVSC root
+ *
+ * \param[in]   body    path key
+ * \param[in]   size    size of \a body
+ *
+ * \return  \a body has no ".." component
+ */
+static bool server_key_inside(const uint8_t *body, size_t size)
+{
+    size_t start = 0;
+    size_t i;
+
+    for (i = 0; i <= size; i++) {
+        if (i == size || body[i] == '/') {
+            if (i - start == 2
+                    && body[start] == '.' && body[start + 1] == '.') {
+                return false;
+            }
+            start = i + 1;
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Get the absolute path of the PSID file a request is about
+ *
+ * A path key is relative to the HVSC root and can't leave it, a digest key
+ * is resolved through the index.
+ *
+ * \param[in]   op      op of the request
+ * \param[in]   body    key
+ * \param[in]   size    size of \a body
+ *
+ * \return  heap-allocated path or `NULL` on failure
+ */
+static char *server_key_path(int op, const uint8_t *body, size_t size)
+{
+    size_t rlen = strlen(hvsc_root_path);
+    const char *rel;
+    char *decoded = NULL;
+    char *path;
+
+    if (op & HVSC_PROTO_DIGEST) {
+        hvsc_index_t *index;
+        long tune;
+
+        index = hvsc_index_acquire();
+        if (index == NULL || size != HVSC_DIGEST_SIZE) {
+            hvsc_errno = HVSC_ERR_INVALID;
+            hvsc_index_release(index);
+            return NULL;
+        }
+        tune = hvsc_index_find_digest(index, body);
+        if (tune < 0) {
+            hvsc_errno = HVSC_ERR_NOT_FOUND;
+            hvsc_index_release(index);
+            return NULL;
+        }
+        decoded = hvsc_index_path(index, (size_t)tune);
+        hvsc_index_release(index);
+        if (decoded == NULL) {
+            return NULL;
+        }
+        rel = decoded;
+        size = strlen(rel);
+    } else {
+        if (size == 0 || body[0] != '/' || memchr(body, '\0', size) != NULL
+                || !server_key_inside(body, size)) {
+            hvsc_errno = HVSC_ERR_INVALID;
+            return NULL;
+        }
+        rel = (const char *)body;
+    }
+
+    path = hvsc_malloc(rlen + size + 1);
+    if (path == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+    } else {
+        memcpy(path, hvsc_root_path, rlen);
+        memcpy(path + rlen, rel, size);
+        path[rlen + size] = '\0';
+    }
+    hvsc_free(decoded);
+    return path;
+}
+
+
+/** \brief  Append a nul-terminated string to \a out, `NULL` as empty string
+ *
+ * \param[in,out]   out     buffer
+ * \param[in]       s       string
+ * \param[in]       nul     append the terminator as well
+ *
+ * \return  bool
+ */
+static bool server_append(hvsc_proto_buffer_t *out, const char *s, bool nul)
+{
+    if (s == NULL) {
+        s = "";
+    }
+    return hvsc_proto_buffer_append(out, s, strlen(s) + (nul ? 1 : 0));
+}
+
+
+/** \brief  Answer a SLDB lookup
+ *
+ * \param[in,out]   out     buffer
+ * \param[in]       op      op of the request
+ * \param[in]       body    key
+ * \param[in]       size    size of \a body
+ *
+ * \return  bool
+ */
+static bool server_sldb(hvsc_proto_buffer_t *out, int op,
+                        const uint8_t *body, size_t size)
+{
+    char *entry;
+    char *path;
+    bool result;
+
+    if (op & HVSC_PROTO_DIGEST) {
+        if (size != HVSC_DIGEST_SIZE) {
+            hvsc_errno = HVSC_ERR_INVALID;
+            return false;
+        }
+        entry = hvsc_sldb_get_entry_digest(body);
+    } else {
+        path = server_key_path(op, body, size);
+        if (path == NULL) {
+            return false;
+        }
+        entry = hvsc_sldb_get_entry_txt(path);
+        hvsc_free(path);
+    }
+    if (entry == NULL) {
+        return false;
+    }
+    result = server_append(out, entry, false);
+    free(entry);
+    return result;
+}
+
+
+/** \brief  Answer a STIL lookup with the raw text of the entry
+ *
+ * The client parses the entry, which keeps the responses small.
+ *
+ * \param[in,out]   out     buffer
+ * \param[in]       path    absolute path to PSID file
+ *
+ * \return  bool
+ */
+static bool server_stil(hvsc_proto_buffer_t *out, const char *path)
+{
+    hvsc_stil_t stil;
+    const char *line;
+
+    if (!hvsc_stil_open(path, &stil)) {
+        return false;
+    }
+    if (!server_append(out, stil.psid_path, true)) {
+        hvsc_stil_close(&stil);
+        return false;
+    }
+    while ((line = hvsc_text_file_read(&(stil.stil))) != NULL
+            && !hvsc_string_is_empty(line)) {
+        if (!server_append(out, line, false)
+                || !hvsc_proto_buffer_append(out, "\n", 1)) {
+            hvsc_stil_close(&stil);
+            return false;
+        }
+    }
+    if (line == NULL && !hvsc_text_file_eof(&(stil.stil))) {
+        hvsc_stil_close(&stil);
+        return false;
+    }
+    hvsc_stil_close(&stil);
+    return true;
+}
+
+
+/** \brief  Answer a BUGlist lookup with the parsed entry
+ *
+ * \param[in,out]   out     buffer
+ * \param[in]       path    absolute path to PSID file
+ *
+ * \return  bool
+ */
+static bool server_bugs(hvsc_proto_buffer_t *out, const char *path)
+{
+    hvsc_bugs_t bugs;
+    bool result;
+
+    if (!hvsc_bugs_open(path, &bugs)) {
+        return false;
+    }
+    result = server_append(out, bugs.psid_path, true)
+        && server_append(out, bugs.text, true)
+        && server_append(out, bugs.user, false);
+    hvsc_bugs_close(&bugs);
+    return result;
+}
+
+
+/** \brief  Answer a request about a PSID file
+ *
+ * \param[in,out]   out     buffer
+ * \param[in]       op      op of the request
+ * \param[in]       body    key
+ * \param[in]       size    size of \a body
+ *
+ * \return  bool
+ */
+static bool server_lookup(hvsc_proto_buffer_t *out, int op,
+                          const uint8_t *body, size_t size)
+{
+    char *path;
+    char *resolved;
+    bool result = false;
+
+    if ((op & HVSC_PROTO_OP_MASK) == HVSC_PROTO_SLDB) {
+        return server_sldb(out, op, body, size);
+    }
+
+    path = server_key_path(op, body, size);
+    if (path == NULL) {
+        return false;
+    }
+    switch (op & HVSC_PROTO_OP_MASK) {
+        case HVSC_PROTO_STIL:
+            result = server_stil(out, path);
+            break;
+        case HVSC_PROTO_BUGS:
+            result = server_bugs(out, path);
+            break;
+        case HVSC_PROTO_RESOLVE:
+            resolved = hvsc_index_resolve(path);
+            if (resolved != NULL) {
+                result = server_append(out, resolved, false);
+                free(resolved);
+            }
+            break;
+        default:
+            hvsc_errno = HVSC_ERR_INVALID;
+            break;
+    }
+    hvsc_free(path);
+    return result;
+}
+
+
+/** \brief  Answer request \a id, appending the response frame to \a out
+ *
+ * Failed lookups are answered with hvsc_errno as status and an empty body.
+ *
+ * \param[in,out]   out     buffer for responses
+ * \param[in]       id      ID of the request
+ * \param[in]       op      op of the request
+ * \param[in]       body    body of the request
+ * \param[in]       size    size of \a body
+ *
+ * \return  `false` when out of memory for the response
+ */
+bool hvsc_server_request(hvsc_proto_buffer_t *out, uint32_t id, int op,
+                         const uint8_t *body, size_t size)
+{
+    size_t frame;
+    bool result;
+
+    if (!hvsc_proto_begin_frame(out, id, 0, &frame)) {
+        return false;
+    }
+    hvsc_errno = 0;
+    if (op == HVSC_PROTO_HELLO) {
+        result = size == 4 && hvsc_proto_get_u32(body) == HVSC_PROTO_VERSION;
+        if (!result) {
+            hvsc_errno = HVSC_ERR_INVALID;
+        }
+    } else {
+        result = server_lookup(out, op, body, size);
+    }
+    if (!result) {
+        if (hvsc_errno == HVSC_ERR_OOM) {
+            return false;
+        }
+        /* drop a partial body */
+        out->size = frame + HVSC_PROTO_HEADER_SIZE;
+        out->data[frame + 8] = (uint8_t)(hvsc_errno != 0
+                ? hvsc_errno : HVSC_ERR_NOT_FOUND);
+    }
+    hvsc_proto_end_frame(out, frame);
+    return true;
+}
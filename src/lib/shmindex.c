@@ -0,0 +1,504 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/shmindex.c
+ * \brief   Index shared between processes
+ *
+ * The index is copied as is into a file on a tmpfs, one per HVSC root. Other
+ * processes map that file read-only instead of building their own index, so
+ * the memory for the index is used once per host. The arrays of an index
+ * only refer to each other by offset, so the mapping works at any address.
+ *
+ * The segment records the identity of the SLDB, STIL and BUGlist it was
+ * built from; a segment for files that have changed since is ignored.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "index.h"
+#include "pathdict.h"
+#include "sldb.h"
+
+#include "shmindex.h"
+
+
+/** \brief  Get the path of the shared index segment of the HVSC root
+ *
+ * \return  heap-allocated path or `NULL` on failure
+ */
+static char *shm_index_name(void)
+{
+    char *name;
+
+    name = hvsc_malloc(sizeof HVSC_SHM_INDEX_DIR + 32);
+    if (name == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        return NULL;
+    }
+    sprintf(name, "%s/hvsc-index-%016llx", HVSC_SHM_INDEX_DIR,
+            (unsigned long long)hvsc_hash_bytes(hvsc_root_path,
+                                                strlen(hvsc_root_path)));
+    return name;
+}
+
+
+/** \brief  Round \a n up to the alignment of the sections in a segment
+ *
+ * \param[in]   n   offset
+ *
+ * \return  aligned offset
+ */
+static uint64_t shm_index_align(uint64_t n)
+{
+    return (n + HVSC_SHM_INDEX_ALIGN - 1)
+        & ~(uint64_t)(HVSC_SHM_INDEX_ALIGN - 1);
+}
+
+
+/** \brief  Get the sizes of the sections of a segment
+ *
+ * \param[in]   header  header with the counts and sizes set
+ * \param[out]  sizes   size of each section
+ */
+static void shm_index_section_sizes(const shm_index_header_t *header,
+                                    uint64_t *sizes)
+{
+    sizes[HVSC_SHM_INDEX_ROOT] = header->root_size + 1;
+    sizes[HVSC_SHM_INDEX_SLDB_TEXT] = header->sldb_size + 1;
+    sizes[HVSC_SHM_INDEX_SLDB_ENTRIES] =
+        header->sldb_count * sizeof(hvsc_sldb_entry_t);
+    sizes[HVSC_SHM_INDEX_STIL_TEXT] = header->stil_size;
+    sizes[HVSC_SHM_INDEX_BUGS_TEXT] = header->bugs_size;
+    sizes[HVSC_SHM_INDEX_PATH_DATA] = header->path_data_size;
+    sizes[HVSC_SHM_INDEX_PATH_BLOCKS] = sizeof(uint32_t)
+        * ((header->count + HVSC_PATHDICT_BLOCK - 1) / HVSC_PATHDICT_BLOCK);
+    sizes[HVSC_SHM_INDEX_SLDB_ENTRY] = header->count * sizeof(uint32_t);
+    sizes[HVSC_SHM_INDEX_STIL] = header->count * sizeof(uint32_t);
+    sizes[HVSC_SHM_INDEX_STIL_HASH] = header->count * sizeof(uint64_t);
+    sizes[HVSC_SHM_INDEX_BUGS] = header->count * sizeof(uint32_t);
+    sizes[HVSC_SHM_INDEX_SUM_TUNES] = (header->count + 1) * sizeof(uint32_t);
+    sizes[HVSC_SHM_INDEX_SUM_PLAYTIME] =
+        (header->count + 1) * sizeof(uint64_t);
+    sizes[HVSC_SHM_INDEX_SUM_STIL] = (header->count + 1) * sizeof(uint32_t);
+    sizes[HVSC_SHM_INDEX_SUM_BUGS] = (header->count + 1) * sizeof(uint32_t);
+    sizes[HVSC_SHM_INDEX_DIGEST_SLOTS] = header->digest_size * sizeof(uint32_t);
+}
+
+
+/** \brief  Calculate the section offsets of a segment
+ *
+ * \param[out]  layout  header to store the offsets in
+ * \param[in]   header  header with the counts and sizes set
+ *
+ * \return  total size of the segment
+ */
+static uint64_t shm_index_layout(shm_index_header_t *layout,
+                                 const shm_index_header_t *header)
+{
+    uint64_t sizes[HVSC_SHM_INDEX_SECTIONS];
+    uint64_t offset = shm_index_align(sizeof *header);
+    int i;
+
+    shm_index_section_sizes(header, sizes);
+    for (i = 0; i < HVSC_SHM_INDEX_SECTIONS; i++) {
+        layout->sections[i] = offset;
+        offset = shm_index_align(offset + sizes[i]);
+    }
+    return offset;
+}
+
+
+/** \brief  Write \a index to the shared index segment of the HVSC root
+ *
+ * The segment is written to a temporary file first which is then renamed, so
+ * processes attaching never see a partially written segment. A segment that
+ * is already mapped by other processes stays valid for them.
+ *
+ * \param[in]   index   index
+ *
+ * \return  bool
+ */
+bool hvsc_shm_index_write(const hvsc_index_t *index)
+{
+    static const uint8_t padding[HVSC_SHM_INDEX_ALIGN];
+    shm_index_header_t header;
+    uint64_t sizes[HVSC_SHM_INDEX_SECTIONS];
+    const void *data[HVSC_SHM_INDEX_SECTIONS];
+    struct iovec iov[(HVSC_SHM_INDEX_SECTIONS + 1) * 2];
+    char *name;
+    char *tmp_name;
+    int count = 0;
+    int fd;
+    int i;
+    bool ok;
+
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, HVSC_SHM_INDEX_MAGIC, sizeof header.magic);
+    header.version = HVSC_SHM_INDEX_VERSION;
+    header.byte_order = HVSC_SHM_INDEX_BYTE_ORDER;
+    header.entry_size = (uint32_t)sizeof(hvsc_sldb_entry_t);
+    memcpy(header.stamps, index->stamps, sizeof header.stamps);
+    header.root_size = strlen(hvsc_root_path);
+    header.sldb_size = index->sldb.size;
+    header.sldb_count = index->sldb.count;
+    header.stil_size = index->stil_size;
+    header.bugs_size = index->bugs_size;
+    header.path_data_size = index->paths.data_size;
+    header.path_max_len = index->paths.max_len;
+    header.count = index->count;
+    header.digest_size = index->digest_size;
+    shm_index_layout(&header, &header);
+
+    data[HVSC_SHM_INDEX_ROOT] = hvsc_root_path;
+    data[HVSC_SHM_INDEX_SLDB_TEXT] = index->sldb.text;
+    data[HVSC_SHM_INDEX_SLDB_ENTRIES] = index->sldb.entries;
+    data[HVSC_SHM_INDEX_STIL_TEXT] = index->stil_text;
+    data[HVSC_SHM_INDEX_BUGS_TEXT] = index->bugs_text;
+    data[HVSC_SHM_INDEX_PATH_DATA] = index->paths.data;
+    data[HVSC_SHM_INDEX_PATH_BLOCKS] = index->paths.blocks;
+    data[HVSC_SHM_INDEX_SLDB_ENTRY] = index->sldb_entry;
+    data[HVSC_SHM_INDEX_STIL] = index->stil;
+    data[HVSC_SHM_INDEX_STIL_HASH] = index->stil_hash;
+    data[HVSC_SHM_INDEX_BUGS] = index->bugs;
+    data[HVSC_SHM_INDEX_SUM_TUNES] = index->sum_tunes;
+    data[HVSC_SHM_INDEX_SUM_PLAYTIME] = index->sum_playtime;
+    data[HVSC_SHM_INDEX_SUM_STIL] = index->sum_stil;
+    data[HVSC_SHM_INDEX_SUM_BUGS] = index->sum_bugs;
+    data[HVSC_SHM_INDEX_DIGEST_SLOTS] = index->digest_slots;
+
+    /* each section followed by the padding up to the next one */
+    shm_index_section_sizes(&header, sizes);
+    iov[count].iov_base = &header;
+    iov[count++].iov_len = sizeof header;
+    iov[count].iov_base = (void *)padding;
+    iov[count++].iov_len = header.sections[0] - sizeof header;
+    for (i = 0; i < HVSC_SHM_INDEX_SECTIONS; i++) {
+        iov[count].iov_base = (void *)data[i];
+        iov[count++].iov_len = (size_t)sizes[i];
+        iov[count].iov_base = (void *)padding;
+        iov[count++].iov_len = (size_t)(shm_index_align(sizes[i]) - sizes[i]);
+    }
+
+    name = shm_index_name();
+    if (name == NULL) {
+        return false;
+    }
+    tmp_name = hvsc_malloc(strlen(name) + 32);
+    if (tmp_name == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        hvsc_free(name);
+        return false;
+    }
+    sprintf(tmp_name, "%s.%ld", name, (long)getpid());
+
+    fd = open(tmp_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        hvsc_free(tmp_name);
+        hvsc_free(name);
+        return false;
+    }
+    ok = hvsc_writev_all(fd, iov, count);
+    if (close(fd) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp_name, name) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        hvsc_errno = HVSC_ERR_IO;
+        unlink(tmp_name);
+    } else {
+        hvsc_dbg("shared index of %zu tunes in %s\n", index->count, name);
+    }
+    hvsc_free(tmp_name);
+    hvsc_free(name);
+    return ok;
+}
+
+
+/** \brief  Check the header of a mapped segment
+ *
+ * \param[in]   header  header
+ * \param[in]   size    size of the segment
+ *
+ * \return  bool
+ */
+static bool shm_index_check_header(const shm_index_header_t *header,
+                                   size_t size)
+{
+    shm_index_header_t layout;
+    hvsc_index_stamp_t stamps[HVSC_INDEX_FILES];
+    uint64_t total;
+    int i;
+
+    if (memcmp(header->magic, HVSC_SHM_INDEX_MAGIC, sizeof header->magic) != 0
+            || header->version != HVSC_SHM_INDEX_VERSION
+            || header->byte_order != HVSC_SHM_INDEX_BYTE_ORDER
+            || header->entry_size != sizeof(hvsc_sldb_entry_t)) {
+        hvsc_dbg("invalid shared index header\n");
+        return false;
+    }
+    /* everything refers to these with 32-bit offsets */
+    if (header->root_size >= UINT32_MAX || header->sldb_size >= UINT32_MAX
+            || header->sldb_count >= UINT32_MAX
+            || header->stil_size >= UINT32_MAX
+            || header->bugs_size >= UINT32_MAX
+            || header->path_data_size >= UINT32_MAX
+            || header->path_max_len >= UINT32_MAX
+            || header->count >= UINT32_MAX
+            || header->digest_size >= UINT32_MAX) {
+        hvsc_dbg("invalid shared index sizes\n");
+        return false;
+    }
+    total = shm_index_layout(&layout, header);
+    for (i = 0; i < HVSC_SHM_INDEX_SECTIONS; i++) {
+        if (header->sections[i] != layout.sections[i]) {
+            total = UINT64_MAX;
+        }
+    }
+    if (total > size) {
+        hvsc_dbg("invalid shared index layout\n");
+        return false;
+    }
+
+    if (!hvsc_index_stamp_files(stamps)
+            || memcmp(stamps, header->stamps, sizeof stamps) != 0) {
+        hvsc_dbg("shared index is stale\n");
+        return false;
+    }
+    return true;
+}
+
+
+/** \brief  Check the references between the arrays of a mapped index
+ *
+ * The segment could have been written by a different build or be corrupt,
+ * so make sure lookups can't run off the mapping or loop forever.
+ *
+ * \param[in]   index   index attached to the segment
+ *
+ * \return  bool
+ */
+static bool shm_index_check_tables(const hvsc_index_t *index)
+{
+    const hvsc_sldb_table_t *sldb = &(index->sldb);
+    size_t used;
+    size_t i;
+
+    if (sldb->text[sldb->size] != '\0'
+            || !hvsc_pathdict_check(&(index->paths))) {
+        return false;
+    }
+    for (i = 0; i < sldb->count; i++) {
+        if (sldb->entries[i].line >= sldb->size
+                || (sldb->entries[i].path != HVSC_SLDB_NONE
+                    && sldb->entries[i].path >= sldb->size)) {
+            return false;
+        }
+    }
+    for (i = 0; i < index->count; i++) {
+        if ((index->sldb_entry[i] != HVSC_INDEX_NONE
+                    && index->sldb_entry[i] >= sldb->count)
+                || (index->stil[i] != HVSC_INDEX_NONE
+                    && index->stil[i] > index->stil_size)
+                || (index->bugs[i] != HVSC_INDEX_NONE
+                    && index->bugs[i] > index->bugs_size)) {
+            return false;
+        }
+    }
+
+    /* power of two size with at least one free slot */
+    if (index->digest_size == 0
+            || (index->digest_size & (index->digest_size - 1))) {
+        return false;
+    }
+    used = 0;
+    for (i = 0; i < index->digest_size; i++) {
+        uint32_t tune = index->digest_slots[i];
+
+        if (tune > index->count
+                || (tune > 0
+                    && index->sldb_entry[tune - 1] == HVSC_INDEX_NONE)) {
+            return false;
+        }
+        used += tune != 0;
+    }
+    return used < index->digest_size;
+}
+
+
+/** \brief  Attach to the shared index segment of the HVSC root
+ *
+ * Segments owned by another user than the current one or root are ignored,
+ * anyone can create files in the segment directory.
+ *
+ * \return  index with a single reference, or `NULL` on failure: hvsc_errno is
+ *          HVSC_ERR_NOT_FOUND when there is no segment, HVSC_ERR_INVALID when
+ *          it's stale or damaged
+ */
+hvsc_index_t *hvsc_shm_index_attach(void)
+{
+    shm_index_header_t header;
+    struct stat st;
+    hvsc_index_t *index;
+    uint8_t *base;
+    char *name;
+    int fd;
+
+    name = shm_index_name();
+    if (name == NULL) {
+        return NULL;
+    }
+    fd = open(name, O_RDONLY | O_CLOEXEC);
+    hvsc_free(name);
+    if (fd < 0) {
+        hvsc_errno = errno == ENOENT ? HVSC_ERR_NOT_FOUND : HVSC_ERR_IO;
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        close(fd);
+        return NULL;
+    }
+    if ((st.st_uid != geteuid() && st.st_uid != 0)
+            || (uint64_t)st.st_size < sizeof header) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        hvsc_errno = HVSC_ERR_IO;
+        return NULL;
+    }
+    memcpy(&header, base, sizeof header);
+    if (!shm_index_check_header(&header, (size_t)st.st_size)
+            || header.root_size != strlen(hvsc_root_path)
+            || memcmp(base + header.sections[HVSC_SHM_INDEX_ROOT],
+                      hvsc_root_path, header.root_size + 1) != 0) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    index = hvsc_calloc(1, sizeof *index);
+    if (index == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    index->refs = 1;
+    index->map = base;
+    index->map_size = (size_t)st.st_size;
+    memcpy(index->stamps, header.stamps, sizeof index->stamps);
+
+    index->sldb.text = (char *)(base
+            + header.sections[HVSC_SHM_INDEX_SLDB_TEXT]);
+    index->sldb.size = (size_t)header.sldb_size;
+    index->sldb.entries = (hvsc_sldb_entry_t *)(base
+            + header.sections[HVSC_SHM_INDEX_SLDB_ENTRIES]);
+    index->sldb.count = (size_t)header.sldb_count;
+    index->stil_text = (char *)(base
+            + header.sections[HVSC_SHM_INDEX_STIL_TEXT]);
+    index->stil_size = (size_t)header.stil_size;
+    index->bugs_text = (char *)(base
+            + header.sections[HVSC_SHM_INDEX_BUGS_TEXT]);
+    index->bugs_size = (size_t)header.bugs_size;
+    index->paths.data = base + header.sections[HVSC_SHM_INDEX_PATH_DATA];
+    index->paths.data_size = (size_t)header.path_data_size;
+    index->paths.blocks = (uint32_t *)(base
+            + header.sections[HVSC_SHM_INDEX_PATH_BLOCKS]);
+    index->paths.count = (size_t)header.count;
+    index->paths.max_len = (size_t)header.path_max_len;
+    index->count = (size_t)header.count;
+    index->sldb_entry = (uint32_t *)(base
+            + header.sections[HVSC_SHM_INDEX_SLDB_ENTRY]);
+    index->stil = (uint32_t *)(base + header.sections[HVSC_SHM_INDEX_STIL]);
+    index->stil_hash = (uint64_t *)(base
+            + header.sections[HVSC_SHM_INDEX_STIL_HASH]);
+    index->bugs = (uint32_t *)(base + header.sections[HVSC_SHM_INDEX_BUGS]);
+    index->sum_tunes = (uint32_t *)(base
+            + header.sections[HVSC_SHM_INDEX_SUM_TUNES]);
+    index->sum_playtime = (uint64_t *)(base
+            + header.sections[HVSC_SHM_INDEX_SUM_PLAYTIME]);
+    index->sum_stil = (uint32_t *)(base
+            + header.sections[HVSC_SHM_INDEX_SUM_STIL]);
+    index->sum_bugs = (uint32_t *)(base
+            + header.sections[HVSC_SHM_INDEX_SUM_BUGS]);
+    index->digest_slots = (uint32_t *)(base
+            + header.sections[HVSC_SHM_INDEX_DIGEST_SLOTS]);
+    index->digest_size = (size_t)header.digest_size;
+
+    if (!shm_index_check_tables(index)) {
+        hvsc_dbg("invalid shared index tables\n");
+        hvsc_errno = HVSC_ERR_INVALID;
+        munmap(base, (size_t)st.st_size);
+        hvsc_free(index);
+        return NULL;
+    }
+    hvsc_dbg("attached to shared index of %zu tunes\n", index->count);
+    return index;
+}
+
+
+/** \brief  Remove the shared index segment of the HVSC root
+ *
+ * Processes attached to the segment keep using it, new processes build their
+ * own index or share a new one.
+ *
+ * \return  bool
+ */
+bool hvsc_shm_index_remove(void)
+{
+    char *name = shm_index_name();
+    bool result;
+
+    if (name == NULL) {
+        return false;
+    }
+    result = unlink(name) == 0 || errno == ENOENT;
+    if (!result) {
+        hvsc_errno = HVSC_ERR_IO;
+    }
+    hvsc_free(name);
+    return result;
+}
@@ -0,0 +1,112 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/shmindex.h
+ * \brief   Index shared between processes - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_SHMINDEX_H
+#define HVSC_SHMINDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hvsc_defs.h"
+#include "index.h"
+
+
+/** \brief  Magic bytes of a shared index segment
+ */
+#define HVSC_SHM_INDEX_MAGIC        "HVSCIDX"
+
+
+/** \brief  Version of the shared index layout
+ *
+ * Increment when the layout changes, older segments are then ignored.
+ */
+#define HVSC_SHM_INDEX_VERSION      3
+
+
+/** \brief  Byte order marker of a shared index segment
+ */
+#define HVSC_SHM_INDEX_BYTE_ORDER   0x01020304U
+
+
+/** \brief  Alignment of the sections in a shared index segment
+ */
+#define HVSC_SHM_INDEX_ALIGN        16
+
+
+/** \brief  Sections of a shared index segment, in segment order
+ */
+enum {
+    HVSC_SHM_INDEX_ROOT,        /**< HVSC root path */
+    HVSC_SHM_INDEX_SLDB_TEXT,   /**< SLDB text, split into lines */
+    HVSC_SHM_INDEX_SLDB_ENTRIES,    /**< SLDB table entries */
+    HVSC_SHM_INDEX_STIL_TEXT,   /**< STIL text */
+    HVSC_SHM_INDEX_BUGS_TEXT,   /**< BUGlist text */
+    HVSC_SHM_INDEX_PATH_DATA,   /**< front-coded paths */
+    HVSC_SHM_INDEX_PATH_BLOCKS, /**< offset per block of paths */
+    HVSC_SHM_INDEX_SLDB_ENTRY,  /**< SLDB entry per tune */
+    HVSC_SHM_INDEX_STIL,        /**< STIL offset per tune */
+    HVSC_SHM_INDEX_STIL_HASH,   /**< STIL entry hash per tune */
+    HVSC_SHM_INDEX_BUGS,        /**< BUGlist offset per tune */
+    HVSC_SHM_INDEX_SUM_TUNES,   /**< SLDB tunes before each tune */
+    HVSC_SHM_INDEX_SUM_PLAYTIME,    /**< playtime before each tune */
+    HVSC_SHM_INDEX_SUM_STIL,    /**< STIL tunes before each tune */
+    HVSC_SHM_INDEX_SUM_BUGS,    /**< BUGlist tunes before each tune */
+    HVSC_SHM_INDEX_DIGEST_SLOTS,    /**< digest hash table */
+
+    HVSC_SHM_INDEX_SECTIONS     /**< number of sections */
+};
+
+
+/** \brief  Header of a shared index segment
+ *
+ * All offsets are relative to the start of the segment.
+ */
+typedef struct shm_index_header_s {
+    char        magic[8];       /**< HVSC_SHM_INDEX_MAGIC */
+    uint32_t    version;        /**< HVSC_SHM_INDEX_VERSION */
+    uint32_t    byte_order;     /**< HVSC_SHM_INDEX_BYTE_ORDER */
+    uint32_t    entry_size;     /**< size of a SLDB table entry */
+    uint32_t    reserved;       /**< padding, zero */
+    hvsc_index_stamp_t  stamps[HVSC_INDEX_FILES];   /**< files indexed */
+    uint64_t    root_size;      /**< length of the root path */
+    uint64_t    sldb_size;      /**< size of the SLDB text */
+    uint64_t    sldb_count;     /**< number of SLDB entries */
+    uint64_t    stil_size;      /**< size of the STIL text */
+    uint64_t    bugs_size;      /**< size of the BUGlist text */
+    uint64_t    path_data_size; /**< size of the front-coded paths */
+    uint64_t    path_max_len;   /**< length of the longest path */
+    uint64_t    count;          /**< number of tunes */
+    uint64_t    digest_size;    /**< number of digest slots */
+    uint64_t    sections[HVSC_SHM_INDEX_SECTIONS];  /**< section offsets */
+} shm_index_header_t;
+
+
+bool            hvsc_shm_index_write(const hvsc_index_t *index);
+hvsc_index_t *  hvsc_shm_index_attach(void);
+bool            hvsc_shm_index_remove(void);
+
+#endif
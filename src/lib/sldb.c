@@ -29,21 +29,28 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <string.h>
 #include <ctype.h>
 
-#include <gcrypt.h>
-
 #include "hvsc.h"
 
 #include "hvsc_defs.h"
 #include "base.h"
+#include "alloc.h"
+#include "md5.h"
+#include "dcache.h"
+#include "index.h"
+#include "stats.h"
+#include "trace.h"
+#include "record.h"
+#include "client.h"
 
 #include "sldb.h"
 
 
-#ifdef HVSC_USE_MD5
-
 /** \brief  Calculate MD5 hash of file \a psid
+ *
+ * Uses the digest cache when it's open, see hvsc_dcache_open().
  *
  * \param[in]   psid    PSID file
  * \param[out]  digest  memory to store MD5 digest, needs to be 16+ bytes
@@ -52,45 +59,11 @@
  */
 static bool create_md5_hash(const char *psid, unsigned char *digest)
 {
-    unsigned char *data;
-    long size;
-    gcry_md_hd_t handle;
-    gcry_error_t err;
-    unsigned char *d;
-
-    /* attempt to open file */
-    hvsc_dbg("reading '%s\n", psid);
-    size = hvsc_read_file(&data, psid);
-    if (size < 0) {
-        fprintf(stderr, "failed!\n");
-        return false;
-    }
-    hvsc_dbg("got %ld bytes\n", size);
-
-    /*
-     * calculate MD5 hash
-     */
-    err = gcry_md_open(&handle, GCRY_MD_MD5, 0);
-    if (err != 0) {
-        hvsc_errno = HVSC_ERR_GCRYPT;
-        free(data);
-        return -1;
-    }
-
-    gcry_md_write(handle, data, (size_t)size);
-    d = gcry_md_read(handle, GCRY_MD_MD5);
-    memcpy(digest, d, HVSC_DIGEST_SIZE);
-
-    gcry_md_close(handle);
-
-    free(data);
-
-    return true;
+    hvsc_dbg("hashing '%s'\n", psid);
+    return hvsc_dcache_digest(psid, digest);
 }
-#endif
 
 
-#ifdef HVSC_USE_MD5
 /** \brief  Find SLDB entry by \a digest
  *
  * The \a digest has to be in the same string form as the SLDB. So 32 bytes
@@ -109,9 +82,14 @@ static char *find_sldb_entry_md5(const char *digest)
         return NULL;
     }
 
+    HVSC_TRACE_BEGIN(HVSC_TRACE_SCAN, hvsc_sldb_path);
     while (true) {
         line = hvsc_text_file_read(&handle);
         if (line == NULL) {
+            if (hvsc_text_file_eof(&handle)) {
+                hvsc_errno = HVSC_ERR_NOT_FOUND;
+            }
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle.bytes, false);
             hvsc_text_file_close(&handle);
             return NULL;
         }
@@ -120,7 +98,8 @@ static char *find_sldb_entry_md5(const char *digest)
 #endif
         if (memcmp(digest, line, HVSC_DIGEST_SIZE * 2) == 0) {
             /* copy the current line before closing the file */
-            char *s = hvsc_strdup(handle.buffer);
+            char *s = hvsc_strdup_result(handle.buffer);
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle.bytes, true);
             hvsc_text_file_close(&handle);
             if (s == NULL) {
                 return NULL;
@@ -128,12 +107,7 @@ static char *find_sldb_entry_md5(const char *digest)
             return s;
         }
     }
-
-    hvsc_text_file_close(&handle);
-    hvsc_errno = HVSC_ERR_NOT_FOUND;
-    return NULL;
 }
-#endif
 
 
 /** \brief  Find song length entry by PSID name in the comments
@@ -154,9 +128,14 @@ static char *find_sldb_entry_txt(const char *path)
 
     plen = strlen(path);
 
+    HVSC_TRACE_BEGIN(HVSC_TRACE_SCAN, hvsc_sldb_path);
     while (true) {
         line = hvsc_text_file_read(&handle);
         if (line == NULL) {
+            if (hvsc_text_file_eof(&handle)) {
+                hvsc_errno = HVSC_ERR_NOT_FOUND;
+            }
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle.bytes, false);
             hvsc_text_file_close(&handle);
             return NULL;
         }
@@ -168,10 +147,12 @@ static char *find_sldb_entry_txt(const char *path)
                 char *s;
                 line = hvsc_text_file_read(&handle);
                 if (line == NULL) {
+                    HVSC_TRACE_END(HVSC_TRACE_SCAN, handle.bytes, false);
                     hvsc_text_file_close(&handle);
                     return NULL;
                 }
-                s = hvsc_strdup(handle.buffer);
+                s = hvsc_strdup_result(handle.buffer);
+                HVSC_TRACE_END(HVSC_TRACE_SCAN, handle.bytes, true);
                 hvsc_text_file_close(&handle);
                 return s;
             }
@@ -194,7 +175,7 @@ static char *find_sldb_entry_txt(const char *path)
  *
  * \return  number of songs or -1 on error
  */
-static int parse_sldb_entry(char *line, long **lengths)
+int hvsc_sldb_parse_entry(char *line, long **lengths)
 {
     char *p;
     char *endptr;
@@ -234,37 +215,45 @@ static int parse_sldb_entry(char *line, long **lengths)
 
 
 
-#ifdef HVSC_USE_MD5
-/** \brief  Get the SLDB entry for PSID file \a psid
+/** \brief  Look up MD5 \a digest in the index or the SLDB
  *
- * \param[in]   psid    path to PSID file
+ * Asks hvscd in client mode, uses the index when loaded with
+ * hvsc_index_load(), otherwise scans the SLDB.
+ *
+ * \param[in]   digest  MD5 digest (HVSC_DIGEST_SIZE bytes)
  *
  * \return  heap-allocated entry or `NULL` on failure
  */
-char *hvsc_sldb_get_entry_md5(const char *psid)
+static char *sldb_get_entry_digest(const uint8_t *digest)
 {
-    unsigned char hash[HVSC_DIGEST_SIZE];
     char hash_text[HVSC_DIGEST_SIZE * 2 + 1];
-    bool result;
     int i;
     char *entry;
+    hvsc_index_t *index;
 
-    result = create_md5_hash(psid, hash);
-    if (!result) {
-        return NULL;
+    if (HVSC_CLIENT_ACTIVE()) {
+        return hvsc_client_lookup_result(HVSC_PROTO_SLDB, NULL, digest);
+    }
+
+    index = hvsc_index_acquire();
+    if (index != NULL) {
+        long row = hvsc_sldb_table_find(&(index->sldb), digest);
+
+        hvsc_stats_lookup(HVSC_STATS_INDEX, row >= 0);
+        entry = NULL;
+        if (row >= 0) {
+            entry = hvsc_strdup_result(
+                    hvsc_sldb_table_line(&(index->sldb), (size_t)row));
+        }
+        hvsc_index_release(index);
+        return entry;
     }
 
     /* generate text version of hash */
-    hvsc_dbg("HASH = ");
     for (i = 0; i < HVSC_DIGEST_SIZE; i++) {
-#ifdef HVSC_DEBUG
-        printf("%02x", hash[i]);
-#endif
-        snprintf(hash_text + i * 2, 3, "%02x", hash[i]);
+        snprintf(hash_text + i * 2, 3, "%02x", digest[i]);
     }
-#ifdef HVSC_DEBUG
-    putchar('\n');
-#endif
+    hvsc_dbg("HASH = %s\n", hash_text);
 
     /* parse SLDB */
     entry = find_sldb_entry_md5(hash_text);
@@ -275,22 +264,128 @@ char *hvsc_sldb_get_entry_md5(const char *psid)
     return entry;
 }
 
-#endif  /* ifdef HVSC_USE_MD5 */
 
+/** \brief  Get the SLDB entry for MD5 \a digest
+ *
+ * \param[in]   digest  MD5 digest (HVSC_DIGEST_SIZE bytes)
+ *
+ * \return  heap-allocated entry or `NULL` on failure
+ */
+char *hvsc_sldb_get_entry_digest(const uint8_t *digest)
+{
+    hvsc_stats_timer_t timer;
+    char *entry;
 
-/** \brief  Find SLDB entry by using text lookup
+    HVSC_RECORD_DIGEST(HVSC_OP_SLDB_ENTRY_DIGEST, digest);
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    entry = sldb_get_entry_digest(digest);
+    hvsc_stats_end(&timer, entry != NULL);
+    return entry;
+}
+
+
+/** \brief  Get the SLDB entry for PSID file \a psid
  *
- * This function uses the "; /path/to/file" lines to identify the SID entry,
- * which makes using/linking against libgcrypt no longer required.
+ * \param[in]   psid    path to PSID file
+ *
+ * \return  heap-allocated entry or `NULL` on failure
+ */
+char *hvsc_sldb_get_entry_md5(const char *psid)
+{
+    hvsc_stats_timer_t timer;
+    unsigned char hash[HVSC_DIGEST_SIZE];
+    char *entry = NULL;
+
+    HVSC_RECORD_PATH(HVSC_OP_SLDB_ENTRY_MD5, psid);
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    if (create_md5_hash(psid, hash)) {
+        entry = sldb_get_entry_digest(hash);
+    }
+    hvsc_stats_end(&timer, entry != NULL);
+    return entry;
+}
+
+
+/** \brief  Get the SLDB entry for a PSID file already in memory
+ *
+ * Calculates the MD5 digest of \a data and looks it up in the SLDB, so a
+ * file that has already been read doesn't need to be read again.
+ *
+ * \param[in]   data    contents of a PSID file
+ * \param[in]   size    size of \a data
+ *
+ * \return  heap-allocated entry or `NULL` on failure
+ */
+char *hvsc_sldb_get_entry_data(const uint8_t *data, size_t size)
+{
+    hvsc_stats_timer_t timer;
+    unsigned char hash[HVSC_DIGEST_SIZE];
+    char *entry;
+
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    HVSC_TRACE_BEGIN(HVSC_TRACE_HASH, NULL);
+    hvsc_md5(data, size, hash);
+    HVSC_TRACE_END(HVSC_TRACE_HASH, size, true);
+    entry = sldb_get_entry_digest(hash);
+    hvsc_stats_end(&timer, entry != NULL);
+    /*
+     * Replayed as a digest lookup, the data itself isn't recorded. Logged
+     * after the lookup, outside the timer, to reuse the digest.
+     */
+    HVSC_RECORD_DIGEST(HVSC_OP_SLDB_ENTRY_DIGEST, hash);
+    return entry;
+}
+
+
+/** \brief  Get the SLDB entry for an opened PSID file
+ *
+ * Uses the data of \a handle to calculate the digest, so the file isn't read
+ * again. The handle must have its data loaded, for handles opened with
+ * hvsc_psid_open_header() call hvsc_psid_load_data() first.
+ *
+ * \param[in]   handle  PSID handle
+ *
+ * \return  heap-allocated entry or `NULL` on failure
+ */
+char *hvsc_sldb_get_entry_psid(const hvsc_psid_t *handle)
+{
+    hvsc_stats_timer_t timer;
+    unsigned char hash[HVSC_DIGEST_SIZE];
+    char *entry = NULL;
+    bool have_digest;
+
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    have_digest = hvsc_psid_get_digest(handle, hash);
+    if (have_digest) {
+        entry = sldb_get_entry_digest(hash);
+    }
+    hvsc_stats_end(&timer, entry != NULL);
+    /* logged after the lookup, like hvsc_sldb_get_entry_data() */
+    if (have_digest) {
+        HVSC_RECORD_DIGEST(HVSC_OP_SLDB_ENTRY_DIGEST, hash);
+    }
+    return entry;
+}
+
+
+/** \brief  Look up the SLDB entry of \a psid by path
+ *
+ * Asks hvscd in client mode, uses the index when loaded with
+ * hvsc_index_load(), otherwise scans the comments in the SLDB.
  *
  * \param   [in]    psid    absolute path to SID in the HVSC
  *
  * \return  line of text containing the song length info or `NULL` on failure
  */
-char *hvsc_sldb_get_entry_txt(const char *psid)
+static char *sldb_get_entry_txt(const char *psid)
 {
     char *path;
     char *entry;
+    hvsc_index_t *index;
+
+    if (HVSC_CLIENT_ACTIVE()) {
+        return hvsc_client_lookup_result(HVSC_PROTO_SLDB, psid, NULL);
+    }
 
     /* strip HVSC root from path */
     path = hvsc_path_strip_root(psid);
@@ -298,8 +393,24 @@ char *hvsc_sldb_get_entry_txt(const char *psid)
         return NULL;
     }
 
+    index = hvsc_index_acquire();
+    if (index != NULL) {
+        long tune = hvsc_index_find_path(index, path);
+
+        hvsc_free(path);
+        entry = NULL;
+        if (tune < 0 || index->sldb_entry[tune] == HVSC_INDEX_NONE) {
+            hvsc_errno = HVSC_ERR_NOT_FOUND;
+        } else {
+            entry = hvsc_strdup_result(hvsc_sldb_table_line(&(index->sldb),
+                        index->sldb_entry[tune]));
+        }
+        hvsc_index_release(index);
+        return entry;
+    }
+
     entry = find_sldb_entry_txt(path);
-    free(path);
+    hvsc_free(path);
     if (entry != NULL) {
         hvsc_dbg("Got it: %s\n", entry);
     }
@@ -307,6 +418,55 @@ char *hvsc_sldb_get_entry_txt(const char *psid)
 }
 
 
+/** \brief  Find SLDB entry by using text lookup
+ *
+ * This function uses the "; /path/to/file" lines to identify the SID entry,
+ * which avoids calculating the MD5 digest of the file.
+ *
+ * \param   [in]    psid    absolute path to SID in the HVSC
+ *
+ * \return  line of text containing the song length info or `NULL` on failure
+ */
+char *hvsc_sldb_get_entry_txt(const char *psid)
+{
+    hvsc_stats_timer_t timer;
+    char *entry;
+
+    HVSC_RECORD_PATH(HVSC_OP_SLDB_ENTRY_TXT, psid);
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    entry = sldb_get_entry_txt(psid);
+    hvsc_stats_end(&timer, entry != NULL);
+    return entry;
+}
+
+
+
+/** \brief  Parse SLDB \a entry into a list of song lengths and free \a entry
+ *
+ * \param[in]   entry   heap-allocated SLDB entry (can be `NULL`)
+ * \param[out]  lengths object to store pointer to array of song lengths
+ *
+ * \return  number of songs or -1 on error
+ */
+static int sldb_entry_to_lengths(char *entry, long **lengths)
+{
+    int result;
+
+    *lengths = NULL;
+    if (entry == NULL) {
+        return -1;
+    }
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_PARSE, entry);
+    result = hvsc_sldb_parse_entry(entry, lengths);
+    HVSC_TRACE_END(HVSC_TRACE_PARSE, strlen(entry), result >= 0);
+    free(entry);
+    if (result < 0) {
+        *lengths = NULL;
+    }
+    return result;
+}
+
 
 /** \brief  Get a list of song lengths for PSID file \a psid
  *
@@ -317,25 +477,862 @@ char *hvsc_sldb_get_entry_txt(const char *psid)
  */
 int hvsc_sldb_get_lengths(const char *psid, long **lengths)
 {
+    hvsc_stats_timer_t timer;
     char *entry;
     int result;
 
-    *lengths = NULL;
-
+    HVSC_RECORD_PATH(HVSC_OP_SLDB_LENGTHS, psid);
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
 #ifdef HVSC_USE_MD5
     entry = hvsc_sldb_get_entry_md5(psid);
 #else
     entry = hvsc_sldb_get_entry_txt(psid);
 #endif
-    if (entry == NULL) {
-        return -1;
+    result = sldb_entry_to_lengths(entry, lengths);
+    hvsc_stats_end(&timer, result >= 0);
+    return result;
+}
+
+
+/** \brief  Get a list of song lengths for an opened PSID file
+ *
+ * Looks up the song lengths using the MD5 digest of the data in \a handle,
+ * avoiding a second read of the file.
+ *
+ * \param[in]   handle  PSID handle with data loaded
+ * \param[out]  lengths object to store pointer to array of song lengths
+ *
+ * \return  number of songs or -1 on error
+ */
+int hvsc_sldb_get_lengths_psid(const hvsc_psid_t *handle, long **lengths)
+{
+    hvsc_stats_timer_t timer;
+    int result;
+
+    HVSC_RECORD_PATH(HVSC_OP_SLDB_LENGTHS_PSID, handle->path);
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    result = sldb_entry_to_lengths(hvsc_sldb_get_entry_psid(handle), lengths);
+    hvsc_stats_end(&timer, result >= 0);
+    return result;
+}
+
+
+/** \brief  State of hvsc_sldb_get_lengths_batch() in client mode
+ */
+typedef struct sldb_batch_s {
+    const char **           psids;      /**< paths to PSID files */
+    hvsc_sldb_lengths_cb_t  callback;   /**< callback of the caller */
+    void *                  data;       /**< user data of the caller */
+} sldb_batch_t;
+
+
+/** \brief  Parse a SLDB entry received from hvscd and pass it on
+ *
+ * \param[in]   index   index of the PSID file in the list
+ * \param[in]   body    SLDB entry (`NULL` on error)
+ * \param[in]   size    size of \a body
+ * \param[in]   error   error code (0 on success)
+ * \param[in]   data    batch state
+ */
+static void sldb_batch_reply(size_t index, const char *body, size_t size,
+                             int error, void *data)
+{
+    sldb_batch_t *batch = data;
+    long *lengths = NULL;
+    int songs = -1;
+
+    (void)size;
+    if (body != NULL) {
+        songs = sldb_entry_to_lengths(hvsc_strdup_result(body), &lengths);
+        if (songs < 0) {
+            error = HVSC_ERR_INVALID;
+        }
     }
+    batch->callback(index, batch->psids[index], songs, lengths, error,
+                    batch->data);
+    free(lengths);
+}
 
-    result = parse_sldb_entry(entry, lengths);
-    if (result < 0) {
-        free(*lengths);
-        return false;
+
+/** \brief  Get the song lengths of a list of PSID files
+ *
+ * In client mode the lookups are pipelined to hvscd, which costs a single
+ * round trip per HVSC_CLIENT_BATCH files instead of one per file. Otherwise
+ * this is the same as calling hvsc_sldb_get_lengths() for each file.
+ *
+ * \param[in]   psids       paths to PSID files
+ * \param[in]   count       number of paths in \a psids
+ * \param[in]   callback    function called for each file, in order
+ * \param[in]   data        user data for \a callback
+ *
+ * \return  `false` when the connection to hvscd failed, not all files have
+ *          been reported then
+ *
+ * \ingroup sldb
+ */
+bool hvsc_sldb_get_lengths_batch(const char **psids, size_t count,
+                                 hvsc_sldb_lengths_cb_t callback, void *data)
+{
+    hvsc_stats_timer_t timer;
+    sldb_batch_t batch;
+    size_t i;
+    bool result;
+
+    if (!HVSC_CLIENT_ACTIVE()) {
+        for (i = 0; i < count; i++) {
+            long *lengths;
+            int songs;
+
+            hvsc_errno = 0;
+            songs = hvsc_sldb_get_lengths(psids[i], &lengths);
+            callback(i, psids[i], songs, lengths,
+                     songs < 0 ? hvsc_errno : 0, data);
+            free(lengths);
+        }
+        return true;
     }
-    free(entry);
+
+    if (HVSC_RECORD_ENABLED()) {
+        for (i = 0; i < count; i++) {
+            hvsc_record_path(HVSC_OP_SLDB_LENGTHS, psids[i]);
+        }
+    }
+    batch.psids = psids;
+    batch.callback = callback;
+    batch.data = data;
+    hvsc_stats_begin(&timer, HVSC_STATS_SLDB);
+    result = hvsc_client_lookup_many(HVSC_PROTO_SLDB, psids, count,
+                                     sldb_batch_reply, &batch);
+    hvsc_stats_end(&timer, result);
     return result;
 }
+
+
+/** \brief  Get value of hexadecimal digit \a c
+ *
+ * \param[in]   c   character
+ *
+ * \return  value or -1 when \a c isn't a hex digit
+ */
+static int sldb_hex_value(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+
+/** \brief  Parse MD5 digest in \a line into \a digest
+ *
+ * \param[in]   line    SLDB line
+ * \param[out]  digest  digest
+ *
+ * \return  true if \a line starts with a digest followed by '='
+ */
+static bool sldb_parse_digest(const char *line, uint8_t *digest)
+{
+    int i;
+
+    for (i = 0; i < HVSC_DIGEST_SIZE; i++) {
+        int hi = sldb_hex_value((unsigned char)line[i * 2]);
+        int lo;
+
+        if (hi < 0) {
+            return false;
+        }
+        lo = sldb_hex_value((unsigned char)line[i * 2 + 1]);
+        if (lo < 0) {
+            return false;
+        }
+        digest[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return line[HVSC_DIGEST_SIZE * 2] == '=';
+}
+
+
+/** \brief  Count the song lengths in SLDB entry \a line and add them up
+ *
+ * \param[in]   line        SLDB entry (including digest and '=')
+ * \param[out]  playtime    sum of the song lengths that can be parsed, in
+ *                          seconds
+ *
+ * \return  number of whitespace-separated song lengths
+ */
+static int sldb_count_songs(const char *line, uint32_t *playtime)
+{
+    const char *p = line + HVSC_DIGEST_SIZE * 2 + 1;
+    uint64_t total = 0;
+    int count = 0;
+
+    while (*p != '\0') {
+        char *endptr;
+        long secs;
+
+        while (*p != '\0' && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        count++;
+        /* the timestamp parser doesn't modify the text */
+        secs = hvsc_parse_simple_timestamp((char *)p, &endptr);
+        if (secs > 0) {
+            total += (uint64_t)secs;
+        }
+        while (*p != '\0' && !isspace((unsigned char)*p)) {
+            p++;
+        }
+    }
+    *playtime = total < UINT32_MAX ? (uint32_t)total : UINT32_MAX;
+    return count;
+}
+
+
+/** \brief  Compare SLDB table entries on digest, then on position in file
+ *
+ * \param[in]   p1  first entry
+ * \param[in]   p2  second entry
+ *
+ * \return  <0, 0 or >0
+ */
+static int sldb_entry_cmp(const void *p1, const void *p2)
+{
+    const hvsc_sldb_entry_t *e1 = p1;
+    const hvsc_sldb_entry_t *e2 = p2;
+    int result = memcmp(e1->digest, e2->digest, HVSC_DIGEST_SIZE);
+
+    if (result != 0) {
+        return result;
+    }
+    return e1->line < e2->line ? -1 : e1->line > e2->line;
+}
+
+
+/** \brief  State for reusing the entries of a previous SLDB table
+ */
+typedef struct sldb_reuse_s {
+    const hvsc_sldb_table_t *old;   /**< previous table */
+    uint32_t *      slots;      /**< content hash table: entry index + 1 */
+    size_t          slots_size; /**< number of slots, a power of two */
+    uint32_t *      order;      /**< entry indexes in file order */
+    uint32_t *      reused;     /**< index in the new table per old entry,
+                                     or HVSC_SLDB_NONE */
+    const char *    pos;        /**< read position in the old text */
+    size_t          next;       /**< position in \a order of the first old
+                                     entry at or after \a pos */
+} sldb_reuse_t;
+
+
+/** \brief  Calculate content hash of an SLDB entry
+ *
+ * \param[in]   line    entry text ("digest=lengths")
+ * \param[in]   len     length of \a line
+ * \param[in]   path    path from the preceding comment or `NULL`
+ * \param[in]   plen    length of \a path
+ *
+ * \return  hash
+ */
+static uint64_t sldb_entry_hash(const char *line, size_t len,
+                                const char *path, size_t plen)
+{
+    uint64_t hash = hvsc_hash_bytes(line, len);
+
+    if (path != NULL) {
+        hash ^= hvsc_hash_bytes(path, plen) * 0x9e3779b97f4a7c15ULL;
+    }
+    return hash;
+}
+
+
+/** \brief  Free memory used by \a reuse
+ *
+ * \param[in,out]   reuse   reuse state
+ */
+static void sldb_reuse_free(sldb_reuse_t *reuse)
+{
+    hvsc_free(reuse->slots);
+    hvsc_free(reuse->order);
+    hvsc_free(reuse->reused);
+    reuse->slots = NULL;
+    reuse->order = NULL;
+    reuse->reused = NULL;
+}
+
+
+/** \brief  Set up \a reuse for taking unchanged entries from \a old
+ *
+ * \param[out]  reuse   reuse state
+ * \param[in]   old     previous SLDB table
+ *
+ * \return  bool
+ */
+static bool sldb_reuse_init(sldb_reuse_t *reuse, const hvsc_sldb_table_t *old)
+{
+    size_t count = old->count > 0 ? old->count : 1;
+    size_t mask;
+    size_t i;
+
+    reuse->old = old;
+    reuse->slots_size = 16;
+    while (reuse->slots_size < old->count * 2) {
+        reuse->slots_size *= 2;
+    }
+    reuse->slots = hvsc_calloc(reuse->slots_size, sizeof *(reuse->slots));
+    reuse->order = hvsc_malloc(count * sizeof *(reuse->order));
+    reuse->reused = hvsc_malloc(count * sizeof *(reuse->reused));
+    if (reuse->slots == NULL || reuse->order == NULL
+            || reuse->reused == NULL) {
+        sldb_reuse_free(reuse);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    mask = reuse->slots_size - 1;
+    for (i = 0; i < old->count; i++) {
+        size_t slot = (size_t)old->entries[i].hash & mask;
+
+        while (reuse->slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        reuse->slots[slot] = (uint32_t)i + 1;
+        reuse->order[old->entries[i].seq] = (uint32_t)i;
+        reuse->reused[i] = HVSC_SLDB_NONE;
+    }
+    reuse->pos = old->text;
+    reuse->next = 0;
+    return true;
+}
+
+
+/** \brief  Compare \a line with the line at the read position in the old text
+ *
+ * Both texts are walked side by side, as long as lines are equal the read
+ * position moves along with \a line.
+ *
+ * \param[in,out]   reuse   reuse state
+ * \param[in]       line    line, split like the old text
+ * \param[in]       raw     length of \a line including a CR
+ *
+ * \return  the equal line in the old text, or `NULL` when different
+ */
+static const char *sldb_reuse_line(sldb_reuse_t *reuse, const char *line,
+                                   size_t raw)
+{
+    const char *pos = reuse->pos;
+    const char *end = reuse->old->text + reuse->old->size;
+
+    /* after the last line the read position is one past the terminator */
+    if (pos <= end && (size_t)(end - pos) >= raw
+            && memcmp(pos, line, raw + 1) == 0) {
+        reuse->pos = pos + raw + 1;
+        return pos;
+    }
+    return NULL;
+}
+
+
+/** \brief  Find the entry in the old table equal to an entry in the new text
+ *
+ * An entry on an equal line at the read position is taken as is, otherwise
+ * the content hash is looked up, the text of the entry found is compared,
+ * and the read position continues after that entry.
+ *
+ * \param[in,out]   reuse   reuse state
+ * \param[in]       same    equal line in the old text (sldb_reuse_line())
+ * \param[in]       line    entry text
+ * \param[in]       comment path from the preceding comment or `NULL`
+ * \param[in]       plen    length of \a comment
+ * \param[in]       index   index of the entry in the new table
+ * \param[out]      hash    content hash of the entry
+ *
+ * \return  old entry or `NULL` when not found
+ */
+static const hvsc_sldb_entry_t *sldb_reuse_find(sldb_reuse_t *reuse,
+                                                const char *same,
+                                                const char *line,
+                                                const char *comment,
+                                                size_t plen, size_t index,
+                                                uint64_t *hash)
+{
+    const hvsc_sldb_table_t *old = reuse->old;
+    const hvsc_sldb_entry_t *entry;
+    size_t mask = reuse->slots_size - 1;
+    size_t slot;
+    size_t len;
+
+    if (same != NULL) {
+        uint32_t offset = (uint32_t)(same - old->text);
+
+        while (reuse->next < old->count
+                && old->entries[reuse->order[reuse->next]].line < offset) {
+            reuse->next++;
+        }
+        if (reuse->next < old->count) {
+            size_t i = reuse->order[reuse->next];
+
+            entry = &(old->entries[i]);
+            if (entry->line == offset && reuse->reused[i] == HVSC_SLDB_NONE
+                    && (entry->path == HVSC_SLDB_NONE) == (comment == NULL)
+                    && (comment == NULL
+                        || strcmp(old->text + entry->path, comment) == 0)) {
+                reuse->reused[i] = (uint32_t)index;
+                reuse->next++;
+                *hash = entry->hash;
+                return entry;
+            }
+        }
+    }
+
+    len = strlen(line);
+    *hash = sldb_entry_hash(line, len, comment, plen);
+    slot = (size_t)*hash & mask;
+    while (reuse->slots[slot] != 0) {
+        size_t i = reuse->slots[slot] - 1;
+        const char *prev;
+
+        entry = &(old->entries[i]);
+        prev = old->text + entry->line;
+        /* equal hashes don't prove equal entries */
+        if (entry->hash == *hash && reuse->reused[i] == HVSC_SLDB_NONE
+                && strlen(prev) == len && memcmp(prev, line, len) == 0
+                && (entry->path == HVSC_SLDB_NONE) == (comment == NULL)
+                && (comment == NULL
+                    || strcmp(old->text + entry->path, comment) == 0)) {
+            const char *end = old->text + old->size;
+
+            reuse->reused[i] = (uint32_t)index;
+            /*
+             * Continue the side by side walk after this entry: skip its
+             * terminator, a CR and empty lines, which don't matter to
+             * sldb_reuse_line().
+             */
+            prev += len;
+            while (prev < end && *prev == '\0') {
+                prev++;
+            }
+            reuse->pos = prev;
+            reuse->next = entry->seq + 1;
+            return entry;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+
+/** \brief  Sort the entries of \a table, reusing the order of \a old
+ *
+ * Entries copied from \a old are already in digest order, so only the new
+ * entries are sorted and then merged with them.
+ *
+ * \param[in,out]   table   SLDB table, entries in file order
+ * \param[in]       old     previous SLDB table
+ * \param[in]       reused  index in \a table per entry of \a old, or
+ *                          HVSC_SLDB_NONE when not reused
+ * \param[in]       fresh   number of entries in \a table not from \a old
+ *
+ * \return  bool
+ */
+static bool sldb_table_merge(hvsc_sldb_table_t *table,
+                             const hvsc_sldb_table_t *old,
+                             const uint32_t *reused, size_t fresh)
+{
+    hvsc_sldb_entry_t *sorted;
+    hvsc_sldb_entry_t *added;
+    uint8_t *is_old;
+    size_t kept = table->count - fresh;
+    size_t i;
+    size_t j;
+    size_t k;
+    size_t n;
+
+    sorted = hvsc_malloc((table->count > 0 ? table->count : 1)
+                         * sizeof *sorted);
+    added = hvsc_malloc((fresh > 0 ? fresh : 1) * sizeof *added);
+    is_old = hvsc_calloc(table->count > 0 ? table->count : 1, 1);
+    if (sorted == NULL || added == NULL || is_old == NULL) {
+        hvsc_free(sorted);
+        hvsc_free(added);
+        hvsc_free(is_old);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+
+    for (i = 0; i < old->count; i++) {
+        if (reused[i] != HVSC_SLDB_NONE) {
+            is_old[reused[i]] = 1;
+        }
+    }
+    n = 0;
+    for (i = 0; i < table->count; i++) {
+        if (!is_old[i]) {
+            added[n++] = table->entries[i];
+        }
+    }
+    hvsc_free(is_old);
+    qsort(added, n, sizeof *added, sldb_entry_cmp);
+    /* the reused entries in the old order go to the back of `sorted` */
+    k = fresh;
+    for (i = 0; i < old->count; i++) {
+        if (reused[i] != HVSC_SLDB_NONE) {
+            sorted[k++] = table->entries[reused[i]];
+        }
+    }
+
+    /* merge front to back, the write position never passes the reused
+     * entries still to be read */
+    i = fresh;
+    j = 0;
+    k = 0;
+    while (i < fresh + kept || j < n) {
+        if (j == n || (i < fresh + kept
+                       && sldb_entry_cmp(&(sorted[i]), &(added[j])) <= 0)) {
+            sorted[k++] = sorted[i++];
+        } else {
+            sorted[k++] = added[j++];
+        }
+    }
+    hvsc_free(added);
+    hvsc_free(table->entries);
+    table->entries = sorted;
+
+    /* reused duplicates of a digest may have swapped places in the file */
+    for (i = 1; i < table->count; i++) {
+        if (sldb_entry_cmp(&(sorted[i - 1]), &(sorted[i])) > 0) {
+            qsort(sorted, table->count, sizeof *sorted, sldb_entry_cmp);
+            break;
+        }
+    }
+    return true;
+}
+
+
+/** \brief  Read SLDB file \a path into an in-memory table
+ *
+ * \param[out]  table   SLDB table
+ * \param[in]   path    path to Songlengths.md5
+ * \param[in]   old     previous table to reuse unchanged entries of, or
+ *                      `NULL`
+ *
+ * \return  bool
+ */
+static bool sldb_table_read(hvsc_sldb_table_t *table, const char *path,
+                            const hvsc_sldb_table_t *old)
+{
+    uint8_t *data;
+    char *text;
+    char *line;
+    char *end;
+    const char *comment = NULL;
+    size_t comment_len = 0;
+    size_t max = 1024;
+    long size;
+    sldb_reuse_t reuse = { NULL, NULL, 0, NULL, NULL, NULL, 0 };
+    size_t fresh = 0;
+    bool result = true;
+
+    table->text = NULL;
+    table->size = 0;
+    table->entries = NULL;
+    table->count = 0;
+
+    size = hvsc_pread_file(&data, path);
+    if (size < 0) {
+        return false;
+    }
+    /* entries refer to the text with 32-bit offsets */
+    if ((unsigned long)size >= UINT32_MAX) {
+        hvsc_errno = HVSC_ERR_FILE_TOO_LARGE;
+        hvsc_free(data);
+        return false;
+    }
+    /* add room for a terminating nul */
+    text = hvsc_realloc(data, (size_t)size + 1);
+    if (text == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        hvsc_free(data);
+        return false;
+    }
+    text[size] = '\0';
+    table->text = text;
+    table->size = (size_t)size;
+
+    if (old != NULL) {
+        if (!sldb_reuse_init(&reuse, old)) {
+            hvsc_sldb_table_free(table);
+            return false;
+        }
+        max = old->count > 0 ? old->count : 1;
+    }
+
+    table->entries = hvsc_malloc(max * sizeof *(table->entries));
+    if (table->entries == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        if (old != NULL) {
+            sldb_reuse_free(&reuse);
+        }
+        hvsc_sldb_table_free(table);
+        return false;
+    }
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_PARSE, path);
+    end = text + size;
+    line = text;
+    while (line < end) {
+        char *eol = memchr(line, '\n', (size_t)(end - line));
+        const char *same = NULL;
+        hvsc_sldb_entry_t *entry;
+
+        if (eol == NULL) {
+            eol = end;
+        }
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        if (old != NULL) {
+            same = sldb_reuse_line(&reuse, line, (size_t)(eol - line));
+        }
+
+        if (*line == ';') {
+            /* "; /path/to/file.sid" */
+            comment = line + 1;
+            while (*comment == ' ') {
+                comment++;
+            }
+            comment_len = strlen(comment);
+        } else if ((size_t)(eol - line) > HVSC_DIGEST_SIZE * 2) {
+            const hvsc_sldb_entry_t *prev = NULL;
+            uint64_t hash;
+
+            if (table->count == max) {
+                hvsc_sldb_entry_t *tmp;
+
+                tmp = hvsc_realloc(table->entries, max * 2 * sizeof *tmp);
+                if (tmp == NULL) {
+                    hvsc_errno = HVSC_ERR_OOM;
+                    result = false;
+                    break;
+                }
+                table->entries = tmp;
+                max *= 2;
+            }
+            entry = &(table->entries[table->count]);
+            if (old != NULL) {
+                prev = sldb_reuse_find(&reuse, same, line, comment,
+                                       comment_len, table->count, &hash);
+            } else {
+                hash = sldb_entry_hash(line, strlen(line), comment,
+                                       comment_len);
+            }
+            if (prev != NULL) {
+                memcpy(entry->digest, prev->digest, HVSC_DIGEST_SIZE);
+                entry->songs = prev->songs;
+                entry->playtime = prev->playtime;
+            } else if (sldb_parse_digest(line, entry->digest)) {
+                entry->songs = sldb_count_songs(line, &(entry->playtime));
+                fresh++;
+            } else {
+                entry = NULL;
+            }
+            if (entry != NULL) {
+                entry->seq = (uint32_t)table->count;
+                entry->line = (uint32_t)(line - text);
+                entry->path = comment != NULL
+                    ? (uint32_t)(comment - text) : HVSC_SLDB_NONE;
+                entry->hash = hash;
+                table->count++;
+            }
+            comment = NULL;
+        }
+        line = eol < end ? eol + 1 : end;
+    }
+
+    if (result) {
+        if (old == NULL) {
+            qsort(table->entries, table->count, sizeof *(table->entries),
+                  sldb_entry_cmp);
+        } else {
+            result = sldb_table_merge(table, old, reuse.reused, fresh);
+        }
+    }
+    if (old != NULL) {
+        sldb_reuse_free(&reuse);
+    }
+    if (!result) {
+        hvsc_sldb_table_free(table);
+        HVSC_TRACE_END(HVSC_TRACE_PARSE, (size_t)(line - text), false);
+        return false;
+    }
+    HVSC_TRACE_END(HVSC_TRACE_PARSE, (size_t)size, true);
+    hvsc_dbg("got %zu entries, %zu parsed\n", table->count,
+             old != NULL ? fresh : table->count);
+    return true;
+}
+
+
+/** \brief  Load SLDB file \a path into an in-memory table
+ *
+ * The file is read with a single read and split into lines in place. Each
+ * entry gets its digest in binary form, its song count, the path from the
+ * comment line preceding it and a hash of its text. The entries are sorted
+ * on digest so they can be looked up with hvsc_sldb_table_find().
+ *
+ * \param[out]  table   SLDB table, free with hvsc_sldb_table_free()
+ * \param[in]   path    path to Songlengths.md5
+ *
+ * \return  bool
+ */
+bool hvsc_sldb_table_load(hvsc_sldb_table_t *table, const char *path)
+{
+    return sldb_table_read(table, path, NULL);
+}
+
+
+/** \brief  Load a changed SLDB file \a path, reusing the entries of \a old
+ *
+ * Entries whose text hash is found in \a old take the digest and song count
+ * from there instead of parsing them, and keep their relative order so only
+ * the changed entries are sorted. The result is the same as that of
+ * hvsc_sldb_table_load(), \a old is left untouched.
+ *
+ * \param[out]  table   SLDB table, free with hvsc_sldb_table_free()
+ * \param[in]   path    path to Songlengths.md5
+ * \param[in]   old     table loaded earlier
+ *
+ * \return  bool
+ */
+bool hvsc_sldb_table_update(hvsc_sldb_table_t *table, const char *path,
+                            const hvsc_sldb_table_t *old)
+{
+    return sldb_table_read(table, path, old);
+}
+
+
+/** \brief  Find the entry for \a digest in \a table
+ *
+ * When the SLDB contains duplicate digests, the first entry in file order is
+ * returned, the duplicates directly follow it in the table.
+ *
+ * \param[in]   table   SLDB table
+ * \param[in]   digest  MD5 digest (HVSC_DIGEST_SIZE bytes)
+ *
+ * \return  index in `table->entries` or -1 when not found
+ */
+long hvsc_sldb_table_find(const hvsc_sldb_table_t *table,
+                          const uint8_t *digest)
+{
+    size_t lo = 0;
+    size_t hi = table->count;
+
+    /* lower bound */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (memcmp(table->entries[mid].digest, digest, HVSC_DIGEST_SIZE) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < table->count
+            && memcmp(table->entries[lo].digest, digest,
+                      HVSC_DIGEST_SIZE) == 0) {
+        return (long)lo;
+    }
+    hvsc_errno = HVSC_ERR_NOT_FOUND;
+    return -1;
+}
+
+
+/** \brief  Get the entry text of \a row in \a table
+ *
+ * \param[in]   table   SLDB table
+ * \param[in]   row     index in `table->entries`
+ *
+ * \return  entry text ("digest=lengths")
+ */
+const char *hvsc_sldb_table_line(const hvsc_sldb_table_t *table, size_t row)
+{
+    return table->text + table->entries[row].line;
+}
+
+
+/** \brief  Get the path from the comment preceding \a row in \a table
+ *
+ * \param[in]   table   SLDB table
+ * \param[in]   row     index in `table->entries`
+ *
+ * \return  path or `NULL` when the entry has no path comment
+ */
+const char *hvsc_sldb_table_path(const hvsc_sldb_table_t *table, size_t row)
+{
+    uint32_t path = table->entries[row].path;
+
+    return path != HVSC_SLDB_NONE ? table->text + path : NULL;
+}
+
+
+/** \brief  Parse the song lengths of \a row in \a table
+ *
+ * Parses like hvsc_sldb_parse_entry(), into a buffer of the caller.
+ *
+ * \param[in]   table   SLDB table
+ * \param[in]   row     index in `table->entries`
+ * \param[out]  lengths song lengths in seconds, room for the number of
+ *                      songs of the entry
+ *
+ * \return  number of songs or -1 on error
+ */
+int hvsc_sldb_table_lengths(const hvsc_sldb_table_t *table, size_t row,
+                            long *lengths)
+{
+    /* the timestamp parser doesn't modify the text */
+    char *p = (char *)hvsc_sldb_table_line(table, row)
+        + HVSC_DIGEST_SIZE * 2 + 1;
+    char *endptr;
+    int songs = table->entries[row].songs;
+    int i = 0;
+
+    while (*p != '\0') {
+        while (*p != '\0' && isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (i == songs) {
+            return -1;
+        }
+        lengths[i] = hvsc_parse_simple_timestamp(p, &endptr);
+        if (lengths[i] < 0) {
+            return -1;
+        }
+        i++;
+        p = endptr;
+    }
+    return i;
+}
+
+
+/** \brief  Free memory used by \a table
+ *
+ * \param[in,out]   table   SLDB table
+ */
+void hvsc_sldb_table_free(hvsc_sldb_table_t *table)
+{
+    hvsc_free(table->entries);
+    hvsc_free(table->text);
+    table->entries = NULL;
+    table->text = NULL;
+    table->size = 0;
+    table->count = 0;
+}
@@ -28,7 +28,58 @@
 #ifndef HVSC_SLDB_H
 #define HVSC_SLDB_H
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <stdbool.h>
 
+#include "hvsc_defs.h"
+
+/** \brief  Marker for an entry of a previous table that isn't reused, or an
+ *          entry without a path comment
+ */
+#define HVSC_SLDB_NONE  UINT32_MAX
+
+
+/** \brief  Entry in an in-memory SLDB table
+ *
+ * Text is referenced by offset instead of pointer, so a table can be shared
+ * between processes that map it at different addresses.
+ */
+typedef struct hvsc_sldb_entry_s {
+    uint8_t         digest[HVSC_DIGEST_SIZE];   /**< MD5 digest */
+    int             songs;  /**< number of song lengths in the entry */
+    uint32_t        seq;    /**< position of the entry in the file */
+    uint32_t        line;   /**< offset in the text of the entry text
+                                 ("digest=lengths") */
+    uint32_t        path;   /**< offset in the text of the path from the
+                                 preceding comment, or HVSC_SLDB_NONE */
+    uint32_t        playtime;   /**< sum of the song lengths in seconds */
+    uint64_t        hash;   /**< hash of the entry text and path, to find
+                                 unchanged entries when reloading */
+} hvsc_sldb_entry_t;
+
+
+/** \brief  In-memory SLDB table, sorted on digest
+ */
+typedef struct hvsc_sldb_table_s {
+    char *              text;       /**< SLDB file contents */
+    size_t              size;       /**< size of \a text */
+    hvsc_sldb_entry_t * entries;    /**< entries */
+    size_t              count;      /**< number of entries */
+} hvsc_sldb_table_t;
+
+
+bool    hvsc_sldb_table_load(hvsc_sldb_table_t *table, const char *path);
+bool    hvsc_sldb_table_update(hvsc_sldb_table_t *table, const char *path,
+                               const hvsc_sldb_table_t *old);
+long    hvsc_sldb_table_find(const hvsc_sldb_table_t *table,
+                             const uint8_t *digest);
+void    hvsc_sldb_table_free(hvsc_sldb_table_t *table);
+const char *hvsc_sldb_table_line(const hvsc_sldb_table_t *table, size_t row);
+const char *hvsc_sldb_table_path(const hvsc_sldb_table_t *table, size_t row);
+int     hvsc_sldb_table_lengths(const hvsc_sldb_table_t *table, size_t row,
+                                long *lengths);
+int     hvsc_sldb_parse_entry(char *line, long **lengths);
+
 
 #endif
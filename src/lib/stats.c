@@ -0,0 +1,543 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/stats.c
+ * \brief   Runtime statistics
+ *
+ * Counts lookups, hits, misses, I/O and allocations per subsystem and keeps
+ * latency histograms of the public lookup functions.
+ *
+ * Each thread updates its own block of counters without locking or atomic
+ * read-modify-write instructions, hvsc_stats_get() adds up the blocks of all
+ * threads. Blocks of exited threads are reused by new threads, their counts
+ * are kept.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+
+#include "stats.h"
+
+
+/** \brief  Relaxed load of a counter, other threads may be updating it
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define STATS_LOAD(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+# define STATS_LOAD(p)      (*(p))
+#endif
+
+/** \brief  Add \a n to a counter of the calling thread's own block
+ *
+ * Only the owning thread writes to a block, so a relaxed load and store is
+ * enough, the store just has to be atomic for the readers.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define STATS_ADD(p, n) \
+    __atomic_store_n((p), __atomic_load_n((p), __ATOMIC_RELAXED) + (n), \
+                     __ATOMIC_RELAXED)
+#else
+# define STATS_ADD(p, n)    (*(p) += (n))
+#endif
+
+
+/** \brief  Counters of a single thread
+ */
+typedef struct stats_block_s {
+    hvsc_stats_t            stats;  /**< counters */
+    bool                    in_use; /**< owned by a running thread */
+    struct stats_block_s *  next;   /**< next block */
+} stats_block_t;
+
+
+/** \brief  Names of the subsystems
+ */
+static const char *subsys_names[HVSC_STATS_SUBSYS_COUNT] = {
+    "sldb", "stil", "bugs", "psid", "index", "dcache", "other"
+};
+
+
+/** \brief  Lock for the list of blocks and the baseline
+ */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  List of blocks, blocks are never freed
+ */
+static stats_block_t *stats_blocks = NULL;
+
+/** \brief  Totals at the last hvsc_stats_reset()
+ */
+static hvsc_stats_t stats_baseline;
+
+/** \brief  Key used to release a thread's block when the thread exits
+ */
+static pthread_key_t stats_key;
+
+/** \brief  Control for the one-time creation of \a stats_key
+ */
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+/** \brief  Block of the calling thread
+ */
+static HVSC_THREAD_LOCAL stats_block_t *stats_local = NULL;
+
+/** \brief  Subsystem the calling thread is working for
+ */
+static HVSC_THREAD_LOCAL int stats_current = HVSC_STATS_OTHER;
+
+/** \brief  Number of nested timed calls of the calling thread
+ */
+static HVSC_THREAD_LOCAL int stats_depth = 0;
+
+
+/** \brief  Release block \a data of an exiting thread for reuse
+ *
+ * \param[in]   data    block
+ */
+static void stats_release_block(void *data)
+{
+    stats_block_t *block = data;
+
+    pthread_mutex_lock(&stats_lock);
+    block->in_use = false;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+/** \brief  Create the key used to release blocks
+ */
+static void stats_create_key(void)
+{
+    pthread_key_create(&stats_key, stats_release_block);
+}
+
+
+/** \brief  Get the block of the calling thread, claiming one if needed
+ *
+ * \return  block or `NULL` when out of memory (the update is dropped)
+ */
+static stats_block_t *stats_get_block(void)
+{
+    stats_block_t *block;
+
+    if (stats_local != NULL) {
+        return stats_local;
+    }
+
+    pthread_once(&stats_key_once, stats_create_key);
+    pthread_mutex_lock(&stats_lock);
+    for (block = stats_blocks; block != NULL; block = block->next) {
+        if (!block->in_use) {
+            break;
+        }
+    }
+    if (block == NULL) {
+        block = calloc(1, sizeof *block);
+        if (block == NULL) {
+            pthread_mutex_unlock(&stats_lock);
+            return NULL;
+        }
+        block->next = stats_blocks;
+        stats_blocks = block;
+    }
+    block->in_use = true;
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_setspecific(stats_key, block);
+    stats_local = block;
+    return block;
+}
+
+
+/** \brief  Get monotonic time in nanoseconds
+ *
+ * \return  time
+ */
+static uint64_t stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/** \brief  Get histogram bucket of \a ns nanoseconds
+ *
+ * Values below HVSC_STATS_HIST_LINEAR get a bucket each, larger values get
+ * HVSC_STATS_HIST_SUB buckets per power of two.
+ *
+ * \param[in]   ns  latency
+ *
+ * \return  bucket index
+ */
+static int stats_bucket(uint64_t ns)
+{
+    int exp = 0;
+    int bucket;
+    uint64_t v = ns;
+
+    if (ns < HVSC_STATS_HIST_LINEAR) {
+        return (int)ns;
+    }
+    while (v > 1) {
+        v >>= 1;
+        exp++;
+    }
+    /* HVSC_STATS_HIST_LINEAR is 2^4, HVSC_STATS_HIST_SUB is 2^2 */
+    bucket = HVSC_STATS_HIST_LINEAR + (exp - 4) * HVSC_STATS_HIST_SUB
+        + (int)((ns >> (exp - 2)) & (HVSC_STATS_HIST_SUB - 1));
+    if (bucket >= HVSC_STATS_HIST_BUCKETS) {
+        bucket = HVSC_STATS_HIST_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+
+/** \brief  Start timing a call of a public function of \a subsys
+ *
+ * I/O and allocations done until hvsc_stats_end() are accounted to \a subsys.
+ *
+ * \param[out]  timer   timer
+ * \param[in]   subsys  subsystem
+ */
+void hvsc_stats_begin(hvsc_stats_timer_t *timer, int subsys)
+{
+    timer->outer = stats_depth++ == 0;
+    timer->subsys = subsys;
+    timer->prev = stats_current;
+    stats_current = subsys;
+    timer->start = timer->outer ? stats_now() : 0;
+}
+
+
+/** \brief  Stop timing a call and record its result
+ *
+ * A failed call counts as a miss when hvsc_errno is HVSC_ERR_NOT_FOUND,
+ * otherwise as an error.
+ *
+ * \param[in]   timer   timer started with hvsc_stats_begin()
+ * \param[in]   result  result of the call
+ */
+void hvsc_stats_end(const hvsc_stats_timer_t *timer, bool result)
+{
+    stats_block_t *block;
+    hvsc_stats_counters_t *c;
+    uint64_t ns;
+
+    stats_depth--;
+    stats_current = timer->prev;
+    if (!timer->outer) {
+        return;
+    }
+    ns = stats_now() - timer->start;
+
+    block = stats_get_block();
+    if (block == NULL) {
+        return;
+    }
+    c = &(block->stats.subsys[timer->subsys]);
+    STATS_ADD(&(c->lookups), 1);
+    if (result) {
+        STATS_ADD(&(c->hits), 1);
+    } else if (hvsc_errno == HVSC_ERR_NOT_FOUND) {
+        STATS_ADD(&(c->misses), 1);
+    } else {
+        STATS_ADD(&(c->errors), 1);
+    }
+    STATS_ADD(&(c->latency_ns), ns);
+    STATS_ADD(&(c->histogram[stats_bucket(ns)]), 1);
+}
+
+
+/** \brief  Record an untimed lookup in \a subsys (index, digest cache)
+ *
+ * \param[in]   subsys  subsystem
+ * \param[in]   hit     lookup found an entry
+ */
+void hvsc_stats_lookup(int subsys, bool hit)
+{
+    stats_block_t *block = stats_get_block();
+
+    if (block != NULL) {
+        hvsc_stats_counters_t *c = &(block->stats.subsys[subsys]);
+
+        STATS_ADD(&(c->lookups), 1);
+        if (hit) {
+            STATS_ADD(&(c->hits), 1);
+        } else {
+            STATS_ADD(&(c->misses), 1);
+        }
+    }
+}
+
+
+/** \brief  Get the subsystem the calling thread is working for
+ *
+ * \return  subsystem (hvsc_stats_subsys_t)
+ */
+int hvsc_stats_subsys(void)
+{
+    return stats_current;
+}
+
+
+/** \brief  Get the number of timed calls the calling thread is in
+ *
+ * \return  0 outside the public functions
+ */
+int hvsc_stats_depth(void)
+{
+    return stats_depth;
+}
+
+
+/** \brief  Set the subsystem the calling thread is working for
+ *
+ * For work outside the timed public functions, like loading the index, so
+ * its I/O and allocations are accounted to the right subsystem.
+ *
+ * \param[in]   subsys  subsystem (hvsc_stats_subsys_t)
+ *
+ * \return  previous subsystem, to restore when done
+ */
+int hvsc_stats_set_subsys(int subsys)
+{
+    int prev = stats_current;
+
+    stats_current = subsys;
+    return prev;
+}
+
+
+/** \brief  Account \a bytes read from disk to the current subsystem
+ *
+ * \param[in]   bytes   number of bytes
+ */
+void hvsc_stats_add_bytes(size_t bytes)
+{
+    stats_block_t *block = stats_get_block();
+
+    if (block != NULL) {
+        STATS_ADD(&(block->stats.subsys[stats_current].bytes_read),
+                  (uint64_t)bytes);
+    }
+}
+
+
+/** \brief  Account \a lines of text scanned to the current subsystem
+ *
+ * \param[in]   lines   number of lines
+ */
+void hvsc_stats_add_lines(size_t lines)
+{
+    stats_block_t *block = stats_get_block();
+
+    if (block != NULL) {
+        STATS_ADD(&(block->stats.subsys[stats_current].lines_scanned),
+                  (uint64_t)lines);
+    }
+}
+
+
+/** \brief  Account an allocation to the current subsystem
+ */
+void hvsc_stats_add_alloc(void)
+{
+    stats_block_t *block = stats_get_block();
+
+    if (block != NULL) {
+        STATS_ADD(&(block->stats.subsys[stats_current].allocations), 1);
+    }
+}
+
+
+/** \brief  Add up the counters of all threads into \a stats
+ *
+ * Must be called with \a stats_lock held.
+ *
+ * \param[out]  stats   totals
+ */
+static void stats_sum(hvsc_stats_t *stats)
+{
+    const stats_block_t *block;
+    const uint64_t *src;
+    uint64_t *dst = (uint64_t *)stats;
+    size_t n = sizeof *stats / sizeof(uint64_t);
+    size_t i;
+
+    memset(stats, 0, sizeof *stats);
+    for (block = stats_blocks; block != NULL; block = block->next) {
+        src = (const uint64_t *)&(block->stats);
+        for (i = 0; i < n; i++) {
+            dst[i] += STATS_LOAD(&src[i]);
+        }
+    }
+}
+
+
+/** \brief  Get the statistics since the last hvsc_stats_reset()
+ *
+ * Adds up the counters of all threads. Threads keep counting while the
+ * totals are collected, so the totals are not a consistent snapshot: a
+ * lookup may be counted without its latency yet.
+ *
+ * \param[out]  stats   statistics
+ *
+ * \ingroup stats
+ */
+void hvsc_stats_get(hvsc_stats_t *stats)
+{
+    uint64_t *dst = (uint64_t *)stats;
+    const uint64_t *base = (const uint64_t *)&stats_baseline;
+    size_t n = sizeof *stats / sizeof(uint64_t);
+    size_t i;
+
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(stats);
+    for (i = 0; i < n; i++) {
+        dst[i] -= base[i];
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+/** \brief  Reset the statistics
+ *
+ * The counters are never cleared, since other threads may be updating them,
+ * the current totals are stored and subtracted by hvsc_stats_get() instead.
+ *
+ * \ingroup stats
+ */
+void hvsc_stats_reset(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(&stats_baseline);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+
+/** \brief  Get the hit ratio of \a counters
+ *
+ * \param[in]   counters    counters of a subsystem
+ *
+ * \return  hits / lookups, or 0.0 without lookups
+ *
+ * \ingroup stats
+ */
+double hvsc_stats_hit_ratio(const hvsc_stats_counters_t *counters)
+{
+    if (counters->lookups == 0) {
+        return 0.0;
+    }
+    return (double)counters->hits / (double)counters->lookups;
+}
+
+
+/** \brief  Get the upper bound of histogram \a bucket
+ *
+ * \param[in]   bucket  bucket index
+ *
+ * \return  latency in nanoseconds, values in the bucket are below it
+ *
+ * \ingroup stats
+ */
+uint64_t hvsc_stats_bucket_limit(int bucket)
+{
+    int exp;
+    int sub;
+
+    if (bucket < HVSC_STATS_HIST_LINEAR) {
+        return (uint64_t)bucket + 1;
+    }
+    exp = 4 + (bucket - HVSC_STATS_HIST_LINEAR) / HVSC_STATS_HIST_SUB;
+    sub = (bucket - HVSC_STATS_HIST_LINEAR) % HVSC_STATS_HIST_SUB;
+    return (1ULL << exp) + (uint64_t)(sub + 1) * (1ULL << (exp - 2));
+}
+
+
+/** \brief  Get latency percentile \a p from the histogram of \a counters
+ *
+ * The result is the upper bound of the bucket containing the percentile, so
+ * it is accurate to within 25%.
+ *
+ * \param[in]   counters    counters of a subsystem
+ * \param[in]   p           percentile (0.0-1.0)
+ *
+ * \return  latency in nanoseconds, 0 without timed calls
+ *
+ * \ingroup stats
+ */
+uint64_t hvsc_stats_percentile(const hvsc_stats_counters_t *counters,
+                               double p)
+{
+    uint64_t total = 0;
+    uint64_t rank;
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < HVSC_STATS_HIST_BUCKETS; i++) {
+        total += counters->histogram[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = (uint64_t)(p * (double)total + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0; i < HVSC_STATS_HIST_BUCKETS; i++) {
+        seen += counters->histogram[i];
+        if (seen >= rank) {
+            return hvsc_stats_bucket_limit(i);
+        }
+    }
+    return hvsc_stats_bucket_limit(HVSC_STATS_HIST_BUCKETS - 1);
+}
+
+
+/** \brief  Get name of \a subsys
+ *
+ * \param[in]   subsys  subsystem
+ *
+ * \return  name
+ *
+ * \ingroup stats
+ */
+const char *hvsc_stats_subsys_name(int subsys)
+{
+    if (subsys < 0 || subsys >= HVSC_STATS_SUBSYS_COUNT) {
+        return "<invalid>";
+    }
+    return subsys_names[subsys];
+}
@@ -0,0 +1,62 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/stats.h
+ * \brief   Runtime statistics - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_STATS_H
+#define HVSC_STATS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+
+/** \brief  Timer for a single API call
+ *
+ * Only the outermost call on a thread is recorded, so a call that uses other
+ * public functions (ie hvsc_sldb_get_lengths() calling
+ * hvsc_sldb_get_entry_txt()) counts as a single lookup.
+ */
+typedef struct hvsc_stats_timer_s {
+    uint64_t    start;      /**< start time in nanoseconds */
+    int         subsys;     /**< subsystem (hvsc_stats_subsys_t) */
+    int         prev;       /**< previous subsystem of the thread */
+    bool        outer;      /**< outermost call on the thread */
+} hvsc_stats_timer_t;
+
+
+void    hvsc_stats_begin(hvsc_stats_timer_t *timer, int subsys);
+void    hvsc_stats_end(const hvsc_stats_timer_t *timer, bool result);
+void    hvsc_stats_lookup(int subsys, bool hit);
+int     hvsc_stats_subsys(void);
+int     hvsc_stats_set_subsys(int subsys);
+int     hvsc_stats_depth(void);
+void    hvsc_stats_add_bytes(size_t bytes);
+void    hvsc_stats_add_lines(size_t lines);
+void    hvsc_stats_add_alloc(void);
+
+#endif
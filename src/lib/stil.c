@@ -36,6 +36,12 @@
 
 #include "hvsc_defs.h"
 #include "base.h"
+#include "alloc.h"
+#include "index.h"
+#include "stats.h"
+#include "trace.h"
+#include "record.h"
+#include "client.h"
 
 #include "stil.h"
 
@@ -200,7 +206,7 @@ static hvsc_stil_field_t *stil_field_new(int type,
                                          long ts_from, long ts_to,
                                          const char *album, size_t alen)
 {
-    hvsc_stil_field_t *field = malloc(sizeof *field);
+    hvsc_stil_field_t *field = hvsc_malloc(sizeof *field);
 
     if (field == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
@@ -234,12 +240,12 @@ static hvsc_stil_field_t *stil_field_new(int type,
 static void stil_field_free(hvsc_stil_field_t *field)
 {
     if (field->text != NULL) {
-        free(field->text);
+        hvsc_free(field->text);
     }
     if (field->album != NULL) {
-        free(field->album);
+        hvsc_free(field->album);
     }
-    free(field);
+    hvsc_free(field);
 }
 
 
@@ -271,14 +277,15 @@ static hvsc_stil_block_t *stil_block_new(void)
     hvsc_stil_block_t *block;
     size_t i;
 
-    block = malloc(sizeof *block);
+    block = hvsc_malloc(sizeof *block);
     if (block == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
         return NULL;
     }
     stil_block_init(block);
 
-    block->fields = malloc(HVSC_STIL_BLOCK_FIELDS_INIT * sizeof *(block->fields));
+    block->fields = hvsc_malloc(HVSC_STIL_BLOCK_FIELDS_INIT
+                                * sizeof *(block->fields));
     if (block->fields == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
         stil_block_free(block);
@@ -317,7 +324,7 @@ static hvsc_stil_block_t *stil_block_dup(const hvsc_stil_block_t *block)
     hvsc_stil_block_t *copy;
     size_t i;
 
-    copy = malloc(sizeof *copy);
+    copy = hvsc_malloc(sizeof *copy);
     if (copy == NULL) {
         return false;
     }
@@ -326,7 +333,7 @@ static hvsc_stil_block_t *stil_block_dup(const hvsc_stil_block_t *block)
     copy->tune = block->tune;
     copy->fields_max = block->fields_max;
     copy->fields_used = block->fields_used;
-    copy->fields = malloc(block->fields_max * sizeof *(copy->fields));
+    copy->fields = hvsc_malloc(block->fields_max * sizeof *(copy->fields));
     for (i = 0; i < copy->fields_used; i++) {
         copy->fields[i] = stil_field_dup(block->fields[i]);
         if (copy->fields[i] == NULL) {
@@ -349,8 +356,8 @@ static void stil_block_free(hvsc_stil_block_t *block)
     for (i = 0; i < block->fields_used; i++) {
         stil_field_free(block->fields[i]);
     }
-    free(block->fields);
-    free(block);
+    hvsc_free(block->fields);
+    hvsc_free(block);
 }
 
 
@@ -370,7 +377,7 @@ static bool stil_block_add_field(hvsc_stil_block_t *block,
         /* yep */
         hvsc_stil_field_t **tmp;
 
-        tmp = realloc(block->fields,
+        tmp = hvsc_realloc(block->fields,
                 block->fields_max * 2 * sizeof *(block->fields));
         if (tmp == NULL) {
             hvsc_errno = HVSC_ERR_OOM;
@@ -416,7 +423,8 @@ static bool stil_handle_init_blocks(hvsc_stil_t *handle)
 {
     size_t i;
 
-    handle->blocks = malloc(HVSC_HANDLE_BLOCKS_INIT * sizeof *(handle->blocks));
+    handle->blocks = hvsc_malloc(HVSC_HANDLE_BLOCKS_INIT
+                                 * sizeof *(handle->blocks));
     if (handle->blocks == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
         return false;
@@ -442,7 +450,7 @@ static void stil_handle_free_blocks(hvsc_stil_t *handle)
         for (i = 0; i < handle->blocks_used; i++) {
             stil_block_free(handle->blocks[i]);
         }
-        free(handle->blocks);
+        hvsc_free(handle->blocks);
         handle->blocks = NULL;
     }
 }
@@ -464,7 +472,7 @@ static bool stil_handle_add_block(hvsc_stil_t *handle, hvsc_stil_block_t *block)
         /* yep */
         hvsc_stil_block_t **tmp;
 
-        tmp = realloc(handle->blocks,
+        tmp = hvsc_realloc(handle->blocks,
                 handle->blocks_max * 2 * sizeof *(handle->blocks));
         if (tmp == NULL) {
             hvsc_errno = HVSC_ERR_OOM;
@@ -485,20 +493,99 @@ static bool stil_handle_add_block(hvsc_stil_t *handle, hvsc_stil_block_t *block)
 
 
 
-/** \brief  Open STIL and look for PSID file \a psid
+/** \brief  Look up PSID file \a psid in the index and open its STIL entry
+ *
+ * The entry is read from the STIL text in memory. \a psid can be outside the
+ * HVSC, in which case its digest is used to find the entry and the path in
+ * \a handle is set to the path in the HVSC. The reference to \a index is
+ * handed over to \a handle, keeping the text alive until the handle is
+ * closed.
  *
+ * \param[in]       index   index, referenced by the caller
  * \param[in]       psid    path to PSID file
  * \param[in,out]   handle  STIL handle
  *
  * \return  bool
  */
-bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
+static bool stil_open_indexed(hvsc_index_t *index, const char *psid,
+                              hvsc_stil_t *handle)
+{
+    long tune;
+
+    tune = hvsc_index_find_psid(index, psid);
+    if (tune < 0 || index->stil[tune] == HVSC_INDEX_NONE) {
+        hvsc_errno = HVSC_ERR_NOT_FOUND;
+        hvsc_index_release(index);
+        hvsc_stil_close(handle);
+        return false;
+    }
+    handle->psid_path = hvsc_index_path(index, (size_t)tune);
+    if (handle->psid_path == NULL
+            || !hvsc_text_file_open_mem(index->stil_text, index->stil_size,
+                                        index->stil[tune], hvsc_stil_path,
+                                        &(handle->stil))) {
+        hvsc_index_release(index);
+        hvsc_stil_close(handle);
+        return false;
+    }
+    handle->stil.index = index;
+    return true;
+}
+
+
+/** \brief  Get the STIL entry of PSID file \a psid from hvscd
+ *
+ * The daemon sends the path of the tune and the raw text of the entry, which
+ * is handed over to \a handle and read like the STIL text in the index.
+ *
+ * \param[in]       psid    path to PSID file
+ * \param[in,out]   handle  STIL handle
+ *
+ * \return  bool
+ */
+static bool stil_open_client(const char *psid, hvsc_stil_t *handle)
 {
+    char *body;
+    size_t size;
+    size_t len;
+
+    body = hvsc_client_lookup(HVSC_PROTO_STIL, psid, NULL, &size);
+    if (body == NULL) {
+        hvsc_stil_close(handle);
+        return false;
+    }
+    len = strlen(body);
+    handle->psid_path = hvsc_strdup(body);
+    if (handle->psid_path == NULL || len == size
+            || !hvsc_text_file_open_mem(body, size, len + 1, hvsc_stil_path,
+                                        &(handle->stil))) {
+        if (len == size) {
+            hvsc_errno = HVSC_ERR_INVALID;
+        }
+        hvsc_free(body);
+        hvsc_stil_close(handle);
+        return false;
+    }
+    handle->stil.mem_owned = body;
+    return true;
+}
+
+
+/** \brief  Open STIL and look for PSID file \a psid (untimed)
+ *
+ * \param[in]       psid    path to PSID file
+ * \param[in,out]   handle  STIL handle
+ *
+ * \return  bool
+ */
+static bool stil_open(const char *psid, hvsc_stil_t *handle)
+{
+    hvsc_index_t *index;
     const char *line;
 
     stil_init_handle(handle);
 
-    handle->entry_buffer = malloc(HVSC_STIL_BUFFER_INIT *
+    handle->entry_buffer = hvsc_malloc(HVSC_STIL_BUFFER_INIT *
             sizeof *(handle->entry_buffer));
     if (handle->entry_buffer == NULL) {
         hvsc_errno = HVSC_ERR_OOM;
@@ -507,6 +594,15 @@ bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
     handle->entry_bufmax = HVSC_STIL_BUFFER_INIT;
     handle->entry_bufused = 0;
 
+    if (HVSC_CLIENT_ACTIVE()) {
+        return stil_open_client(psid, handle);
+    }
+
+    index = hvsc_index_acquire();
+    if (index != NULL) {
+        return stil_open_indexed(index, psid, handle);
+    }
+
     if (!hvsc_text_file_open(hvsc_stil_path, &(handle->stil))) {
         return false;
         hvsc_stil_close(handle);
@@ -521,13 +617,15 @@ bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
     }
 
     /* find the entry */
+    HVSC_TRACE_BEGIN(HVSC_TRACE_SCAN, hvsc_stil_path);
     while (true) {
         line = hvsc_text_file_read(&(handle->stil));
         if (line == NULL) {
-            if (feof(handle->stil.fp)) {
+            if (hvsc_text_file_eof(&(handle->stil))) {
                 /* EOF, so simply not found */
                 hvsc_errno = HVSC_ERR_NOT_FOUND;
             }
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle->stil.bytes, false);
             hvsc_stil_close(handle);
             /* I/O error is already set */
             return false;
@@ -535,6 +633,7 @@ bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
 
         if (strcmp(line, handle->psid_path) == 0) {
             hvsc_dbg("Found '%s' at line %ld\n", line, handle->stil.lineno);
+            HVSC_TRACE_END(HVSC_TRACE_SCAN, handle->stil.bytes, true);
             return true;
         }
     }
@@ -546,6 +645,26 @@ bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
 }
 
 
+/** \brief  Open STIL and look for PSID file \a psid
+ *
+ * \param[in]       psid    path to PSID file
+ * \param[in,out]   handle  STIL handle
+ *
+ * \return  bool
+ */
+bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
+{
+    hvsc_stats_timer_t timer;
+    bool result;
+
+    HVSC_RECORD_PATH(HVSC_OP_STIL_OPEN, psid);
+    hvsc_stats_begin(&timer, HVSC_STATS_STIL);
+    result = stil_open(psid, handle);
+    hvsc_stats_end(&timer, result);
+    return result;
+}
+
+
 /** \brief  Clean up memory and close file handle(s) used by \a handle
  *
  * Doesn't free \a handle itself.
@@ -555,18 +674,18 @@ bool hvsc_stil_open(const char *psid, hvsc_stil_t *handle)
 void hvsc_stil_close(hvsc_stil_t *handle)
 {
     hvsc_text_file_close(&(handle->stil));
-    free(handle->psid_path);
+    hvsc_free(handle->psid_path);
 
     if (handle->entry_buffer != NULL) {
         size_t i;
         for (i = 0; i < handle->entry_bufused; i++){
-            free(handle->entry_buffer[i]);
+            hvsc_free(handle->entry_buffer[i]);
         }
-        free(handle->entry_buffer);
+        hvsc_free(handle->entry_buffer);
     }
 
     if (handle->sid_comment != NULL) {
-        free(handle->sid_comment);
+        hvsc_free(handle->sid_comment);
     }
     if (handle->blocks != NULL) {
         stil_handle_free_blocks(handle);
@@ -591,7 +710,7 @@ static bool hvsc_stil_entry_add_line(hvsc_stil_t *handle, const char *line)
     if (handle->entry_bufmax == handle->entry_bufused) {
         hvsc_dbg("resizing line buffer to %zu entries\n",
                 handle->entry_bufmax * 2);
-        buffer = realloc(handle->entry_buffer,
+        buffer = hvsc_realloc(handle->entry_buffer,
                 (handle->entry_bufmax * 2) * sizeof *(handle->entry_buffer));
         if (buffer == NULL) {
             hvsc_errno = HVSC_ERR_OOM;
@@ -622,28 +741,34 @@ static bool hvsc_stil_entry_add_line(hvsc_stil_t *handle, const char *line)
 bool hvsc_stil_read_entry(hvsc_stil_t *handle)
 {
     const char *line;
+    size_t start = handle->stil.bytes;
 
-
+    HVSC_TRACE_BEGIN(HVSC_TRACE_READ, handle->psid_path);
     while (true) {
         line = hvsc_text_file_read(&(handle->stil));
         if (line == NULL) {
             /* EOF ? */
-            if (feof(handle->stil.fp)) {
+            if (hvsc_text_file_eof(&(handle->stil))) {
                 /* EOF, so end of entry */
+                HVSC_TRACE_END(HVSC_TRACE_READ, handle->stil.bytes - start,
+                               true);
                 return true;
             }
             /* I/O error is already set */
+            HVSC_TRACE_END(HVSC_TRACE_READ, handle->stil.bytes - start, false);
             return false;
         }
 
         /* check for end of entry */
         if (hvsc_string_is_empty(line)) {
             hvsc_dbg("got empty line -> end-of-entry\n");
+            HVSC_TRACE_END(HVSC_TRACE_READ, handle->stil.bytes - start, true);
             return true;
         }
 
         hvsc_dbg("line %ld: '%s'\n", handle->stil.lineno, line);
         if (!hvsc_stil_entry_add_line(handle, line)) {
+            HVSC_TRACE_END(HVSC_TRACE_READ, handle->stil.bytes - start, false);
             return false;
         }
     }
@@ -680,7 +805,7 @@ void hvsc_stil_dump_entry(hvsc_stil_t *handle)
  *
  * \return  comment, or `NULL` on failure
  */
-static char *stil_parse_comment(hvsc_stil_parser_state_t *state)
+char *hvsc_stil_parse_comment(hvsc_stil_parser_state_t *state)
 {
     char *comment;
     char *tmp;
@@ -705,10 +830,10 @@ static char *stil_parse_comment(hvsc_stil_parser_state_t *state)
             return comment;
         }
         /* realloc to add new line */
-        tmp = realloc(comment, total + len - 8 + 1);
+        tmp = hvsc_realloc(comment, total + len - 8 + 1);
         if (tmp == NULL) {
             hvsc_errno = HVSC_ERR_OOM;
-            free(comment);
+            hvsc_free(comment);
             return NULL;
         }
         comment = tmp;
@@ -770,7 +895,7 @@ static void stil_parser_free(hvsc_stil_parser_state_t *parser)
         stil_block_free(parser->block);
     }
     if (parser->album != NULL) {
-        free(parser->album);
+        hvsc_free(parser->album);
         parser->album = NULL;
     }
 }
@@ -778,7 +903,7 @@ static void stil_parser_free(hvsc_stil_parser_state_t *parser)
 
 
 
-/** \brief  Parse textual content of \a handle into a structured representation
+/** \brief  Parse textual content of \a handle (untraced)
  *
  * \param[in,out]   handle  STIL entry handle
  *
@@ -786,7 +911,7 @@ static void stil_parser_free(hvsc_stil_parser_state_t *parser)
  *
  * \todo    Refactor, this function is too long and complex
  */
-bool hvsc_stil_parse_entry(hvsc_stil_t *handle)
+static bool stil_parse_entry(hvsc_stil_t *handle)
 {
     hvsc_stil_parser_state_t state;
 
@@ -851,7 +976,7 @@ bool hvsc_stil_parse_entry(hvsc_stil_t *handle)
             switch (type) {
                 /* COMMENT: field */
                 case HVSC_FIELD_COMMENT:
-                    comment = stil_parse_comment(&state);
+                    comment = hvsc_stil_parse_comment(&state);
                     if (comment == NULL) {
                         return false;
                     }
@@ -972,12 +1097,12 @@ bool hvsc_stil_parse_entry(hvsc_stil_t *handle)
 
                 /* if the line was a comment, free the comment */
                 if (type == HVSC_FIELD_COMMENT) {
-                    free(comment);
+                    hvsc_free(comment);
                     comment = NULL;
                 }
                 /* free album, if present */
                 if (state.album != NULL) {
-                    free(state.album);
+                    hvsc_free(state.album);
                     state.album = NULL;
                 }
             } else {
@@ -1000,6 +1125,41 @@ bool hvsc_stil_parse_entry(hvsc_stil_t *handle)
 }
 
 
+/** \brief  Get the size of the text of the current entry of \a handle
+ *
+ * \param[in]   handle  STIL handle
+ *
+ * \return  number of bytes, excluding line endings
+ */
+static size_t stil_entry_size(const hvsc_stil_t *handle)
+{
+    size_t size = 0;
+    size_t i;
+
+    for (i = 0; i < handle->entry_bufused; i++) {
+        size += strlen(handle->entry_buffer[i]);
+    }
+    return size;
+}
+
+
+/** \brief  Parse textual content of \a handle into a structured representation
+ *
+ * \param[in,out]   handle  STIL entry handle
+ *
+ * \return  bool
+ */
+bool hvsc_stil_parse_entry(hvsc_stil_t *handle)
+{
+    bool result;
+
+    HVSC_TRACE_BEGIN(HVSC_TRACE_PARSE, handle->psid_path);
+    result = stil_parse_entry(handle);
+    HVSC_TRACE_END(HVSC_TRACE_PARSE, stil_entry_size(handle), result);
+    return result;
+}
+
+
 
 /** \brief  Temp: dump parsed entries
  *
@@ -1125,16 +1285,14 @@ void hvsc_stil_dump_tune_entry(const hvsc_stil_tune_entry_t *entry)
 }
 
 
-/** \brief  Retrieve full STIL info on \a path
- *
- * Get full STIL info PSID file \a path.
+/** \brief  Get parsed STIL entry of \a path (untimed)
  *
  * \param[in,out]   stil    STIL handle
  * \param[in]       path    path to PSID file, relative to HVSC root dir
  *
  * \return  true if STIL info found and parsed
  */
-bool hvsc_stil_get(hvsc_stil_t *stil, const char *path)
+static bool stil_get(hvsc_stil_t *stil, const char *path)
 {
     /* find STIL.txt entry */
     if (!hvsc_stil_open(path, stil)) {
@@ -1157,3 +1315,25 @@ bool hvsc_stil_get(hvsc_stil_t *stil, const char *path)
 }
 
 
+/** \brief  Retrieve full STIL info on \a path
+ *
+ * Get full STIL info PSID file \a path.
+ *
+ * \param[in,out]   stil    STIL handle
+ * \param[in]       path    path to PSID file, relative to HVSC root dir
+ *
+ * \return  true if STIL info found and parsed
+ */
+bool hvsc_stil_get(hvsc_stil_t *stil, const char *path)
+{
+    hvsc_stats_timer_t timer;
+    bool result;
+
+    HVSC_RECORD_PATH(HVSC_OP_STIL_GET, path);
+    hvsc_stats_begin(&timer, HVSC_STATS_STIL);
+    result = stil_get(stil, path);
+    hvsc_stats_end(&timer, result);
+    return result;
+}
+
+
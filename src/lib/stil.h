@@ -32,5 +32,6 @@
 
 #include "hvsc_defs.h"
 
+char *hvsc_stil_parse_comment(hvsc_stil_parser_state_t *state);
 
 #endif
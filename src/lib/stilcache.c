@@ -0,0 +1,775 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/stilcache.c
+ * \brief   Cache of parsed STIL entries
+ *
+ * Keeps parsed STIL entries in memory, keyed on the path of the tune relative
+ * to the HVSC root, so popular tunes don't have their entry read and parsed
+ * on every lookup. Callers get a reference to the cached hvsc_stil_t, which
+ * stays valid until they release it, even when the entry is evicted in the
+ * meantime.
+ *
+ * The cache is capped in bytes and evicts the least recently used entries.
+ * New entries are only admitted when the cache has room or when they're
+ * requested more often than the entry they would replace (TinyLFU), so a
+ * single pass over the whole collection doesn't flush the popular tunes. The
+ * request frequencies are approximated with a count-min sketch that's halved
+ * periodically so the popularity of tunes can change over time. Entries
+ * prefetched for tunes that are about to be played bypass the admission
+ * policy, see hvsc_prefetch().
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "index.h"
+#include "stats.h"
+#include "record.h"
+
+#include "stilcache.h"
+
+
+/** \brief  Multipliers for the rows of the sketch
+ */
+static const uint64_t sketch_seeds[HVSC_STIL_CACHE_SKETCH_ROWS] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+    0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+};
+
+
+/** \brief  Lock for the cache
+ */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Cache is open
+ */
+static bool cache_open = false;
+
+/** \brief  Hash table buckets
+ */
+static hvsc_stil_cache_entry_t **cache_buckets = NULL;
+
+/** \brief  Number of buckets, a power of two
+ */
+static size_t cache_size = 0;
+
+/** \brief  Most recently used entry
+ */
+static hvsc_stil_cache_entry_t *cache_mru = NULL;
+
+/** \brief  Least recently used entry, the next candidate for eviction
+ */
+static hvsc_stil_cache_entry_t *cache_lru = NULL;
+
+/** \brief  Frequency sketch, HVSC_STIL_CACHE_SKETCH_ROWS rows of counters
+ */
+static uint8_t *sketch = NULL;
+
+/** \brief  Number of counters per row of the sketch, a power of two
+ */
+static size_t sketch_width = 0;
+
+/** \brief  Shift to get a counter index from a 64-bit hash
+ */
+static int sketch_shift = 0;
+
+/** \brief  Number of increments since the counters were last halved
+ */
+static size_t sketch_samples = 0;
+
+/** \brief  Number of times entries were cleared or invalidated
+ *
+ * An entry parsed before that may come from the old STIL.txt, so it isn't
+ * admitted.
+ */
+static unsigned long cache_generation = 0;
+
+/** \brief  Statistics, \a entries and \a bytes are kept up to date
+ */
+static hvsc_stil_cache_stats_t cache_stats;
+
+
+/** \brief  Calculate hash of \a key (FNV-1a)
+ *
+ * \param[in]   key key
+ *
+ * \return  hash
+ */
+static uint64_t cache_hash(const char *key)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    while (*key != '\0') {
+        hash = (hash ^ (uint8_t)*key++) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+/** \brief  Get the counter of \a hash in \a row of the sketch
+ *
+ * \param[in]   hash    hash of a key
+ * \param[in]   row     row
+ *
+ * \return  pointer to counter
+ */
+static uint8_t *sketch_counter(uint64_t hash, int row)
+{
+    size_t index = (size_t)((hash * sketch_seeds[row]) >> sketch_shift);
+
+    return sketch + (size_t)row * sketch_width + index;
+}
+
+
+/** \brief  Get estimated request frequency of \a hash
+ *
+ * \param[in]   hash    hash of a key
+ *
+ * \return  frequency (0-HVSC_STIL_CACHE_SKETCH_MAX)
+ */
+static int sketch_estimate(uint64_t hash)
+{
+    int freq = HVSC_STIL_CACHE_SKETCH_MAX;
+    int row;
+
+    for (row = 0; row < HVSC_STIL_CACHE_SKETCH_ROWS; row++) {
+        int count = *sketch_counter(hash, row);
+
+        if (count < freq) {
+            freq = count;
+        }
+    }
+    return freq;
+}
+
+
+/** \brief  Count a request for \a hash
+ *
+ * Only the lowest counters are incremented (conservative update), which
+ * reduces the overestimation caused by collisions. After ten increments per
+ * counter all counters are halved.
+ *
+ * \param[in]   hash    hash of a key
+ */
+static void sketch_increment(uint64_t hash)
+{
+    int freq = sketch_estimate(hash);
+    int row;
+
+    if (freq < HVSC_STIL_CACHE_SKETCH_MAX) {
+        for (row = 0; row < HVSC_STIL_CACHE_SKETCH_ROWS; row++) {
+            uint8_t *counter = sketch_counter(hash, row);
+
+            if (*counter == freq) {
+                (*counter)++;
+            }
+        }
+    }
+
+    if (++sketch_samples >= sketch_width * 10) {
+        size_t i;
+
+        for (i = 0; i < sketch_width * HVSC_STIL_CACHE_SKETCH_ROWS; i++) {
+            sketch[i] >>= 1;
+        }
+        sketch_samples /= 2;
+    }
+}
+
+
+/** \brief  Calculate the memory used by the parsed entry in \a stil
+ *
+ * \param[in]   stil    STIL handle
+ *
+ * \return  size in bytes
+ */
+static size_t cache_stil_size(const hvsc_stil_t *stil)
+{
+    size_t size = 0;
+    size_t b;
+    size_t f;
+
+    if (stil->psid_path != NULL) {
+        size += strlen(stil->psid_path) + 1;
+    }
+    if (stil->sid_comment != NULL) {
+        size += strlen(stil->sid_comment) + 1;
+    }
+    size += stil->entry_bufmax * sizeof *(stil->entry_buffer);
+    for (b = 0; b < stil->entry_bufused; b++) {
+        size += strlen(stil->entry_buffer[b]) + 1;
+    }
+    size += stil->blocks_max * sizeof *(stil->blocks);
+    for (b = 0; b < stil->blocks_used; b++) {
+        const hvsc_stil_block_t *block = stil->blocks[b];
+
+        size += sizeof *block + block->fields_max * sizeof *(block->fields);
+        for (f = 0; f < block->fields_used; f++) {
+            const hvsc_stil_field_t *field = block->fields[f];
+
+            size += sizeof *field;
+            if (field->text != NULL) {
+                size += strlen(field->text) + 1;
+            }
+            if (field->album != NULL) {
+                size += strlen(field->album) + 1;
+            }
+        }
+    }
+    return size;
+}
+
+
+/** \brief  Free \a entry
+ *
+ * \param[in,out]   entry   cache entry
+ */
+static void cache_entry_free(hvsc_stil_cache_entry_t *entry)
+{
+    hvsc_stil_close(&(entry->stil));
+    hvsc_free(entry->key);
+    hvsc_free(entry);
+}
+
+
+/** \brief  Find the entry for \a key
+ *
+ * Call with the lock held.
+ *
+ * \param[in]   key     key
+ * \param[in]   hash    hash of \a key
+ *
+ * \return  entry or `NULL` when not cached
+ */
+static hvsc_stil_cache_entry_t *cache_find(const char *key, uint64_t hash)
+{
+    hvsc_stil_cache_entry_t *entry;
+
+    entry = cache_buckets[hash & (cache_size - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+
+/** \brief  Remove \a entry from the LRU list
+ *
+ * \param[in,out]   entry   cache entry
+ */
+static void cache_lru_unlink(hvsc_stil_cache_entry_t *entry)
+{
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache_mru = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache_lru = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+
+/** \brief  Make \a entry the most recently used entry
+ *
+ * \param[in,out]   entry   cache entry, not in the LRU list
+ */
+static void cache_lru_push(hvsc_stil_cache_entry_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache_mru;
+    if (cache_mru != NULL) {
+        cache_mru->lru_prev = entry;
+    } else {
+        cache_lru = entry;
+    }
+    cache_mru = entry;
+}
+
+
+/** \brief  Remove \a entry from the cache
+ *
+ * Call with the lock held. The entry is freed when no caller holds a
+ * reference, otherwise the last hvsc_stil_cache_release() frees it.
+ *
+ * \param[in,out]   entry   cache entry
+ */
+static void cache_remove(hvsc_stil_cache_entry_t *entry)
+{
+    hvsc_stil_cache_entry_t **link;
+
+    link = &(cache_buckets[entry->hash & (cache_size - 1)]);
+    while (*link != entry) {
+        link = &((*link)->next);
+    }
+    *link = entry->next;
+    entry->next = NULL;
+    cache_lru_unlink(entry);
+
+    entry->cached = false;
+    cache_stats.entries--;
+    cache_stats.bytes -= entry->bytes;
+    if (entry->refs == 0) {
+        cache_entry_free(entry);
+    }
+}
+
+
+/** \brief  Double the number of buckets
+ *
+ * Call with the lock held. Failing to grow only makes the chains longer.
+ */
+static void cache_grow(void)
+{
+    hvsc_stil_cache_entry_t **buckets;
+    size_t size = cache_size * 2;
+    size_t i;
+
+    buckets = hvsc_calloc(size, sizeof *buckets);
+    if (buckets == NULL) {
+        return;
+    }
+    for (i = 0; i < cache_size; i++) {
+        hvsc_stil_cache_entry_t *entry = cache_buckets[i];
+
+        while (entry != NULL) {
+            hvsc_stil_cache_entry_t *next = entry->next;
+            size_t b = entry->hash & (size - 1);
+
+            entry->next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    hvsc_free(cache_buckets);
+    cache_buckets = buckets;
+    cache_size = size;
+}
+
+
+/** \brief  Add \a entry to the cache if the admission policy allows it
+ *
+ * Call with the lock held. Least recently used entries are evicted to make
+ * room, but only when \a entry is requested more often than each of the
+ * entries it would replace, unless \a force is set. The victims are picked
+ * first and evicted once \a entry is admitted, so a rejected entry leaves
+ * the cache as it was.
+ *
+ * \param[in,out]   entry   new cache entry
+ * \param[in]       force   evict regardless of the request frequencies
+ *
+ * \return  entry was added
+ */
+static bool cache_admit(hvsc_stil_cache_entry_t *entry, bool force)
+{
+    hvsc_stil_cache_entry_t *victim = cache_lru;
+    size_t bytes = cache_stats.bytes;
+    int freq;
+
+    if (entry->bytes > cache_stats.max_bytes) {
+        cache_stats.rejected++;
+        return false;
+    }
+    if (!force) {
+        freq = sketch_estimate(entry->hash);
+        while (bytes + entry->bytes > cache_stats.max_bytes) {
+            if (freq <= sketch_estimate(victim->hash)) {
+                cache_stats.rejected++;
+                return false;
+            }
+            bytes -= victim->bytes;
+            victim = victim->lru_prev;
+        }
+    }
+    while (cache_stats.bytes + entry->bytes > cache_stats.max_bytes) {
+        cache_remove(cache_lru);
+        cache_stats.evicted++;
+    }
+
+    if (cache_stats.entries >= cache_size) {
+        cache_grow();
+    }
+    entry->next = cache_buckets[entry->hash & (cache_size - 1)];
+    cache_buckets[entry->hash & (cache_size - 1)] = entry;
+    cache_lru_push(entry);
+    entry->cached = true;
+    cache_stats.entries++;
+    cache_stats.bytes += entry->bytes;
+    cache_stats.admitted++;
+    return true;
+}
+
+
+/** \brief  Get the cache key of \a psid
+ *
+ * The key is the path relative to the HVSC root. With the index loaded, a
+ * copy of a HVSC file elsewhere gets the key of the original.
+ *
+ * \param[in]   psid    path to PSID file
+ *
+ * \return  heap-allocated key or `NULL` on failure
+ */
+static char *cache_key(const char *psid)
+{
+    hvsc_index_t *index = hvsc_index_acquire();
+
+    if (index != NULL) {
+        long tune = hvsc_index_find_psid(index, psid);
+        char *key = NULL;
+
+        if (tune >= 0) {
+            key = hvsc_index_path(index, (size_t)tune);
+        }
+        hvsc_index_release(index);
+        if (tune >= 0) {
+            return key;
+        }
+    }
+    return hvsc_path_strip_root(psid);
+}
+
+
+/** \brief  Get the parsed STIL entry of \a psid (untimed)
+ *
+ * A prefetch isn't a request: it doesn't count as hit or miss, doesn't
+ * change the request frequency and always admits the entry.
+ *
+ * \param[in]   psid        path to PSID file
+ * \param[in]   prefetch    called by hvsc_prefetch()
+ *
+ * \return  entry or `NULL` on failure
+ */
+static const hvsc_stil_t *stil_cache_get(const char *psid, bool prefetch)
+{
+    hvsc_stil_cache_entry_t *entry;
+    hvsc_stil_cache_entry_t *found;
+    char *key;
+    uint64_t hash;
+    unsigned long generation;
+
+    key = cache_key(psid);
+    if (key == NULL) {
+        return NULL;
+    }
+    hash = cache_hash(key);
+
+    pthread_mutex_lock(&cache_lock);
+    generation = cache_generation;
+    if (cache_open) {
+        if (!prefetch) {
+            sketch_increment(hash);
+        }
+        found = cache_find(key, hash);
+        if (found != NULL) {
+            found->refs++;
+            cache_lru_unlink(found);
+            cache_lru_push(found);
+            if (!prefetch) {
+                cache_stats.hits++;
+            }
+            pthread_mutex_unlock(&cache_lock);
+            hvsc_free(key);
+            return &(found->stil);
+        }
+        if (!prefetch) {
+            cache_stats.misses++;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    /* parse without holding the lock */
+    entry = hvsc_calloc(1, sizeof *entry);
+    if (entry == NULL) {
+        hvsc_free(key);
+        return NULL;
+    }
+    if (!hvsc_stil_get(&(entry->stil), psid)) {
+        hvsc_free(entry);
+        hvsc_free(key);
+        return NULL;
+    }
+    /* the parsed entry is all that's needed, drop the file handle */
+    hvsc_text_file_close(&(entry->stil.stil));
+    entry->stil.stil.mem = NULL;
+    entry->stil.stil.mem_size = 0;
+    entry->key = key;
+    entry->hash = hash;
+    entry->bytes = sizeof *entry + strlen(key) + 1
+        + cache_stil_size(&(entry->stil));
+    entry->refs = 1;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_open && generation == cache_generation) {
+        /* another thread may have added it in the meantime */
+        found = cache_find(key, hash);
+        if (found != NULL) {
+            found->refs++;
+            pthread_mutex_unlock(&cache_lock);
+            cache_entry_free(entry);
+            return &(found->stil);
+        }
+        if (cache_admit(entry, prefetch) && prefetch) {
+            cache_stats.prefetched++;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return &(entry->stil);
+}
+
+
+/** \brief  Open the STIL cache
+ *
+ * \param[in]   max_bytes   memory cap in bytes (0 for the default)
+ *
+ * \return  bool (false with HVSC_ERR_INVALID when already open)
+ *
+ * \ingroup stilcache
+ */
+bool hvsc_stil_cache_open(size_t max_bytes)
+{
+    size_t width = 256;
+    int prev;
+
+    if (max_bytes == 0) {
+        max_bytes = HVSC_STIL_CACHE_SIZE_DEFAULT;
+    }
+    while (width < max_bytes / HVSC_STIL_CACHE_ENTRY_AVG) {
+        width *= 2;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_open) {
+        pthread_mutex_unlock(&cache_lock);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    prev = hvsc_stats_set_subsys(HVSC_STATS_STIL);
+    cache_buckets = hvsc_calloc(HVSC_STIL_CACHE_BUCKETS_INIT,
+                                sizeof *cache_buckets);
+    sketch = hvsc_calloc(width, HVSC_STIL_CACHE_SKETCH_ROWS);
+    hvsc_stats_set_subsys(prev);
+    if (cache_buckets == NULL || sketch == NULL) {
+        hvsc_free(cache_buckets);
+        hvsc_free(sketch);
+        cache_buckets = NULL;
+        sketch = NULL;
+        pthread_mutex_unlock(&cache_lock);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    cache_size = HVSC_STIL_CACHE_BUCKETS_INIT;
+    sketch_width = width;
+    sketch_shift = 64;
+    while (width > 1) {
+        sketch_shift--;
+        width >>= 1;
+    }
+    sketch_samples = 0;
+    memset(&cache_stats, 0, sizeof cache_stats);
+    cache_stats.max_bytes = max_bytes;
+    cache_open = true;
+    pthread_mutex_unlock(&cache_lock);
+    return true;
+}
+
+
+/** \brief  Remove all entries from the STIL cache
+ *
+ * Call when STIL.txt has changed. The request frequencies are kept.
+ *
+ * \ingroup stilcache
+ */
+void hvsc_stil_cache_clear(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    while (cache_lru != NULL) {
+        cache_remove(cache_lru);
+    }
+    cache_generation++;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+
+/** \brief  Remove the entry of \a key from the STIL cache
+ *
+ * Used when the entry changed in STIL.txt.
+ *
+ * \param[in]   key path relative to the HVSC root
+ */
+void hvsc_stil_cache_invalidate(const char *key)
+{
+    uint64_t hash = cache_hash(key);
+    hvsc_stil_cache_entry_t *found;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_open) {
+        found = cache_find(key, hash);
+        if (found != NULL) {
+            cache_remove(found);
+        }
+    }
+    cache_generation++;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+
+/** \brief  Check if the STIL cache is open
+ *
+ * \return  bool
+ */
+bool hvsc_stil_cache_is_open(void)
+{
+    bool result;
+
+    pthread_mutex_lock(&cache_lock);
+    result = cache_open;
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+
+/** \brief  Close the STIL cache and free its memory
+ *
+ * Entries still referenced are freed when they're released.
+ *
+ * \ingroup stilcache
+ */
+void hvsc_stil_cache_close(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    while (cache_lru != NULL) {
+        cache_remove(cache_lru);
+    }
+    hvsc_free(cache_buckets);
+    hvsc_free(sketch);
+    cache_buckets = NULL;
+    sketch = NULL;
+    cache_size = 0;
+    sketch_width = 0;
+    cache_open = false;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+
+/** \brief  Get the parsed STIL entry of \a psid
+ *
+ * Returns the cached entry when present, otherwise reads and parses the
+ * entry and offers it to the cache. Without an open cache every call parses
+ * the entry. The result is read-only and shared with other callers, release
+ * it with hvsc_stil_cache_release().
+ *
+ * \param[in]   psid    path to PSID file
+ *
+ * \return  STIL handle with the parsed entry, or `NULL` on failure
+ *
+ * \ingroup stilcache
+ */
+const hvsc_stil_t *hvsc_stil_cache_get(const char *psid)
+{
+    hvsc_stats_timer_t timer;
+    const hvsc_stil_t *result;
+
+    HVSC_RECORD_PATH(HVSC_OP_STIL_CACHE_GET, psid);
+    hvsc_stats_begin(&timer, HVSC_STATS_STIL);
+    result = stil_cache_get(psid, false);
+    hvsc_stats_end(&timer, result != NULL);
+    return result;
+}
+
+
+/** \brief  Add the parsed STIL entry of \a psid to the cache ahead of use
+ *
+ * Unlike hvsc_stil_cache_get() the entry is always admitted, evicting the
+ * least recently used entries when needed.
+ *
+ * \param[in]   psid    path to PSID file
+ *
+ * \return  `false` when the entry can't be parsed or the cache isn't open
+ */
+bool hvsc_stil_cache_prefetch(const char *psid)
+{
+    const hvsc_stil_t *stil;
+
+    if (!hvsc_stil_cache_is_open()) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    stil = stil_cache_get(psid, true);
+    hvsc_stil_cache_release(stil);
+    return stil != NULL;
+}
+
+
+/** \brief  Release a result of hvsc_stil_cache_get()
+ *
+ * \param[in]   stil    STIL handle returned by hvsc_stil_cache_get()
+ *
+ * \ingroup stilcache
+ */
+void hvsc_stil_cache_release(const hvsc_stil_t *stil)
+{
+    hvsc_stil_cache_entry_t *entry = (hvsc_stil_cache_entry_t *)stil;
+    bool unused;
+
+    if (entry == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache_lock);
+    unused = --entry->refs == 0 && !entry->cached;
+    pthread_mutex_unlock(&cache_lock);
+    if (unused) {
+        cache_entry_free(entry);
+    }
+}
+
+
+/** \brief  Get statistics of the STIL cache
+ *
+ * \param[out]  stats   statistics
+ *
+ * \ingroup stilcache
+ */
+void hvsc_stil_cache_get_stats(hvsc_stil_cache_stats_t *stats)
+{
+    pthread_mutex_lock(&cache_lock);
+    *stats = cache_stats;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,74 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/stilcache.h
+ * \brief   Cache of parsed STIL entries - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_STILCACHE_H
+#define HVSC_STILCACHE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+
+/** \brief  Number of rows of the frequency sketch
+ */
+#define HVSC_STIL_CACHE_SKETCH_ROWS     4
+
+
+/** \brief  Maximum value of a sketch counter
+ *
+ * Counters saturate at 15 like the 4-bit counters of TinyLFU, which keeps
+ * old favourites from dominating the admission decisions forever.
+ */
+#define HVSC_STIL_CACHE_SKETCH_MAX      15
+
+
+/** \brief  Cached STIL entry
+ *
+ * The handle must be the first member, hvsc_stil_cache_release() gets the
+ * entry from the handle it returned.
+ */
+typedef struct hvsc_stil_cache_entry_s {
+    hvsc_stil_t         stil;       /**< parsed entry, read-only */
+    char *              key;        /**< path relative to the HVSC root */
+    uint64_t            hash;       /**< hash of \a key */
+    size_t              bytes;      /**< memory used by the entry */
+    unsigned int        refs;       /**< references held by callers */
+    bool                cached;     /**< entry is in the cache, when false
+                                         the last release frees it */
+    struct hvsc_stil_cache_entry_s *next;       /**< next in bucket */
+    struct hvsc_stil_cache_entry_s *lru_prev;   /**< more recently used */
+    struct hvsc_stil_cache_entry_s *lru_next;   /**< less recently used */
+} hvsc_stil_cache_entry_t;
+
+
+void    hvsc_stil_cache_invalidate(const char *key);
+bool    hvsc_stil_cache_is_open(void);
+bool    hvsc_stil_cache_prefetch(const char *psid);
+
+#endif
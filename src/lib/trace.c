@@ -0,0 +1,142 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/trace.c
+ * \brief   Tracing hooks
+ *
+ * Lets a host register hooks that are called at the start and end of the
+ * phases of a lookup: opening files, reading, scanning, parsing, hashing and
+ * allocating buffers. Without hooks the checks in the library cost a load and
+ * a branch, so tracing can stay compiled in.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+#include "stats.h"
+#include "trace.h"
+
+
+/** \brief  Names of the phases
+ */
+static const char *phase_names[HVSC_TRACE_PHASE_COUNT] = {
+    "open", "read", "scan", "parse", "hash", "alloc"
+};
+
+
+/** \brief  Storage for the registered hooks
+ */
+static hvsc_trace_hooks_t trace_hooks;
+
+/** \brief  Registered hooks, `NULL` when tracing is disabled
+ *
+ * Checked by HVSC_TRACE_BEGIN() and HVSC_TRACE_END().
+ */
+hvsc_trace_hooks_t *hvsc_trace_active = NULL;
+
+
+/** \brief  Register trace hooks
+ *
+ * Either hook can be `NULL`, passing `NULL` for both disables tracing. The
+ * hooks are called from the thread doing the work, so they must be
+ * thread-safe when the library is used from multiple threads.
+ *
+ * Hooks must only be changed while no other threads use the library, a phase
+ * that was running during the change might otherwise report only its begin
+ * or end.
+ *
+ * \param[in]   begin   hook called when a phase starts
+ * \param[in]   end     hook called when a phase ends
+ * \param[in]   data    data passed to the hooks
+ *
+ * \ingroup trace
+ */
+void hvsc_trace_set_hooks(hvsc_trace_begin_func_t begin,
+                          hvsc_trace_end_func_t end,
+                          void *data)
+{
+    hvsc_trace_hooks_t *active = NULL;
+
+    if (begin != NULL || end != NULL) {
+        trace_hooks.begin = begin;
+        trace_hooks.end = end;
+        trace_hooks.data = data;
+        active = &trace_hooks;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&hvsc_trace_active, active, __ATOMIC_RELEASE);
+#else
+    hvsc_trace_active = active;
+#endif
+}
+
+
+/** \brief  Get name of \a phase
+ *
+ * \param[in]   phase   phase (hvsc_trace_phase_t)
+ *
+ * \return  name or "unknown"
+ *
+ * \ingroup trace
+ */
+const char *hvsc_trace_phase_name(int phase)
+{
+    if (phase < 0 || phase >= HVSC_TRACE_PHASE_COUNT) {
+        return "unknown";
+    }
+    return phase_names[phase];
+}
+
+
+/** \brief  Call the begin hook, use HVSC_TRACE_BEGIN() instead
+ *
+ * \param[in]   phase   phase
+ * \param[in]   subject subject of the phase (can be `NULL`)
+ */
+void hvsc_trace_fire_begin(int phase, const char *subject)
+{
+    hvsc_trace_hooks_t *hooks = hvsc_trace_active;
+
+    if (hooks != NULL && hooks->begin != NULL) {
+        hooks->begin(hooks->data, phase, hvsc_stats_subsys(), subject);
+    }
+}
+
+
+/** \brief  Call the end hook, use HVSC_TRACE_END() instead
+ *
+ * \param[in]   phase   phase
+ * \param[in]   bytes   number of bytes processed
+ * \param[in]   result  phase succeeded
+ */
+void hvsc_trace_fire_end(int phase, size_t bytes, bool result)
+{
+    hvsc_trace_hooks_t *hooks = hvsc_trace_active;
+
+    if (hooks != NULL && hooks->end != NULL) {
+        hooks->end(hooks->data, phase, hvsc_stats_subsys(), bytes, result);
+    }
+}
@@ -0,0 +1,84 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/trace.h
+ * \brief   Tracing hooks - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+
+#ifndef HVSC_TRACE_H
+#define HVSC_TRACE_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+
+/** \brief  Registered hooks
+ */
+typedef struct hvsc_trace_hooks_s {
+    hvsc_trace_begin_func_t begin;  /**< begin hook (can be `NULL`) */
+    hvsc_trace_end_func_t   end;    /**< end hook (can be `NULL`) */
+    void *                  data;   /**< data for the hooks */
+} hvsc_trace_hooks_t;
+
+
+extern hvsc_trace_hooks_t *hvsc_trace_active;
+
+
+/** \brief  Branch hint for the hooks check, no hooks is the expected case
+ */
+#if defined(__GNUC__) || defined(__clang__)
+# define HVSC_TRACE_ENABLED() \
+    __builtin_expect(__atomic_load_n(&hvsc_trace_active, __ATOMIC_RELAXED) \
+                     != NULL, 0)
+#else
+# define HVSC_TRACE_ENABLED()   (hvsc_trace_active != NULL)
+#endif
+
+/** \brief  Report the start of \a phase on \a subject to the hooks
+ *
+ * Costs a load and a not-taken branch when no hooks are registered.
+ */
+#define HVSC_TRACE_BEGIN(phase, subject) \
+    do { \
+        if (HVSC_TRACE_ENABLED()) { \
+            hvsc_trace_fire_begin((phase), (subject)); \
+        } \
+    } while (0)
+
+/** \brief  Report the end of \a phase, having processed \a bytes, to the hooks
+ */
+#define HVSC_TRACE_END(phase, bytes, result) \
+    do { \
+        if (HVSC_TRACE_ENABLED()) { \
+            hvsc_trace_fire_end((phase), (bytes), (result)); \
+        } \
+    } while (0)
+
+
+void    hvsc_trace_fire_begin(int phase, const char *subject);
+void    hvsc_trace_fire_end(int phase, size_t bytes, bool result);
+
+#endif
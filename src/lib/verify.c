@@ -0,0 +1,336 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/verify.c
+ * \brief   Collection-wide SLDB verification
+ *
+ * Checks a HVSC tree against its Songlengths.md5: every PSID file should have
+ * an entry with the same number of songs, and every entry should belong to a
+ * PSID file.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "catalog.h"
+#include "dcache.h"
+#include "pool.h"
+#include "sldb.h"
+
+#include "verify.h"
+
+
+/** \brief  Shared state of a verification run
+ *
+ * \ingroup sldb
+ */
+typedef struct verify_state_s {
+    const hvsc_catalog_t *      catalog;    /**< PSID files in the HVSC */
+    const hvsc_sldb_table_t *   table;      /**< SLDB entries */
+    long *                      matches;    /**< SLDB entry index per row */
+} verify_state_t;
+
+
+/** \brief  Range of catalog rows handled by a single job
+ *
+ * \ingroup sldb
+ */
+typedef struct verify_job_s {
+    verify_state_t *    state;  /**< shared state */
+    size_t              first;  /**< first row */
+    size_t              last;   /**< last row + 1 */
+} verify_job_t;
+
+
+/** \brief  Worker job: hash the PSID files in a range of rows
+ *
+ * Each file is read with a single read (unless its digest is in the digest
+ * cache), its MD5 digest calculated and looked up in the SLDB table. The
+ * result is stored in the row's slot of `matches`, so no locking is needed.
+ *
+ * \param[in]   arg verify job
+ */
+static void verify_rows(void *arg)
+{
+    verify_job_t *job = arg;
+    verify_state_t *state = job->state;
+    size_t row;
+
+    for (row = job->first; row < job->last; row++) {
+        const char *rel;
+        char *path;
+        uint8_t digest[HVSC_DIGEST_SIZE];
+        bool ok;
+
+        state->matches[row] = HVSC_VERIFY_ROW_ERROR;
+
+        rel = hvsc_catalog_string(state->catalog, state->catalog->path[row]);
+        path = hvsc_paths_join(hvsc_root_path, rel + 1);
+        if (path == NULL) {
+            continue;
+        }
+        ok = hvsc_dcache_digest(path, digest);
+        hvsc_free(path);
+        if (!ok) {
+            continue;
+        }
+
+        state->matches[row] = hvsc_sldb_table_find(state->table, digest);
+    }
+}
+
+
+/** \brief  Report a PSID file the crawler couldn't open or parse
+ *
+ * The file is still hashed, if possible, so its SLDB entries don't show up as
+ * orphans. Failing that, the entry with \a path in its comment is used.
+ *
+ * \param[in]       table       SLDB entries
+ * \param[in,out]   seen        SLDB entries accounted for
+ * \param[in]       path        path of the PSID file, relative to the root
+ * \param[in,out]   totals      totals
+ * \param[in]       callback    problem callback (can be `NULL`)
+ * \param[in]       data        user data passed to \a callback
+ */
+static void verify_skipped(const hvsc_sldb_table_t *table, bool *seen,
+                           const char *path, hvsc_sldb_verify_t *totals,
+                           hvsc_sldb_verify_cb_t callback, void *data)
+{
+    uint8_t digest[HVSC_DIGEST_SIZE];
+    char *full;
+    long match = -1;
+    size_t k;
+
+    full = hvsc_paths_join(hvsc_root_path, path + 1);
+    if (full != NULL) {
+        if (hvsc_dcache_digest(full, digest)) {
+            match = hvsc_sldb_table_find(table, digest);
+        }
+        hvsc_free(full);
+    }
+    if (match < 0) {
+        /* truncated or damaged file: fall back to the path in the SLDB */
+        for (k = 0; k < table->count; k++) {
+            const char *name = hvsc_sldb_table_path(table, k);
+
+            if (name != NULL && strcmp(name, path) == 0) {
+                seen[k] = true;
+                match = (long)k;
+                break;
+            }
+        }
+    }
+    if (match >= 0) {
+        for (k = (size_t)match; k < table->count
+                && memcmp(table->entries[k].digest,
+                          table->entries[match].digest,
+                          HVSC_DIGEST_SIZE) == 0; k++) {
+            seen[k] = true;
+        }
+    }
+
+    totals->files++;
+    totals->errors++;
+    if (callback != NULL) {
+        callback(HVSC_VERIFY_IO, path, -1,
+                 match >= 0 ? table->entries[match].songs : -1, data);
+    }
+}
+
+
+/** \brief  Verify the SLDB against the PSID files in the HVSC
+ *
+ * Crawls the HVSC root set with hvsc_init() and calculates the MD5 digest of
+ * each PSID file on \a threads worker threads, each thread hashing a range of
+ * files. Each file is checked against the SLDB, loaded in memory once.
+ *
+ * Problems are reported via \a callback, which is called from the calling
+ * thread: first the PSID files, sorted on path, then the orphaned SLDB
+ * entries in digest order. PSID files that couldn't be opened or parsed are
+ * reported as HVSC_VERIFY_IO, with -1 for the number of songs in the header. For HVSC_VERIFY_ORPHAN \a path is the path from
+ * the SLDB comment, or the entry text if there is no comment.
+ *
+ * \param[out]  result      totals (optional)
+ * \param[in]   threads     number of worker threads (<= 0 for the default)
+ * \param[in]   callback    problem callback (can be `NULL`)
+ * \param[in]   data        user data passed to \a callback
+ *
+ * \return  bool (false when the SLDB or HVSC couldn't be read)
+ *
+ * \ingroup sldb
+ */
+bool hvsc_sldb_verify(hvsc_sldb_verify_t *result, int threads,
+                      hvsc_sldb_verify_cb_t callback, void *data)
+{
+    hvsc_sldb_verify_t totals;
+    hvsc_catalog_t catalog;
+    hvsc_catalog_skipped_t skipped;
+    hvsc_sldb_table_t table;
+    hvsc_pool_t pool;
+    verify_state_t state;
+    verify_job_t *jobs;
+    size_t njobs;
+    bool *seen;
+    size_t i;
+    size_t s;
+
+    memset(&totals, 0, sizeof totals);
+
+    if (!hvsc_sldb_table_load(&table, hvsc_sldb_path)) {
+        return false;
+    }
+    if (!hvsc_catalog_crawl(&catalog, hvsc_root_path, threads, &skipped)) {
+        hvsc_sldb_table_free(&table);
+        return false;
+    }
+
+    njobs = (catalog.count + HVSC_VERIFY_CHUNK - 1) / HVSC_VERIFY_CHUNK;
+    state.catalog = &catalog;
+    state.table = &table;
+    state.matches = hvsc_malloc((catalog.count > 0 ? catalog.count : 1)
+                                * sizeof *(state.matches));
+    seen = hvsc_calloc(table.count > 0 ? table.count : 1, sizeof *seen);
+    jobs = hvsc_malloc((njobs > 0 ? njobs : 1) * sizeof *jobs);
+    if (state.matches == NULL || seen == NULL || jobs == NULL) {
+        hvsc_errno = HVSC_ERR_OOM;
+        hvsc_free(state.matches);
+        hvsc_free(seen);
+        hvsc_free(jobs);
+        hvsc_catalog_free(&catalog);
+        hvsc_catalog_skipped_free(&skipped);
+        hvsc_sldb_table_free(&table);
+        return false;
+    }
+
+    if (!hvsc_pool_init(&pool, threads)) {
+        hvsc_free(state.matches);
+        hvsc_free(seen);
+        hvsc_free(jobs);
+        hvsc_catalog_free(&catalog);
+        hvsc_catalog_skipped_free(&skipped);
+        hvsc_sldb_table_free(&table);
+        return false;
+    }
+    for (i = 0; i < njobs; i++) {
+        jobs[i].state = &state;
+        jobs[i].first = i * HVSC_VERIFY_CHUNK;
+        jobs[i].last = jobs[i].first + HVSC_VERIFY_CHUNK;
+        if (jobs[i].last > catalog.count) {
+            jobs[i].last = catalog.count;
+        }
+        if (!hvsc_pool_submit(&pool, verify_rows, &(jobs[i]))) {
+            verify_rows(&(jobs[i]));
+        }
+    }
+    hvsc_pool_wait(&pool);
+    hvsc_pool_free(&pool);
+
+    /* report PSID files */
+    totals.files = catalog.count;
+    totals.entries = table.count;
+    s = 0;
+    for (i = 0; i < catalog.count; i++) {
+        const char *path = hvsc_catalog_string(&catalog, catalog.path[i]);
+        long match = state.matches[i];
+        int songs = catalog.songs[i];
+        size_t k;
+
+        /* keep the reports sorted on path */
+        while (s < skipped.count && strcmp(skipped.paths[s], path) < 0) {
+            verify_skipped(&table, seen, skipped.paths[s++], &totals,
+                           callback, data);
+        }
+
+        if (match == HVSC_VERIFY_ROW_ERROR) {
+            totals.errors++;
+            if (callback != NULL) {
+                callback(HVSC_VERIFY_IO, path, songs, -1, data);
+            }
+            continue;
+        }
+        if (match < 0) {
+            totals.missing++;
+            if (callback != NULL) {
+                callback(HVSC_VERIFY_MISSING, path, songs, -1, data);
+            }
+            continue;
+        }
+
+        /* duplicate digests are all accounted for by this file */
+        for (k = (size_t)match; k < table.count
+                && memcmp(table.entries[k].digest,
+                          table.entries[match].digest,
+                          HVSC_DIGEST_SIZE) == 0; k++) {
+            seen[k] = true;
+        }
+
+        if (table.entries[match].songs != songs) {
+            totals.mismatches++;
+            if (callback != NULL) {
+                callback(HVSC_VERIFY_SONGS, path, songs,
+                         table.entries[match].songs, data);
+            }
+        } else {
+            totals.ok++;
+        }
+    }
+
+    while (s < skipped.count) {
+        verify_skipped(&table, seen, skipped.paths[s++], &totals,
+                       callback, data);
+    }
+
+    /* report SLDB entries without PSID file */
+    for (i = 0; i < table.count; i++) {
+        if (!seen[i]) {
+            const char *name = hvsc_sldb_table_path(&table, i);
+
+            totals.orphans++;
+            if (callback != NULL) {
+                callback(HVSC_VERIFY_ORPHAN,
+                         name != NULL ? name : hvsc_sldb_table_line(&table, i),
+                         -1, table.entries[i].songs, data);
+            }
+        }
+    }
+
+    hvsc_free(state.matches);
+    hvsc_free(seen);
+    hvsc_free(jobs);
+    hvsc_catalog_free(&catalog);
+    hvsc_catalog_skipped_free(&skipped);
+    hvsc_sldb_table_free(&table);
+
+    if (result != NULL) {
+        *result = totals;
+    }
+    return true;
+}
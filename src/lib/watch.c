@@ -0,0 +1,358 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/watch.c
+ * \brief   Reloading changed DOCUMENTS files
+ *
+ * A background thread watches the directories of the SLDB, STIL and BUGlist
+ * with inotify(7). Once changes have settled the index is updated and
+ * swapped in, while lookups keep running on the previous index, and changed
+ * STIL entries are dropped from the STIL cache.
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include "hvsc.h"
+
+#include "hvsc_defs.h"
+#include "base.h"
+#include "alloc.h"
+#include "index.h"
+#include "record.h"
+
+#include "watch.h"
+
+
+/** \brief  Lock for starting and stopping the watcher
+ */
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** \brief  Watcher thread is running
+ */
+static bool watch_running = false;
+
+/** \brief  Watcher thread
+ */
+static pthread_t watch_thread;
+
+/** \brief  inotify instance
+ */
+static int watch_fd = -1;
+
+/** \brief  Pipe used to tell the thread to quit
+ */
+static int watch_pipe[2] = { -1, -1 };
+
+/** \brief  Watched files
+ */
+static hvsc_watch_file_t watch_files[HVSC_WATCH_FILES];
+
+/** \brief  Statistics, updated atomically by the watcher thread
+ */
+static hvsc_watch_stats_t watch_stats;
+
+
+/** \brief  Close the inotify instance and pipe, and free the file names
+ */
+static void watch_cleanup(void)
+{
+    int i;
+
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+    for (i = 0; i < 2; i++) {
+        if (watch_pipe[i] >= 0) {
+            close(watch_pipe[i]);
+            watch_pipe[i] = -1;
+        }
+    }
+    for (i = 0; i < HVSC_WATCH_FILES; i++) {
+        hvsc_free(watch_files[i].name);
+        watch_files[i].name = NULL;
+    }
+}
+
+
+/** \brief  Add a watch for the directory of \a path
+ *
+ * \param[out]  file    watched file
+ * \param[in]   path    path to the file
+ * \param[in]   mask    HVSC_WATCH_* bit of the file
+ *
+ * \return  bool
+ */
+static bool watch_add(hvsc_watch_file_t *file, const char *path, int mask)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir;
+
+    if (slash == NULL) {
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+    dir = hvsc_malloc((size_t)(slash - path) + 2);
+    file->name = hvsc_strdup(slash + 1);
+    if (dir == NULL || file->name == NULL) {
+        hvsc_free(dir);
+        hvsc_errno = HVSC_ERR_OOM;
+        return false;
+    }
+    /* keep the slash for a file in the root directory */
+    memcpy(dir, path, (size_t)(slash - path) + 1);
+    dir[slash == path ? 1 : slash - path] = '\0';
+
+    /* an update usually replaces the files, so watch the directory */
+    file->wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    hvsc_free(dir);
+    if (file->wd < 0) {
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+    file->mask = mask;
+    return true;
+}
+
+
+/** \brief  Read pending inotify events
+ *
+ * \return  HVSC_WATCH_* bits of the files that changed
+ */
+static int watch_read_events(void)
+{
+    union {
+        struct inotify_event    event;
+        char                    data[4096];
+    } buffer;
+    ssize_t len;
+    size_t pos = 0;
+    int changed = 0;
+
+    len = read(watch_fd, buffer.data, sizeof buffer.data);
+    if (len <= 0) {
+        return 0;
+    }
+    while (pos < (size_t)len) {
+        const struct inotify_event *event =
+            (const struct inotify_event *)(buffer.data + pos);
+        int i;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            /* events were lost, assume everything changed */
+            changed |= HVSC_WATCH_SLDB | HVSC_WATCH_STIL | HVSC_WATCH_BUGS;
+        } else if (event->len > 0) {
+            for (i = 0; i < HVSC_WATCH_FILES; i++) {
+                if (event->wd == watch_files[i].wd
+                        && strcmp(event->name, watch_files[i].name) == 0) {
+                    changed |= watch_files[i].mask;
+                    __atomic_add_fetch(&(watch_stats.events), 1,
+                                       __ATOMIC_RELAXED);
+                }
+            }
+        }
+        pos += sizeof *event + event->len;
+    }
+    return changed;
+}
+
+
+/** \brief  Apply changes to the files
+ *
+ * The index covers all three files, so it's updated for any change, which
+ * also drops the changed entries from the STIL cache. Without an index the
+ * STIL cache is cleared when STIL.txt changed. When the update fails, for
+ * example because a file is incomplete, the current index stays in use
+ * until the next change.
+ *
+ * \param[in]   changed HVSC_WATCH_* bits of the files that changed
+ */
+static void watch_apply(int changed)
+{
+    bool result;
+    bool loaded;
+
+    hvsc_dbg("DOCUMENTS changed (%02x), reloading\n", changed);
+    result = hvsc_index_reload(&loaded);
+    if (!loaded && (changed & HVSC_WATCH_STIL)) {
+        hvsc_stil_cache_clear();
+    }
+    if (result) {
+        __atomic_add_fetch(&(watch_stats.reloads), 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&(watch_stats.failures), 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/** \brief  Watcher thread main loop
+ *
+ * Collects changes until none have arrived for HVSC_WATCH_SETTLE_MS, then
+ * applies them.
+ *
+ * \param[in]   arg unused
+ *
+ * \return  `NULL`
+ */
+static void *watch_main(void *arg)
+{
+    struct pollfd fds[2];
+    int changed = 0;
+
+    (void)arg;
+    /* reloads aren't part of the host's workload */
+    hvsc_record_ignore_thread();
+
+    fds[0].fd = watch_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watch_pipe[0];
+    fds[1].events = POLLIN;
+
+    while (true) {
+        int n = poll(fds, 2, changed != 0 ? HVSC_WATCH_SETTLE_MS : -1);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NULL;
+        }
+        if (fds[1].revents != 0) {
+            /* told to quit */
+            return NULL;
+        }
+        if (n == 0) {
+            watch_apply(changed);
+            changed = 0;
+        } else if (fds[0].revents & POLLIN) {
+            changed |= watch_read_events();
+        }
+    }
+}
+
+
+/** \brief  Start watching the SLDB, STIL and BUGlist for changes
+ *
+ * When one of the files is changed or replaced, the index is updated in the
+ * background (when loaded) and swapped in without blocking lookups: calls
+ * already running and open handles keep using the previous index. Changed
+ * STIL entries are dropped from the STIL cache. Requires hvsc_init(), the
+ * watcher is stopped by hvsc_exit().
+ *
+ * \return  bool (false with HVSC_ERR_INVALID when already running)
+ *
+ * \ingroup watch
+ */
+bool hvsc_watch_start(void)
+{
+    const char *paths[HVSC_WATCH_FILES];
+    static const int masks[HVSC_WATCH_FILES] = {
+        HVSC_WATCH_SLDB, HVSC_WATCH_STIL, HVSC_WATCH_BUGS
+    };
+    int i;
+
+    pthread_mutex_lock(&watch_lock);
+    if (watch_running || hvsc_sldb_path == NULL) {
+        pthread_mutex_unlock(&watch_lock);
+        hvsc_errno = HVSC_ERR_INVALID;
+        return false;
+    }
+
+    watch_fd = inotify_init1(IN_CLOEXEC);
+    if (watch_fd < 0 || pipe(watch_pipe) != 0) {
+        watch_cleanup();
+        pthread_mutex_unlock(&watch_lock);
+        hvsc_errno = HVSC_ERR_IO;
+        return false;
+    }
+    paths[0] = hvsc_sldb_path;
+    paths[1] = hvsc_stil_path;
+    paths[2] = hvsc_bugs_path;
+    for (i = 0; i < HVSC_WATCH_FILES; i++) {
+        if (!watch_add(&(watch_files[i]), paths[i], masks[i])) {
+            watch_cleanup();
+            pthread_mutex_unlock(&watch_lock);
+            return false;
+        }
+    }
+
+    memset(&watch_stats, 0, sizeof watch_stats);
+    if (pthread_create(&watch_thread, NULL, watch_main, NULL) != 0) {
+        watch_cleanup();
+        pthread_mutex_unlock(&watch_lock);
+        hvsc_errno = HVSC_ERR_THREAD;
+        return false;
+    }
+    watch_running = true;
+    pthread_mutex_unlock(&watch_lock);
+    return true;
+}
+
+
+/** \brief  Stop watching for changes
+ *
+ * Waits for a reload in progress to finish. Does nothing when the watcher
+ * isn't running.
+ *
+ * \ingroup watch
+ */
+void hvsc_watch_stop(void)
+{
+    pthread_mutex_lock(&watch_lock);
+    if (watch_running) {
+        if (write(watch_pipe[1], "q", 1) != 1) {
+            hvsc_dbg("failed to signal watcher thread\n");
+        }
+        pthread_join(watch_thread, NULL);
+        watch_cleanup();
+        watch_running = false;
+    }
+    pthread_mutex_unlock(&watch_lock);
+}
+
+
+/** \brief  Get statistics of the watcher
+ *
+ * The statistics are kept after the watcher is stopped and reset when it's
+ * started again.
+ *
+ * \param[out]  stats   statistics
+ *
+ * \ingroup watch
+ */
+void hvsc_watch_get_stats(hvsc_watch_stats_t *stats)
+{
+    stats->events = __atomic_load_n(&(watch_stats.events), __ATOMIC_RELAXED);
+    stats->reloads = __atomic_load_n(&(watch_stats.reloads), __ATOMIC_RELAXED);
+    stats->failures = __atomic_load_n(&(watch_stats.failures),
+                                      __ATOMIC_RELAXED);
+}
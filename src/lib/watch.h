@@ -0,0 +1,57 @@
+/* vim: set et ts=4 sw=4 sts=4 fdm=marker syntax=c.doxygen: */
+
+/** \file   src/lib/watch.h
+ * \brief   Reloading changed DOCUMENTS files - header
+ *
+ * \author  Bas Wassink <b.wassink@ziggo.nl>
+ */
+
+/*
+ *  HVSClib - a library to work with High Voltage SID Collection files
+ *  Copyright (C) 2018  Bas Wassink <b.wassink@ziggo.nl>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.*
+ */
+
+#ifndef HVSC_WATCH_H
+#define HVSC_WATCH_H
+
+#include <stdbool.h>
+
+#include "hvsc.h"
+
+
+/** \brief  Files watched for changes, bit masks
+ */
+enum {
+    HVSC_WATCH_SLDB = 0x01,     /**< Songlengths file */
+    HVSC_WATCH_STIL = 0x02,     /**< STIL.txt */
+    HVSC_WATCH_BUGS = 0x04      /**< BUGlist.txt */
+};
+
+/** \brief  Number of watched files
+ */
+#define HVSC_WATCH_FILES    3
+
+
+/** \brief  Watched file
+ */
+typedef struct hvsc_watch_file_s {
+    int     wd;         /**< inotify watch descriptor of the directory */
+    char *  name;       /**< name of the file in the directory */
+    int     mask;       /**< HVSC_WATCH_* bit of the file */
+} hvsc_watch_file_t;
+
+#endif